@@ -1816,6 +1816,34 @@ ZT_SDK_API void ZT_Node_delete(ZT_Node* node);
 ZT_SDK_API enum ZT_ResultCode
 ZT_Node_processWirePacket(ZT_Node* node, void* tptr, int64_t now, int64_t localSocket, const struct sockaddr_storage* remoteAddress, const void* packetData, unsigned int packetLength, volatile int64_t* nextBackgroundTaskDeadline);
 
+/**
+ * Process several packets received together from the same local socket
+ *
+ * This is equivalent to calling ZT_Node_processWirePacket() for each packet
+ * in order, but lets the node verify and decrypt packets as a batch.
+ *
+ * @param node Node instance
+ * @param tptr Thread pointer to pass to functions/callbacks resulting from this call
+ * @param now Current clock in milliseconds
+ * @param localSocket Local socket (you can use 0 if only one local socket is bound and ignore this)
+ * @param remoteAddresses Origin of each packet
+ * @param packetData Data of each packet
+ * @param packetLengths Length of each packet
+ * @param packetCount Number of packets
+ * @param nextBackgroundTaskDeadline Value/result: set to deadline for next call to processBackgroundTasks()
+ * @return OK (0) or error code if a fatal error condition has occurred
+ */
+ZT_SDK_API enum ZT_ResultCode ZT_Node_processWirePackets(
+	ZT_Node* node,
+	void* tptr,
+	int64_t now,
+	int64_t localSocket,
+	const struct sockaddr_storage* const* remoteAddresses,
+	const void* const* packetData,
+	const unsigned int* packetLengths,
+	unsigned int packetCount,
+	volatile int64_t* nextBackgroundTaskDeadline);
+
 /**
  * Process a frame from a virtual network port (tap)
  *
@@ -449,6 +449,184 @@ void AES::CTR::finish() noexcept
 	}
 }
 
+// AES-GMAC-SIV batches -----------------------------------------------------------------------------------------------
+
+void AES::GMACSIVBatch::encrypt(Message* msgs, unsigned int count) noexcept
+{
+	const AES* keys[ZT_AES_GMACSIV_BATCH_MAX];
+	uint64_t blocks[ZT_AES_GMACSIV_BATCH_MAX][2];
+	while (count) {
+		const unsigned int n = (count < ZT_AES_GMACSIV_BATCH_MAX) ? count : ZT_AES_GMACSIV_BATCH_MAX;
+
+		// GHASH is serial within a message, so GMAC each message on its own.
+		for (unsigned int i = 0; i < n; ++i) {
+			const Message& m = msgs[i];
+			uint64_t tmp[2];
+			tmp[0] = m.tag[0];
+			tmp[1] = 0;
+			GMAC gmac(*m.k0);
+			gmac.init(reinterpret_cast<const uint8_t*>(tmp));
+			gmac.update(m.aad, m.aadLen);
+			if ((m.aadLen & 0xfU) != 0) {
+				gmac.update(Utils::ZERO256, 16 - (m.aadLen & 0xfU));
+			}
+			gmac.update(m.in, m.len);
+			gmac.finish(reinterpret_cast<uint8_t*>(tmp));
+			blocks[i][0] = m.tag[0];
+			blocks[i][1] = tmp[0] ^ tmp[1];
+			keys[i] = m.k1;
+		}
+
+		// Encrypt every message's IV and shortened MAC at once, then derive
+		// CTR IVs exactly as GMACSIVEncryptor::finish1() does.
+		p_encryptMulti(keys, reinterpret_cast<const uint8_t*>(blocks), reinterpret_cast<uint8_t*>(blocks), n);
+		for (unsigned int i = 0; i < n; ++i) {
+			msgs[i].tag[0] = blocks[i][0];
+			msgs[i].tag[1] = blocks[i][1];
+			blocks[i][1] &= ZT_CONST_TO_BE_UINT64(0xffffffff7fffffffULL);
+		}
+
+		p_crypt(msgs, n, blocks);
+
+		msgs += n;
+		count -= n;
+	}
+}
+
+unsigned int AES::GMACSIVBatch::decrypt(Message* msgs, unsigned int count) noexcept
+{
+	const AES* keys[ZT_AES_GMACSIV_BATCH_MAX];
+	uint64_t blocks[ZT_AES_GMACSIV_BATCH_MAX][2];
+	uint64_t ivMac[ZT_AES_GMACSIV_BATCH_MAX][2];
+	unsigned int authenticated = 0;
+	while (count) {
+		const unsigned int n = (count < ZT_AES_GMACSIV_BATCH_MAX) ? count : ZT_AES_GMACSIV_BATCH_MAX;
+
+		for (unsigned int i = 0; i < n; ++i) {
+			blocks[i][0] = msgs[i].tag[0];
+			blocks[i][1] = msgs[i].tag[1];
+			keys[i] = msgs[i].k1;
+		}
+		p_decryptMulti(keys, reinterpret_cast<const uint8_t*>(blocks), reinterpret_cast<uint8_t*>(ivMac), n);
+		for (unsigned int i = 0; i < n; ++i) {
+			blocks[i][1] &= ZT_CONST_TO_BE_UINT64(0xffffffff7fffffffULL);
+		}
+
+		p_crypt(msgs, n, blocks);
+
+		for (unsigned int i = 0; i < n; ++i) {
+			Message& m = msgs[i];
+			uint64_t tmp[2];
+			tmp[0] = ivMac[i][0];
+			tmp[1] = 0;
+			GMAC gmac(*m.k0);
+			gmac.init(reinterpret_cast<const uint8_t*>(tmp));
+			gmac.update(m.aad, m.aadLen);
+			if ((m.aadLen & 0xfU) != 0) {
+				gmac.update(Utils::ZERO256, 16 - (m.aadLen & 0xfU));
+			}
+			gmac.update(m.out, m.len);
+			gmac.finish(reinterpret_cast<uint8_t*>(tmp));
+			m.ok = ((tmp[0] ^ tmp[1]) == ivMac[i][1]);
+			if (m.ok) {
+				++authenticated;
+			}
+		}
+
+		msgs += n;
+		count -= n;
+	}
+	return authenticated;
+}
+
+void AES::GMACSIVBatch::p_crypt(Message* msgs, unsigned int count, const uint64_t (*ctrIv)[2]) noexcept
+{
+	// Short messages only need a few key stream blocks each, so generate all of
+	// them in one interleaved pass. Longer ones have enough blocks of their own
+	// to keep the pipeline full and go through CTR as usual.
+	const AES* keys[ZT_AES_GMACSIV_BATCH_MAX * (ZT_AES_GMACSIV_BATCH_SHORT / 16)];
+	uint64_t keyStream[ZT_AES_GMACSIV_BATCH_MAX * (ZT_AES_GMACSIV_BATCH_SHORT / 16)][2];
+	unsigned int blocks = 0;
+	for (unsigned int i = 0; i < count; ++i) {
+		const Message& m = msgs[i];
+		if (m.len <= ZT_AES_GMACSIV_BATCH_SHORT) {
+			const uint32_t ctr = Utils::ntoh(reinterpret_cast<const uint32_t*>(ctrIv[i])[3]);
+			for (unsigned int b = 0; b < m.len; b += 16) {
+				keyStream[blocks][0] = ctrIv[i][0];
+				keyStream[blocks][1] = ctrIv[i][1];
+				reinterpret_cast<uint32_t*>(keyStream[blocks])[3] = Utils::hton((uint32_t)(ctr + (b >> 4U)));
+				keys[blocks++] = m.k1;
+			}
+		}
+		else {
+			CTR c(*m.k1);
+			c.init(reinterpret_cast<const uint8_t*>(ctrIv[i]), m.out);
+			c.crypt(m.in, m.len);
+			c.finish();
+		}
+	}
+
+	if (! blocks) {
+		return;
+	}
+	p_encryptMulti(keys, reinterpret_cast<const uint8_t*>(keyStream), reinterpret_cast<uint8_t*>(keyStream), blocks);
+
+	const uint8_t* ks = reinterpret_cast<const uint8_t*>(keyStream);
+	for (unsigned int i = 0; i < count; ++i) {
+		const Message& m = msgs[i];
+		if (m.len <= ZT_AES_GMACSIV_BATCH_SHORT) {
+			const uint8_t* const in = reinterpret_cast<const uint8_t*>(m.in);
+			uint8_t* const out = reinterpret_cast<uint8_t*>(m.out);
+			for (unsigned int j = 0; j < m.len; ++j) {
+				out[j] = in[j] ^ ks[j];
+			}
+			ks += (m.len + 15U) & ~15U;
+		}
+	}
+}
+
+void AES::p_encryptMulti(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept
+{
+#ifdef ZT_AES_AESNI
+	if (likely(Utils::CPUID.aes)) {
+		p_encryptMulti_aesni(keys, in, out, n);
+		return;
+	}
+#endif	 // ZT_AES_AESNI
+
+#ifdef ZT_AES_NEON
+	if (Utils::ARMCAP.aes) {
+		p_encryptMulti_armneon_crypto(keys, in, out, n);
+		return;
+	}
+#endif	 // ZT_AES_NEON
+
+	for (unsigned int i = 0; i < n; ++i) {
+		keys[i]->p_encryptSW(in + (i * 16), out + (i * 16));
+	}
+}
+
+void AES::p_decryptMulti(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept
+{
+#ifdef ZT_AES_AESNI
+	if (likely(Utils::CPUID.aes)) {
+		p_decryptMulti_aesni(keys, in, out, n);
+		return;
+	}
+#endif	 // ZT_AES_AESNI
+
+#ifdef ZT_AES_NEON
+	if (Utils::ARMCAP.aes) {
+		p_decryptMulti_armneon_crypto(keys, in, out, n);
+		return;
+	}
+#endif	 // ZT_AES_NEON
+
+	for (unsigned int i = 0; i < n; ++i) {
+		keys[i]->p_decryptSW(in + (i * 16), out + (i * 16));
+	}
+}
+
 // Software AES and AES key expansion ---------------------------------------------------------------------------------
 
 const uint32_t AES::Te0[256] = { 0xc66363a5, 0xf87c7c84, 0xee777799, 0xf67b7b8d, 0xfff2f20d, 0xd66b6bbd, 0xde6f6fb1, 0x91c5c554, 0x60303050, 0x02010103, 0xce6767a9, 0x562b2b7d, 0xe7fefe19, 0xb5d7d762, 0x4dababe6, 0xec76769a,
@@ -26,6 +26,16 @@
 #define ZT_INLINE inline
 #endif
 
+/**
+ * Maximum number of messages processed together by AES::GMACSIVBatch
+ */
+#define ZT_AES_GMACSIV_BATCH_MAX 16
+
+/**
+ * Messages up to this many bytes get their CTR key stream from the batch's interleaved lanes
+ */
+#define ZT_AES_GMACSIV_BATCH_SHORT 64
+
 namespace ZeroTier {
 
 /**
@@ -541,6 +551,58 @@ class AES {
 		unsigned int _decryptedLen;
 	};
 
+	/**
+	 * Multi-buffer AES-GMAC-SIV for batches of small messages
+	 *
+	 * GMACSIVEncryptor and GMACSIVDecryptor handle one message at a time, so
+	 * the single AES block that encrypts or decrypts the SIV tag and the few
+	 * CTR blocks of a short packet each wait on the full latency of the AES
+	 * rounds. This runs the same construction over a batch of messages and
+	 * interleaves those block operations across messages in parallel lanes.
+	 * Each message may use a different pair of keys. Results are identical
+	 * to GMACSIVEncryptor and GMACSIVDecryptor.
+	 */
+	class GMACSIVBatch {
+	  public:
+		/**
+		 * One message in a batch
+		 */
+		struct Message {
+			const AES* k0;		   // AES instance keyed with K0 (GMAC)
+			const AES* k1;		   // AES instance keyed with K1 (CTR and tag)
+			const void* aad;	   // Additional authenticated data or NULL
+			unsigned int aadLen;   // Length of AAD in bytes
+			const void* in;		   // Input plaintext or ciphertext
+			void* out;			   // Output buffer, may be the same as in
+			unsigned int len;	   // Length of input in bytes
+			uint64_t tag[2];	   // Encrypt: IV in tag[0] in, opaque IV+MAC out; decrypt: IV+MAC in
+			bool ok;			   // Decrypt: set to result of message authentication
+		};
+
+		/**
+		 * Encrypt a batch of messages
+		 *
+		 * Any number of messages may be supplied. They are processed in groups
+		 * of up to ZT_AES_GMACSIV_BATCH_MAX.
+		 *
+		 * @param msgs Messages (tag[0] must hold each IV, tag[] receives IV+MAC)
+		 * @param count Number of messages
+		 */
+		static void encrypt(Message* msgs, unsigned int count) noexcept;
+
+		/**
+		 * Decrypt and authenticate a batch of messages
+		 *
+		 * @param msgs Messages (tag[] must hold each IV+MAC, ok receives result)
+		 * @param count Number of messages
+		 * @return Number of messages that passed authentication
+		 */
+		static unsigned int decrypt(Message* msgs, unsigned int count) noexcept;
+
+	  private:
+		static void p_crypt(Message* msgs, unsigned int count, const uint64_t (*ctrIv)[2]) noexcept;
+	};
+
   private:
 	static const uint32_t Te0[256];
 	static const uint32_t Te4[256];
@@ -552,6 +614,10 @@ class AES {
 	void p_encryptSW(const uint8_t* in, uint8_t* out) const noexcept;
 	void p_decryptSW(const uint8_t* in, uint8_t* out) const noexcept;
 
+	// Encrypt or decrypt n independent blocks, block i under keys[i]
+	static void p_encryptMulti(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept;
+	static void p_decryptMulti(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept;
+
 	union {
 #ifdef ZT_AES_AESNI
 		struct {
@@ -581,12 +647,16 @@ class AES {
 	void p_init_aesni(const uint8_t* key) noexcept;
 	void p_encrypt_aesni(const void* in, void* out) const noexcept;
 	void p_decrypt_aesni(const void* in, void* out) const noexcept;
+	static void p_encryptMulti_aesni(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept;
+	static void p_decryptMulti_aesni(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept;
 #endif
 
 #ifdef ZT_AES_NEON
 	void p_init_armneon_crypto(const uint8_t* key) noexcept;
 	void p_encrypt_armneon_crypto(const void* in, void* out) const noexcept;
 	void p_decrypt_armneon_crypto(const void* in, void* out) const noexcept;
+	static void p_encryptMulti_armneon_crypto(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept;
+	static void p_decryptMulti_armneon_crypto(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept;
 #endif
 };
 
@@ -390,6 +390,75 @@ void AES::p_decrypt_armneon_crypto(const void* const in, void* const out) const
 	vst1q_u8(reinterpret_cast<uint8_t*>(out), tmp);
 }
 
+void AES::p_encryptMulti_armneon_crypto(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept
+{
+	// Four lanes with independent keys hide AESE/AESMC latency.
+	while (n >= 4) {
+		const uint8x16_t* const k0 = keys[0]->p_k.neon.ek;
+		const uint8x16_t* const k1 = keys[1]->p_k.neon.ek;
+		const uint8x16_t* const k2 = keys[2]->p_k.neon.ek;
+		const uint8x16_t* const k3 = keys[3]->p_k.neon.ek;
+		uint8x16_t d0 = vld1q_u8(in);
+		uint8x16_t d1 = vld1q_u8(in + 16);
+		uint8x16_t d2 = vld1q_u8(in + 32);
+		uint8x16_t d3 = vld1q_u8(in + 48);
+		for (int r = 0; r < 13; ++r) {
+			d0 = vaesmcq_u8(vaeseq_u8(d0, k0[r]));
+			d1 = vaesmcq_u8(vaeseq_u8(d1, k1[r]));
+			d2 = vaesmcq_u8(vaeseq_u8(d2, k2[r]));
+			d3 = vaesmcq_u8(vaeseq_u8(d3, k3[r]));
+		}
+		vst1q_u8(out, veorq_u8(vaeseq_u8(d0, k0[13]), k0[14]));
+		vst1q_u8(out + 16, veorq_u8(vaeseq_u8(d1, k1[13]), k1[14]));
+		vst1q_u8(out + 32, veorq_u8(vaeseq_u8(d2, k2[13]), k2[14]));
+		vst1q_u8(out + 48, veorq_u8(vaeseq_u8(d3, k3[13]), k3[14]));
+		keys += 4;
+		in += 64;
+		out += 64;
+		n -= 4;
+	}
+	while (n) {
+		(*(keys++))->p_encrypt_armneon_crypto(in, out);
+		in += 16;
+		out += 16;
+		--n;
+	}
+}
+
+void AES::p_decryptMulti_armneon_crypto(const AES* const* keys, const uint8_t* in, uint8_t* out, unsigned int n) noexcept
+{
+	while (n >= 4) {
+		const uint8x16_t* const k0 = keys[0]->p_k.neon.dk;
+		const uint8x16_t* const k1 = keys[1]->p_k.neon.dk;
+		const uint8x16_t* const k2 = keys[2]->p_k.neon.dk;
+		const uint8x16_t* const k3 = keys[3]->p_k.neon.dk;
+		uint8x16_t d0 = vld1q_u8(in);
+		uint8x16_t d1 = vld1q_u8(in + 16);
+		uint8x16_t d2 = vld1q_u8(in + 32);
+		uint8x16_t d3 = vld1q_u8(in + 48);
+		for (int r = 0; r < 13; ++r) {
+			d0 = vaesimcq_u8(vaesdq_u8(d0, k0[r]));
+			d1 = vaesimcq_u8(vaesdq_u8(d1, k1[r]));
+			d2 = vaesimcq_u8(vaesdq_u8(d2, k2[r]));
+			d3 = vaesimcq_u8(vaesdq_u8(d3, k3[r]));
+		}
+		vst1q_u8(out, veorq_u8(vaesdq_u8(d0, k0[13]), k0[14]));
+		vst1q_u8(out + 16, veorq_u8(vaesdq_u8(d1, k1[13]), k1[14]));
+		vst1q_u8(out + 32, veorq_u8(vaesdq_u8(d2, k2[13]), k2[14]));
+		vst1q_u8(out + 48, veorq_u8(vaesdq_u8(d3, k3[13]), k3[14]));
+		keys += 4;
+		in += 64;
+		out += 64;
+		n -= 4;
+	}
+	while (n) {
+		(*(keys++))->p_decrypt_armneon_crypto(in, out);
+		in += 16;
+		out += 16;
+		--n;
+	}
+}
+
 }	// namespace ZeroTier
 
 #endif	 // ZT_AES_NEON
@@ -0,0 +1,244 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#include "AQMScheduler.hpp"
+
+#include <math.h>
+
+namespace ZeroTier {
+
+// Determines the next drop time for a queue in the dropping state
+static inline int64_t _controlLaw(const int64_t t, const uint32_t count)
+{
+	return (int64_t)(t + ZT_AQM_INTERVAL / sqrt((double)count));
+}
+
+AQMScheduler::AQMScheduler() : _size(0)
+{
+	for (unsigned int i = 0; i < ZT_AQM_NUM_BUCKETS; ++i) {
+		_Queue& q = _queues[i];
+		q.head = (Entry*)0;
+		q.tail = (Entry*)0;
+		q.byteCredit = ZT_AQM_QUANTUM;
+		q.byteLength = 0;
+		q.firstAboveTime = 0;
+		q.dropNext = 0;
+		q.count = 0;
+		q.dropping = false;
+		q.list = _LIST_INACTIVE;
+		q.nextInList = -1;
+	}
+	_new.head = _new.tail = -1;
+	_old.head = _old.tail = -1;
+}
+
+AQMScheduler::Entry* AQMScheduler::enqueue(Entry* e, const unsigned int bucket)
+{
+	e->next = (Entry*)0;
+	if (bucket >= ZT_AQM_NUM_BUCKETS) {
+		return e;
+	}
+
+	_Queue& q = _queues[bucket];
+	if (q.list == _LIST_INACTIVE) {
+		q.byteCredit = ZT_AQM_QUANTUM;
+		_pushBack(_new, _LIST_NEW, (int)bucket);
+	}
+	if (q.tail) {
+		q.tail->next = e;
+	}
+	else {
+		q.head = e;
+	}
+	q.tail = e;
+	q.byteLength += (int)e->packet.payloadLength();
+	++_size;
+
+	if (_size > ZT_AQM_MAX_ENQUEUED_PACKETS) {
+		// Drop from the head of the longest queue
+		_Queue* longest = (_Queue*)0;
+		for (unsigned int i = 0; i < ZT_AQM_NUM_BUCKETS; ++i) {
+			if ((_queues[i].head) && ((! longest) || (_queues[i].byteLength > longest->byteLength))) {
+				longest = &(_queues[i]);
+			}
+		}
+		return _pop(*longest);
+	}
+
+	return (Entry*)0;
+}
+
+unsigned int AQMScheduler::dequeue(const int64_t now, Entry* out[2], Entry*& dropped)
+{
+	unsigned int n = 0;
+
+	// Serve the queue at the front of the NEW list
+	while (_new.head >= 0) {
+		_Queue& q = _queues[_new.head];
+		if (q.byteCredit < 0) {
+			q.byteCredit += ZT_AQM_QUANTUM;
+			_pushBack(_old, _LIST_OLD, _popFront(_new));
+			continue;
+		}
+		Entry* const e = _codelDequeue(q, now, dropped);
+		if (e) {
+			out[n++] = e;
+		}
+		else {
+			_pushBack(_old, _LIST_OLD, _popFront(_new));
+		}
+		break;
+	}
+
+	// Serve the queue at the front of the OLD list
+	while (_old.head >= 0) {
+		_Queue& q = _queues[_old.head];
+		if (q.byteCredit < 0) {
+			q.byteCredit += ZT_AQM_QUANTUM;
+			_pushBack(_old, _LIST_OLD, _popFront(_old));
+			continue;
+		}
+		Entry* const e = _codelDequeue(q, now, dropped);
+		if (e) {
+			out[n++] = e;
+		}
+		else {
+			_queues[_popFront(_old)].list = _LIST_INACTIVE;
+		}
+		break;
+	}
+
+	return n;
+}
+
+AQMScheduler::Entry* AQMScheduler::clear()
+{
+	Entry* all = (Entry*)0;
+	for (unsigned int i = 0; i < ZT_AQM_NUM_BUCKETS; ++i) {
+		_Queue& q = _queues[i];
+		if (q.tail) {
+			q.tail->next = all;
+			all = q.head;
+		}
+		q.head = (Entry*)0;
+		q.tail = (Entry*)0;
+		q.byteLength = 0;
+		q.dropping = false;
+		q.list = _LIST_INACTIVE;
+		q.nextInList = -1;
+	}
+	_new.head = _new.tail = -1;
+	_old.head = _old.tail = -1;
+	_size = 0;
+	return all;
+}
+
+void AQMScheduler::_pushBack(_List& l, const _ListId id, const int q)
+{
+	_queues[q].list = id;
+	_queues[q].nextInList = -1;
+	if (l.tail >= 0) {
+		_queues[l.tail].nextInList = q;
+	}
+	else {
+		l.head = q;
+	}
+	l.tail = q;
+}
+
+int AQMScheduler::_popFront(_List& l)
+{
+	const int q = l.head;
+	l.head = _queues[q].nextInList;
+	if (l.head < 0) {
+		l.tail = -1;
+	}
+	_queues[q].nextInList = -1;
+	return q;
+}
+
+// Returns the head of a queue without removing it and whether CoDel may drop it
+AQMScheduler::Entry* AQMScheduler::_front(_Queue& q, const int64_t now, bool& okToDrop)
+{
+	okToDrop = false;
+	Entry* const e = q.head;
+	if (! e) {
+		q.firstAboveTime = 0;
+		return e;
+	}
+	if (((now - e->creationTime) < ZT_AQM_TARGET) || (q.byteLength <= ZT_DEFAULT_MTU)) {
+		// went below - stay below for at least interval
+		q.firstAboveTime = 0;
+	}
+	else if (q.firstAboveTime == 0) {
+		// just went above from below. if still above at
+		// first_above_time, will say it's ok to drop.
+		q.firstAboveTime = now + ZT_AQM_INTERVAL;
+	}
+	else if (now >= q.firstAboveTime) {
+		okToDrop = true;
+	}
+	return e;
+}
+
+AQMScheduler::Entry* AQMScheduler::_pop(_Queue& q)
+{
+	Entry* const e = q.head;
+	q.head = e->next;
+	if (! q.head) {
+		q.tail = (Entry*)0;
+	}
+	e->next = (Entry*)0;
+	q.byteLength -= (int)e->packet.payloadLength();
+	--_size;
+	return e;
+}
+
+AQMScheduler::Entry* AQMScheduler::_codelDequeue(_Queue& q, const int64_t now, Entry*& dropped)
+{
+	bool okToDrop;
+	Entry* e = _front(q, now, okToDrop);
+
+	if (q.dropping) {
+		if (! okToDrop) {
+			q.dropping = false;
+		}
+		while ((now >= q.dropNext) && (q.dropping)) {
+			Entry* const d = _pop(q);
+			d->next = dropped;
+			dropped = d;
+			e = _front(q, now, okToDrop);
+			if (! okToDrop) {
+				// leave dropping state
+				q.dropping = false;
+			}
+			else {
+				++q.count;
+				// schedule the next drop.
+				q.dropNext = _controlLaw(q.dropNext, q.count);
+			}
+		}
+	}
+	else if (okToDrop) {
+		Entry* const d = _pop(q);
+		d->next = dropped;
+		dropped = d;
+		e = _front(q, now, okToDrop);
+		q.dropping = true;
+		q.count = ((q.count > 2) && ((now - q.dropNext) < (8 * ZT_AQM_INTERVAL))) ? q.count - 2 : 1;
+		q.dropNext = _controlLaw(now, q.count);
+	}
+
+	if (e) {
+		e = _pop(q);
+		q.byteCredit -= (int)e->packet.payloadLength();
+	}
+	return e;
+}
+
+}	// namespace ZeroTier
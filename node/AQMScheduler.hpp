@@ -0,0 +1,120 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#ifndef ZT_AQMSCHEDULER_HPP
+#define ZT_AQMSCHEDULER_HPP
+
+#include "Constants.hpp"
+#include "Packet.hpp"
+
+#include <stdint.h>
+
+namespace ZeroTier {
+
+/**
+ * FQ-CoDel scheduler for one network's outgoing frames
+ *
+ * Frames go into one of ZT_AQM_NUM_BUCKETS queues by QoS bucket. Queues are
+ * served by deficit round robin, newly active queues first, and CoDel
+ * decides when a queue has had a standing backlog for long enough that it
+ * should start dropping from its head.
+ *
+ * Entries are supplied by the caller and linked through their own next
+ * pointer, and each bucket's queue is found by index, so neither enqueue()
+ * nor dequeue() allocates or searches.
+ *
+ * This class is not thread safe.
+ */
+class AQMScheduler {
+  public:
+	/**
+	 * A queued frame
+	 */
+	struct Entry {
+		Entry* next;
+		int64_t creationTime;
+		uint64_t nwid;
+		int32_t flowId;
+		bool encrypt;
+		Packet packet;
+	};
+
+	AQMScheduler();
+
+	/**
+	 * Queue a frame
+	 *
+	 * @param e Entry with creationTime and packet set, owned by the scheduler until it is returned
+	 * @param bucket QoS bucket
+	 * @return Entry dropped from the longest queue to stay within ZT_AQM_MAX_ENQUEUED_PACKETS, e itself if bucket is invalid, or NULL
+	 */
+	Entry* enqueue(Entry* e, unsigned int bucket);
+
+	/**
+	 * Run one scheduling round
+	 *
+	 * A round emits at most one frame from a new queue and one from an old one.
+	 *
+	 * @param now Current time
+	 * @param out Filled with frames to send, in order
+	 * @param dropped Frames dropped by CoDel are pushed onto this list
+	 * @return Number of frames in out (0-2)
+	 */
+	unsigned int dequeue(int64_t now, Entry* out[2], Entry*& dropped);
+
+	/**
+	 * Remove all queued frames
+	 *
+	 * @return Removed frames linked through next
+	 */
+	Entry* clear();
+
+	/**
+	 * @return Number of queued frames
+	 */
+	inline unsigned int size() const
+	{
+		return _size;
+	}
+
+  private:
+	enum _ListId { _LIST_INACTIVE, _LIST_NEW, _LIST_OLD };
+
+	struct _Queue {
+		Entry* head;
+		Entry* tail;
+		int byteCredit;
+		int byteLength;
+		int64_t firstAboveTime;
+		int64_t dropNext;
+		uint32_t count;
+		bool dropping;
+		_ListId list;
+		int nextInList;	  // next queue in the same list or -1
+	};
+
+	struct _List {
+		int head;
+		int tail;
+	};
+
+	void _pushBack(_List& l, _ListId id, int q);
+	int _popFront(_List& l);
+	Entry* _front(_Queue& q, int64_t now, bool& okToDrop);
+	Entry* _pop(_Queue& q);
+	Entry* _codelDequeue(_Queue& q, int64_t now, Entry*& dropped);
+
+	_Queue _queues[ZT_AQM_NUM_BUCKETS];
+	_List _new;
+	_List _old;
+	unsigned int _size;
+};
+
+}	// namespace ZeroTier
+
+#endif
@@ -0,0 +1,125 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#ifndef ZT_BOUNDEDQUEUE_HPP
+#define ZT_BOUNDEDQUEUE_HPP
+
+#include <atomic>
+
+namespace ZeroTier {
+
+/**
+ * Fixed capacity lock-free FIFO queue
+ *
+ * Any number of threads may push and pop concurrently. Each slot carries a
+ * sequence number that tells pushers and poppers whether it is free for the
+ * current lap of the ring, so an operation is one compare-and-swap on the
+ * head or tail index plus one store to the slot. Neither push() nor pop()
+ * ever blocks; they return false if the queue is full or empty.
+ *
+ * T should be cheap to copy, e.g. a pointer.
+ *
+ * @tparam T Element type
+ * @tparam C Capacity, must be a power of two
+ */
+template <typename T, unsigned long C> class BoundedQueue {
+	static_assert((C >= 2) && ((C & (C - 1)) == 0), "BoundedQueue capacity must be a power of two");
+
+  public:
+	BoundedQueue() : _head(0), _tail(0)
+	{
+		for (unsigned long i = 0; i < C; ++i) {
+			_cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	/**
+	 * @param v Value to add
+	 * @return True if added, false if queue is full
+	 */
+	inline bool push(const T& v)
+	{
+		unsigned long pos = _tail.load(std::memory_order_relaxed);
+		for (;;) {
+			_Cell& c = _cells[pos & (C - 1)];
+			const unsigned long seq = c.seq.load(std::memory_order_acquire);
+			const long dif = (long)seq - (long)pos;
+			if (dif == 0) {
+				if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					c.v = v;
+					c.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (dif < 0) {
+				return false;
+			}
+			else {
+				pos = _tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/**
+	 * @param v Value to fill with the oldest entry
+	 * @return True if an entry was removed, false if queue is empty
+	 */
+	inline bool pop(T& v)
+	{
+		unsigned long pos = _head.load(std::memory_order_relaxed);
+		for (;;) {
+			_Cell& c = _cells[pos & (C - 1)];
+			const unsigned long seq = c.seq.load(std::memory_order_acquire);
+			const long dif = (long)seq - (long)(pos + 1);
+			if (dif == 0) {
+				if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					v = c.v;
+					c.seq.store(pos + C, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (dif < 0) {
+				return false;
+			}
+			else {
+				pos = _head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/**
+	 * @return Capacity of queue
+	 */
+	static inline unsigned long capacity()
+	{
+		return C;
+	}
+
+  private:
+	struct _Cell {
+		std::atomic<unsigned long> seq;
+		T v;
+	};
+
+	BoundedQueue(const BoundedQueue&)
+	{
+	}
+	const BoundedQueue& operator=(const BoundedQueue&)
+	{
+		return *this;
+	}
+
+	// Head and tail are on separate cache lines so producers and consumers do not false share
+	_Cell _cells[C];
+	alignas(64) std::atomic<unsigned long> _head;
+	alignas(64) std::atomic<unsigned long> _tail;
+};
+
+}	// namespace ZeroTier
+
+#endif
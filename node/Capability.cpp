@@ -8,6 +8,7 @@
 
 #include "Capability.hpp"
 
+#include "CredentialCache.hpp"
 #include "Identity.hpp"
 #include "Network.hpp"
 #include "Node.hpp"
@@ -17,7 +18,7 @@
 
 namespace ZeroTier {
 
-int Capability::verify(const RuntimeEnvironment* RR, void* tPtr) const
+int Capability::verify(const RuntimeEnvironment* RR, void* tPtr, SignatureBatch* batch) const
 {
 	try {
 		// There must be at least one entry, and sanity check for bad chain max length
@@ -45,7 +46,7 @@ int Capability::verify(const RuntimeEnvironment* RR, void* tPtr) const
 
 			const Identity id(RR->topology->getIdentity(tPtr, _custody[c].from));
 			if (id) {
-				if (! id.verify(tmp.data(), tmp.size(), _custody[c].signature)) {
+				if (! RR->cc->verify(id, tmp.data(), tmp.size(), _custody[c].signature, batch)) {
 					return -1;
 				}
 			}
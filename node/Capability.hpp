@@ -24,6 +24,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * A set of grouped and signed network flow rules
@@ -81,6 +82,19 @@ class Capability : public Credential {
 		}
 	}
 
+	// Copied bytewise, padding included, since operator==() compares bytes
+	Capability(const Capability& c)
+	{
+		memcpy(reinterpret_cast<void*>(this), &c, sizeof(Capability));
+	}
+	inline Capability& operator=(const Capability& c)
+	{
+		if (this != &c) {
+			memcpy(reinterpret_cast<void*>(this), &c, sizeof(Capability));
+		}
+		return *this;
+	}
+
 	/**
 	 * @return Rules -- see ruleCount() for size of array
 	 */
@@ -174,9 +188,10 @@ class Capability : public Credential {
 	 * Verify this capability's chain of custody and signatures
 	 *
 	 * @param RR Runtime environment to provide for peer lookup, etc.
+	 * @param batch If non-NULL, signatures are added to this batch instead of checked and 0 means OK if the batch verifies
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or chain
 	 */
-	int verify(const RuntimeEnvironment* RR, void* tPtr) const;
+	int verify(const RuntimeEnvironment* RR, void* tPtr, SignatureBatch* batch = (SignatureBatch*)0) const;
 
 	template <unsigned int C> static inline void serializeRules(Buffer<C>& b, const ZT_VirtualNetworkRule* rules, unsigned int ruleCount)
 	{
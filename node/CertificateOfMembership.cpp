@@ -8,6 +8,7 @@
 
 #include "CertificateOfMembership.hpp"
 
+#include "CredentialCache.hpp"
 #include "ECC.hpp"
 #include "Network.hpp"
 #include "Node.hpp"
@@ -111,7 +112,7 @@ bool CertificateOfMembership::sign(const Identity& with)
 	}
 }
 
-int CertificateOfMembership::verify(const RuntimeEnvironment* RR, void* tPtr) const
+int CertificateOfMembership::verify(const RuntimeEnvironment* RR, void* tPtr, SignatureBatch* batch) const
 {
 	if ((! _signedBy) || (_signedBy != Network::controllerFor(networkId())) || (_qualifierCount > ZT_NETWORK_COM_MAX_QUALIFIERS)) {
 		return -1;
@@ -130,7 +131,7 @@ int CertificateOfMembership::verify(const RuntimeEnvironment* RR, void* tPtr) co
 		buf[ptr++] = Utils::hton(_qualifiers[i].value);
 		buf[ptr++] = Utils::hton(_qualifiers[i].maxDelta);
 	}
-	return (id.verify(buf, ptr * sizeof(uint64_t), _signature) ? 0 : -1);
+	return (RR->cc->verify(id, buf, ptr * sizeof(uint64_t), _signature, batch) ? 0 : -1);
 }
 
 }	// namespace ZeroTier
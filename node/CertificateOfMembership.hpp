@@ -31,6 +31,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * Certificate of network membership
@@ -205,9 +206,10 @@ class CertificateOfMembership : public Credential {
 	 *
 	 * @param RR Runtime environment for looking up peers
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch If non-NULL, signatures are added to this batch instead of checked and 0 means OK if the batch verifies
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or credential
 	 */
-	int verify(const RuntimeEnvironment* RR, void* tPtr) const;
+	int verify(const RuntimeEnvironment* RR, void* tPtr, SignatureBatch* batch = (SignatureBatch*)0) const;
 
 	/**
 	 * @return True if signed
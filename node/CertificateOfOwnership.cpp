@@ -8,6 +8,7 @@
 
 #include "CertificateOfOwnership.hpp"
 
+#include "CredentialCache.hpp"
 #include "Identity.hpp"
 #include "Network.hpp"
 #include "Node.hpp"
@@ -17,7 +18,7 @@
 
 namespace ZeroTier {
 
-int CertificateOfOwnership::verify(const RuntimeEnvironment* RR, void* tPtr) const
+int CertificateOfOwnership::verify(const RuntimeEnvironment* RR, void* tPtr, SignatureBatch* batch) const
 {
 	if ((! _signedBy) || (_signedBy != Network::controllerFor(_networkId))) {
 		return -1;
@@ -30,7 +31,7 @@ int CertificateOfOwnership::verify(const RuntimeEnvironment* RR, void* tPtr) con
 	try {
 		Buffer<(sizeof(CertificateOfOwnership) + 64)> tmp;
 		this->serialize(tmp, true);
-		return (id.verify(tmp.data(), tmp.size(), _signature) ? 0 : -1);
+		return (RR->cc->verify(id, tmp.data(), tmp.size(), _signature, batch) ? 0 : -1);
 	}
 	catch (...) {
 		return -1;
@@ -32,6 +32,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * Certificate indicating ownership of a network identifier
@@ -154,9 +155,10 @@ class CertificateOfOwnership : public Credential {
 	/**
 	 * @param RR Runtime environment to allow identity lookup for signedBy
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch If non-NULL, signatures are added to this batch instead of checked and 0 means OK if the batch verifies
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature
 	 */
-	int verify(const RuntimeEnvironment* RR, void* tPtr) const;
+	int verify(const RuntimeEnvironment* RR, void* tPtr, SignatureBatch* batch = (SignatureBatch*)0) const;
 
 	template <unsigned int C> inline void serialize(Buffer<C>& b, const bool forSign = false) const
 	{
@@ -0,0 +1,1354 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#include "CompiledRules.hpp"
+
+#include "Constants.hpp"
+#include "InetAddress.hpp"
+#include "Node.hpp"
+#include "RuntimeEnvironment.hpp"
+#include "Switch.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+// Minimum number of consecutive ethertype gated rule sets worth indexing
+#define ZT_COMPILEDRULES_MIN_DISPATCH_RUN 4
+
+namespace ZeroTier {
+
+namespace {
+
+// Returns true if packet appears valid; pos and proto will be set
+static inline bool _ipv6GetPayload(const uint8_t* frameData, unsigned int frameLen, unsigned int& pos, unsigned int& proto)
+{
+	if (frameLen < 40) {
+		return false;
+	}
+	pos = 40;
+	proto = frameData[6];
+	while (pos <= frameLen) {
+		switch (proto) {
+			case 0:		// hop-by-hop options
+			case 43:	// routing
+			case 60:	// destination options
+			case 135:	// mobility options
+				if ((pos + 8) > frameLen) {
+					return false;	// invalid!
+				}
+				proto = frameData[pos];
+				pos += ((unsigned int)frameData[pos + 1] * 8) + 8;
+				break;
+
+			// case 44: // fragment -- we currently can't parse these and they are deprecated in IPv6 anyway
+			// case 50:
+			// case 51: // IPSec ESP and AH -- we have to stop here since this is encrypted stuff
+			default:
+				return true;
+		}
+	}
+	return false;	// overflow == invalid
+}
+
+static inline bool _isAction(const ZT_VirtualNetworkRule& r)
+{
+	return ((unsigned int)(r.t & 0x3f) <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID);
+}
+
+static inline bool _isForward(const ZT_VirtualNetworkRuleType rt)
+{
+	return ((rt == ZT_NETWORK_RULE_ACTION_TEE) || (rt == ZT_NETWORK_RULE_ACTION_WATCH) || (rt == ZT_NETWORK_RULE_ACTION_REDIRECT));
+}
+
+}	// anonymous namespace
+
+struct CompiledRules::_State {
+	_State(
+		const RuntimeEnvironment* renv,
+		Trace::RuleResultLog* l,
+		const NetworkConfig& nc,
+		const Membership* m,
+		const bool in,
+		const Address& src,
+		Address& dest,
+		const Frame& fr,
+		Address& c,
+		unsigned int& cl,
+		bool& cw,
+		uint8_t& qb)
+		: RR(renv)
+		, rrl(l)
+		, nconf(nc)
+		, membership(m)
+		, inbound(in)
+		, ztSource(src)
+		, ztDest(dest)
+		, f(fr)
+		, cc(c)
+		, ccLength(cl)
+		, ccWatch(cw)
+		, qosBucket(qb)
+		, superAccept(false)
+		, thisSetMatches(1)
+		, skipDrop(0)
+		, result(FILTER_NO_MATCH)
+	{
+	}
+
+	const RuntimeEnvironment* const RR;
+	Trace::RuleResultLog* const rrl;
+	const NetworkConfig& nconf;
+	const Membership* const membership;
+	const bool inbound;
+	const Address& ztSource;
+	Address& ztDest;
+	const Frame& f;
+	Address& cc;
+	unsigned int& ccLength;
+	bool& ccWatch;
+	uint8_t& qosBucket;
+
+	bool superAccept;
+	uint8_t thisSetMatches;
+	uint8_t skipDrop;
+	Result result;
+};
+
+CompiledRules::Frame::Frame(const MAC& macSource, const MAC& macDest, const uint8_t* frameData, unsigned int frameLen, unsigned int etherType, unsigned int vlanId)
+	: _macSource(macSource)
+	, _macDest(macDest)
+	, _data(frameData)
+	, _len(frameLen)
+	, _etherType(etherType)
+	, _vlanId(vlanId)
+	, _ipv4((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20))
+	, _ipv6((etherType == ZT_ETHERTYPE_IPV6) && (frameLen >= 40))
+	, _ipv6Payload(false)
+	, _ports(false)
+	, _icmp(false)
+	, _tos(false)
+	, _ipProtocol(-1)
+	, _srcPort(-1)
+	, _dstPort(-1)
+	, _icmpType(0)
+	, _icmpCode(0)
+	, _tosValue(0)
+	, _ipv6PayloadPos(0)
+	, _ipv4Src(0)
+	, _ipv4Dst(0)
+	, _addressCharacteristics(0)
+	, _ownershipMask(1)
+	, _tcpMask(1)
+{
+	_ipv6Src[0] = _ipv6Src[1] = 0;
+	_ipv6Dst[0] = _ipv6Dst[1] = 0;
+
+	if (macDest.isMulticast()) {
+		_addressCharacteristics |= ZT_RULE_PACKET_CHARACTERISTICS_MULTICAST;
+	}
+	if (macDest.isBroadcast()) {
+		_addressCharacteristics |= ZT_RULE_PACKET_CHARACTERISTICS_BROADCAST;
+	}
+
+	if (_ipv4) {
+		const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+		_ipv4Src = ((uint32_t)frameData[12] << 24) | ((uint32_t)frameData[13] << 16) | ((uint32_t)frameData[14] << 8) | (uint32_t)frameData[15];
+		_ipv4Dst = ((uint32_t)frameData[16] << 24) | ((uint32_t)frameData[17] << 16) | ((uint32_t)frameData[18] << 8) | (uint32_t)frameData[19];
+		_ipProtocol = (int)frameData[9];
+		_tos = true;
+		_tosValue = frameData[1];
+		_ports = true;
+		switch (frameData[9]) {
+			case 0x06:	 // TCP
+			case 0x11:	 // UDP
+			case 0x84:	 // SCTP
+			case 0x88:	 // UDPLite
+				if (frameLen > (headerLen + 4)) {
+					_srcPort = ((int)frameData[headerLen] << 8) | (int)frameData[headerLen + 1];
+					_dstPort = ((int)frameData[headerLen + 2] << 8) | (int)frameData[headerLen + 3];
+				}
+				break;
+			case 0x01:	 // ICMP
+				if (frameLen >= (headerLen + 2)) {
+					_icmp = true;
+					_icmpType = frameData[headerLen];
+					_icmpCode = frameData[headerLen + 1];
+				}
+				break;
+		}
+	}
+	else if (etherType == ZT_ETHERTYPE_IPV6) {
+		if (_ipv6) {
+			memcpy(_ipv6Src, frameData + 8, 16);
+			memcpy(_ipv6Dst, frameData + 24, 16);
+			_tos = true;
+			_tosValue = ((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f);
+		}
+		unsigned int pos = 0, proto = 0;
+		if (_ipv6GetPayload(frameData, frameLen, pos, proto)) {
+			_ipv6Payload = true;
+			_ipv6PayloadPos = pos;
+			_ipProtocol = (int)(proto & 0xff);
+			_ports = true;
+			switch (proto) {
+				case 0x06:	 // TCP
+				case 0x11:	 // UDP
+				case 0x84:	 // SCTP
+				case 0x88:	 // UDPLite
+					if (frameLen > (pos + 4)) {
+						// Port zero never matches a range on IPv6
+						_srcPort = ((int)frameData[pos] << 8) | (int)frameData[pos + 1];
+						_dstPort = ((int)frameData[pos + 2] << 8) | (int)frameData[pos + 3];
+						if (_srcPort == 0) {
+							_srcPort = -1;
+						}
+						if (_dstPort == 0) {
+							_dstPort = -1;
+						}
+					}
+					break;
+				case 0x3a:	 // ICMPv6
+					if (frameLen >= (pos + 2)) {
+						_icmp = true;
+						_icmpType = frameData[pos];
+						_icmpCode = frameData[pos + 1];
+					}
+					break;
+			}
+		}
+	}
+}
+
+uint64_t CompiledRules::Frame::_ownership(const NetworkConfig& nconf, const Membership* membership, bool inbound) const
+{
+	if (_ownershipMask != 1) {
+		return _ownershipMask;
+	}
+
+	uint64_t m = 0;
+	InetAddress src;
+	if (_ipv4) {
+		src.set((const void*)(_data + 12), 4, 0);
+	}
+	else if (_ipv6) {
+		// IPv6 NDP requires special handling, since the src and dest IPs in the packet are empty or link-local.
+		if ((_len >= (40 + 8 + 16)) && (_data[6] == 0x3a) && ((_data[40] == 0x87) || (_data[40] == 0x88))) {
+			if (_data[40] == 0x87) {
+				// Neighbor solicitations are considered authenticated, see interpret()
+				m |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+			}
+			else {
+				src.set((const void*)(_data + 40 + 8), 16, 0);
+			}
+		}
+		else {
+			src.set((const void*)(_data + 8), 16, 0);
+		}
+	}
+	else if ((_etherType == ZT_ETHERTYPE_ARP) && (_len >= 28)) {
+		src.set((const void*)(_data + 14), 4, 0);
+	}
+	if (inbound) {
+		if (membership) {
+			if ((src) && (membership->hasCertificateOfOwnershipFor<InetAddress>(nconf, src))) {
+				m |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+			}
+			if (membership->hasCertificateOfOwnershipFor<MAC>(nconf, _macSource)) {
+				m |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
+			}
+		}
+	}
+	else {
+		for (unsigned int i = 0; i < nconf.certificateOfOwnershipCount; ++i) {
+			if ((src) && (nconf.certificatesOfOwnership[i].owns(src))) {
+				m |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+			}
+			if (nconf.certificatesOfOwnership[i].owns(_macSource)) {
+				m |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
+			}
+		}
+	}
+
+	_ownershipMask = m;
+	return m;
+}
+
+uint64_t CompiledRules::Frame::_tcpCharacteristics() const
+{
+	if (_tcpMask != 1) {
+		return _tcpMask;
+	}
+
+	// Read lazily since, like interpret(), the IPv4 case does not bound the
+	// TCP header against the frame length.
+	uint64_t m = 0;
+	if ((_ipv4) && (_data[9] == 0x06)) {
+		const unsigned int headerLen = 4 * (_data[0] & 0xf);
+		m |= (uint64_t)_data[headerLen + 13];
+		m |= (((uint64_t)(_data[headerLen + 12] & 0x0f)) << 8);
+	}
+	else if ((_ipv6Payload) && (_ipProtocol == 0x06) && (_len > (_ipv6PayloadPos + 14))) {
+		m |= (uint64_t)_data[_ipv6PayloadPos + 13];
+		m |= (((uint64_t)(_data[_ipv6PayloadPos + 12] & 0x0f)) << 8);
+	}
+
+	_tcpMask = m;
+	return m;
+}
+
+CompiledRules::CompiledRules() : _unsupportedMatchResult(0)
+{
+}
+
+void CompiledRules::compile(const ZT_VirtualNetworkRule* rules, unsigned int ruleCount, const NetworkConfig& nconf)
+{
+	_rules.clear();
+	_segments.clear();
+	_dispatch.clear();
+	_unsupportedMatchResult = (uint8_t)((nconf.flags & ZT_NETWORKCONFIG_FLAG_RULES_RESULT_OF_UNSUPPORTED_MATCH) != 0);
+
+	_rules.resize(ruleCount);
+	unsigned int next = ruleCount;
+	for (unsigned int rn = ruleCount; rn > 0;) {
+		--rn;
+		_Rule& cr = _rules[rn];
+		memset(&cr, 0, sizeof(_Rule));
+		cr.r = rules[rn];
+		cr.skipTo = next;
+		if ((_isAction(rules[rn])) || ((rules[rn].t & 0x40) != 0)) {
+			next = rn;
+		}
+
+		switch ((ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f)) {
+			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+				cr.mac = MAC(rules[rn].v.mac, 6).toInt();
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+				if (rules[rn].v.ipv4.mask <= 32) {
+					cr.exactMask = true;
+					cr.ipv4Shift = 32 - (unsigned int)rules[rn].v.ipv4.mask;
+					cr.ipv4Net = (cr.ipv4Shift < 32) ? (Utils::ntoh(rules[rn].v.ipv4.ip) >> cr.ipv4Shift) : 0;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+				if (rules[rn].v.ipv6.mask <= 128) {
+					const InetAddress mask(InetAddress((const void*)rules[rn].v.ipv6.ip, 16, rules[rn].v.ipv6.mask).netmask());
+					cr.exactMask = true;
+					memcpy(cr.ipv6Net, rules[rn].v.ipv6.ip, 16);
+					memcpy(cr.ipv6Mask, mask.rawIpData(), 16);
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+			case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL:
+			case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+			case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER: {
+				const Tag* const localTag = std::lower_bound(&(nconf.tags[0]), &(nconf.tags[nconf.tagCount]), rules[rn].v.tag.id, Tag::IdComparePredicate());
+				if ((localTag != &(nconf.tags[nconf.tagCount])) && (localTag->id() == rules[rn].v.tag.id)) {
+					cr.localTag = true;
+					cr.localTagValue = localTag->value();
+				}
+			} break;
+			default:
+				break;
+		}
+	}
+
+	// Split the table into sets (matches followed by an action). A set can be
+	// skipped by ethertype if it starts with a plain ETHERTYPE match, has no
+	// OR'd matches that could revive it, and its action has no side effect
+	// when the set does not match (TEE, WATCH and REDIRECT can still flag a
+	// super-accept). The set match state is always true at a set boundary.
+	std::vector<_Dispatch> sets;
+	std::vector<bool> gated;
+	unsigned int rn = 0;
+	while (rn < ruleCount) {
+		unsigned int a = rn;
+		bool ored = false;
+		while ((a < ruleCount) && (! _isAction(rules[a]))) {
+			ored |= ((rules[a].t & 0x40) != 0);
+			++a;
+		}
+		_Dispatch s;
+		s.etherType = rules[rn].v.etherType;
+		s.start = rn;
+		s.end = (a < ruleCount) ? (a + 1) : ruleCount;
+		sets.push_back(s);
+		gated.push_back(
+			(a < ruleCount) && (a > rn) && (! ored) && (rules[rn].t == (uint8_t)ZT_NETWORK_RULE_MATCH_ETHERTYPE) && (! _isForward((ZT_VirtualNetworkRuleType)(rules[a].t & 0x3f))));
+		rn = s.end;
+	}
+
+	for (unsigned int i = 0; i < (unsigned int)sets.size();) {
+		unsigned int j = i;
+		while ((j < (unsigned int)sets.size()) && (gated[j])) {
+			++j;
+		}
+		if ((j - i) >= ZT_COMPILEDRULES_MIN_DISPATCH_RUN) {
+			_Segment seg;
+			seg.start = sets[i].start;
+			seg.end = sets[j - 1].end;
+			seg.dispatchBegin = (unsigned int)_dispatch.size();
+			_dispatch.insert(_dispatch.end(), sets.begin() + i, sets.begin() + j);
+			seg.dispatchEnd = (unsigned int)_dispatch.size();
+			std::sort(_dispatch.begin() + seg.dispatchBegin, _dispatch.end());
+			_segments.push_back(seg);
+			i = j;
+		}
+		else {
+			if (j == i) {
+				++j;
+			}
+			if ((! _segments.empty()) && (_segments.back().dispatchBegin == _segments.back().dispatchEnd)) {
+				_segments.back().end = sets[j - 1].end;
+			}
+			else {
+				_Segment seg;
+				seg.start = sets[i].start;
+				seg.end = sets[j - 1].end;
+				seg.dispatchBegin = seg.dispatchEnd = 0;
+				_segments.push_back(seg);
+			}
+			i = j;
+		}
+	}
+}
+
+CompiledRules::Result CompiledRules::filter(
+	const RuntimeEnvironment* RR,
+	Trace::RuleResultLog* rrl,
+	const NetworkConfig& nconf,
+	const Membership* membership,
+	bool inbound,
+	const Address& ztSource,
+	Address& ztDest,
+	const Frame& frame,
+	Address& cc,
+	unsigned int& ccLength,
+	bool& ccWatch,
+	uint8_t& qosBucket) const
+{
+	_State s(RR, rrl, nconf, membership, inbound, ztSource, ztDest, frame, cc, ccLength, ccWatch, qosBucket);
+
+	if (rrl) {
+		// Traces log every rule, so walk the whole table
+		rrl->clear();
+		_run(0, (unsigned int)_rules.size(), s);
+		return s.result;
+	}
+
+	for (std::vector<_Segment>::const_iterator seg(_segments.begin()); seg != _segments.end(); ++seg) {
+		if (seg->dispatchBegin == seg->dispatchEnd) {
+			if (_run(seg->start, seg->end, s)) {
+				return s.result;
+			}
+		}
+		else {
+			_Dispatch k;
+			k.etherType = (uint16_t)frame._etherType;
+			k.start = 0;
+			k.end = 0;
+			const std::vector<_Dispatch>::const_iterator dend(_dispatch.begin() + seg->dispatchEnd);
+			for (std::vector<_Dispatch>::const_iterator d(std::lower_bound(_dispatch.begin() + seg->dispatchBegin, dend, k)); ((d != dend) && (d->etherType == k.etherType)); ++d) {
+				if (_run(d->start, d->end, s)) {
+					return s.result;
+				}
+			}
+		}
+	}
+
+	return FILTER_NO_MATCH;
+}
+
+bool CompiledRules::_run(unsigned int rn, const unsigned int end, _State& s) const
+{
+	const Frame& f = s.f;
+
+	while (rn < end) {
+		const _Rule& cr = _rules[rn];
+		const ZT_VirtualNetworkRule& rule = cr.r;
+		const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(rule.t & 0x3f);
+
+		if ((unsigned int)rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+			if (s.thisSetMatches) {
+				switch (rt) {
+					case ZT_NETWORK_RULE_ACTION_PRIORITY:
+						s.qosBucket = (rule.v.qosBucket <= 8) ? rule.v.qosBucket : 4;	// 4 = default bucket (no priority)
+						s.result = FILTER_ACCEPT;
+						return true;
+
+					case ZT_NETWORK_RULE_ACTION_DROP:
+						if (s.skipDrop) {
+							s.skipDrop = 0;
+							break;
+						}
+						s.result = FILTER_DROP;
+						return true;
+
+					case ZT_NETWORK_RULE_ACTION_ACCEPT:
+						s.result = (s.superAccept ? FILTER_SUPER_ACCEPT : FILTER_ACCEPT);
+						return true;
+
+					case ZT_NETWORK_RULE_ACTION_TEE:
+					case ZT_NETWORK_RULE_ACTION_WATCH:
+					case ZT_NETWORK_RULE_ACTION_REDIRECT: {
+						const Address fwdAddr(rule.v.fwd.address);
+						if (fwdAddr == s.ztSource) {
+							// Skip as no-op since source is target
+						}
+						else if (fwdAddr == s.RR->identity.address()) {
+							if (s.inbound) {
+								s.result = FILTER_SUPER_ACCEPT;
+								return true;
+							}
+						}
+						else if (fwdAddr == s.ztDest) {
+						}
+						else if (rt == ZT_NETWORK_RULE_ACTION_REDIRECT) {
+							s.ztDest = fwdAddr;
+							s.result = FILTER_REDIRECT;
+							return true;
+						}
+						else {
+							s.cc = fwdAddr;
+							s.ccLength = (rule.v.fwd.length != 0) ? ((f._len < (unsigned int)rule.v.fwd.length) ? f._len : (unsigned int)rule.v.fwd.length) : f._len;
+							s.ccWatch = (rt == ZT_NETWORK_RULE_ACTION_WATCH);
+						}
+					} break;
+
+					case ZT_NETWORK_RULE_ACTION_BREAK:
+						s.result = FILTER_NO_MATCH;
+						return true;
+
+					// Unrecognized ACTIONs are ignored as no-ops
+					default:
+						break;
+				}
+			}
+			else {
+				// Super-accept later if we are the target of an unmatched TEE, WATCH or REDIRECT (see interpret())
+				if ((s.inbound) && (_isForward(rt)) && (s.RR->identity.address() == rule.v.fwd.address)) {
+					s.superAccept = true;
+				}
+				s.thisSetMatches = 1;
+			}
+			++rn;
+			continue;
+		}
+
+		// Nothing can change a false set until its action or the next OR'd match
+		if ((! s.thisSetMatches) && (! (rule.t & 0x40))) {
+			if (s.rrl) {
+				s.rrl->logSkipped(rn, s.thisSetMatches);
+				++rn;
+			}
+			else {
+				rn = cr.skipTo;
+			}
+			continue;
+		}
+
+		uint8_t thisRuleMatches = 0;
+		const uint8_t hardYes = (rule.t >> 7) ^ 1;
+		const uint8_t hardNo = (rule.t >> 7) ^ 0;
+
+		switch (rt) {
+			case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+				thisRuleMatches = (uint8_t)(rule.v.zt == s.ztSource.toInt());
+				break;
+			case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+				thisRuleMatches = (uint8_t)(rule.v.zt == s.ztDest.toInt());
+				break;
+			case ZT_NETWORK_RULE_MATCH_VLAN_ID:
+				thisRuleMatches = (uint8_t)(rule.v.vlanId == (uint16_t)f._vlanId);
+				break;
+			case ZT_NETWORK_RULE_MATCH_VLAN_PCP:
+				thisRuleMatches = (uint8_t)(rule.v.vlanPcp == 0);
+				break;
+			case ZT_NETWORK_RULE_MATCH_VLAN_DEI:
+				thisRuleMatches = (uint8_t)(rule.v.vlanDei == 0);
+				break;
+			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+				thisRuleMatches = (uint8_t)(cr.mac == f._macSource.toInt());
+				break;
+			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+				thisRuleMatches = (uint8_t)(cr.mac == f._macDest.toInt());
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+				if (f._ipv4) {
+					const uint32_t ip = (rt == ZT_NETWORK_RULE_MATCH_IPV4_SOURCE) ? f._ipv4Src : f._ipv4Dst;
+					if (cr.exactMask) {
+						thisRuleMatches = (uint8_t)((cr.ipv4Shift >= 32) || ((ip >> cr.ipv4Shift) == cr.ipv4Net));
+					}
+					else {
+						thisRuleMatches = (uint8_t)(InetAddress((const void*)&(rule.v.ipv4.ip), 4, rule.v.ipv4.mask).containsAddress(InetAddress((const void*)(f._data + ((rt == ZT_NETWORK_RULE_MATCH_IPV4_SOURCE) ? 12 : 16)), 4, 0)));
+					}
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+			case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+				if (f._ipv6) {
+					const uint64_t* const ip = (rt == ZT_NETWORK_RULE_MATCH_IPV6_SOURCE) ? f._ipv6Src : f._ipv6Dst;
+					if (cr.exactMask) {
+						thisRuleMatches = (uint8_t)(((ip[0] & cr.ipv6Mask[0]) == cr.ipv6Net[0]) && ((ip[1] & cr.ipv6Mask[1]) == cr.ipv6Net[1]));
+					}
+					else {
+						thisRuleMatches = (uint8_t)(InetAddress((const void*)rule.v.ipv6.ip, 16, rule.v.ipv6.mask).containsAddress(InetAddress((const void*)(f._data + ((rt == ZT_NETWORK_RULE_MATCH_IPV6_SOURCE) ? 8 : 24)), 16, 0)));
+					}
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IP_TOS:
+				if (f._tos) {
+					const uint8_t tosMasked = f._tosValue & rule.v.ipTos.mask;
+					thisRuleMatches = (uint8_t)((tosMasked >= rule.v.ipTos.value[0]) && (tosMasked <= rule.v.ipTos.value[1]));
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+				thisRuleMatches = (f._ipProtocol >= 0) ? (uint8_t)(rule.v.ipProtocol == (uint8_t)f._ipProtocol) : hardNo;
+				break;
+			case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+				thisRuleMatches = (uint8_t)(rule.v.etherType == (uint16_t)f._etherType);
+				break;
+			case ZT_NETWORK_RULE_MATCH_ICMP:
+				if ((f._icmp) && (rule.v.icmp.type == f._icmpType)) {
+					thisRuleMatches = ((rule.v.icmp.flags & 0x01) != 0) ? (uint8_t)(f._icmpCode == rule.v.icmp.code) : hardYes;
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+			case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+				if (f._ports) {
+					const int p = (rt == ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE) ? f._srcPort : f._dstPort;
+					thisRuleMatches = (p >= 0) ? (uint8_t)((p >= (int)rule.v.port[0]) && (p <= (int)rule.v.port[1])) : (uint8_t)0;
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS: {
+				uint64_t cf = (s.inbound) ? ZT_RULE_PACKET_CHARACTERISTICS_INBOUND : 0ULL;
+				cf |= f._addressCharacteristics;
+				cf |= f._ownership(s.nconf, s.membership, s.inbound);
+				cf |= f._tcpCharacteristics();
+				thisRuleMatches = (uint8_t)((cf & rule.v.characteristics) != 0);
+			} break;
+			case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+				thisRuleMatches = (uint8_t)((f._len >= (unsigned int)rule.v.frameSize[0]) && (f._len <= (unsigned int)rule.v.frameSize[1]));
+				break;
+			case ZT_NETWORK_RULE_MATCH_RANDOM:
+				thisRuleMatches = (uint8_t)((uint32_t)(s.RR->node->prng() & 0xffffffffULL) <= rule.v.randomProbability);
+				break;
+			case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+			case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL:
+				if (cr.localTag) {
+					const Tag* const remoteTag = ((s.membership) ? s.membership->getTag(s.nconf, rule.v.tag.id) : (const Tag*)0);
+					if (remoteTag) {
+						const uint32_t ltv = cr.localTagValue;
+						const uint32_t rtv = remoteTag->value();
+						if (rt == ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE) {
+							const uint32_t diff = (ltv > rtv) ? (ltv - rtv) : (rtv - ltv);
+							thisRuleMatches = (uint8_t)(diff <= rule.v.tag.value);
+						}
+						else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND) {
+							thisRuleMatches = (uint8_t)((ltv & rtv) == rule.v.tag.value);
+						}
+						else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR) {
+							thisRuleMatches = (uint8_t)((ltv | rtv) == rule.v.tag.value);
+						}
+						else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR) {
+							thisRuleMatches = (uint8_t)((ltv ^ rtv) == rule.v.tag.value);
+						}
+						else {
+							thisRuleMatches = (uint8_t)((ltv == rule.v.tag.value) && (rtv == rule.v.tag.value));
+						}
+					}
+					else if ((s.inbound) && (! s.superAccept)) {
+						thisRuleMatches = hardNo;
+					}
+					else {
+						// Not strict when we may not know the remote tag yet (see interpret())
+						s.skipDrop = 1;
+						thisRuleMatches = hardYes;
+					}
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+			case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER:
+				if (s.superAccept) {
+					s.skipDrop = 1;
+					thisRuleMatches = hardYes;
+				}
+				else if (((rt == ZT_NETWORK_RULE_MATCH_TAG_SENDER) && (s.inbound)) || ((rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER) && (! s.inbound))) {
+					const Tag* const remoteTag = ((s.membership) ? s.membership->getTag(s.nconf, rule.v.tag.id) : (const Tag*)0);
+					if (remoteTag) {
+						thisRuleMatches = (uint8_t)(remoteTag->value() == rule.v.tag.value);
+					}
+					else if (rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER) {
+						s.skipDrop = 1;
+						thisRuleMatches = hardYes;
+					}
+					else {
+						thisRuleMatches = hardNo;
+					}
+				}
+				else {
+					thisRuleMatches = (cr.localTag) ? (uint8_t)(cr.localTagValue == rule.v.tag.value) : hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE: {
+				uint64_t integer = 0;
+				const unsigned int bits = (rule.v.intRange.format & 63) + 1;
+				const unsigned int bytes = ((bits + 8 - 1) / 8);
+				if ((rule.v.intRange.format & 0x80) == 0) {
+					unsigned int idx = rule.v.intRange.idx + (8 - bytes);
+					const unsigned int eof = idx + bytes;
+					if (eof <= f._len) {
+						while (idx < eof) {
+							integer <<= 8;
+							integer |= f._data[idx++];
+						}
+					}
+					integer &= 0xffffffffffffffffULL >> (64 - bits);
+				}
+				else {
+					unsigned int idx = rule.v.intRange.idx;
+					const unsigned int eof = idx + bytes;
+					if (eof <= f._len) {
+						while (idx < eof) {
+							integer >>= 8;
+							integer |= ((uint64_t)f._data[idx++]) << 56;
+						}
+					}
+					integer >>= (64 - bits);
+				}
+				thisRuleMatches = (uint8_t)((integer >= rule.v.intRange.start) && (integer <= (rule.v.intRange.start + (uint64_t)rule.v.intRange.end)));
+			} break;
+
+			default:
+				thisRuleMatches = _unsupportedMatchResult;
+				break;
+		}
+
+		if (s.rrl) {
+			s.rrl->log(rn, thisRuleMatches, s.thisSetMatches);
+		}
+
+		if ((rule.t & 0x40)) {
+			s.thisSetMatches |= (thisRuleMatches ^ ((rule.t >> 7) & 1));
+		}
+		else {
+			s.thisSetMatches &= (thisRuleMatches ^ ((rule.t >> 7) & 1));
+		}
+		++rn;
+	}
+
+	return false;
+}
+
+CompiledRules::Result CompiledRules::interpret(
+	const RuntimeEnvironment* RR,
+	Trace::RuleResultLog& rrl,
+	const NetworkConfig& nconf,
+	const Membership* membership,	// can be NULL
+	const bool inbound,
+	const Address& ztSource,
+	Address& ztDest,   // MUTABLE -- is changed on REDIRECT actions
+	const MAC& macSource,
+	const MAC& macDest,
+	const uint8_t* const frameData,
+	const unsigned int frameLen,
+	const unsigned int etherType,
+	const unsigned int vlanId,
+	const ZT_VirtualNetworkRule* rules,	  // cannot be NULL
+	const unsigned int ruleCount,
+	Address& cc,			  // MUTABLE -- set to TEE destination if TEE action is taken or left alone otherwise
+	unsigned int& ccLength,	  // MUTABLE -- set to length of packet payload to TEE
+	bool& ccWatch,			  // MUTABLE -- set to true for WATCH target as opposed to normal TEE
+	uint8_t& qosBucket)		  // MUTABLE -- set to the value of the argument provided to PRIORITY
+{
+	// Set to true if we are a TEE/REDIRECT/WATCH target
+	bool superAccept = false;
+
+	// The default match state for each set of entries starts as 'true' since an
+	// ACTION with no MATCH entries preceding it is always taken.
+	uint8_t thisSetMatches = 1;
+	uint8_t skipDrop = 0;
+
+	rrl.clear();
+
+	// uncomment for easier debugging fprintf
+	// if (!ztDest) { return FILTER_ACCEPT; }
+#ifdef ZT_TRACE
+	// char buf[40], buf2[40];
+	// fprintf(stderr, "\nsrc %s dest %s inbound: %d ethertype %u", ztSource.toString(buf), ztDest.toString(buf2), inbound, etherType);
+#endif
+
+	for (unsigned int rn = 0; rn < ruleCount; ++rn) {
+		const ZT_VirtualNetworkRuleType rt = (ZT_VirtualNetworkRuleType)(rules[rn].t & 0x3f);
+#ifdef ZT_TRACE
+		// fprintf(stderr, "\n%02u %02d", rn, rt);
+#endif
+
+		// First check if this is an ACTION
+		if ((unsigned int)rt <= (unsigned int)ZT_NETWORK_RULE_ACTION__MAX_ID) {
+			if (thisSetMatches) {
+				switch (rt) {
+					case ZT_NETWORK_RULE_ACTION_PRIORITY:
+						qosBucket = (rules[rn].v.qosBucket <= 8) ? rules[rn].v.qosBucket : 4;	// 4 = default bucket (no priority)
+						return FILTER_ACCEPT;
+
+					case ZT_NETWORK_RULE_ACTION_DROP: {
+						if (! ! skipDrop) {
+#ifdef ZT_TRACE
+							// fprintf(stderr, "\tskip Drop");
+#endif
+							skipDrop = 0;
+							continue;
+						}
+#ifdef ZT_TRACE
+						// fprintf(stderr, "\tDrop\n");
+#endif
+						return FILTER_DROP;
+					}
+
+					case ZT_NETWORK_RULE_ACTION_ACCEPT: {
+#ifdef ZT_TRACE
+						// fprintf(stderr, "\tAccept\n");
+#endif
+						return (superAccept ? FILTER_SUPER_ACCEPT : FILTER_ACCEPT);	  // match, accept packet
+					}
+
+					// These are initially handled together since preliminary logic is common
+					case ZT_NETWORK_RULE_ACTION_TEE:
+					case ZT_NETWORK_RULE_ACTION_WATCH:
+					case ZT_NETWORK_RULE_ACTION_REDIRECT: {
+						const Address fwdAddr(rules[rn].v.fwd.address);
+						if (fwdAddr == ztSource) {
+							// Skip as no-op since source is target
+						}
+						else if (fwdAddr == RR->identity.address()) {
+							if (inbound) {
+								return FILTER_SUPER_ACCEPT;
+							}
+							else {
+							}
+						}
+						else if (fwdAddr == ztDest) {
+						}
+						else {
+							if (rt == ZT_NETWORK_RULE_ACTION_REDIRECT) {
+								ztDest = fwdAddr;
+								return FILTER_REDIRECT;
+							}
+							else {
+								cc = fwdAddr;
+								ccLength = (rules[rn].v.fwd.length != 0) ? ((frameLen < (unsigned int)rules[rn].v.fwd.length) ? frameLen : (unsigned int)rules[rn].v.fwd.length) : frameLen;
+								ccWatch = (rt == ZT_NETWORK_RULE_ACTION_WATCH);
+							}
+						}
+					}
+						continue;
+
+					case ZT_NETWORK_RULE_ACTION_BREAK:
+						return FILTER_NO_MATCH;
+
+					// Unrecognized ACTIONs are ignored as no-ops
+					default:
+						continue;
+				}
+			}
+			else {
+				// If this is an incoming packet and we are a TEE or REDIRECT target, we should
+				// super-accept if we accept at all. This will cause us to accept redirected or
+				// tee'd packets in spite of MAC and ZT addressing checks.
+				if (inbound) {
+					switch (rt) {
+						case ZT_NETWORK_RULE_ACTION_TEE:
+						case ZT_NETWORK_RULE_ACTION_WATCH:
+						case ZT_NETWORK_RULE_ACTION_REDIRECT:
+							if (RR->identity.address() == rules[rn].v.fwd.address) {
+								superAccept = true;
+							}
+							break;
+						default:
+							break;
+					}
+				}
+
+				thisSetMatches = 1;	  // reset to default true for next batch of entries
+				continue;
+			}
+		}
+
+		// Circuit breaker: no need to evaluate an AND if the set's match state
+		// is currently false since anything AND false is false.
+		if ((! thisSetMatches) && (! (rules[rn].t & 0x40))) {
+			rrl.logSkipped(rn, thisSetMatches);
+			continue;
+		}
+
+		// If this was not an ACTION evaluate next MATCH and update thisSetMatches with (AND [result])
+		uint8_t thisRuleMatches = 0;
+		uint64_t ownershipVerificationMask = 1;		// this magic value means it hasn't been computed yet -- this is done lazily the first time it's needed
+		uint8_t hardYes = (rules[rn].t >> 7) ^ 1;	// XOR with the NOT bit of the rule
+		uint8_t hardNo = (rules[rn].t >> 7) ^ 0;
+
+		switch (rt) {
+			case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+				thisRuleMatches = (uint8_t)(rules[rn].v.zt == ztSource.toInt());
+				break;
+			case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+				thisRuleMatches = (uint8_t)(rules[rn].v.zt == ztDest.toInt());
+				break;
+			case ZT_NETWORK_RULE_MATCH_VLAN_ID:
+				thisRuleMatches = (uint8_t)(rules[rn].v.vlanId == (uint16_t)vlanId);
+				break;
+			case ZT_NETWORK_RULE_MATCH_VLAN_PCP:
+				// NOT SUPPORTED YET
+				thisRuleMatches = (uint8_t)(rules[rn].v.vlanPcp == 0);
+				break;
+			case ZT_NETWORK_RULE_MATCH_VLAN_DEI:
+				// NOT SUPPORTED YET
+				thisRuleMatches = (uint8_t)(rules[rn].v.vlanDei == 0);
+				break;
+			case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+				thisRuleMatches = (uint8_t)(MAC(rules[rn].v.mac, 6) == macSource);
+				break;
+			case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+				thisRuleMatches = (uint8_t)(MAC(rules[rn].v.mac, 6) == macDest);
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+				if ((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20)) {
+					thisRuleMatches = (uint8_t)(InetAddress((const void*)&(rules[rn].v.ipv4.ip), 4, rules[rn].v.ipv4.mask).containsAddress(InetAddress((const void*)(frameData + 12), 4, 0)));
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+				if ((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20)) {
+					thisRuleMatches = (uint8_t)(InetAddress((const void*)&(rules[rn].v.ipv4.ip), 4, rules[rn].v.ipv4.mask).containsAddress(InetAddress((const void*)(frameData + 16), 4, 0)));
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+				if ((etherType == ZT_ETHERTYPE_IPV6) && (frameLen >= 40)) {
+					thisRuleMatches = (uint8_t)(InetAddress((const void*)rules[rn].v.ipv6.ip, 16, rules[rn].v.ipv6.mask).containsAddress(InetAddress((const void*)(frameData + 8), 16, 0)));
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+				if ((etherType == ZT_ETHERTYPE_IPV6) && (frameLen >= 40)) {
+					thisRuleMatches = (uint8_t)(InetAddress((const void*)rules[rn].v.ipv6.ip, 16, rules[rn].v.ipv6.mask).containsAddress(InetAddress((const void*)(frameData + 24), 16, 0)));
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IP_TOS:
+				if ((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20)) {
+					const uint8_t tosMasked = frameData[1] & rules[rn].v.ipTos.mask;
+					thisRuleMatches = (uint8_t)((tosMasked >= rules[rn].v.ipTos.value[0]) && (tosMasked <= rules[rn].v.ipTos.value[1]));
+				}
+				else if ((etherType == ZT_ETHERTYPE_IPV6) && (frameLen >= 40)) {
+					const uint8_t tosMasked = (((frameData[0] << 4) & 0xf0) | ((frameData[1] >> 4) & 0x0f)) & rules[rn].v.ipTos.mask;
+					thisRuleMatches = (uint8_t)((tosMasked >= rules[rn].v.ipTos.value[0]) && (tosMasked <= rules[rn].v.ipTos.value[1]));
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+				if ((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20)) {
+					thisRuleMatches = (uint8_t)(rules[rn].v.ipProtocol == frameData[9]);
+				}
+				else if (etherType == ZT_ETHERTYPE_IPV6) {
+					unsigned int pos = 0, proto = 0;
+					if (_ipv6GetPayload(frameData, frameLen, pos, proto)) {
+						thisRuleMatches = (uint8_t)(rules[rn].v.ipProtocol == (uint8_t)proto);
+					}
+					else {
+						thisRuleMatches = hardNo;
+					}
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+				thisRuleMatches = (uint8_t)(rules[rn].v.etherType == (uint16_t)etherType);
+				break;
+			case ZT_NETWORK_RULE_MATCH_ICMP:
+				if ((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20)) {
+					if (frameData[9] == 0x01) {	  // IP protocol == ICMP
+						const unsigned int ihl = (frameData[0] & 0xf) * 4;
+						if (frameLen >= (ihl + 2)) {
+							if (rules[rn].v.icmp.type == frameData[ihl]) {
+								if ((rules[rn].v.icmp.flags & 0x01) != 0) {
+									thisRuleMatches = (uint8_t)(frameData[ihl + 1] == rules[rn].v.icmp.code);
+								}
+								else {
+									thisRuleMatches = hardYes;
+								}
+							}
+							else {
+								thisRuleMatches = hardNo;
+							}
+						}
+						else {
+							thisRuleMatches = hardNo;
+						}
+					}
+					else {
+						thisRuleMatches = hardNo;
+					}
+				}
+				else if (etherType == ZT_ETHERTYPE_IPV6) {
+					unsigned int pos = 0, proto = 0;
+					if (_ipv6GetPayload(frameData, frameLen, pos, proto)) {
+						if ((proto == 0x3a) && (frameLen >= (pos + 2))) {
+							if (rules[rn].v.icmp.type == frameData[pos]) {
+								if ((rules[rn].v.icmp.flags & 0x01) != 0) {
+									thisRuleMatches = (uint8_t)(frameData[pos + 1] == rules[rn].v.icmp.code);
+								}
+								else {
+									thisRuleMatches = hardYes;
+								}
+							}
+							else {
+								thisRuleMatches = hardNo;
+							}
+						}
+						else {
+							thisRuleMatches = hardNo;
+						}
+					}
+					else {
+						thisRuleMatches = hardNo;
+					}
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+			case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+				if ((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20)) {
+					const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+					int p = -1;
+					switch (frameData[9]) {	  // IP protocol number
+						// All these start with 16-bit source and destination port in that order
+						case 0x06:	 // TCP
+						case 0x11:	 // UDP
+						case 0x84:	 // SCTP
+						case 0x88:	 // UDPLite
+							if (frameLen > (headerLen + 4)) {
+								unsigned int pos = headerLen + ((rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) ? 2 : 0);
+								p = (int)frameData[pos++] << 8;
+								p |= (int)frameData[pos];
+							}
+							break;
+					}
+
+					thisRuleMatches = (p >= 0) ? (uint8_t)((p >= (int)rules[rn].v.port[0]) && (p <= (int)rules[rn].v.port[1])) : (uint8_t)0;
+				}
+				else if (etherType == ZT_ETHERTYPE_IPV6) {
+					unsigned int pos = 0, proto = 0;
+					if (_ipv6GetPayload(frameData, frameLen, pos, proto)) {
+						int p = -1;
+						switch (proto) {   // IP protocol number
+							// All these start with 16-bit source and destination port in that order
+							case 0x06:	 // TCP
+							case 0x11:	 // UDP
+							case 0x84:	 // SCTP
+							case 0x88:	 // UDPLite
+								if (frameLen > (pos + 4)) {
+									if (rt == ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE) {
+										pos += 2;
+									}
+									p = (int)frameData[pos++] << 8;
+									p |= (int)frameData[pos];
+								}
+								break;
+						}
+						thisRuleMatches = (p > 0) ? (uint8_t)((p >= (int)rules[rn].v.port[0]) && (p <= (int)rules[rn].v.port[1])) : (uint8_t)0;
+					}
+					else {
+						thisRuleMatches = hardNo;
+					}
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+				break;
+			case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS: {
+				uint64_t cf = (inbound) ? ZT_RULE_PACKET_CHARACTERISTICS_INBOUND : 0ULL;
+				if (macDest.isMulticast()) {
+					cf |= ZT_RULE_PACKET_CHARACTERISTICS_MULTICAST;
+				}
+				if (macDest.isBroadcast()) {
+					cf |= ZT_RULE_PACKET_CHARACTERISTICS_BROADCAST;
+				}
+				if (ownershipVerificationMask == 1) {
+					ownershipVerificationMask = 0;
+					InetAddress src;
+					if ((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20)) {
+						src.set((const void*)(frameData + 12), 4, 0);
+					}
+					else if ((etherType == ZT_ETHERTYPE_IPV6) && (frameLen >= 40)) {
+						// IPv6 NDP requires special handling, since the src and dest IPs in the packet are empty or link-local.
+						if ((frameLen >= (40 + 8 + 16)) && (frameData[6] == 0x3a) && ((frameData[40] == 0x87) || (frameData[40] == 0x88))) {
+							if (frameData[40] == 0x87) {
+								// Neighbor solicitations contain no reliable source address, so we implement a small
+								// hack by considering them authenticated. Otherwise you would pretty much have to do
+								// this manually in the rule set for IPv6 to work at all.
+								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+							}
+							else {
+								// Neighbor advertisements on the other hand can absolutely be authenticated.
+								src.set((const void*)(frameData + 40 + 8), 16, 0);
+							}
+						}
+						else {
+							// Other IPv6 packets can be handled normally
+							src.set((const void*)(frameData + 8), 16, 0);
+						}
+					}
+					else if ((etherType == ZT_ETHERTYPE_ARP) && (frameLen >= 28)) {
+						src.set((const void*)(frameData + 14), 4, 0);
+					}
+					if (inbound) {
+						if (membership) {
+							if ((src) && (membership->hasCertificateOfOwnershipFor<InetAddress>(nconf, src))) {
+								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+							}
+							if (membership->hasCertificateOfOwnershipFor<MAC>(nconf, macSource)) {
+								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
+							}
+						}
+					}
+					else {
+						for (unsigned int i = 0; i < nconf.certificateOfOwnershipCount; ++i) {
+							if ((src) && (nconf.certificatesOfOwnership[i].owns(src))) {
+								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_IP_AUTHENTICATED;
+							}
+							if (nconf.certificatesOfOwnership[i].owns(macSource)) {
+								ownershipVerificationMask |= ZT_RULE_PACKET_CHARACTERISTICS_SENDER_MAC_AUTHENTICATED;
+							}
+						}
+					}
+				}
+				cf |= ownershipVerificationMask;
+				if ((etherType == ZT_ETHERTYPE_IPV4) && (frameLen >= 20) && (frameData[9] == 0x06)) {
+					const unsigned int headerLen = 4 * (frameData[0] & 0xf);
+					cf |= (uint64_t)frameData[headerLen + 13];
+					cf |= (((uint64_t)(frameData[headerLen + 12] & 0x0f)) << 8);
+				}
+				else if (etherType == ZT_ETHERTYPE_IPV6) {
+					unsigned int pos = 0, proto = 0;
+					if (_ipv6GetPayload(frameData, frameLen, pos, proto)) {
+						if ((proto == 0x06) && (frameLen > (pos + 14))) {
+							cf |= (uint64_t)frameData[pos + 13];
+							cf |= (((uint64_t)(frameData[pos + 12] & 0x0f)) << 8);
+						}
+					}
+				}
+				thisRuleMatches = (uint8_t)((cf & rules[rn].v.characteristics) != 0);
+			} break;
+			case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+				thisRuleMatches = (uint8_t)((frameLen >= (unsigned int)rules[rn].v.frameSize[0]) && (frameLen <= (unsigned int)rules[rn].v.frameSize[1]));
+				break;
+			case ZT_NETWORK_RULE_MATCH_RANDOM:
+				thisRuleMatches = (uint8_t)((uint32_t)(RR->node->prng() & 0xffffffffULL) <= rules[rn].v.randomProbability);
+				break;
+			case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+			case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+			case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL: {
+				const Tag* const localTag = std::lower_bound(&(nconf.tags[0]), &(nconf.tags[nconf.tagCount]), rules[rn].v.tag.id, Tag::IdComparePredicate());
+				if ((localTag != &(nconf.tags[nconf.tagCount])) && (localTag->id() == rules[rn].v.tag.id)) {
+					const Tag* const remoteTag = ((membership) ? membership->getTag(nconf, rules[rn].v.tag.id) : (const Tag*)0);
+#ifdef ZT_TRACE
+					/*fprintf(stderr, "\tlocal tag [%u: %u] remote tag [%u: %u] match [%u]",
+							!!localTag ? localTag->id() : 0,
+							!!localTag ? localTag->value() : 0,
+							!!remoteTag ? remoteTag->id() : 0,
+							!!remoteTag ? remoteTag->value() : 0,
+							thisRuleMatches);*/
+#endif
+					if (remoteTag) {
+						const uint32_t ltv = localTag->value();
+						const uint32_t rtv = remoteTag->value();
+						if (rt == ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE) {
+							const uint32_t diff = (ltv > rtv) ? (ltv - rtv) : (rtv - ltv);
+							thisRuleMatches = (uint8_t)(diff <= rules[rn].v.tag.value);
+						}
+						else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND) {
+							thisRuleMatches = (uint8_t)((ltv & rtv) == rules[rn].v.tag.value);
+						}
+						else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR) {
+							thisRuleMatches = (uint8_t)((ltv | rtv) == rules[rn].v.tag.value);
+						}
+						else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR) {
+							thisRuleMatches = (uint8_t)((ltv ^ rtv) == rules[rn].v.tag.value);
+						}
+						else if (rt == ZT_NETWORK_RULE_MATCH_TAGS_EQUAL) {
+							thisRuleMatches = (uint8_t)((ltv == rules[rn].v.tag.value) && (rtv == rules[rn].v.tag.value));
+						}
+						else {	 // sanity check, can't really happen
+							thisRuleMatches = hardNo;
+						}
+					}
+					else {
+						if ((inbound) && (! superAccept)) {
+							thisRuleMatches = hardNo;
+#ifdef ZT_TRACE
+							// fprintf(stderr, "\tinbound ");
+#endif
+						}
+						else {
+							// Outbound side is not strict since if we have to match both tags and
+							// we are sending a first packet to a recipient, we probably do not know
+							// about their tags yet. They will filter on inbound and we will filter
+							// once we get their tag. If we are a tee/redirect target we are also
+							// not strict since we likely do not have these tags.
+							skipDrop = 1;
+							thisRuleMatches = hardYes;
+#ifdef ZT_TRACE
+							// fprintf(stderr, "\toutbound ");
+#endif
+						}
+					}
+				}
+				else {
+					thisRuleMatches = hardNo;
+				}
+			} break;
+			case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+			case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER: {
+				const Tag* const localTag = std::lower_bound(&(nconf.tags[0]), &(nconf.tags[nconf.tagCount]), rules[rn].v.tag.id, Tag::IdComparePredicate());
+#ifdef ZT_TRACE
+				/*const Tag *const remoteTag = ((membership) ? membership->getTag(nconf,rules[rn].v.tag.id) : (const Tag *)0);
+				fprintf(stderr, "\tlocal tag [%u: %u] remote tag [%u: %u] match [%u]",
+						!!localTag ? localTag->id() : 0,
+						!!localTag ? localTag->value() : 0,
+						!!remoteTag ? remoteTag->id() : 0,
+						!!remoteTag ? remoteTag->value() : 0,
+						thisRuleMatches);*/
+#endif
+				if (superAccept) {
+					skipDrop = 1;
+					thisRuleMatches = hardYes;
+				}
+				else if (((rt == ZT_NETWORK_RULE_MATCH_TAG_SENDER) && (inbound)) || ((rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER) && (! inbound))) {
+					const Tag* const remoteTag = ((membership) ? membership->getTag(nconf, rules[rn].v.tag.id) : (const Tag*)0);
+					if (remoteTag) {
+						thisRuleMatches = (uint8_t)(remoteTag->value() == rules[rn].v.tag.value);
+					}
+					else {
+						if (rt == ZT_NETWORK_RULE_MATCH_TAG_RECEIVER) {
+							// If we are checking the receiver and this is an outbound packet, we
+							// can't be strict since we may not yet know the receiver's tag.
+							skipDrop = 1;
+							thisRuleMatches = hardYes;
+						}
+						else {
+							thisRuleMatches = hardNo;
+						}
+					}
+				}
+				else {	 // sender and outbound or receiver and inbound
+					if ((localTag != &(nconf.tags[nconf.tagCount])) && (localTag->id() == rules[rn].v.tag.id)) {
+						thisRuleMatches = (uint8_t)(localTag->value() == rules[rn].v.tag.value);
+					}
+					else {
+						thisRuleMatches = hardNo;
+					}
+				}
+			} break;
+			case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE: {
+				uint64_t integer = 0;
+				const unsigned int bits = (rules[rn].v.intRange.format & 63) + 1;
+				const unsigned int bytes = ((bits + 8 - 1) / 8);   // integer ceiling of division by 8
+				if ((rules[rn].v.intRange.format & 0x80) == 0) {
+					// Big-endian
+					unsigned int idx = rules[rn].v.intRange.idx + (8 - bytes);
+					const unsigned int eof = idx + bytes;
+					if (eof <= frameLen) {
+						while (idx < eof) {
+							integer <<= 8;
+							integer |= frameData[idx++];
+						}
+					}
+					integer &= 0xffffffffffffffffULL >> (64 - bits);
+				}
+				else {
+					// Little-endian
+					unsigned int idx = rules[rn].v.intRange.idx;
+					const unsigned int eof = idx + bytes;
+					if (eof <= frameLen) {
+						while (idx < eof) {
+							integer >>= 8;
+							integer |= ((uint64_t)frameData[idx++]) << 56;
+						}
+					}
+					integer >>= (64 - bits);
+				}
+				thisRuleMatches = (uint8_t)((integer >= rules[rn].v.intRange.start) && (integer <= (rules[rn].v.intRange.start + (uint64_t)rules[rn].v.intRange.end)));
+			} break;
+
+			// The result of an unsupported MATCH is configurable at the network
+			// level via a flag.
+			default:
+				thisRuleMatches = (uint8_t)((nconf.flags & ZT_NETWORKCONFIG_FLAG_RULES_RESULT_OF_UNSUPPORTED_MATCH) != 0);
+				break;
+		}
+
+		rrl.log(rn, thisRuleMatches, thisSetMatches);
+
+		if ((rules[rn].t & 0x40)) {
+			thisSetMatches |= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
+		}
+		else {
+			thisSetMatches &= (thisRuleMatches ^ ((rules[rn].t >> 7) & 1));
+		}
+	}
+
+	return FILTER_NO_MATCH;
+}
+
+}	// namespace ZeroTier
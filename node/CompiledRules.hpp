@@ -0,0 +1,220 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#ifndef ZT_COMPILEDRULES_HPP
+#define ZT_COMPILEDRULES_HPP
+
+#include "../include/ZeroTierOne.h"
+#include "Address.hpp"
+#include "Constants.hpp"
+#include "MAC.hpp"
+#include "Membership.hpp"
+#include "NetworkConfig.hpp"
+#include "Trace.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+namespace ZeroTier {
+
+class RuntimeEnvironment;
+
+/**
+ * A rule table compiled for fast evaluation against frames
+ *
+ * Network rules and local capabilities are compiled once when a network
+ * config is applied. Compilation resolves everything that depends only on
+ * the rule and the config: address masks are pre-shifted, local tag values
+ * are looked up, each match knows where the next rule that could change
+ * the outcome of its set lives, and long runs of rule sets that begin with
+ * an ethertype match are indexed by ethertype so a frame only visits the
+ * sets that can apply to it.
+ *
+ * Frame fields are parsed once per frame into a Frame and shared by the
+ * network's rules and every capability it is checked against.
+ *
+ * The results are identical to interpret(), which walks the raw rule table
+ * and is still used for credentials received from remote peers.
+ */
+class CompiledRules {
+  public:
+	enum Result { FILTER_NO_MATCH, FILTER_DROP, FILTER_REDIRECT, FILTER_ACCEPT, FILTER_SUPER_ACCEPT };
+
+	/**
+	 * Frame fields used by rule matches, parsed once per frame
+	 *
+	 * The sender ownership bits used by characteristics matches are computed
+	 * the first time they are needed and then reused, so a Frame must only
+	 * be filtered with one network config, membership and direction.
+	 */
+	class Frame {
+		friend class CompiledRules;
+
+	  public:
+		Frame(const MAC& macSource, const MAC& macDest, const uint8_t* frameData, unsigned int frameLen, unsigned int etherType, unsigned int vlanId);
+
+	  private:
+		uint64_t _ownership(const NetworkConfig& nconf, const Membership* membership, bool inbound) const;
+		uint64_t _tcpCharacteristics() const;
+
+		const MAC _macSource;
+		const MAC _macDest;
+		const uint8_t* const _data;
+		const unsigned int _len;
+		const unsigned int _etherType;
+		const unsigned int _vlanId;
+
+		bool _ipv4;			 // IPv4 with at least a minimal header
+		bool _ipv6;			 // IPv6 with at least a fixed header
+		bool _ipv6Payload;	 // IPv6 extension headers were walked successfully
+		bool _ports;		 // port ranges can be evaluated (otherwise they never match)
+		bool _icmp;			 // ICMP or ICMPv6 with type and code present
+		bool _tos;
+		int _ipProtocol;	 // -1 if not IPv4 or parseable IPv6
+		int _srcPort;		 // -1 if not present
+		int _dstPort;
+		uint8_t _icmpType;
+		uint8_t _icmpCode;
+		uint8_t _tosValue;
+		unsigned int _ipv6PayloadPos;
+		uint32_t _ipv4Src;
+		uint32_t _ipv4Dst;
+		uint64_t _ipv6Src[2];
+		uint64_t _ipv6Dst[2];
+		uint64_t _addressCharacteristics;
+		mutable uint64_t _ownershipMask;	// 1 if not yet computed
+		mutable uint64_t _tcpMask;			// 1 if not yet computed
+	};
+
+	CompiledRules();
+
+	/**
+	 * Compile a rule table
+	 *
+	 * The rules are copied, but local tag values and the result of
+	 * unsupported matches are taken from nconf, so a table must be
+	 * recompiled whenever the config it was compiled against changes.
+	 *
+	 * @param rules Rules
+	 * @param ruleCount Number of rules
+	 * @param nconf Network config the rules will be evaluated with
+	 */
+	void compile(const ZT_VirtualNetworkRule* rules, unsigned int ruleCount, const NetworkConfig& nconf);
+
+	/**
+	 * Evaluate compiled rules against a frame
+	 *
+	 * @param RR Runtime environment
+	 * @param rrl Rule result log, or NULL if not tracing (tracing forces a rule-by-rule walk)
+	 * @param nconf Network config these rules were compiled against
+	 * @param membership Membership of remote peer or NULL if none
+	 * @param inbound True if frame is inbound
+	 * @param ztSource Source ZeroTier address
+	 * @param ztDest Destination ZeroTier address, changed on REDIRECT
+	 * @param frame Parsed frame
+	 * @param cc Set to TEE or WATCH target if one is taken
+	 * @param ccLength Set to length of frame to send to cc
+	 * @param ccWatch Set to true if cc is a WATCH target
+	 * @param qosBucket Set to PRIORITY argument if one is taken
+	 * @return Filter result
+	 */
+	Result filter(
+		const RuntimeEnvironment* RR,
+		Trace::RuleResultLog* rrl,
+		const NetworkConfig& nconf,
+		const Membership* membership,
+		bool inbound,
+		const Address& ztSource,
+		Address& ztDest,
+		const Frame& frame,
+		Address& cc,
+		unsigned int& ccLength,
+		bool& ccWatch,
+		uint8_t& qosBucket) const;
+
+	/**
+	 * Evaluate a raw rule table against a frame
+	 *
+	 * Parameters are as for filter().
+	 */
+	static Result interpret(
+		const RuntimeEnvironment* RR,
+		Trace::RuleResultLog& rrl,
+		const NetworkConfig& nconf,
+		const Membership* membership,
+		bool inbound,
+		const Address& ztSource,
+		Address& ztDest,
+		const MAC& macSource,
+		const MAC& macDest,
+		const uint8_t* frameData,
+		unsigned int frameLen,
+		unsigned int etherType,
+		unsigned int vlanId,
+		const ZT_VirtualNetworkRule* rules,
+		unsigned int ruleCount,
+		Address& cc,
+		unsigned int& ccLength,
+		bool& ccWatch,
+		uint8_t& qosBucket);
+
+	/**
+	 * @return Number of rules
+	 */
+	inline unsigned int ruleCount() const
+	{
+		return (unsigned int)_rules.size();
+	}
+
+  private:
+	struct _Rule {
+		ZT_VirtualNetworkRule r;
+		unsigned int skipTo;   // next action or OR rule, where a false set can change again
+		uint64_t mac;
+		uint32_t ipv4Net;	   // IPv4 network shifted right by ipv4Shift
+		unsigned int ipv4Shift;
+		uint64_t ipv6Net[2];
+		uint64_t ipv6Mask[2];
+		bool exactMask;		   // mask is in range and was precomputed
+		bool localTag;
+		uint32_t localTagValue;
+	};
+
+	// A span of rules evaluated in order, or a run of ethertype gated sets
+	// dispatched through _dispatch[dispatchBegin,dispatchEnd)
+	struct _Segment {
+		unsigned int start;
+		unsigned int end;
+		unsigned int dispatchBegin;
+		unsigned int dispatchEnd;
+	};
+
+	struct _Dispatch {
+		unsigned int etherType;
+		unsigned int start;
+		unsigned int end;
+
+		inline bool operator<(const _Dispatch& d) const
+		{
+			return ((etherType < d.etherType) || ((etherType == d.etherType) && (start < d.start)));
+		}
+	};
+
+	struct _State;
+
+	bool _run(unsigned int rn, unsigned int end, _State& s) const;
+
+	std::vector<_Rule> _rules;
+	std::vector<_Segment> _segments;
+	std::vector<_Dispatch> _dispatch;
+	uint8_t _unsupportedMatchResult;
+};
+
+}	// namespace ZeroTier
+
+#endif
@@ -295,9 +295,39 @@
 #define ZT_MAX_PACKET_FRAGMENTS 7
 
 /**
- * Size of RX queue
+ * Default capacity of RX queue (packets being reassembled or waiting for WHOIS)
  */
-#define ZT_RX_QUEUE_SIZE 32
+#define ZT_RX_QUEUE_SIZE 256
+
+/**
+ * Maximum capacity of RX queue that can be configured
+ */
+#define ZT_RX_QUEUE_MAX_SIZE 1048576
+
+/**
+ * Number of independently locked shards in RX queue
+ */
+#define ZT_RX_QUEUE_SHARDS 16
+
+/**
+ * One physical source IP may hold at most 1/this of the RX queue
+ */
+#define ZT_RX_QUEUE_MAX_SOURCE_SHARE 4
+
+/**
+ * Number of buckets physical sources are hashed into to count their RX queue entries
+ */
+#define ZT_RX_QUEUE_SOURCE_BUCKETS 1024
+
+/**
+ * Free RX queue entries kept for reuse (power of two)
+ */
+#define ZT_RX_QUEUE_POOL_SIZE 64
+
+/**
+ * Free fragment buffers kept for reuse (power of two)
+ */
+#define ZT_RX_FRAGMENT_POOL_SIZE 256
 
 /**
  * Size of TX queue
@@ -314,6 +344,11 @@
  */
 #define ZT_HOUSEKEEPING_PERIOD 30000
 
+/**
+ * Number of steps Topology::doPeriodicTasks() takes to cover the peer and path tables once per ZT_HOUSEKEEPING_PERIOD
+ */
+#define ZT_TOPOLOGY_HOUSEKEEPING_STEPS 16
+
 /**
  * Delay between WHOIS retries in ms
  */
@@ -363,6 +398,11 @@
  */
 #define ZT_PING_CHECK_INTERVAL 5000
 
+/**
+ * Peers pinged per slice of a ping check, which is spread over the check interval when there are many peers
+ */
+#define ZT_PING_CHECK_SLICE_PEERS 1024
+
 /**
  * How often the local.conf file is checked for changes (service, should be moved there)
  */
@@ -501,6 +541,16 @@
  */
 #define ZT_AQM_DEFAULT_BUCKET 0
 
+/**
+ * Number of lock stripes per-network AQM schedulers are spread over
+ */
+#define ZT_AQM_STRIPES 16
+
+/**
+ * Free AQM queue entries kept for reuse (power of two)
+ */
+#define ZT_AQM_POOL_SIZE 256
+
 /**
  * Timeout for overall peer activity (measured from last receive)
  */
@@ -510,6 +560,14 @@
 #define ZT_PEER_ACTIVITY_TIMEOUT 30000
 #endif
 
+/**
+ * Maximum number of validated identities and agreed keys remembered after their peers leave memory
+ *
+ * This lets roots skip key agreement and identity validation when evicted
+ * peers come back, e.g. in a reconnect storm. Each entry is a few hundred bytes.
+ */
+#define ZT_TOPOLOGY_MAX_KNOWN_IDENTITIES 16384
+
 /**
  * General rate limit timeout for multiple packet types (HELLO, etc.)
  */
@@ -553,6 +611,11 @@
  */
 #define ZT_MAX_BRIDGE_ROUTES 67108864
 
+/**
+ * Number of independently locked shards for a network's member table
+ */
+#define ZT_NETWORK_MEMBERSHIP_SHARDS 16
+
 /**
  * If there is no known L2 bridging route, spam to up to this many active bridges
  */
@@ -618,6 +681,20 @@
  */
 #define ZT_PEER_CREDENTIALS_REQUEST_RATE_LIMIT 1000
 
+/**
+ * Number of credential signature check results remembered (must be a power of two)
+ *
+ * Peers re-push the same credentials over and over, so remembering whether
+ * a signature checked out turns most credential pushes into a hash and a
+ * compare. Each entry is 56 bytes.
+ */
+#define ZT_CREDENTIAL_CACHE_SIZE 8192
+
+/**
+ * Entries per set in the credential cache
+ */
+#define ZT_CREDENTIAL_CACHE_WAYS 4
+
 /**
  * WHOIS rate limit (we allow these to be pretty fast)
  */
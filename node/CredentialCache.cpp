@@ -0,0 +1,109 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#include "CredentialCache.hpp"
+
+#include "Metrics.hpp"
+#include "SHA512.hpp"
+#include "SignatureBatch.hpp"
+#include "Utils.hpp"
+
+#include <string.h>
+
+namespace ZeroTier {
+
+CredentialCache::CredentialCache()
+{
+	for (unsigned int s = 0; s < (ZT_CREDENTIAL_CACHE_SIZE / ZT_CREDENTIAL_CACHE_WAYS); ++s) {
+		for (unsigned int w = 0; w < ZT_CREDENTIAL_CACHE_WAYS; ++w) {
+			_sets[s].entries[w].used = false;
+			_sets[s].entries[w].valid = false;
+		}
+	}
+}
+
+bool CredentialCache::verify(const Identity& id, const void* data, unsigned int len, const ECC::Signature& signature, SignatureBatch* batch)
+{
+	// The cache key only covers the digest carried in the signature, so the data must match it
+	uint8_t digest[64];
+	SHA512(digest, data, len);
+	if (! Utils::secureEq(signature.data + 64, digest, 32)) {
+		return false;
+	}
+
+	uint8_t key[48];
+	_key(id.publicKey(), signature, key);
+	const int cached = _get(key);
+	if (cached >= 0) {
+		Metrics::credential_cache_hit++;
+		return (cached != 0);
+	}
+	Metrics::credential_cache_miss++;
+
+	if (batch) {
+		batch->add(id, data, len, signature);
+		return true;
+	}
+
+	const bool valid = id.verify(data, len, signature);
+	_set(key, valid);
+	return valid;
+}
+
+bool CredentialCache::verify(SignatureBatch& batch)
+{
+	if (! batch.verify()) {
+		return false;
+	}
+	uint8_t key[48];
+	for (unsigned int i = 0; i < batch.size(); ++i) {
+		_key(batch.publicKey(i), batch.signature(i), key);
+		_set(key, true);
+	}
+	return true;
+}
+
+void CredentialCache::_key(const ECC::Public& publicKey, const ECC::Signature& signature, uint8_t key[48])
+{
+	SHA384(key, publicKey.data, ZT_ECC_PUBLIC_KEY_SET_LEN, signature.data, ZT_ECC_SIGNATURE_LEN);
+}
+
+int CredentialCache::_get(const uint8_t key[48])
+{
+	_Set& s = _sets[(((unsigned int)key[0] << 8) | (unsigned int)key[1]) & ((ZT_CREDENTIAL_CACHE_SIZE / ZT_CREDENTIAL_CACHE_WAYS) - 1)];
+	Mutex::Lock _l(s.lock);
+	for (unsigned int w = 0; w < ZT_CREDENTIAL_CACHE_WAYS; ++w) {
+		const _Entry& e = s.entries[w];
+		if ((e.used) && (memcmp(e.key, key, 48) == 0)) {
+			return (e.valid) ? 1 : 0;
+		}
+	}
+	return -1;
+}
+
+void CredentialCache::_set(const uint8_t key[48], const bool valid)
+{
+	_Set& s = _sets[(((unsigned int)key[0] << 8) | (unsigned int)key[1]) & ((ZT_CREDENTIAL_CACHE_SIZE / ZT_CREDENTIAL_CACHE_WAYS) - 1)];
+	Mutex::Lock _l(s.lock);
+	_Entry* e = (_Entry*)0;
+	for (unsigned int w = 0; w < ZT_CREDENTIAL_CACHE_WAYS; ++w) {
+		if ((s.entries[w].used) && (memcmp(s.entries[w].key, key, 48) == 0)) {
+			e = &(s.entries[w]);
+			break;
+		}
+	}
+	if (! e) {
+		e = &(s.entries[s.next]);
+		s.next = (s.next + 1) % ZT_CREDENTIAL_CACHE_WAYS;
+	}
+	memcpy(e->key, key, 48);
+	e->used = true;
+	e->valid = valid;
+}
+
+}	// namespace ZeroTier
@@ -0,0 +1,84 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#ifndef ZT_CREDENTIALCACHE_HPP
+#define ZT_CREDENTIALCACHE_HPP
+
+#include "Constants.hpp"
+#include "ECC.hpp"
+#include "Identity.hpp"
+#include "Mutex.hpp"
+
+#include <stdint.h>
+
+namespace ZeroTier {
+
+class SignatureBatch;
+
+/**
+ * Remembers the results of credential signature checks
+ *
+ * Signatures sign a digest of the signed data and carry that digest, so a
+ * signer's public key and a signature together identify exactly what was
+ * checked. Entries are keyed by a hash of the two and kept in a fixed-size
+ * set associative table shared by all networks and memberships. Once the
+ * signed data has been matched against the digest in the signature, a cached
+ * result replaces the Ed25519 verification.
+ *
+ * This class is thread safe.
+ */
+class CredentialCache {
+  public:
+	CredentialCache();
+
+	/**
+	 * Check a signature, using the cached result if it has been checked before
+	 *
+	 * @param id Signer's identity
+	 * @param data Signed data
+	 * @param len Length of data
+	 * @param signature Signature
+	 * @param batch If non-NULL a signature that is not cached is added to this batch and true is returned
+	 * @return True if signature is valid
+	 */
+	bool verify(const Identity& id, const void* data, unsigned int len, const ECC::Signature& signature, SignatureBatch* batch);
+
+	/**
+	 * Verify a batch and remember its signatures if all were valid
+	 *
+	 * @param batch Signature batch
+	 * @return True if all signatures in the batch are valid
+	 */
+	bool verify(SignatureBatch& batch);
+
+  private:
+	struct _Entry {
+		uint8_t key[48];
+		bool used;
+		bool valid;
+	};
+
+	struct _Set {
+		_Set() : next(0)
+		{
+		}
+		Mutex lock;
+		_Entry entries[ZT_CREDENTIAL_CACHE_WAYS];
+		unsigned int next;	 // next entry to replace
+	};
+
+	static void _key(const ECC::Public& publicKey, const ECC::Signature& signature, uint8_t key[48]);
+	int _get(const uint8_t key[48]);
+	void _set(const uint8_t key[48], bool valid);
+
+	_Set _sets[ZT_CREDENTIAL_CACHE_SIZE / ZT_CREDENTIAL_CACHE_WAYS];
+};
+
+}	// namespace ZeroTier
+
+#endif
@@ -15,6 +15,8 @@
 #include "Utils.hpp"
 
 #include <stdint.h>
+#include <string.h>
+#include <vector>
 
 namespace ZeroTier {
 
@@ -30,7 +32,8 @@ namespace ZeroTier {
  * contains these characters it may not be retrievable. This is not checked.
  *
  * Lookup is via linear search and will be slow with a lot of keys. It's
- * designed for small things.
+ * designed for small things. Use an Index to look up many keys in a large
+ * dictionary.
  *
  * There is code to test and fuzz this in selftest.cpp. Fuzzing a blob of
  * pointer tricks like this is important after any modifications.
@@ -121,12 +124,8 @@ template <unsigned int C> class Dictionary {
 	 */
 	inline unsigned int sizeBytes() const
 	{
-		for (unsigned int i = 0; i < C; ++i) {
-			if (! _d[i]) {
-				return i;
-			}
-		}
-		return C - 1;
+		const char* const e = reinterpret_cast<const char*>(memchr(_d, 0, C));
+		return (e) ? (unsigned int)(e - _d) : (C - 1);
 	}
 
 	/**
@@ -156,8 +155,6 @@ template <unsigned int C> class Dictionary {
 		const char* p = _d;
 		const char* const eof = p + C;
 		const char* k;
-		bool esc;
-		int j;
 
 		if (! destlen) {   // sanity check
 			return -1;
@@ -177,51 +174,7 @@ template <unsigned int C> class Dictionary {
 			}
 
 			if ((! *k) && (*p == '=')) {
-				j = 0;
-				esc = false;
-				++p;
-				while ((*p != 0) && (*p != 13) && (*p != 10)) {
-					if (esc) {
-						esc = false;
-						switch (*p) {
-							case 'r':
-								dest[j++] = 13;
-								break;
-							case 'n':
-								dest[j++] = 10;
-								break;
-							case '0':
-								dest[j++] = (char)0;
-								break;
-							case 'e':
-								dest[j++] = '=';
-								break;
-							default:
-								dest[j++] = *p;
-								break;
-						}
-						if (j == (int)destlen) {
-							dest[j - 1] = (char)0;
-							return j - 1;
-						}
-					}
-					else if (*p == '\\') {
-						esc = true;
-					}
-					else {
-						dest[j++] = *p;
-						if (j == (int)destlen) {
-							dest[j - 1] = (char)0;
-							return j - 1;
-						}
-					}
-					if (++p == eof) {
-						dest[0] = (char)0;
-						return -1;
-					}
-				}
-				dest[j] = (char)0;
-				return j;
+				return _unescape(p + 1, eof, dest, destlen);
 			}
 			else {
 				while ((*p) && (*p != 13) && (*p != 10)) {
@@ -331,87 +284,87 @@ template <unsigned int C> class Dictionary {
 	 */
 	inline bool add(const char* key, const char* value, int vlen = -1)
 	{
-		for (unsigned int i = 0; i < C; ++i) {
-			if (! _d[i]) {
-				unsigned int j = i;
+		const char* const e = reinterpret_cast<const char*>(memchr(_d, 0, C));
+		if (! e) {
+			return false;
+		}
+		const unsigned int i = (unsigned int)(e - _d);
+		unsigned int j = i;
 
-				if (j > 0) {
-					_d[j++] = (char)10;
-					if (j == C) {
-						_d[i] = (char)0;
-						return false;
-					}
-				}
+		if (j > 0) {
+			_d[j++] = (char)10;
+			if (j == C) {
+				_d[i] = (char)0;
+				return false;
+			}
+		}
 
-				const char* p = key;
-				while (*p) {
-					_d[j++] = *(p++);
+		const char* p = key;
+		while (*p) {
+			_d[j++] = *(p++);
+			if (j == C) {
+				_d[i] = (char)0;
+				return false;
+			}
+		}
+
+		_d[j++] = '=';
+		if (j == C) {
+			_d[i] = (char)0;
+			return false;
+		}
+
+		p = value;
+		int k = 0;
+		while (((vlen < 0) && (*p)) || (k < vlen)) {
+			switch (*p) {
+				case 0:
+				case 13:
+				case 10:
+				case '\\':
+				case '=':
+					_d[j++] = '\\';
 					if (j == C) {
 						_d[i] = (char)0;
 						return false;
 					}
-				}
-
-				_d[j++] = '=';
-				if (j == C) {
-					_d[i] = (char)0;
-					return false;
-				}
-
-				p = value;
-				int k = 0;
-				while (((vlen < 0) && (*p)) || (k < vlen)) {
 					switch (*p) {
 						case 0:
+							_d[j++] = '0';
+							break;
 						case 13:
+							_d[j++] = 'r';
+							break;
 						case 10:
+							_d[j++] = 'n';
+							break;
 						case '\\':
-						case '=':
 							_d[j++] = '\\';
-							if (j == C) {
-								_d[i] = (char)0;
-								return false;
-							}
-							switch (*p) {
-								case 0:
-									_d[j++] = '0';
-									break;
-								case 13:
-									_d[j++] = 'r';
-									break;
-								case 10:
-									_d[j++] = 'n';
-									break;
-								case '\\':
-									_d[j++] = '\\';
-									break;
-								case '=':
-									_d[j++] = 'e';
-									break;
-							}
-							if (j == C) {
-								_d[i] = (char)0;
-								return false;
-							}
 							break;
-						default:
-							_d[j++] = *p;
-							if (j == C) {
-								_d[i] = (char)0;
-								return false;
-							}
+						case '=':
+							_d[j++] = 'e';
 							break;
 					}
-					++p;
-					++k;
-				}
-
-				_d[j] = (char)0;
-
-				return true;
+					if (j == C) {
+						_d[i] = (char)0;
+						return false;
+					}
+					break;
+				default:
+					_d[j++] = *p;
+					if (j == C) {
+						_d[i] = (char)0;
+						return false;
+					}
+					break;
 			}
+			++p;
+			++k;
 		}
-		return false;
+
+		_d[j] = (char)0;
+
+		return true;
 	}
 
 	/**
@@ -492,7 +445,264 @@ template <unsigned int C> class Dictionary {
 		return _d;
 	}
 
+	/**
+	 * Read-only view of a dictionary that finds every key in one pass
+	 *
+	 * Each get() on a Dictionary scans its text from the start. An Index scans
+	 * it once and remembers where each key's value begins, so a lookup is a
+	 * hash probe plus unescaping the value into the caller's buffer. As with
+	 * Dictionary::get() the first occurrence of a key is returned.
+	 *
+	 * The dictionary must not be changed or destroyed while its Index is used.
+	 */
+	class Index {
+	  public:
+		Index(const Dictionary& d) : _d(d._d), _eof(d._d + C), _t(64), _count(0)
+		{
+			_parse();
+		}
+
+		/**
+		 * Index dictionary text that is not held in a Dictionary
+		 *
+		 * @param d Text in Dictionary format, which must stay valid while this Index is used
+		 * @param len Size of text including its terminating 0
+		 */
+		Index(const char* d, const unsigned int len) : _d(d), _eof(d + len), _t(64), _count(0)
+		{
+			_parse();
+		}
+
+		/**
+		 * Get an entry (same semantics as Dictionary::get())
+		 *
+		 * @param key Key to look up
+		 * @param dest Destination buffer
+		 * @param destlen Size of destination buffer
+		 * @return -1 if not found, or actual number of bytes stored in dest[] minus trailing 0
+		 */
+		inline int get(const char* key, char* dest, unsigned int destlen) const
+		{
+			if (! destlen) {
+				return -1;
+			}
+			const _Entry* const e = _find(key, (unsigned int)strlen(key));
+			if (! e) {
+				dest[0] = (char)0;
+				return -1;
+			}
+			return _unescape(_d + e->value, _eof, dest, destlen);
+		}
+
+		template <unsigned int BC> inline bool get(const char* key, Buffer<BC>& dest) const
+		{
+			const int r = this->get(key, const_cast<char*>(reinterpret_cast<const char*>(dest.data())), BC);
+			if (r >= 0) {
+				dest.setSize((unsigned int)r);
+				return true;
+			}
+			else {
+				dest.clear();
+				return false;
+			}
+		}
+
+		inline bool getB(const char* key, bool dfl = false) const
+		{
+			char tmp[4];
+			if (this->get(key, tmp, sizeof(tmp)) >= 0) {
+				return ((*tmp == '1') || (*tmp == 't') || (*tmp == 'T'));
+			}
+			return dfl;
+		}
+
+		inline uint64_t getUI(const char* key, uint64_t dfl = 0) const
+		{
+			char tmp[128];
+			if (this->get(key, tmp, sizeof(tmp)) >= 1) {
+				return Utils::hexStrToU64(tmp);
+			}
+			return dfl;
+		}
+
+		inline int64_t getI(const char* key, int64_t dfl = 0) const
+		{
+			char tmp[128];
+			if (this->get(key, tmp, sizeof(tmp)) >= 1) {
+				return Utils::hexStrTo64(tmp);
+			}
+			return dfl;
+		}
+
+		inline bool contains(const char* key) const
+		{
+			return (_find(key, (unsigned int)strlen(key)) != (const _Entry*)0);
+		}
+
+		/**
+		 * @return Number of distinct keys
+		 */
+		inline unsigned int size() const
+		{
+			return _count;
+		}
+
+	  private:
+		struct _Entry {
+			_Entry() : hash(0), key(0), keyLen(0), value(0)
+			{
+			}
+			uint32_t hash;
+			uint32_t key;	   // offset of key in dictionary
+			uint32_t keyLen;
+			uint32_t value;	   // offset of escaped value, 0 if this slot is empty
+		};
+
+		inline void _parse()
+		{
+			const char* p = _d;
+			while ((p != _eof) && (*p)) {
+				const char* const k = p;
+				while ((p != _eof) && (*p) && (*p != '=') && (*p != 13) && (*p != 10)) {
+					++p;
+				}
+				if (p == _eof) {
+					break;
+				}
+				if (*p == '=') {
+					const char* const v = ++p;
+					while ((p != _eof) && (*p) && (*p != 13) && (*p != 10)) {
+						++p;
+					}
+					if (p == _eof) {
+						break;	 // unterminated values are not returned by get() either
+					}
+					_add(k, (unsigned int)(v - 1 - k), (unsigned int)(v - _d));
+				}
+				if (! *p) {
+					break;
+				}
+				++p;
+			}
+		}
+
+		static inline uint32_t _hash(const char* k, const unsigned int len)
+		{
+			uint32_t h = 2166136261U;	// FNV-1a
+			for (unsigned int i = 0; i < len; ++i) {
+				h = (h ^ (uint32_t)((uint8_t)k[i])) * 16777619U;
+			}
+			return h;
+		}
+
+		inline const _Entry* _find(const char* k, const unsigned int len) const
+		{
+			const uint32_t h = _hash(k, len);
+			const unsigned long m = (unsigned long)_t.size() - 1;
+			for (unsigned long i = (unsigned long)h & m;; i = (i + 1) & m) {
+				const _Entry& e = _t[i];
+				if (! e.value) {
+					return (const _Entry*)0;
+				}
+				if ((e.hash == h) && (e.keyLen == len) && (memcmp(_d + e.key, k, len) == 0)) {
+					return &e;
+				}
+			}
+		}
+
+		inline void _add(const char* k, const unsigned int len, const unsigned int value)
+		{
+			if (_find(k, len)) {
+				return;
+			}
+			if (((_count + 1) * 2) > (unsigned int)_t.size()) {
+				std::vector<_Entry> old(_t.size() * 2);
+				old.swap(_t);
+				for (typename std::vector<_Entry>::const_iterator e(old.begin()); e != old.end(); ++e) {
+					if (e->value) {
+						_put(*e);
+					}
+				}
+			}
+			_Entry e;
+			e.hash = _hash(k, len);
+			e.key = (uint32_t)(k - _d);
+			e.keyLen = len;
+			e.value = value;
+			_put(e);
+			++_count;
+		}
+
+		inline void _put(const _Entry& e)
+		{
+			const unsigned long m = (unsigned long)_t.size() - 1;
+			unsigned long i = (unsigned long)e.hash & m;
+			while (_t[i].value) {
+				i = (i + 1) & m;
+			}
+			_t[i] = e;
+		}
+
+		const char* _d;
+		const char* _eof;
+		std::vector<_Entry> _t;
+		unsigned int _count;
+	};
+
   private:
+	// Unescape a value starting at p and ending at CR, LF, or 0 into dest (see get())
+	static inline int _unescape(const char* p, const char* const eof, char* dest, const unsigned int destlen)
+	{
+		int j = 0;
+		bool esc = false;
+		if (p == eof) {
+			dest[0] = (char)0;
+			return -1;
+		}
+		while ((*p != 0) && (*p != 13) && (*p != 10)) {
+			if (esc) {
+				esc = false;
+				switch (*p) {
+					case 'r':
+						dest[j++] = 13;
+						break;
+					case 'n':
+						dest[j++] = 10;
+						break;
+					case '0':
+						dest[j++] = (char)0;
+						break;
+					case 'e':
+						dest[j++] = '=';
+						break;
+					default:
+						dest[j++] = *p;
+						break;
+				}
+				if (j == (int)destlen) {
+					dest[j - 1] = (char)0;
+					return j - 1;
+				}
+			}
+			else if (*p == '\\') {
+				esc = true;
+			}
+			else {
+				dest[j++] = *p;
+				if (j == (int)destlen) {
+					dest[j - 1] = (char)0;
+					return j - 1;
+				}
+			}
+			if (++p == eof) {
+				dest[0] = (char)0;
+				return -1;
+			}
+		}
+		dest[j] = (char)0;
+		return j;
+	}
+
 	char _d[C];
 };
 
@@ -2439,6 +2439,132 @@ static inline void get_hram(unsigned char* hram, const unsigned char* sm, const
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
+// Randomized batch verification: for random z[i], a batch of valid
+// signatures satisfies
+//
+//   (sum z[i]*s[i])*B + sum z[i]*(-R[i]) + sum (z[i]*h[i])*(-A[i]) == 0
+//
+// which is computed with one interleaved multi-scalar multiplication that
+// shares its doublings across all points.
+
+/* Signed radix-16 digits of s, each in [-8,8] */
+static inline void sc25519_window4(signed char r[64], const sc25519* s)
+{
+	int i;
+	signed char carry = 0;
+	for (i = 0; i < 32; i++) {
+		r[2 * i] = s->v[i] & 15;
+		r[2 * i + 1] = (s->v[i] >> 4) & 15;
+	}
+	for (i = 0; i < 63; i++) {
+		r[i] += carry;
+		carry = (r[i] + 8) >> 4;
+		r[i] -= carry << 4;
+	}
+	r[63] += carry;
+}
+
+/* pre[k] = (k+1)*p for k = 0..7 */
+static inline void ge25519_precompute8(ge25519_p3 pre[8], const ge25519_p3* p)
+{
+	ge25519_p1p1 t;
+	pre[0] = *p;
+	dbl_p1p1(&t, (const ge25519_p2*)p);
+	p1p1_to_p3(&pre[1], &t);
+	for (int k = 2; k < 8; k++) {
+		add_p1p1(&t, &pre[k - 1], p);
+		p1p1_to_p3(&pre[k], &t);
+	}
+}
+
+/* r += d*p for a radix-16 digit d, where pre holds 1p..8p */
+static inline void ge25519_add_digit_vartime(ge25519_p3* r, const ge25519_p3 pre[8], const signed char d)
+{
+	ge25519_p1p1 t;
+	if (d > 0) {
+		add_p1p1(&t, r, &pre[d - 1]);
+		p1p1_to_p3(r, &t);
+	}
+	else if (d < 0) {
+		ge25519_p3 n = pre[-d - 1];
+		fe25519_neg(&n.x, &n.x);
+		fe25519_neg(&n.t, &n.t);
+		add_p1p1(&t, r, &n);
+		p1p1_to_p3(r, &t);
+	}
+}
+
+static inline int ge25519_isneutral_vartime(const ge25519_p3* p)
+{
+	fe25519 zero;
+	fe25519_setzero(&zero);
+	return (fe25519_iseq_vartime(&p->x, &zero) && fe25519_iseq_vartime(&p->y, &p->z));
+}
+
+/* r = 8*r, which clears any torsion component */
+static inline void ge25519_mulcofactor(ge25519_p3* r)
+{
+	ge25519_p1p1 t;
+	dbl_p1p1(&t, (ge25519_p2*)r);
+	p1p1_to_p2((ge25519_p2*)r, &t);
+	dbl_p1p1(&t, (ge25519_p2*)r);
+	p1p1_to_p2((ge25519_p2*)r, &t);
+	dbl_p1p1(&t, (ge25519_p2*)r);
+	p1p1_to_p3(r, &t);
+}
+
+static inline int ge25519_hassmallorder_vartime(const ge25519_p3* p)
+{
+	ge25519_p3 r = *p;
+	ge25519_mulcofactor(&r);
+	return ge25519_isneutral_vartime(&r);
+}
+
+/* Only canonical encodings of R can match the packed result of a single verification */
+static inline int ge25519_iscanonical(const unsigned char p[32])
+{
+	if ((p[31] & 0x7f) != 0x7f) {
+		return 1;
+	}
+	for (int i = 30; i > 0; i--) {
+		if (p[i] != 0xff) {
+			return 1;
+		}
+	}
+	return (p[0] < 0xed);
+}
+
+/* Multi-scalar multiplication sum(s[i]*p[i]) + sb*B, checked against the neutral element after multiplying by the cofactor */
+static inline int ge25519_multi_scalarmult_isneutral_vartime(const ge25519_p3* pre, signed char (*digits)[64], const unsigned int n, const sc25519* sb)
+{
+	ge25519_p3 r, b;
+	ge25519_p1p1 t;
+	setneutral(&r);
+	for (int i = 63; i >= 0; i--) {
+		if (i != 63) {
+			dbl_p1p1(&t, (ge25519_p2*)&r);
+			p1p1_to_p2((ge25519_p2*)&r, &t);
+			dbl_p1p1(&t, (ge25519_p2*)&r);
+			p1p1_to_p2((ge25519_p2*)&r, &t);
+			dbl_p1p1(&t, (ge25519_p2*)&r);
+			p1p1_to_p2((ge25519_p2*)&r, &t);
+			dbl_p1p1(&t, (ge25519_p2*)&r);
+			p1p1_to_p3(&r, &t);
+		}
+		for (unsigned int j = 0; j < n; j++) {
+			ge25519_add_digit_vartime(&r, pre + (8 * j), digits[j][i]);
+		}
+	}
+	ge25519_scalarmult_base(&b, sb);
+	add_p1p1(&t, &r, &b);
+	p1p1_to_p3(&r, &t);
+	ge25519_mulcofactor(&r);
+	return ge25519_isneutral_vartime(&r);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
 }	// anonymous namespace
 
 #ifdef ZT_USE_FAST_X64_ED25519
@@ -2550,6 +2676,111 @@ bool ECC::verify(const ECC::Public& their, const void* msg, unsigned int len, co
 	return Utils::secureEq(sig, t2, 32);
 }
 
+bool ECC::verifyBatch(const unsigned int n, const ECC::Public* const* their, const void* const* msg, const unsigned int* len, const void* const* signature, bool* valid)
+{
+	if (n == 1) {
+		return (valid[0] = verify(*their[0], msg[0], len[0], signature[0]));
+	}
+
+	// Two points (-R and -A) with eight precomputed multiples each per signature
+	ge25519_p3* const pre = new ge25519_p3[ZT_ECC_VERIFY_BATCH_SIZE * 16];
+	signed char digits[ZT_ECC_VERIFY_BATCH_SIZE * 2][64];
+	unsigned int items[ZT_ECC_VERIFY_BATCH_SIZE];
+	unsigned int solo[ZT_ECC_VERIFY_BATCH_SIZE];
+	unsigned char z[ZT_ECC_VERIFY_BATCH_SIZE][32];
+	bool all = true;
+
+	for (unsigned int start = 0; start < n; start += ZT_ECC_VERIFY_BATCH_SIZE) {
+		const unsigned int end = ((n - start) > ZT_ECC_VERIFY_BATCH_SIZE) ? (start + ZT_ECC_VERIFY_BATCH_SIZE) : n;
+
+		memset(z, 0, sizeof(z));
+		for (unsigned int j = 0; j < (end - start); j++) {
+			Utils::getSecureRandom(z[j], 16);
+			z[j][0] |= 1;	// never zero
+		}
+
+		sc25519 sb;
+		memset(&sb, 0, sizeof(sb));
+		unsigned int cnt = 0, soloCnt = 0;
+		for (unsigned int i = start; i < end; ++i) {
+			const unsigned char* const sig = (const unsigned char*)signature[i];
+			unsigned char digest[64];
+			ge25519_p3 p;
+			valid[i] = false;
+
+			SHA512(digest, msg[i], len[i]);
+			if (! Utils::secureEq(sig + 64, digest, 32)) {
+				all = false;
+				continue;
+			}
+			if ((! ge25519_iscanonical(sig)) || (ge25519_unpackneg_vartime(&p, sig))) {
+				all = false;
+				continue;
+			}
+			fe25519 zero;
+			fe25519_setzero(&zero);
+			if (((sig[31] >> 7) != 0) && (fe25519_iseq_vartime(&p.x, &zero))) {
+				all = false;
+				continue;	// non-canonical encoding of x = 0
+			}
+			if (ge25519_hassmallorder_vartime(&p)) {
+				solo[soloCnt++] = i;   // the cofactored equation cannot tell R apart from the neutral element
+				continue;
+			}
+
+			sc25519 zs, t;
+			sc25519_from32bytes(&zs, z[cnt]);
+			ge25519_precompute8(pre + (16 * cnt), &p);
+			sc25519_window4(digits[2 * cnt], &zs);
+
+			if (ge25519_unpackneg_vartime(&p, their[i]->data + 32)) {
+				all = false;
+				continue;
+			}
+			if (ge25519_hassmallorder_vartime(&p)) {
+				solo[soloCnt++] = i;
+				continue;
+			}
+			unsigned char hram[crypto_hash_sha512_BYTES];
+			unsigned char m[96];
+			get_hram(hram, sig, their[i]->data + 32, m, 96);
+			sc25519_from64bytes(&t, hram);
+			sc25519_mul(&t, &t, &zs);
+			ge25519_precompute8(pre + (16 * cnt) + 8, &p);
+			sc25519_window4(digits[(2 * cnt) + 1], &t);
+
+			sc25519_from32bytes(&t, sig + 32);
+			sc25519_mul(&t, &t, &zs);
+			sc25519_add(&sb, &sb, &t);
+
+			items[cnt++] = i;
+		}
+
+		for (unsigned int k = 0; k < soloCnt; ++k) {
+			if (! (valid[solo[k]] = verify(*their[solo[k]], msg[solo[k]], len[solo[k]], signature[solo[k]]))) {
+				all = false;
+			}
+		}
+
+		if ((cnt > 0) && (ge25519_multi_scalarmult_isneutral_vartime(pre, digits, cnt * 2, &sb))) {
+			for (unsigned int k = 0; k < cnt; ++k) {
+				valid[items[k]] = true;
+			}
+		}
+		else {
+			// At least one is bad, so find out which
+			for (unsigned int k = 0; k < cnt; ++k) {
+				if (! (valid[items[k]] = verify(*their[items[k]], msg[items[k]], len[items[k]], signature[items[k]]))) {
+					all = false;
+				}
+			}
+		}
+	}
+
+	delete[] pre;
+	return all;
+}
+
 void ECC::_calcPubDH(ECC::Pair& kp)
 {
 	// First 32 bytes of pub and priv are the keys for ECDH key
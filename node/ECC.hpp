@@ -60,6 +60,7 @@ namespace ZeroTier {
 #define ZT_ECC_PUBLIC_KEY_SET_LEN		64 /* C25519 and Ed25519 keys */
 #define ZT_ECC_PRIVATE_KEY_SET_LEN		64 /* C25519 and Ed25519 secret keys */
 #define ZT_ECC_SIGNATURE_LEN			96 /* Ed25519 signature plus (not necessary) hash */
+#define ZT_ECC_VERIFY_BATCH_SIZE		16 /* Signatures verifyBatch() checks together, bounds its precomputed tables */
 
 class ECC {
   public:
@@ -205,6 +206,32 @@ class ECC {
 		return verify(their, msg, len, signature.data);
 	}
 
+	/**
+	 * Verify several signatures at once
+	 *
+	 * Signatures are checked together with a randomized linear combination
+	 * that needs a single multi-scalar multiplication, which is about twice
+	 * as fast per signature as verify(). If a batch does not check out its
+	 * signatures are verified one by one to find the bad ones.
+	 *
+	 * The batch uses the cofactored equation, so its result does not depend
+	 * on the random coefficients. verify() uses the cofactorless one. The two
+	 * agree whenever R and the public key lie in the prime order subgroup,
+	 * which is always the case for signatures made by sign(). Signatures with
+	 * a small order R or public key are verified singly. The holder of a key
+	 * can still craft a signature with a mixed order R that the batch accepts
+	 * and verify() rejects, but nobody else can.
+	 *
+	 * @param n Number of signatures
+	 * @param their Public keys to verify against
+	 * @param msg Messages
+	 * @param len Message lengths in bytes
+	 * @param signature 96-byte signatures
+	 * @param valid Filled with the result for each signature
+	 * @return True if all signatures are valid
+	 */
+	static bool verifyBatch(unsigned int n, const Public* const* their, const void* const* msg, const unsigned int* len, const void* const* signature, bool* valid);
+
   private:
 	// derive first 32 bytes of kp.pub from first 32 bytes of kp.priv
 	// this is the ECDH key
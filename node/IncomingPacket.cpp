@@ -14,6 +14,7 @@
 #include "Capability.hpp"
 #include "CertificateOfMembership.hpp"
 #include "Constants.hpp"
+#include "CredentialCache.hpp"
 #include "Metrics.hpp"
 #include "NetworkController.hpp"
 #include "Node.hpp"
@@ -23,6 +24,7 @@
 #include "Revocation.hpp"
 #include "RuntimeEnvironment.hpp"
 #include "SelfAwareness.hpp"
+#include "SignatureBatch.hpp"
 #include "Switch.hpp"
 #include "Tag.hpp"
 #include "Topology.hpp"
@@ -32,6 +34,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 
 namespace ZeroTier {
 
@@ -439,21 +442,26 @@ bool IncomingPacket::_doHELLO(const RuntimeEnvironment* RR, void* tPtr, const bo
 			return true;
 		}
 
+		// Identities we have validated before (e.g. peers evicted from memory) skip key agreement and validation
+		uint8_t knownKey[ZT_SYMMETRIC_KEY_SIZE];
+		const bool known = RR->topology->knownIdentityKey(id, knownKey, now);
+
 		// Check rate limits
-		if (! RR->node->rateGateIdentityVerification(now, _path->address())) {
+		if ((! known) && (! RR->node->rateGateIdentityVerification(now, _path->address()))) {
 			RR->t->incomingPacketDroppedHELLO(tPtr, _path, pid, fromAddress, "rate limit exceeded");
 			return true;
 		}
 
 		// Check packet integrity and MAC (this is faster than locallyValidate() so do it first to filter out total crap)
-		SharedPtr<Peer> newPeer(new Peer(RR, RR->identity, id));
+		SharedPtr<Peer> newPeer(new Peer(RR, RR->identity, id, (known) ? knownKey : (const uint8_t*)0));
+		Utils::burn(knownKey, sizeof(knownKey));
 		if (! dearmor(newPeer->key(), newPeer->aesKeysIfSupported(), RR->identity)) {
 			RR->t->incomingPacketMessageAuthenticationFailure(tPtr, _path, pid, fromAddress, hops(), "invalid MAC");
 			return true;
 		}
 
 		// Check that identity's address is valid as per the derivation function
-		if (! id.locallyValidate()) {
+		if ((! known) && (! id.locallyValidate())) {
 			RR->t->incomingPacketDroppedHELLO(tPtr, _path, pid, fromAddress, "invalid identity");
 			return true;
 		}
@@ -1066,6 +1074,55 @@ bool IncomingPacket::_doMULTICAST_LIKE(const RuntimeEnvironment* RR, void* tPtr,
 	return true;
 }
 
+template <typename C> static bool _addDeferredCredentials(const RuntimeEnvironment* RR, void* tPtr, const std::vector<C>& creds, SignatureBatch* batch)
+{
+	bool accepted = false;
+	for (typename std::vector<C>::const_iterator c(creds.begin()); c != creds.end(); ++c) {
+		const SharedPtr<Network> network(RR->node->network(c->networkId()));
+		if (network) {
+			const Membership::AddCredentialResult r = network->addCredential(tPtr, *c, batch);
+			accepted |= ((r == Membership::ADD_ACCEPTED_NEW) || (r == Membership::ADD_ACCEPTED_REDUNDANT));
+		}
+	}
+	return accepted;
+}
+
+// Credentials from a NETWORK_CREDENTIALS packet that passed every check but
+// their signatures, which are verified together once the packet is parsed
+struct _DeferredCredentials {
+	SignatureBatch batch;
+	std::vector<CertificateOfMembership> coms;
+	std::vector<Capability> caps;
+	std::vector<Tag> tags;
+	std::vector<Revocation> revocations;
+	std::vector<CertificateOfOwnership> coos;
+
+	// Verify the batch and add deferred credentials, returns true if any were accepted
+	inline bool add(const RuntimeEnvironment* RR, void* tPtr, const Address& sentFrom)
+	{
+		if (coms.empty() && caps.empty() && tags.empty() && revocations.empty() && coos.empty()) {
+			return false;
+		}
+
+		// Signatures found in the credential cache were never added, so the batch may be empty.
+		// If it fails, credentials are added with their signatures checked one by one.
+		SignatureBatch* const b = (RR->cc->verify(batch)) ? &batch : (SignatureBatch*)0;
+
+		bool accepted = _addDeferredCredentials(RR, tPtr, coms, b);
+		accepted |= _addDeferredCredentials(RR, tPtr, caps, b);
+		accepted |= _addDeferredCredentials(RR, tPtr, tags, b);
+		for (std::vector<Revocation>::const_iterator r(revocations.begin()); r != revocations.end(); ++r) {
+			const SharedPtr<Network> network(RR->node->network(r->networkId()));
+			if (network) {
+				const Membership::AddCredentialResult ar = network->addCredential(tPtr, sentFrom, *r, b);
+				accepted |= ((ar == Membership::ADD_ACCEPTED_NEW) || (ar == Membership::ADD_ACCEPTED_REDUNDANT));
+			}
+		}
+		accepted |= _addDeferredCredentials(RR, tPtr, coos, b);
+		return accepted;
+	}
+};
+
 bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment* RR, void* tPtr, const SharedPtr<Peer>& peer)
 {
 	Metrics::pkt_network_credentials_in++;
@@ -1080,125 +1137,155 @@ bool IncomingPacket::_doNETWORK_CREDENTIALS(const RuntimeEnvironment* RR, void*
 	CertificateOfOwnership coo;
 	bool trustEstablished = false;
 	SharedPtr<Network> network;
+	_DeferredCredentials deferred;
 
-	unsigned int p = ZT_PACKET_IDX_PAYLOAD;
-	while ((p < size()) && ((*this)[p] != 0)) {
-		p += com.deserialize(*this, p);
-		if (com) {
-			network = RR->node->network(com.networkId());
-			if (network) {
-				switch (network->addCredential(tPtr, com)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+	try {
+		unsigned int p = ZT_PACKET_IDX_PAYLOAD;
+		while ((p < size()) && ((*this)[p] != 0)) {
+			p += com.deserialize(*this, p);
+			if (com) {
+				network = RR->node->network(com.networkId());
+				if (network) {
+					switch (network->addCredential(tPtr, com, &deferred.batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred.coms.push_back(com);
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
 		}
-	}
-	++p;   // skip trailing 0 after COMs if present
-
-	if (p < size()) {	// older ZeroTier versions do not send capabilities, tags, or revocations
-		const unsigned int numCapabilities = at<uint16_t>(p);
-		p += 2;
-		for (unsigned int i = 0; i < numCapabilities; ++i) {
-			p += cap.deserialize(*this, p);
-			if ((! network) || (network->id() != cap.networkId())) {
-				network = RR->node->network(cap.networkId());
-			}
-			if (network) {
-				switch (network->addCredential(tPtr, cap)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+		++p;   // skip trailing 0 after COMs if present
+
+		if (p < size()) {	// older ZeroTier versions do not send capabilities, tags, or revocations
+			const unsigned int numCapabilities = at<uint16_t>(p);
+			p += 2;
+			for (unsigned int i = 0; i < numCapabilities; ++i) {
+				p += cap.deserialize(*this, p);
+				if ((! network) || (network->id() != cap.networkId())) {
+					network = RR->node->network(cap.networkId());
+				}
+				if (network) {
+					switch (network->addCredential(tPtr, cap, &deferred.batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred.caps.push_back(cap);
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
-		}
 
-		if (p >= size()) {
-			return true;
-		}
-
-		const unsigned int numTags = at<uint16_t>(p);
-		p += 2;
-		for (unsigned int i = 0; i < numTags; ++i) {
-			p += tag.deserialize(*this, p);
-			if ((! network) || (network->id() != tag.networkId())) {
-				network = RR->node->network(tag.networkId());
+			if (p >= size()) {
+				deferred.add(RR, tPtr, peer->address());
+				return true;
 			}
-			if (network) {
-				switch (network->addCredential(tPtr, tag)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+
+			const unsigned int numTags = at<uint16_t>(p);
+			p += 2;
+			for (unsigned int i = 0; i < numTags; ++i) {
+				p += tag.deserialize(*this, p);
+				if ((! network) || (network->id() != tag.networkId())) {
+					network = RR->node->network(tag.networkId());
+				}
+				if (network) {
+					switch (network->addCredential(tPtr, tag, &deferred.batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred.tags.push_back(tag);
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
-		}
-
-		if (p >= size()) {
-			return true;
-		}
 
-		const unsigned int numRevocations = at<uint16_t>(p);
-		p += 2;
-		for (unsigned int i = 0; i < numRevocations; ++i) {
-			p += revocation.deserialize(*this, p);
-			if ((! network) || (network->id() != revocation.networkId())) {
-				network = RR->node->network(revocation.networkId());
+			if (p >= size()) {
+				deferred.add(RR, tPtr, peer->address());
+				return true;
 			}
-			if (network) {
-				switch (network->addCredential(tPtr, peer->address(), revocation)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+
+			const unsigned int numRevocations = at<uint16_t>(p);
+			p += 2;
+			for (unsigned int i = 0; i < numRevocations; ++i) {
+				p += revocation.deserialize(*this, p);
+				if ((! network) || (network->id() != revocation.networkId())) {
+					network = RR->node->network(revocation.networkId());
+				}
+				if (network) {
+					switch (network->addCredential(tPtr, peer->address(), revocation, &deferred.batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred.revocations.push_back(revocation);
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
-		}
-
-		if (p >= size()) {
-			return true;
-		}
 
-		const unsigned int numCoos = at<uint16_t>(p);
-		p += 2;
-		for (unsigned int i = 0; i < numCoos; ++i) {
-			p += coo.deserialize(*this, p);
-			if ((! network) || (network->id() != coo.networkId())) {
-				network = RR->node->network(coo.networkId());
+			if (p >= size()) {
+				deferred.add(RR, tPtr, peer->address());
+				return true;
 			}
-			if (network) {
-				switch (network->addCredential(tPtr, coo)) {
-					case Membership::ADD_REJECTED:
-						break;
-					case Membership::ADD_ACCEPTED_NEW:
-					case Membership::ADD_ACCEPTED_REDUNDANT:
-						trustEstablished = true;
-						break;
-					case Membership::ADD_DEFERRED_FOR_WHOIS:
-						return false;
+
+			const unsigned int numCoos = at<uint16_t>(p);
+			p += 2;
+			for (unsigned int i = 0; i < numCoos; ++i) {
+				p += coo.deserialize(*this, p);
+				if ((! network) || (network->id() != coo.networkId())) {
+					network = RR->node->network(coo.networkId());
+				}
+				if (network) {
+					switch (network->addCredential(tPtr, coo, &deferred.batch)) {
+						case Membership::ADD_REJECTED:
+							break;
+						case Membership::ADD_ACCEPTED_NEW:
+						case Membership::ADD_ACCEPTED_REDUNDANT:
+							trustEstablished = true;
+							break;
+						case Membership::ADD_DEFERRED_FOR_BATCH:
+							deferred.coos.push_back(coo);
+							break;
+						case Membership::ADD_DEFERRED_FOR_WHOIS:
+							return false;
+					}
 				}
 			}
 		}
 	}
+	catch (...) {
+		// Credentials parsed before a malformed one may be waiting in the batch, so add them before giving up
+		deferred.add(RR, tPtr, peer->address());
+		throw;
+	}
+
+	if (deferred.add(RR, tPtr, peer->address())) {
+		trustEstablished = true;
+	}
 
 	peer->received(tPtr, _path, hops(), packetId(), payloadLength(), Packet::VERB_NETWORK_CREDENTIALS, 0, Packet::VERB_NOP, trustEstablished, (network) ? network->id() : 0, ZT_QOS_NO_FLOW);
 
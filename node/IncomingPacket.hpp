@@ -92,6 +92,17 @@ class IncomingPacket : public Packet {
 	 */
 	bool tryDecode(const RuntimeEnvironment* RR, void* tPtr, int32_t flowId);
 
+	/**
+	 * Mark this packet as already verified and decrypted
+	 *
+	 * tryDecode() then skips dearmor(). This is for packets that were
+	 * dearmored together with others by Packet::dearmorBatch().
+	 */
+	inline void setAuthenticated()
+	{
+		_authenticated = true;
+	}
+
 	/**
 	 * @return Time of packet receipt / start of decode
 	 */
@@ -13,6 +13,7 @@
 #include "Packet.hpp"
 #include "Peer.hpp"
 #include "RuntimeEnvironment.hpp"
+#include "SignatureBatch.hpp"
 #include "Switch.hpp"
 #include "Topology.hpp"
 #include "Trace.hpp"
@@ -21,7 +22,7 @@
 
 namespace ZeroTier {
 
-Membership::Membership() : _lastUpdatedMulticast(0), _comRevocationThreshold(0), _lastPushedCredentials(0), _revocations(4), _remoteTags(4), _remoteCaps(4), _remoteCoos(4)
+Membership::Membership() : _lastUpdatedMulticast(0), _comRevocationThreshold(0), _lastPushedCredentials(0), _revocations(4), _remoteTags(4), _remoteCaps(4), _remoteCoos(4), _cooIndex(8)
 {
 }
 
@@ -96,7 +97,7 @@ void Membership::pushCredentials(const RuntimeEnvironment* RR, void* tPtr, const
 	_lastPushedCredentials = now;
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const CertificateOfMembership& com)
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const CertificateOfMembership& com, SignatureBatch* batch)
 {
 	const int64_t newts = com.timestamp();
 	if (newts <= _comRevocationThreshold) {
@@ -113,11 +114,14 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 		return ADD_ACCEPTED_REDUNDANT;
 	}
 
-	switch (com.verify(RR, tPtr)) {
+	switch (((batch) && (batch->verified())) ? 0 : com.verify(RR, tPtr, batch)) {
 		default:
 			RR->t->credentialRejected(tPtr, com, "invalid");
 			return ADD_REJECTED;
 		case 0:
+			if ((batch) && (! batch->verified())) {
+				return ADD_DEFERRED_FOR_BATCH;
+			}
 			// printf("%.16llx %.10llx replacing COM %lld with %lld\n", com.networkId(), com.issuedTo().toInt(), _com.timestamp(), com.timestamp()); fflush(stdout);
 			_com = com;
 			return ADD_ACCEPTED_NEW;
@@ -128,7 +132,7 @@ Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironme
 
 // Template out addCredential() for many cred types to avoid copypasta
 template <typename C>
-static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t, C>& remoteCreds, const Hashtable<uint64_t, int64_t>& revocations, const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const C& cred)
+static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t, C>& remoteCreds, const Hashtable<uint64_t, int64_t>& revocations, const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const C& cred, SignatureBatch* batch)
 {
 	C* rc = remoteCreds.get(cred.id());
 	if (rc) {
@@ -147,11 +151,14 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t, C>& remo
 		return Membership::ADD_REJECTED;
 	}
 
-	switch (cred.verify(RR, tPtr)) {
+	switch (((batch) && (batch->verified())) ? 0 : cred.verify(RR, tPtr, batch)) {
 		default:
 			RR->t->credentialRejected(tPtr, cred, "invalid");
 			return Membership::ADD_REJECTED;
 		case 0:
+			if ((batch) && (! batch->verified())) {
+				return Membership::ADD_DEFERRED_FOR_BATCH;
+			}
 			if (! rc) {
 				rc = &(remoteCreds[cred.id()]);
 			}
@@ -162,27 +169,34 @@ static Membership::AddCredentialResult _addCredImpl(Hashtable<uint32_t, C>& remo
 	}
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Tag& tag)
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Tag& tag, SignatureBatch* batch)
 {
-	return _addCredImpl<Tag>(_remoteTags, _revocations, RR, tPtr, nconf, tag);
+	return _addCredImpl<Tag>(_remoteTags, _revocations, RR, tPtr, nconf, tag, batch);
 }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Capability& cap)
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Capability& cap, SignatureBatch* batch)
 {
-	return _addCredImpl<Capability>(_remoteCaps, _revocations, RR, tPtr, nconf, cap);
+	return _addCredImpl<Capability>(_remoteCaps, _revocations, RR, tPtr, nconf, cap, batch);
 }
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const CertificateOfOwnership& coo)
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const CertificateOfOwnership& coo, SignatureBatch* batch)
 {
-	return _addCredImpl<CertificateOfOwnership>(_remoteCoos, _revocations, RR, tPtr, nconf, coo);
+	const AddCredentialResult r = _addCredImpl<CertificateOfOwnership>(_remoteCoos, _revocations, RR, tPtr, nconf, coo, batch);
+	if (r == ADD_ACCEPTED_NEW) {
+		_rebuildCooIndex();
+	}
+	return r;
 }
 
-Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Revocation& rev)
+Membership::AddCredentialResult Membership::addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Revocation& rev, SignatureBatch* batch)
 {
 	int64_t* rt;
-	switch (rev.verify(RR, tPtr)) {
+	switch (((batch) && (batch->verified())) ? 0 : rev.verify(RR, tPtr, batch)) {
 		default:
 			RR->t->credentialRejected(tPtr, rev, "invalid");
 			return ADD_REJECTED;
 		case 0: {
+			if ((batch) && (! batch->verified())) {
+				return ADD_DEFERRED_FOR_BATCH;
+			}
 			const Credential::Type ct = rev.type();
 			switch (ct) {
 				case Credential::CREDENTIAL_TYPE_COM:
@@ -215,7 +229,39 @@ void Membership::clean(const int64_t now, const NetworkConfig& nconf)
 {
 	_cleanCredImpl<Tag>(nconf, _remoteTags);
 	_cleanCredImpl<Capability>(nconf, _remoteCaps);
-	_cleanCredImpl<CertificateOfOwnership>(nconf, _remoteCoos);
+	if (_cleanCredImpl<CertificateOfOwnership>(nconf, _remoteCoos)) {
+		_rebuildCooIndex();
+	}
+}
+
+void Membership::_rebuildCooIndex()
+{
+	_cooIndex.clear();
+	uint32_t* k = (uint32_t*)0;
+	CertificateOfOwnership* v = (CertificateOfOwnership*)0;
+	Hashtable<uint32_t, CertificateOfOwnership>::Iterator i(_remoteCoos);
+	while (i.next(k, v)) {
+		for (unsigned int t = 0; t < v->thingCount(); ++t) {
+			unsigned int len;
+			switch (v->thingType(t)) {
+				case CertificateOfOwnership::THING_MAC_ADDRESS:
+					len = 6;
+					break;
+				case CertificateOfOwnership::THING_IPV4_ADDRESS:
+					len = 4;
+					break;
+				case CertificateOfOwnership::THING_IPV6_ADDRESS:
+					len = 16;
+					break;
+				default:
+					continue;
+			}
+			std::vector<uint32_t>& ids = _cooIndex[_cooThingKey((unsigned int)v->thingType(t), v->thingValue(t), len)];
+			if (std::find(ids.begin(), ids.end(), *k) == ids.end()) {
+				ids.push_back(*k);
+			}
+		}
+	}
 }
 
 }	// namespace ZeroTier
@@ -20,6 +20,7 @@
 #include "Tag.hpp"
 
 #include <stdint.h>
+#include <vector>
 
 #define ZT_MEMBERSHIP_CRED_ID_UNUSED 0xffffffffffffffffULL
 
@@ -27,6 +28,7 @@ namespace ZeroTier {
 
 class RuntimeEnvironment;
 class Network;
+class SignatureBatch;
 
 /**
  * A container for certificates of membership and other network credentials
@@ -37,7 +39,7 @@ class Network;
  */
 class Membership {
   public:
-	enum AddCredentialResult { ADD_REJECTED, ADD_ACCEPTED_NEW, ADD_ACCEPTED_REDUNDANT, ADD_DEFERRED_FOR_WHOIS };
+	enum AddCredentialResult { ADD_REJECTED, ADD_ACCEPTED_NEW, ADD_ACCEPTED_REDUNDANT, ADD_DEFERRED_FOR_WHOIS, ADD_DEFERRED_FOR_BATCH };
 
 	Membership();
 
@@ -107,12 +109,13 @@ class Membership {
 	 */
 	template <typename T> inline bool hasCertificateOfOwnershipFor(const NetworkConfig& nconf, const T& r) const
 	{
-		uint32_t* k = (uint32_t*)0;
-		CertificateOfOwnership* v = (CertificateOfOwnership*)0;
-		Hashtable<uint32_t, CertificateOfOwnership>::Iterator i(*(const_cast<Hashtable<uint32_t, CertificateOfOwnership>*>(&_remoteCoos)));
-		while (i.next(k, v)) {
-			if (_isCredentialTimestampValid(nconf, *v) && (v->owns(r))) {
-				return true;
+		const std::vector<uint32_t>* const ids = _cooIndex.get(_cooThingKey(r));
+		if (ids) {
+			for (std::vector<uint32_t>::const_iterator id(ids->begin()); id != ids->end(); ++id) {
+				const CertificateOfOwnership* const v = _remoteCoos.get(*id);
+				if ((v) && (_isCredentialTimestampValid(nconf, *v)) && (v->owns(r))) {
+					return true;
+				}
 			}
 		}
 		return _isV6NDPEmulated(nconf, r);
@@ -133,28 +136,36 @@ class Membership {
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
+	 *
+	 * With a batch that has not been verified yet, a credential that passes
+	 * every check but its signature has its signature added to the batch and
+	 * ADD_DEFERRED_FOR_BATCH is returned. Once the batch has verified the
+	 * same credential can be added again with it, and its signature is then
+	 * taken as checked.
+	 *
+	 * @param batch Signature batch or NULL to verify signatures now
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const CertificateOfMembership& com);
+	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const CertificateOfMembership& com, SignatureBatch* batch = (SignatureBatch*)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Tag& tag);
+	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Tag& tag, SignatureBatch* batch = (SignatureBatch*)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Capability& cap);
+	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Capability& cap, SignatureBatch* batch = (SignatureBatch*)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const CertificateOfOwnership& coo);
+	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const CertificateOfOwnership& coo, SignatureBatch* batch = (SignatureBatch*)0);
 
 	/**
 	 * Validate and add a credential if signature is okay and it's otherwise good
 	 */
-	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Revocation& rev);
+	AddCredentialResult addCredential(const RuntimeEnvironment* RR, void* tPtr, const NetworkConfig& nconf, const Revocation& rev, SignatureBatch* batch = (SignatureBatch*)0);
 
 	/**
 	 * Clean internal databases of stale entries
@@ -227,18 +238,53 @@ class Membership {
 		return false;
 	}
 
-	template <typename C> inline void _cleanCredImpl(const NetworkConfig& nconf, Hashtable<uint32_t, C>& remoteCreds)
+	template <typename C> inline bool _cleanCredImpl(const NetworkConfig& nconf, Hashtable<uint32_t, C>& remoteCreds)
 	{
+		bool erased = false;
 		uint32_t* k = (uint32_t*)0;
 		C* v = (C*)0;
 		typename Hashtable<uint32_t, C>::Iterator i(remoteCreds);
 		while (i.next(k, v)) {
 			if (! _isCredentialTimestampValid(nconf, *v)) {
 				remoteCreds.erase(*k);
+				erased = true;
 			}
 		}
+		return erased;
 	}
 
+	// Index key for a COO thing; IPv6 addresses are folded so keys can collide and owns() must still be checked
+	static inline uint64_t _cooThingKey(const unsigned int type, const uint8_t* v, const unsigned int len)
+	{
+		uint64_t k = (uint64_t)type << 60;
+		for (unsigned int i = 0; i < len; ++i) {
+			k ^= (uint64_t)v[i] << ((i & 7) * 8);
+		}
+		// Hashtable buckets by the low bits, which are often the same for addresses in one subnet
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		return k;
+	}
+	static inline uint64_t _cooThingKey(const InetAddress& ip)
+	{
+		if (ip.ss_family == AF_INET) {
+			return _cooThingKey(CertificateOfOwnership::THING_IPV4_ADDRESS, reinterpret_cast<const uint8_t*>(&(reinterpret_cast<const struct sockaddr_in*>(&ip)->sin_addr.s_addr)), 4);
+		}
+		if (ip.ss_family == AF_INET6) {
+			return _cooThingKey(CertificateOfOwnership::THING_IPV6_ADDRESS, reinterpret_cast<const struct sockaddr_in6*>(&ip)->sin6_addr.s6_addr, 16);
+		}
+		return 0;
+	}
+	static inline uint64_t _cooThingKey(const MAC& mac)
+	{
+		uint8_t tmp[6];
+		mac.copyTo(tmp, 6);
+		return _cooThingKey(CertificateOfOwnership::THING_MAC_ADDRESS, tmp, 6);
+	}
+
+	void _rebuildCooIndex();
+
 	// Last time we pushed MULTICAST_LIKE(s)
 	int64_t _lastUpdatedMulticast;
 
@@ -259,6 +305,9 @@ class Membership {
 	Hashtable<uint32_t, Capability> _remoteCaps;
 	Hashtable<uint32_t, CertificateOfOwnership> _remoteCoos;
 
+	// IDs of COOs in _remoteCoos by _cooThingKey() of each thing they claim
+	Hashtable<uint64_t, std::vector<uint32_t> > _cooIndex;
+
   public:
 	class CapabilityIterator {
 	  public:
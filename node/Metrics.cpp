@@ -100,6 +100,27 @@ prometheus::simpleapi::counter_metric_t udp_send { data.Add({ { "protocol", "udp
 prometheus::simpleapi::counter_metric_t tcp_send { data.Add({ { "protocol", "tcp" }, { "direction", "tx" } }) };
 prometheus::simpleapi::counter_metric_t tcp_recv { data.Add({ { "protocol", "tcp" }, { "direction", "rx" } }) };
 
+// Post-decode Multiplexer Metrics
+prometheus::simpleapi::counter_metric_t post_decode_drops { "zt_post_decode_drops", "number of decoded frames dropped because a post-decode queue was full" };
+
+// Packet Reassembly Metrics
+prometheus::simpleapi::counter_family_t fragment_reassembly { "zt_fragment_reassembly", "outcomes of packets held for fragment reassembly" };
+prometheus::simpleapi::counter_metric_t fragment_reassembly_completed { fragment_reassembly.Add({ { "result", "completed" } }) };
+prometheus::simpleapi::counter_metric_t fragment_reassembly_evicted { fragment_reassembly.Add({ { "result", "evicted" } }) };
+prometheus::simpleapi::counter_metric_t fragment_reassembly_timed_out { fragment_reassembly.Add({ { "result", "timed_out" } }) };
+prometheus::simpleapi::counter_metric_t fragment_reassembly_refused { fragment_reassembly.Add({ { "result", "refused" } }) };
+
+// WHOIS Wait Metrics
+prometheus::simpleapi::counter_family_t whois_wait { "zt_whois_wait", "complete packets dropped while held waiting for WHOIS or other decode info" };
+prometheus::simpleapi::counter_metric_t whois_wait_evicted { whois_wait.Add({ { "result", "evicted" } }) };
+prometheus::simpleapi::counter_metric_t whois_wait_timed_out { whois_wait.Add({ { "result", "timed_out" } }) };
+prometheus::simpleapi::counter_metric_t whois_wait_refused { whois_wait.Add({ { "result", "refused" } }) };
+
+// Credential Cache Metrics
+prometheus::simpleapi::counter_family_t credential_cache { "zt_credential_cache", "credential signature checks answered from or missing the credential cache" };
+prometheus::simpleapi::counter_metric_t credential_cache_hit { credential_cache.Add({ { "result", "hit" } }) };
+prometheus::simpleapi::counter_metric_t credential_cache_miss { credential_cache.Add({ { "result", "miss" } }) };
+
 // Network Metrics
 prometheus::simpleapi::gauge_metric_t network_num_joined { "zt_num_networks", "number of networks this instance is joined to" };
 prometheus::simpleapi::gauge_family_t network_num_multicast_groups { "zt_network_multicast_groups_subscribed", "number of multicast groups networks are subscribed to" };
@@ -130,6 +151,9 @@ prometheus::simpleapi::counter_metric_t sso_member_deauth { "controller_sso_time
 
 prometheus::simpleapi::counter_metric_t network_config_request { "controller_network_config_request", "count of config requests handled" };
 prometheus::simpleapi::gauge_metric_t network_config_request_threads { "controller_network_config_request_threads", "number of active network config handling threads" };
+prometheus::simpleapi::counter_family_t network_config_cache { "controller_network_config_cache", "config requests answered from or missing the rendered config cache" };
+prometheus::simpleapi::counter_metric_t network_config_cache_hit { network_config_cache.Add({ { "result", "hit" } }) };
+prometheus::simpleapi::counter_metric_t network_config_cache_miss { network_config_cache.Add({ { "result", "miss" } }) };
 prometheus::simpleapi::counter_metric_t db_get_network { "controller_db_get_network", "counter" };
 prometheus::simpleapi::counter_metric_t db_get_network_and_member { "controller_db_get_network_and_member", "counter" };
 prometheus::simpleapi::counter_metric_t db_get_network_and_member_and_summary { "controller_db_get_networK_and_member_summary", "counter" };
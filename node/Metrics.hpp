@@ -101,6 +101,27 @@ extern prometheus::simpleapi::counter_metric_t udp_recv;
 extern prometheus::simpleapi::counter_metric_t tcp_send;
 extern prometheus::simpleapi::counter_metric_t tcp_recv;
 
+// Post-decode Multiplexer Metrics
+extern prometheus::simpleapi::counter_metric_t post_decode_drops;
+
+// Packet Reassembly Metrics
+extern prometheus::simpleapi::counter_family_t fragment_reassembly;
+extern prometheus::simpleapi::counter_metric_t fragment_reassembly_completed;
+extern prometheus::simpleapi::counter_metric_t fragment_reassembly_evicted;
+extern prometheus::simpleapi::counter_metric_t fragment_reassembly_timed_out;
+extern prometheus::simpleapi::counter_metric_t fragment_reassembly_refused;
+
+// WHOIS Wait Metrics
+extern prometheus::simpleapi::counter_family_t whois_wait;
+extern prometheus::simpleapi::counter_metric_t whois_wait_evicted;
+extern prometheus::simpleapi::counter_metric_t whois_wait_timed_out;
+extern prometheus::simpleapi::counter_metric_t whois_wait_refused;
+
+// Credential Cache Metrics
+extern prometheus::simpleapi::counter_family_t credential_cache;
+extern prometheus::simpleapi::counter_metric_t credential_cache_hit;
+extern prometheus::simpleapi::counter_metric_t credential_cache_miss;
+
 // Network Metrics
 extern prometheus::simpleapi::gauge_metric_t network_num_joined;
 extern prometheus::simpleapi::gauge_family_t network_num_multicast_groups;
@@ -127,6 +148,9 @@ extern prometheus::simpleapi::counter_metric_t sso_expiration_checks;
 extern prometheus::simpleapi::counter_metric_t sso_member_deauth;
 extern prometheus::simpleapi::counter_metric_t network_config_request;
 extern prometheus::simpleapi::gauge_metric_t network_config_request_threads;
+extern prometheus::simpleapi::counter_family_t network_config_cache;
+extern prometheus::simpleapi::counter_metric_t network_config_cache_hit;
+extern prometheus::simpleapi::counter_metric_t network_config_cache_miss;
 
 extern prometheus::simpleapi::counter_metric_t db_get_network;
 extern prometheus::simpleapi::counter_metric_t db_get_network_and_member;
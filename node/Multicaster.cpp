@@ -193,6 +193,7 @@ void Multicaster::send(void* tPtr, int64_t now, const SharedPtr<Network>& networ
 
 	try {
 		Mutex::Lock _l(_groups_m);
+		Switch::TxBatch txBatch(RR->sw);   // copies for each recipient are armored together
 		MulticastGroupStatus& gs = _groups[Multicaster::Key(network->id(), mg)];
 
 		if (! gs.members.empty()) {
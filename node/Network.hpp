@@ -13,6 +13,7 @@
 #include "Address.hpp"
 #include "AtomicCounter.hpp"
 #include "CertificateOfMembership.hpp"
+#include "CompiledRules.hpp"
 #include "Constants.hpp"
 #include "Dictionary.hpp"
 #include "Hashtable.hpp"
@@ -23,6 +24,7 @@
 #include "Multicaster.hpp"
 #include "Mutex.hpp"
 #include "NetworkConfig.hpp"
+#include "RCUPtr.hpp"
 #include "SharedPtr.hpp"
 
 #include <algorithm>
@@ -316,7 +318,7 @@ class Network {
 	 */
 	inline Address findBridgeTo(const MAC& mac) const
 	{
-		Mutex::Lock _l(_lock);
+		Mutex::Lock _l(_remoteBridgeRoutes_l);
 		const Address* const br = _remoteBridgeRoutes.get(mac);
 		return ((br) ? *br : Address());
 	}
@@ -349,47 +351,53 @@ class Network {
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	Membership::AddCredentialResult addCredential(void* tPtr, const CertificateOfMembership& com);
+	Membership::AddCredentialResult addCredential(void* tPtr, const CertificateOfMembership& com, SignatureBatch* batch = (SignatureBatch*)0);
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void* tPtr, const Capability& cap)
+	inline Membership::AddCredentialResult addCredential(void* tPtr, const Capability& cap, SignatureBatch* batch = (SignatureBatch*)0)
 	{
 		if (cap.networkId() != _id) {
 			return Membership::ADD_REJECTED;
 		}
-		Mutex::Lock _l(_lock);
-		return _membership(cap.issuedTo()).addCredential(RR, tPtr, _config, cap);
+		RCUPtr<_ConfigSnapshot>::Reader snap(_snapshot);
+		_MembershipShard& ms = _membershipShard(cap.issuedTo());
+		Mutex::Lock _l(ms.lock);
+		return ms.members[cap.issuedTo()].addCredential(RR, tPtr, snap->config, cap, batch);
 	}
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void* tPtr, const Tag& tag)
+	inline Membership::AddCredentialResult addCredential(void* tPtr, const Tag& tag, SignatureBatch* batch = (SignatureBatch*)0)
 	{
 		if (tag.networkId() != _id) {
 			return Membership::ADD_REJECTED;
 		}
-		Mutex::Lock _l(_lock);
-		return _membership(tag.issuedTo()).addCredential(RR, tPtr, _config, tag);
+		RCUPtr<_ConfigSnapshot>::Reader snap(_snapshot);
+		_MembershipShard& ms = _membershipShard(tag.issuedTo());
+		Mutex::Lock _l(ms.lock);
+		return ms.members[tag.issuedTo()].addCredential(RR, tPtr, snap->config, tag, batch);
 	}
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	Membership::AddCredentialResult addCredential(void* tPtr, const Address& sentFrom, const Revocation& rev);
+	Membership::AddCredentialResult addCredential(void* tPtr, const Address& sentFrom, const Revocation& rev, SignatureBatch* batch = (SignatureBatch*)0);
 
 	/**
 	 * Validate a credential and learn it if it passes certificate and other checks
 	 */
-	inline Membership::AddCredentialResult addCredential(void* tPtr, const CertificateOfOwnership& coo)
+	inline Membership::AddCredentialResult addCredential(void* tPtr, const CertificateOfOwnership& coo, SignatureBatch* batch = (SignatureBatch*)0)
 	{
 		if (coo.networkId() != _id) {
 			return Membership::ADD_REJECTED;
 		}
-		Mutex::Lock _l(_lock);
-		return _membership(coo.issuedTo()).addCredential(RR, tPtr, _config, coo);
+		RCUPtr<_ConfigSnapshot>::Reader snap(_snapshot);
+		_MembershipShard& ms = _membershipShard(coo.issuedTo());
+		Mutex::Lock _l(ms.lock);
+		return ms.members[coo.issuedTo()].addCredential(RR, tPtr, snap->config, coo, batch);
 	}
 
 	/**
@@ -401,11 +409,13 @@ class Network {
 	 */
 	inline void peerRequestedCredentials(void* tPtr, const Address& to, const int64_t now)
 	{
-		Mutex::Lock _l(_lock);
-		Membership& m = _membership(to);
+		RCUPtr<_ConfigSnapshot>::Reader snap(_snapshot);
+		_MembershipShard& ms = _membershipShard(to);
+		Mutex::Lock _l(ms.lock);
+		Membership& m = ms.members[to];
 		const int64_t lastPushed = m.lastPushedCredentials();
-		if ((lastPushed < _lastConfigUpdate) || ((now - lastPushed) > ZT_PEER_CREDENTIALS_REQUEST_RATE_LIMIT)) {
-			m.pushCredentials(RR, tPtr, now, to, _config);
+		if ((lastPushed < snap->timestamp) || ((now - lastPushed) > ZT_PEER_CREDENTIALS_REQUEST_RATE_LIMIT)) {
+			m.pushCredentials(RR, tPtr, now, to, snap->config);
 		}
 	}
 
@@ -418,11 +428,13 @@ class Network {
 	 */
 	inline void pushCredentialsIfNeeded(void* tPtr, const Address& to, const int64_t now)
 	{
-		Mutex::Lock _l(_lock);
-		Membership& m = _membership(to);
+		RCUPtr<_ConfigSnapshot>::Reader snap(_snapshot);
+		_MembershipShard& ms = _membershipShard(to);
+		Mutex::Lock _l(ms.lock);
+		Membership& m = ms.members[to];
 		const int64_t lastPushed = m.lastPushedCredentials();
-		if ((lastPushed < _lastConfigUpdate) || ((now - lastPushed) > ZT_PEER_ACTIVITY_TIMEOUT)) {
-			m.pushCredentials(RR, tPtr, now, to, _config);
+		if ((lastPushed < snap->timestamp) || ((now - lastPushed) > ZT_PEER_ACTIVITY_TIMEOUT)) {
+			m.pushCredentials(RR, tPtr, now, to, snap->config);
 		}
 	}
 
@@ -460,7 +472,6 @@ class Network {
 	void _sendUpdatesToMembers(void* tPtr, const MulticastGroup* const newMulticastGroup);
 	void _announceMulticastGroupsTo(void* tPtr, const Address& peer, const std::vector<MulticastGroup>& allMulticastGroups);
 	std::vector<MulticastGroup> _allMulticastGroups() const;
-	Membership& _membership(const Address& a);
 	void _sendUpdateEvent(void* tPtr);
 
 	const RuntimeEnvironment* const RR;
@@ -474,21 +485,35 @@ class Network {
 	std::vector<MulticastGroup> _myMulticastGroups;					// multicast groups that we belong to (according to tap)
 	Hashtable<MulticastGroup, uint64_t> _multicastGroupsBehindMe;	// multicast groups that seem to be behind us and when we last saw them (if we are a bridge)
 	Hashtable<MAC, Address> _remoteBridgeRoutes;					// remote addresses where given MACs are reachable (for tracking devices behind remote bridges)
+	Mutex _remoteBridgeRoutes_l;
 
 	NetworkConfig _config;
 	int64_t _lastConfigUpdate;
 
+	// Immutable copy of the config and its compiled rules, replaced as a whole
+	// by setConfiguration() and read by the frame path without taking _lock
+	struct _ConfigSnapshot {
+		_ConfigSnapshot() : timestamp(0)
+		{
+		}
+		NetworkConfig config;
+		CompiledRules rules;
+		std::vector<CompiledRules> capabilities;
+		int64_t timestamp;
+	};
+	RCUPtr<_ConfigSnapshot> _snapshot;
+
 	struct _IncomingConfigChunk {
-		_IncomingConfigChunk()
+		_IncomingConfigChunk() : ts(0), updateId(0), haveChunks(0), haveBytes(0), data()
 		{
-			memset(this, 0, sizeof(_IncomingConfigChunk));
+			memset(haveChunkIds, 0, sizeof(haveChunkIds));
 		}
 		uint64_t ts;
 		uint64_t updateId;
 		uint64_t haveChunkIds[ZT_NETWORK_MAX_UPDATE_CHUNKS];
 		unsigned long haveChunks;
 		unsigned long haveBytes;
-		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> data;
+		std::vector<char> data;	  // dictionary text being reassembled, sized to the update and freed once it is complete
 	};
 	_IncomingConfigChunk _incomingConfigChunks[ZT_NETWORK_MAX_INCOMING_UPDATES];
 
@@ -498,7 +523,17 @@ class Network {
 	int _portError;	  // return value from port config callback
 	std::string _authenticationURL;
 
-	Hashtable<Address, Membership> _memberships;
+	// Memberships are sharded by member address, each shard guarded by its own
+	// lock. Shard locks may be taken while holding _lock but never the reverse.
+	struct _MembershipShard {
+		Hashtable<Address, Membership> members;
+		Mutex lock;
+	};
+	_MembershipShard _memberships[ZT_NETWORK_MEMBERSHIP_SHARDS];
+	inline _MembershipShard& _membershipShard(const Address& a)
+	{
+		return _memberships[(unsigned long)(a.toInt() % ZT_NETWORK_MEMBERSHIP_SHARDS)];
+	}
 
 	Mutex _lock;
 
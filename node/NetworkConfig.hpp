@@ -233,16 +233,32 @@ namespace ZeroTier {
 /**
  * Network configuration received from network controller nodes
  *
- * This is a memcpy()'able structure and is safe (in a crash sense) to modify
- * without locks.
+ * Everything but the capability list is stored inline. Capabilities are by
+ * far the largest credential, so they are kept in a vector sized to what the
+ * controller actually sent instead of a ZT_MAX_NETWORK_CAPABILITIES array.
  */
 class NetworkConfig {
   public:
 	NetworkConfig();
 
+	// Everything before the capability list is plain data, and is copied as
+	// such so that copies (padding included) compare equal in operator==().
+	NetworkConfig(const NetworkConfig& nc) : capabilities(nc.capabilities)
+	{
+		memcpy(reinterpret_cast<void*>(this), &nc, _inlineSize());
+	}
+	inline NetworkConfig& operator=(const NetworkConfig& nc)
+	{
+		if (this != &nc) {
+			memcpy(reinterpret_cast<void*>(this), &nc, _inlineSize());
+			capabilities = nc.capabilities;
+		}
+		return *this;
+	}
+
 	inline bool operator==(const NetworkConfig& nc) const
 	{
-		return (memcmp(this, &nc, sizeof(NetworkConfig)) == 0);
+		return ((memcmp(this, &nc, _inlineSize()) == 0) && (capabilities == nc.capabilities));
 	}
 	inline bool operator!=(const NetworkConfig& nc) const
 	{
@@ -266,6 +282,14 @@ class NetworkConfig {
 	 */
 	bool fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>& d);
 
+	/**
+	 * Read this network config from an index of a dictionary
+	 *
+	 * @param idx Index of dictionary, which may be raw text such as reassembled config chunks
+	 * @return True if dictionary was valid and network config successfully initialized
+	 */
+	bool fromDictionary(const Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index& idx);
+
 	/**
 	 * @return True if broadcast (ff:ff:ff:ff:ff:ff) address should work on this network
 	 */
@@ -569,11 +593,6 @@ class NetworkConfig {
 	 */
 	ZT_VirtualNetworkRule rules[ZT_MAX_NETWORK_RULES];
 
-	/**
-	 * Capabilities for this node on this network, in ascending order of capability ID
-	 */
-	Capability capabilities[ZT_MAX_NETWORK_CAPABILITIES];
-
 	/**
 	 * Tags for this node on this network, in ascending order of tag ID
 	 */
@@ -664,6 +683,19 @@ class NetworkConfig {
 	 * correctly
 	 **/
 	char ssoProvider[64];
+
+	/**
+	 * Capabilities for this node on this network, in ascending order of capability ID
+	 *
+	 * This holds capabilityCount entries. It must remain the last member, see operator==().
+	 */
+	std::vector<Capability> capabilities;
+
+  private:
+	inline unsigned long _inlineSize() const
+	{
+		return (unsigned long)(reinterpret_cast<const char*>(&capabilities) - reinterpret_cast<const char*>(this));
+	}
 };
 
 }	// namespace ZeroTier
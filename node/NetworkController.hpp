@@ -45,6 +45,17 @@ class NetworkController {
 		 */
 		virtual void ncSendConfig(uint64_t nwid, uint64_t requestPacketId, const Address& destination, const NetworkConfig& nc, bool sendLegacyFormatConfig) = 0;
 
+		/**
+		 * Send a configuration that has already been serialized by NetworkConfig::toDictionary()
+		 *
+		 * @param nwid Network ID
+		 * @param requestPacketId Request packet ID to send OK(NETWORK_CONFIG_REQUEST) or 0 to send NETWORK_CONFIG (push)
+		 * @param destination Destination peer Address
+		 * @param dict Serialized configuration, which must be 0-terminated
+		 * @param len Length of serialized configuration not including terminating 0
+		 */
+		virtual void ncSendConfigDictionary(uint64_t nwid, uint64_t requestPacketId, const Address& destination, const char* dict, unsigned int len) = 0;
+
 		/**
 		 * Send revocation to a node
 		 *
@@ -11,6 +11,7 @@
 #include "../version.h"
 #include "Address.hpp"
 #include "Constants.hpp"
+#include "CredentialCache.hpp"
 #include "ECC.hpp"
 #include "Identity.hpp"
 #include "Metrics.hpp"
@@ -26,11 +27,14 @@
 #include "Topology.hpp"
 #include "Trace.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <thread>
 
 // FIXME: remove this suppression and actually fix warnings
 #ifdef __GNUC__
@@ -50,8 +54,11 @@ Node::Node(void* uptr, void* tptr, const struct ZT_Node_Config* config, const st
 	, _networks(8)
 	, _now(now)
 	, _lastPingCheck(0)
+	, _pingCheckSlices(0)
+	, _pingCheckSlicesDone(0)
 	, _lastGratuitousPingCheck(0)
 	, _lastHousekeepingRun(0)
+	, _lastTopologyHousekeepingStep(0)
 	, _lastMemoizedTraceSettings(0)
 	, _lowBandwidthMode(false)
 {
@@ -120,8 +127,9 @@ Node::Node(void* uptr, void* tptr, const struct ZT_Node_Config* config, const st
 		const unsigned long sas = sizeof(SelfAwareness) + (((sizeof(SelfAwareness) & 0xf) != 0) ? (16 - (sizeof(SelfAwareness) & 0xf)) : 0);
 		const unsigned long bcs = sizeof(Bond) + (((sizeof(Bond) & 0xf) != 0) ? (16 - (sizeof(Bond) & 0xf)) : 0);
 		const unsigned long pms = sizeof(PacketMultiplexer) + (((sizeof(PacketMultiplexer) & 0xf) != 0) ? (16 - (sizeof(PacketMultiplexer) & 0xf)) : 0);
+		const unsigned long ccs = sizeof(CredentialCache) + (((sizeof(CredentialCache) & 0xf) != 0) ? (16 - (sizeof(CredentialCache) & 0xf)) : 0);
 
-		m = reinterpret_cast<char*>(::malloc(16 + ts + sws + mcs + topologys + sas + bcs + pms));
+		m = reinterpret_cast<char*>(::malloc(16 + ts + sws + mcs + topologys + sas + bcs + pms + ccs));
 		if (! m) {
 			throw std::bad_alloc();
 		}
@@ -143,6 +151,8 @@ Node::Node(void* uptr, void* tptr, const struct ZT_Node_Config* config, const st
 		RR->bc = new (m) Bond(RR);
 		m += bcs;
 		RR->pm = new (m) PacketMultiplexer(RR);
+		m += pms;
+		RR->cc = new (m) CredentialCache();
 	}
 	catch (...) {
 		if (RR->sa) {
@@ -166,6 +176,9 @@ Node::Node(void* uptr, void* tptr, const struct ZT_Node_Config* config, const st
 		if (RR->pm) {
 			RR->pm->~PacketMultiplexer();
 		}
+		if (RR->cc) {
+			RR->cc->~CredentialCache();
+		}
 		::free(m);
 		throw;
 	}
@@ -201,6 +214,9 @@ Node::~Node()
 	if (RR->pm) {
 		RR->pm->~PacketMultiplexer();
 	}
+	if (RR->cc) {
+		RR->cc->~CredentialCache();
+	}
 	::free(RR->rtmem);
 }
 
@@ -211,6 +227,21 @@ ZT_ResultCode Node::processWirePacket(void* tptr, int64_t now, int64_t localSock
 	return ZT_RESULT_OK;
 }
 
+ZT_ResultCode Node::processWirePackets(
+	void* tptr,
+	int64_t now,
+	int64_t localSocket,
+	const struct sockaddr_storage* const* remoteAddresses,
+	const void* const* packetData,
+	const unsigned int* packetLengths,
+	unsigned int packetCount,
+	volatile int64_t* nextBackgroundTaskDeadline)
+{
+	_now = now;
+	RR->sw->onRemotePackets(tptr, localSocket, reinterpret_cast<const InetAddress* const*>(remoteAddresses), packetData, packetLengths, packetCount);
+	return ZT_RESULT_OK;
+}
+
 ZT_ResultCode Node::processVirtualNetworkFrame(
 	void* tptr,
 	int64_t now,
@@ -239,6 +270,11 @@ void Node::initMultithreading(unsigned int concurrency, bool cpuPinningEnabled)
 	RR->pm->setUpPostDecodeReceiveThreads(concurrency, cpuPinningEnabled);
 }
 
+void Node::setRxQueueSize(unsigned long n)
+{
+	RR->sw->setRxQueueSize(n);
+}
+
 // Closure used to ping upstream and active/online peers
 class _PingPeersThatNeedPing {
   public:
@@ -315,6 +351,26 @@ class _PingPeersThatNeedPing {
 	const SharedPtr<Peer> _bestCurrentUpstream;
 };
 
+// Closure used to keep active peers alive, skipping those already handled as always-contact peers
+class _PingActivePeers {
+  public:
+	_PingActivePeers(void* tPtr, const std::vector<Address>& alwaysContact, int64_t now) : _tPtr(tPtr), _alwaysContact(alwaysContact), _now(now)
+	{
+	}
+
+	inline void operator()(Topology& t, const SharedPtr<Peer>& p)
+	{
+		if ((p->isActive(_now)) && (! std::binary_search(_alwaysContact.begin(), _alwaysContact.end(), p->address()))) {
+			p->doPingAndKeepalive(_tPtr, _now);
+		}
+	}
+
+  private:
+	void* _tPtr;
+	const std::vector<Address>& _alwaysContact;
+	const int64_t _now;
+};
+
 ZT_ResultCode Node::processBackgroundTasks(void* tptr, int64_t now, volatile int64_t* nextBackgroundTaskDeadline)
 {
 	_now = now;
@@ -330,10 +386,14 @@ ZT_ResultCode Node::processBackgroundTasks(void* tptr, int64_t now, volatile int
 		}
 	}
 
-	unsigned long timeUntilNextPingCheck = _lowBandwidthMode ? (ZT_PING_CHECK_INTERVAL * 5) : ZT_PING_CHECK_INTERVAL;
+	const unsigned long pingCheckInterval = _lowBandwidthMode ? (ZT_PING_CHECK_INTERVAL * 5) : ZT_PING_CHECK_INTERVAL;
+	unsigned long timeUntilNextPingCheck = pingCheckInterval;
 	const int64_t timeSinceLastPingCheck = now - _lastPingCheck;
 	if (timeSinceLastPingCheck >= timeUntilNextPingCheck) {
 		try {
+			// Finish any slices of the last check that came due before this one
+			_pingActivePeers(tptr, now, pingCheckInterval);
+
 			_lastPingCheck = now;
 
 			// Get designated VL1 upstreams (roots)
@@ -392,9 +452,31 @@ ZT_ResultCode Node::processBackgroundTasks(void* tptr, int64_t now, volatile int
 				}
 			}
 
-			// Ping active peers, upstreams, and others that we should always contact
-			_PingPeersThatNeedPing pfunc(RR, tptr, alwaysContact, now);
-			RR->topology->eachPeer<_PingPeersThatNeedPing&>(pfunc);
+			// Ping upstreams and others that we should always contact
+			{
+				_pingCheckAlwaysContact.clear();
+				Hashtable<Address, std::vector<InetAddress> >::Iterator i(alwaysContact);
+				Address* upstreamAddress = (Address*)0;
+				std::vector<InetAddress>* upstreamStableEndpoints = (std::vector<InetAddress>*)0;
+				while (i.next(upstreamAddress, upstreamStableEndpoints)) {
+					_pingCheckAlwaysContact.push_back(*upstreamAddress);
+				}
+				std::sort(_pingCheckAlwaysContact.begin(), _pingCheckAlwaysContact.end());
+			}
+			{
+				_PingPeersThatNeedPing pfunc(RR, tptr, alwaysContact, now);
+				for (std::vector<Address>::const_iterator a(_pingCheckAlwaysContact.begin()); a != _pingCheckAlwaysContact.end(); ++a) {
+					SharedPtr<Peer> p(RR->topology->getPeerNoCache(*a));
+					if (p) {
+						pfunc(*RR->topology, p);
+					}
+				}
+			}
+
+			// Ping other active peers, in slices spread over the check interval if there are many
+			_pingCheckSlices = std::max(1U, std::min(Topology::peerShards(), (unsigned int)(RR->topology->peerCount() / ZT_PING_CHECK_SLICE_PEERS)));
+			_pingCheckSlicesDone = 0;
+			_pingActivePeers(tptr, now, pingCheckInterval);
 
 			// Run WHOIS to create Peer for alwaysContact addresses that could not be contacted
 			{
@@ -429,6 +511,27 @@ ZT_ResultCode Node::processBackgroundTasks(void* tptr, int64_t now, volatile int
 	}
 	else {
 		timeUntilNextPingCheck -= (unsigned long)timeSinceLastPingCheck;
+		try {
+			_pingActivePeers(tptr, now, pingCheckInterval);
+		}
+		catch (...) {
+			return ZT_RESULT_FATAL_ERROR_INTERNAL;
+		}
+	}
+	if (_pingCheckSlicesDone < _pingCheckSlices) {
+		const int64_t nextSliceDue = _lastPingCheck + (int64_t)((pingCheckInterval * _pingCheckSlicesDone) / _pingCheckSlices);
+		timeUntilNextPingCheck = std::min(timeUntilNextPingCheck, (unsigned long)std::max(nextSliceDue - now, (int64_t)0));
+	}
+
+	// Topology housekeeping runs in steps, catching up on any that came due since the last call
+	try {
+		for (unsigned int step = 0; (step < ZT_TOPOLOGY_HOUSEKEEPING_STEPS) && ((now - _lastTopologyHousekeepingStep) >= (ZT_HOUSEKEEPING_PERIOD / ZT_TOPOLOGY_HOUSEKEEPING_STEPS)); ++step) {
+			_lastTopologyHousekeepingStep = std::max(_lastTopologyHousekeepingStep + (int64_t)(ZT_HOUSEKEEPING_PERIOD / ZT_TOPOLOGY_HOUSEKEEPING_STEPS), now - (int64_t)ZT_HOUSEKEEPING_PERIOD);
+			RR->topology->doPeriodicTasks(tptr, now);
+		}
+	}
+	catch (...) {
+		return ZT_RESULT_FATAL_ERROR_INTERNAL;
 	}
 
 	if ((now - _lastMemoizedTraceSettings) >= (ZT_HOUSEKEEPING_PERIOD / 4)) {
@@ -439,7 +542,6 @@ ZT_ResultCode Node::processBackgroundTasks(void* tptr, int64_t now, volatile int
 	if ((now - _lastHousekeepingRun) >= ZT_HOUSEKEEPING_PERIOD) {
 		_lastHousekeepingRun = now;
 		try {
-			RR->topology->doPeriodicTasks(tptr, now);
 			RR->sa->clean(now);
 			RR->mc->clean(now);
 		}
@@ -458,6 +560,19 @@ ZT_ResultCode Node::processBackgroundTasks(void* tptr, int64_t now, volatile int
 	return ZT_RESULT_OK;
 }
 
+void Node::_pingActivePeers(void* tptr, int64_t now, unsigned long pingCheckInterval)
+{
+	// Slice i covers its share of the peer table's shards and is due i/slices of the way through the check interval
+	while ((_pingCheckSlicesDone < _pingCheckSlices) && ((now - _lastPingCheck) >= (int64_t)((pingCheckInterval * _pingCheckSlicesDone) / _pingCheckSlices))) {
+		_PingActivePeers pfunc(tptr, _pingCheckAlwaysContact, now);
+		const unsigned int last = (Topology::peerShards() * (_pingCheckSlicesDone + 1)) / _pingCheckSlices;
+		for (unsigned int s = (Topology::peerShards() * _pingCheckSlicesDone) / _pingCheckSlices; s < last; ++s) {
+			RR->topology->eachPeerInShard<_PingActivePeers&>(s, pfunc);
+		}
+		++_pingCheckSlicesDone;
+	}
+}
+
 ZT_ResultCode Node::join(uint64_t nwid, void* uptr, void* tptr)
 {
 	Mutex::Lock _l(_networks_m);
@@ -468,6 +583,66 @@ ZT_ResultCode Node::join(uint64_t nwid, void* uptr, void* tptr)
 	return ZT_RESULT_OK;
 }
 
+ZT_ResultCode Node::join(const std::vector<uint64_t>& nwids, void* tptr)
+{
+	// Reading and parsing cached configs dominates startup on nodes joined to many networks
+	std::vector<NetworkConfig*> configs(nwids.size(), (NetworkConfig*)0);
+	std::atomic<unsigned long> next(0);
+	auto loader = [this, &nwids, &configs, &next, tptr]() {
+		char* const dict = new char[ZT_NETWORKCONFIG_DICT_CAPACITY];
+		for (;;) {
+			const unsigned long i = next++;
+			if (i >= nwids.size()) {
+				break;
+			}
+			uint64_t tmp[2];
+			tmp[0] = nwids[i];
+			tmp[1] = 0;
+			const int n = stateObjectGet(tptr, ZT_STATE_OBJECT_NETWORK_CONFIG, tmp, dict, ZT_NETWORKCONFIG_DICT_CAPACITY - 1);
+			if (n > 1) {
+				dict[n] = (char)0;
+				NetworkConfig* nconf = new NetworkConfig();
+				try {
+					if (nconf->fromDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index(dict, (unsigned int)n + 1))) {
+						configs[i] = nconf;
+						nconf = (NetworkConfig*)0;
+					}
+				}
+				catch (...) {
+				}
+				delete nconf;
+			}
+		}
+		delete[] dict;
+	};
+
+	unsigned long threadCount = std::min((unsigned long)std::thread::hardware_concurrency(), (unsigned long)ZT_NODE_MAX_CONFIG_LOAD_THREADS);
+	if (threadCount > nwids.size()) {
+		threadCount = (unsigned long)nwids.size();
+	}
+	std::vector<std::thread> threads;
+	for (unsigned long t = 1; t < threadCount; ++t) {
+		threads.push_back(std::thread(loader));
+	}
+	loader();
+	for (std::vector<std::thread>::iterator t(threads.begin()); t != threads.end(); ++t) {
+		t->join();
+	}
+
+	// Networks without a usable cached config load it themselves, which also creates its placeholder
+	for (unsigned long i = 0; i < nwids.size(); ++i) {
+		{
+			Mutex::Lock _l(_networks_m);
+			SharedPtr<Network>& nw = _networks[nwids[i]];
+			if (! nw) {
+				nw = SharedPtr<Network>(new Network(RR, tptr, nwids[i], (void*)0, configs[i]));
+			}
+		}
+		delete configs[i];
+	}
+	return ZT_RESULT_OK;
+}
+
 ZT_ResultCode Node::leave(uint64_t nwid, void** uptr, void* tptr)
 {
 	ZT_VirtualNetworkConfig ctmp;
@@ -775,11 +950,11 @@ std::vector<World> Node::moons() const
 
 void Node::ncSendConfig(uint64_t nwid, uint64_t requestPacketId, const Address& destination, const NetworkConfig& nc, bool sendLegacyFormatConfig)
 {
-	_localControllerAuthorizations_m.lock();
-	_localControllerAuthorizations[_LocalControllerAuth(nwid, destination)] = now();
-	_localControllerAuthorizations_m.unlock();
-
 	if (destination == RR->identity.address()) {
+		_localControllerAuthorizations_m.lock();
+		_localControllerAuthorizations[_LocalControllerAuth(nwid, destination)] = now();
+		_localControllerAuthorizations_m.unlock();
+
 		SharedPtr<Network> n(network(nwid));
 		if (! n) {
 			return;
@@ -790,40 +965,7 @@ void Node::ncSendConfig(uint64_t nwid, uint64_t requestPacketId, const Address&
 		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>* dconf = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
 		try {
 			if (nc.toDictionary(*dconf, sendLegacyFormatConfig)) {
-				uint64_t configUpdateId = prng();
-				if (! configUpdateId) {
-					++configUpdateId;
-				}
-
-				const unsigned int totalSize = dconf->sizeBytes();
-				unsigned int chunkIndex = 0;
-				while (chunkIndex < totalSize) {
-					const unsigned int chunkLen = std::min(totalSize - chunkIndex, (unsigned int)(ZT_PROTO_MAX_PACKET_LENGTH - (ZT_PACKET_IDX_PAYLOAD + 256)));
-					Packet outp(destination, RR->identity.address(), (requestPacketId) ? Packet::VERB_OK : Packet::VERB_NETWORK_CONFIG);
-					if (requestPacketId) {
-						outp.append((unsigned char)Packet::VERB_NETWORK_CONFIG_REQUEST);
-						outp.append(requestPacketId);
-					}
-
-					const unsigned int sigStart = outp.size();
-					outp.append(nwid);
-					outp.append((uint16_t)chunkLen);
-					outp.append((const void*)(dconf->data() + chunkIndex), chunkLen);
-
-					outp.append((uint8_t)0);   // no flags
-					outp.append((uint64_t)configUpdateId);
-					outp.append((uint32_t)totalSize);
-					outp.append((uint32_t)chunkIndex);
-
-					ECC::Signature sig(RR->identity.sign(reinterpret_cast<const uint8_t*>(outp.data()) + sigStart, outp.size() - sigStart));
-					outp.append((uint8_t)1);
-					outp.append((uint16_t)ZT_ECC_SIGNATURE_LEN);
-					outp.append(sig.data, ZT_ECC_SIGNATURE_LEN);
-
-					outp.compress();
-					RR->sw->send((void*)0, outp, true, nwid, ZT_QOS_NO_FLOW);
-					chunkIndex += chunkLen;
-				}
+				ncSendConfigDictionary(nwid, requestPacketId, destination, dconf->data(), dconf->sizeBytes());
 			}
 			delete dconf;
 		}
@@ -834,6 +976,66 @@ void Node::ncSendConfig(uint64_t nwid, uint64_t requestPacketId, const Address&
 	}
 }
 
+void Node::ncSendConfigDictionary(uint64_t nwid, uint64_t requestPacketId, const Address& destination, const char* dict, unsigned int len)
+{
+	_localControllerAuthorizations_m.lock();
+	_localControllerAuthorizations[_LocalControllerAuth(nwid, destination)] = now();
+	_localControllerAuthorizations_m.unlock();
+
+	if (destination == RR->identity.address()) {
+		SharedPtr<Network> n(network(nwid));
+		if (! n) {
+			return;
+		}
+		NetworkConfig* nc = new NetworkConfig();
+		try {
+			if (nc->fromDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index(dict, len + 1))) {
+				n->setConfiguration((void*)0, *nc, true);
+			}
+			delete nc;
+		}
+		catch (...) {
+			delete nc;
+			throw;
+		}
+	}
+	else {
+		uint64_t configUpdateId = prng();
+		if (! configUpdateId) {
+			++configUpdateId;
+		}
+
+		unsigned int chunkIndex = 0;
+		while (chunkIndex < len) {
+			const unsigned int chunkLen = std::min(len - chunkIndex, (unsigned int)(ZT_PROTO_MAX_PACKET_LENGTH - (ZT_PACKET_IDX_PAYLOAD + 256)));
+			Packet outp(destination, RR->identity.address(), (requestPacketId) ? Packet::VERB_OK : Packet::VERB_NETWORK_CONFIG);
+			if (requestPacketId) {
+				outp.append((unsigned char)Packet::VERB_NETWORK_CONFIG_REQUEST);
+				outp.append(requestPacketId);
+			}
+
+			const unsigned int sigStart = outp.size();
+			outp.append(nwid);
+			outp.append((uint16_t)chunkLen);
+			outp.append((const void*)(dict + chunkIndex), chunkLen);
+
+			outp.append((uint8_t)0);   // no flags
+			outp.append((uint64_t)configUpdateId);
+			outp.append((uint32_t)len);
+			outp.append((uint32_t)chunkIndex);
+
+			ECC::Signature sig(RR->identity.sign(reinterpret_cast<const uint8_t*>(outp.data()) + sigStart, outp.size() - sigStart));
+			outp.append((uint8_t)1);
+			outp.append((uint16_t)ZT_ECC_SIGNATURE_LEN);
+			outp.append(sig.data, ZT_ECC_SIGNATURE_LEN);
+
+			outp.compress();
+			RR->sw->send((void*)0, outp, true, nwid, ZT_QOS_NO_FLOW);
+			chunkIndex += chunkLen;
+		}
+	}
+}
+
 void Node::ncSendRevocation(const Address& destination, const Revocation& rev)
 {
 	if (destination == RR->identity.address()) {
@@ -960,6 +1162,28 @@ ZT_Node_processWirePacket(ZT_Node* node, void* tptr, int64_t now, int64_t localS
 	}
 }
 
+enum ZT_ResultCode ZT_Node_processWirePackets(
+	ZT_Node* node,
+	void* tptr,
+	int64_t now,
+	int64_t localSocket,
+	const struct sockaddr_storage* const* remoteAddresses,
+	const void* const* packetData,
+	const unsigned int* packetLengths,
+	unsigned int packetCount,
+	volatile int64_t* nextBackgroundTaskDeadline)
+{
+	try {
+		return reinterpret_cast<ZeroTier::Node*>(node)->processWirePackets(tptr, now, localSocket, remoteAddresses, packetData, packetLengths, packetCount, nextBackgroundTaskDeadline);
+	}
+	catch (std::bad_alloc& exc) {
+		return ZT_RESULT_FATAL_ERROR_OUT_OF_MEMORY;
+	}
+	catch (...) {
+		return ZT_RESULT_OK;   // "OK" since invalid packets are simply dropped, but the system is still up
+	}
+}
+
 enum ZT_ResultCode ZT_Node_processVirtualNetworkFrame(
 	ZT_Node* node,
 	void* tptr,
@@ -30,6 +30,9 @@
 #define ZT_EXPECTING_REPLIES_BUCKET_MASK1 255
 #define ZT_EXPECTING_REPLIES_BUCKET_MASK2 31
 
+// Maximum number of threads reading and parsing cached network configs in join()
+#define ZT_NODE_MAX_CONFIG_LOAD_THREADS 8
+
 namespace ZeroTier {
 
 class World;
@@ -59,6 +62,15 @@ class Node : public NetworkController::Sender {
 	// Public API Functions ----------------------------------------------------
 
 	ZT_ResultCode processWirePacket(void* tptr, int64_t now, int64_t localSocket, const struct sockaddr_storage* remoteAddress, const void* packetData, unsigned int packetLength, volatile int64_t* nextBackgroundTaskDeadline);
+	ZT_ResultCode processWirePackets(
+		void* tptr,
+		int64_t now,
+		int64_t localSocket,
+		const struct sockaddr_storage* const* remoteAddresses,
+		const void* const* packetData,
+		const unsigned int* packetLengths,
+		unsigned int packetCount,
+		volatile int64_t* nextBackgroundTaskDeadline);
 	ZT_ResultCode processVirtualNetworkFrame(
 		void* tptr,
 		int64_t now,
@@ -72,6 +84,18 @@ class Node : public NetworkController::Sender {
 		volatile int64_t* nextBackgroundTaskDeadline);
 	ZT_ResultCode processBackgroundTasks(void* tptr, int64_t now, volatile int64_t* nextBackgroundTaskDeadline);
 	ZT_ResultCode join(uint64_t nwid, void* uptr, void* tptr);
+
+	/**
+	 * Join several networks, loading their cached configs in parallel
+	 *
+	 * This is meant for rejoining networks at startup. Cached configs are read
+	 * and parsed by several threads, so the state get callback must be safe to
+	 * call concurrently. Networks are then created in order on this thread.
+	 *
+	 * @param nwids Network IDs to join
+	 * @param tptr Thread pointer passed to callbacks
+	 */
+	ZT_ResultCode join(const std::vector<uint64_t>& nwids, void* tptr);
 	ZT_ResultCode leave(uint64_t nwid, void** uptr, void* tptr);
 	ZT_ResultCode multicastSubscribe(void* tptr, uint64_t nwid, uint64_t multicastGroup, unsigned long multicastAdi);
 	ZT_ResultCode multicastUnsubscribe(uint64_t nwid, uint64_t multicastGroup, unsigned long multicastAdi);
@@ -251,6 +275,7 @@ class Node : public NetworkController::Sender {
 	}
 
 	virtual void ncSendConfig(uint64_t nwid, uint64_t requestPacketId, const Address& destination, const NetworkConfig& nc, bool sendLegacyFormatConfig);
+	virtual void ncSendConfigDictionary(uint64_t nwid, uint64_t requestPacketId, const Address& destination, const char* dict, unsigned int len);
 	virtual void ncSendRevocation(const Address& destination, const Revocation& rev);
 	virtual void ncSendError(uint64_t nwid, uint64_t requestPacketId, const Address& destination, NetworkController::ErrorCode errorCode, const void* errorData, unsigned int errorDataSize);
 
@@ -302,6 +327,14 @@ class Node : public NetworkController::Sender {
 
 	void initMultithreading(unsigned int concurrency, bool cpuPinningEnabled);
 
+	/**
+	 * @param n Number of packets that may be held for fragment reassembly or WHOIS (0 for default)
+	 */
+	void setRxQueueSize(unsigned long n);
+
+  private:
+	void _pingActivePeers(void* tptr, int64_t now, unsigned long pingCheckInterval);
+
   public:
 	RuntimeEnvironment _RR;
 	RuntimeEnvironment* RR;
@@ -355,8 +388,12 @@ class Node : public NetworkController::Sender {
 
 	volatile int64_t _now;
 	int64_t _lastPingCheck;
+	std::vector<Address> _pingCheckAlwaysContact;	// sorted, already handled in this ping check
+	unsigned int _pingCheckSlices;					// active peers are pinged in this many slices per check
+	unsigned int _pingCheckSlicesDone;
 	int64_t _lastGratuitousPingCheck;
 	int64_t _lastHousekeepingRun;
+	int64_t _lastTopologyHousekeepingStep;
 	int64_t _lastMemoizedTraceSettings;
 	volatile int64_t _prngState[2];
 	bool _online;
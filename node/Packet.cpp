@@ -1261,6 +1261,92 @@ bool Packet::dearmor(const void* key, const AES aesKeys[2], const Identity& iden
 	return false;
 }
 
+void Packet::armorBatch(Packet* const* packets, const AES* const* aesKeys, unsigned int count)
+{
+	AES::GMACSIVBatch::Message msgs[ZT_AES_GMACSIV_BATCH_MAX];
+	while (count) {
+		const unsigned int n = (count < ZT_AES_GMACSIV_BATCH_MAX) ? count : ZT_AES_GMACSIV_BATCH_MAX;
+
+		for (unsigned int i = 0; i < n; ++i) {
+			Packet& p = *packets[i];
+			uint8_t* const data = reinterpret_cast<uint8_t*>(p.unsafeData());
+			p.setExtendedArmor(false);
+			p.setCipher(ZT_PROTO_CIPHER_SUITE__AES_GMAC_SIV);
+
+			AES::GMACSIVBatch::Message& m = msgs[i];
+			m.k0 = &aesKeys[i][0];
+			m.k1 = &aesKeys[i][1];
+			m.aad = data + ZT_PACKET_IDX_DEST;
+			m.aadLen = 11;
+			m.in = data + ZT_PACKET_IDX_VERB;
+			m.out = data + ZT_PACKET_IDX_VERB;
+			m.len = p.size() - ZT_PACKET_IDX_VERB;
+			m.tag[0] = Utils::loadMachineEndian<uint64_t>(data + ZT_PACKET_IDX_IV);
+		}
+
+		AES::GMACSIVBatch::encrypt(msgs, n);
+
+		for (unsigned int i = 0; i < n; ++i) {
+			uint8_t* const data = reinterpret_cast<uint8_t*>(packets[i]->unsafeData());
+#ifdef ZT_NO_UNALIGNED_ACCESS
+			Utils::copy<8>(data, msgs[i].tag);
+			Utils::copy<8>(data + ZT_PACKET_IDX_MAC, msgs[i].tag + 1);
+#else
+			*reinterpret_cast<uint64_t*>(data + ZT_PACKET_IDX_IV) = msgs[i].tag[0];
+			*reinterpret_cast<uint64_t*>(data + ZT_PACKET_IDX_MAC) = msgs[i].tag[1];
+#endif
+		}
+
+		packets += n;
+		aesKeys += n;
+		count -= n;
+	}
+}
+
+void Packet::dearmorBatch(Packet* const* packets, const AES* const* aesKeys, bool* ok, unsigned int count)
+{
+	AES::GMACSIVBatch::Message msgs[ZT_AES_GMACSIV_BATCH_MAX];
+	uint8_t aad[ZT_AES_GMACSIV_BATCH_MAX][11];
+	while (count) {
+		const unsigned int n = (count < ZT_AES_GMACSIV_BATCH_MAX) ? count : ZT_AES_GMACSIV_BATCH_MAX;
+
+		for (unsigned int i = 0; i < n; ++i) {
+			Packet& p = *packets[i];
+			uint8_t* const data = reinterpret_cast<uint8_t*>(p.unsafeData());
+
+			// The hop count in the flags is not authenticated, see dearmor()
+			memcpy(aad[i], data + ZT_PACKET_IDX_DEST, 11);
+			aad[i][ZT_PACKET_IDX_FLAGS - ZT_PACKET_IDX_DEST] &= 0xf8;
+
+			AES::GMACSIVBatch::Message& m = msgs[i];
+			m.k0 = &aesKeys[i][0];
+			m.k1 = &aesKeys[i][1];
+			m.aad = aad[i];
+			m.aadLen = 11;
+			m.in = data + ZT_PACKET_IDX_VERB;
+			m.out = data + ZT_PACKET_IDX_VERB;
+			m.len = p.size() - ZT_PACKET_IDX_VERB;
+#ifdef ZT_NO_UNALIGNED_ACCESS
+			Utils::copy<8>(m.tag, data);
+			Utils::copy<8>(m.tag + 1, data + ZT_PACKET_IDX_MAC);
+#else
+			m.tag[0] = *reinterpret_cast<const uint64_t*>(data + ZT_PACKET_IDX_IV);
+			m.tag[1] = *reinterpret_cast<const uint64_t*>(data + ZT_PACKET_IDX_MAC);
+#endif
+		}
+
+		AES::GMACSIVBatch::decrypt(msgs, n);
+		for (unsigned int i = 0; i < n; ++i) {
+			ok[i] = msgs[i].ok;
+		}
+
+		packets += n;
+		aesKeys += n;
+		ok += n;
+		count -= n;
+	}
+}
+
 void Packet::cryptField(const void* key, unsigned int start, unsigned int len)
 {
 	uint8_t* const data = reinterpret_cast<uint8_t*>(unsafeData());
@@ -1377,6 +1377,33 @@ class Packet : public Buffer<ZT_PROTO_MAX_PACKET_LENGTH> {
 	 */
 	bool dearmor(const void* key, const AES aesKeys[2], const Identity& identity);
 
+	/**
+	 * Armor several packets with AES-GMAC-SIV at once
+	 *
+	 * The result for each packet is identical to armor() with encryptPayload
+	 * set, extendedArmor unset and the same AES keys, but the AES work is
+	 * interleaved across packets with AES::GMACSIVBatch.
+	 *
+	 * @param packets Packets to armor
+	 * @param aesKeys Pair of AES-GMAC-SIV keys for each packet
+	 * @param count Number of packets
+	 */
+	static void armorBatch(Packet* const* packets, const AES* const* aesKeys, unsigned int count);
+
+	/**
+	 * Verify and decrypt several AES-GMAC-SIV packets at once
+	 *
+	 * Each packet must use ZT_PROTO_CIPHER_SUITE__AES_GMAC_SIV. The result for
+	 * each packet is identical to dearmor() with the same AES keys. Packets that
+	 * fail authentication are left with garbage payloads.
+	 *
+	 * @param packets Packets to verify and decrypt
+	 * @param aesKeys Pair of AES-GMAC-SIV keys for each packet
+	 * @param ok Set to the result of each packet's authentication check
+	 * @param count Number of packets
+	 */
+	static void dearmorBatch(Packet* const* packets, const AES* const* aesKeys, bool* ok, unsigned int count);
+
 	/**
 	 * Encrypt/decrypt a separately armored portion of a packet
 	 *
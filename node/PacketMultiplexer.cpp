@@ -9,18 +9,20 @@
 #include "PacketMultiplexer.hpp"
 
 #include "Constants.hpp"
+#include "Metrics.hpp"
 #include "Node.hpp"
 #include "RuntimeEnvironment.hpp"
 
+#include <chrono>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 namespace ZeroTier {
 
-PacketMultiplexer::PacketMultiplexer(const RuntimeEnvironment* renv)
+PacketMultiplexer::PacketMultiplexer(const RuntimeEnvironment* renv) : RR(renv), _concurrency(0), _enabled(false)
 {
-	RR = renv;
-};
+}
 
 void PacketMultiplexer::putFrame(void* tPtr, uint64_t nwid, void** nuptr, const MAC& source, const MAC& dest, unsigned int etherType, unsigned int vlanId, const void* data, unsigned int len, unsigned int flowId)
 {
@@ -34,16 +36,13 @@ void PacketMultiplexer::putFrame(void* tPtr, uint64_t nwid, void** nuptr, const
 		return;
 	}
 
-	PacketRecord* packet;
-	_rxPacketVector_m.lock();
-	if (_rxPacketVector.empty()) {
-		packet = new PacketRecord;
-	}
-	else {
-		packet = _rxPacketVector.back();
-		_rxPacketVector.pop_back();
+	_Lane& lane = *(_lanes[flowId % _concurrency]);
+
+	PacketRecord* const packet = _getRecord(lane);
+	if (! packet) {
+		Metrics::post_decode_drops++;
+		return;
 	}
-	_rxPacketVector_m.unlock();
 
 	packet->tPtr = tPtr;
 	packet->nwid = nwid;
@@ -56,8 +55,50 @@ void PacketMultiplexer::putFrame(void* tPtr, uint64_t nwid, void** nuptr, const
 	packet->flowId = flowId;
 	memcpy(packet->data, data, len);
 
-	int bucket = flowId % _concurrency;
-	_rxPacketQueues[bucket]->postLimit(packet, 2048);
+	// Never fails: a lane never has more records than its queue has slots
+	lane.queue.push(packet);
+
+	// Pairs with the fence in _rxThreadMain() so either we see it sleeping or it sees this packet
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (lane.sleeping.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> l(lane.sleepLock);
+		lane.wake.notify_one();
+	}
+}
+
+PacketRecord* PacketMultiplexer::_getRecord(_Lane& lane)
+{
+	PacketRecord* packet = (PacketRecord*)0;
+	if (lane.pool.pop(packet)) {
+		return packet;
+	}
+	if (lane.allocated.fetch_add(1) < ZT_PACKET_MULTIPLEXER_QUEUE_SIZE) {
+		return new PacketRecord;
+	}
+	lane.allocated.fetch_sub(1);
+
+	// Lane is full, so drop rather than stall the receive thread behind one slow flow
+	return (PacketRecord*)0;
+}
+
+void PacketMultiplexer::_rxThreadMain(_Lane& lane)
+{
+	PacketRecord* packet = (PacketRecord*)0;
+	for (;;) {
+		if (! lane.queue.pop(packet)) {
+			std::unique_lock<std::mutex> l(lane.sleepLock);
+			lane.sleeping.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			while (! lane.queue.pop(packet)) {
+				lane.wake.wait_for(l, std::chrono::milliseconds(100));
+			}
+			lane.sleeping.store(false, std::memory_order_relaxed);
+		}
+
+		RR->node->putFrame(packet->tPtr, packet->nwid, packet->nuptr, MAC(packet->source), MAC(packet->dest), packet->etherType, 0, (const void*)packet->data, packet->len);
+
+		lane.pool.push(packet);
+	}
 }
 
 void PacketMultiplexer::setUpPostDecodeReceiveThreads(unsigned int concurrency, bool cpuPinningEnabled)
@@ -65,53 +106,22 @@ void PacketMultiplexer::setUpPostDecodeReceiveThreads(unsigned int concurrency,
 #if defined(__APPLE__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__WINDOWS__)
 	return;
 #endif
-	_enabled = true;
 	_concurrency = concurrency;
-	bool _enablePinning = cpuPinningEnabled;
 
 	for (unsigned int i = 0; i < _concurrency; ++i) {
 		fprintf(stderr, "Reserved queue for thread %d\n", i);
-		_rxPacketQueues.push_back(new BlockingQueue<PacketRecord*>());
+		_lanes.push_back(new _Lane());
 	}
 
-	// Each thread picks from its own queue to feed into the core
+	// Each thread picks from its own lane to feed into the core
 	for (unsigned int i = 0; i < _concurrency; ++i) {
-		_rxThreads.push_back(std::thread([this, i, _enablePinning]() {
+		_rxThreads.push_back(std::thread([this, i]() {
 			fprintf(stderr, "Created post-decode packet ingestion thread %d\n", i);
-
-			PacketRecord* packet = nullptr;
-			for (;;) {
-				if (! _rxPacketQueues[i]->get(packet)) {
-					break;
-				}
-				if (! packet) {
-					break;
-				}
-
-				// fprintf(stderr, "popped packet from queue %d\n", i);
-
-				MAC sourceMac = MAC(packet->source);
-				MAC destMac = MAC(packet->dest);
-
-				RR->node->putFrame(packet->tPtr, packet->nwid, packet->nuptr, sourceMac, destMac, packet->etherType, 0, (const void*)packet->data, packet->len);
-				{
-					Mutex::Lock l(_rxPacketVector_m);
-					_rxPacketVector.push_back(packet);
-				}
-				/*
-				if (ZT_ResultCode_isFatal(err)) {
-					char tmp[256];
-					OSUtils::ztsnprintf(tmp, sizeof(tmp), "error processing packet: %d", (int)err);
-					Mutex::Lock _l(_termReason_m);
-					_termReason = ONE_UNRECOVERABLE_ERROR;
-					_fatalErrorMessage = tmp;
-					this->terminate();
-					break;
-				}
-				*/
-			}
+			_rxThreadMain(*(_lanes[i]));
 		}));
 	}
+
+	_enabled = true;
 }
 
 }	// namespace ZeroTier
@@ -9,14 +9,21 @@
 #ifndef ZT_PACKET_MULTIPLEXER_HPP
 #define ZT_PACKET_MULTIPLEXER_HPP
 
-#include "../osdep/BlockingQueue.hpp"
+#include "BoundedQueue.hpp"
 #include "MAC.hpp"
-#include "Mutex.hpp"
 #include "RuntimeEnvironment.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <vector>
 
+/**
+ * Maximum number of decoded frames in flight per post-decode thread (must be a power of two)
+ */
+#define ZT_PACKET_MULTIPLEXER_QUEUE_SIZE 2048
+
 namespace ZeroTier {
 
 struct PacketRecord {
@@ -32,6 +39,15 @@ struct PacketRecord {
 	unsigned int flowId;
 };
 
+/**
+ * Hands decoded frames to post-decode threads, keeping each flow on one thread
+ *
+ * Each post-decode thread owns a lane: a lock-free queue of frames waiting
+ * for it and a lock-free pool of free records that only it refills. Receive
+ * threads therefore never share a lock with each other or with the post-decode
+ * threads. A lane holds at most ZT_PACKET_MULTIPLEXER_QUEUE_SIZE frames. When
+ * it is full the frame is dropped at once and counted in post_decode_drops.
+ */
 class PacketMultiplexer {
   public:
 	const RuntimeEnvironment* RR;
@@ -42,16 +58,25 @@ class PacketMultiplexer {
 
 	void putFrame(void* tPtr, uint64_t nwid, void** nuptr, const MAC& source, const MAC& dest, unsigned int etherType, unsigned int vlanId, const void* data, unsigned int len, unsigned int flowId);
 
-	std::vector<BlockingQueue<PacketRecord*>*> _rxPacketQueues;
+  private:
+	struct _Lane {
+		_Lane() : allocated(0), sleeping(false)
+		{
+		}
+		BoundedQueue<PacketRecord*, ZT_PACKET_MULTIPLEXER_QUEUE_SIZE> queue;
+		BoundedQueue<PacketRecord*, ZT_PACKET_MULTIPLEXER_QUEUE_SIZE> pool;
+		std::atomic<unsigned long> allocated;
+		std::atomic<bool> sleeping;
+		std::mutex sleepLock;
+		std::condition_variable wake;
+	};
 
-	unsigned int _concurrency;
-	// pool
-	std::vector<PacketRecord*> _rxPacketVector;
-	std::vector<std::thread> _rxPacketThreads;
-	Mutex _rxPacketVector_m, _rxPacketThreads_m;
+	PacketRecord* _getRecord(_Lane& lane);
+	void _rxThreadMain(_Lane& lane);
 
+	unsigned int _concurrency;
+	std::vector<_Lane*> _lanes;
 	std::vector<std::thread> _rxThreads;
-	unsigned int _rxThreadCount;
 	bool _enabled;
 };
 
@@ -25,7 +25,7 @@ namespace ZeroTier {
 
 static unsigned char s_freeRandomByteCounter = 0;
 
-Peer::Peer(const RuntimeEnvironment* renv, const Identity& myIdentity, const Identity& peerIdentity)
+Peer::Peer(const RuntimeEnvironment* renv, const Identity& myIdentity, const Identity& peerIdentity, const uint8_t* key)
 	: RR(renv)
 	, _lastReceive(0)
 	, _lastNontrivialReceive(0)
@@ -57,7 +57,10 @@ Peer::Peer(const RuntimeEnvironment* renv, const Identity& myIdentity, const Ide
 	, _packet_errors { Metrics::peer_packet_errors.Add({ { "node_id", OSUtils::nodeIDStr(peerIdentity.address().toInt()) } }) }
 #endif
 {
-	if (! myIdentity.agree(peerIdentity, _key)) {
+	if (key) {
+		memcpy(_key, key, ZT_SYMMETRIC_KEY_SIZE);
+	}
+	else if (! myIdentity.agree(peerIdentity, _key)) {
 		throw ZT_EXCEPTION_INVALID_ARGUMENT;
 	}
 
@@ -56,9 +56,10 @@ class Peer {
 	 * @param renv Runtime environment
 	 * @param myIdentity Identity of THIS node (for key agreement)
 	 * @param peerIdentity Identity of peer
+	 * @param key Key previously agreed with this identity, or NULL to perform key agreement
 	 * @throws std::runtime_error Key agreement with peer's identity failed
 	 */
-	Peer(const RuntimeEnvironment* renv, const Identity& myIdentity, const Identity& peerIdentity);
+	Peer(const RuntimeEnvironment* renv, const Identity& myIdentity, const Identity& peerIdentity, const uint8_t* key = (const uint8_t*)0);
 
 	/**
 	 * @return This peer's ZT address (short for identity().address())
@@ -530,10 +531,14 @@ class Peer {
 	 */
 	template <unsigned int C> inline void serializeForCache(Buffer<C>& b) const
 	{
-		b.append((uint8_t)2);
+		b.append((uint8_t)3);
 
 		_id.serialize(b);
 
+		// The agreed key is tagged with our own address so it is ignored if this node's identity changes
+		RR->identity.address().appendTo(b);
+		b.append(_key, ZT_SYMMETRIC_KEY_SIZE);
+
 		b.append((uint16_t)_vProto);
 		b.append((uint16_t)_vMajor);
 		b.append((uint16_t)_vMinor);
@@ -561,7 +566,8 @@ class Peer {
 	{
 		try {
 			unsigned int ptr = 0;
-			if (b[ptr++] != 2) {
+			const unsigned int v = b[ptr++];
+			if ((v != 2) && (v != 3)) {
 				return SharedPtr<Peer>();
 			}
 
@@ -571,7 +577,15 @@ class Peer {
 				return SharedPtr<Peer>();
 			}
 
-			SharedPtr<Peer> p(new Peer(renv, renv->identity, id));
+			const uint8_t* key = (const uint8_t*)0;
+			if (v >= 3) {
+				if (Address(b.field(ptr, ZT_ADDRESS_LENGTH), ZT_ADDRESS_LENGTH) == renv->identity.address()) {
+					key = reinterpret_cast<const uint8_t*>(b.field(ptr + ZT_ADDRESS_LENGTH, ZT_SYMMETRIC_KEY_SIZE));
+				}
+				ptr += ZT_ADDRESS_LENGTH + ZT_SYMMETRIC_KEY_SIZE;
+			}
+
+			SharedPtr<Peer> p(new Peer(renv, renv->identity, id, key));
 
 			p->_vProto = b.template at<uint16_t>(ptr);
 			ptr += 2;
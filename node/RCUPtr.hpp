@@ -0,0 +1,158 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#ifndef ZT_RCUPTR_HPP
+#define ZT_RCUPTR_HPP
+
+#include <atomic>
+#include <thread>
+
+// Reader counters per epoch; threads are spread over these so readers on
+// different cores rarely write the same cache line
+#define ZT_RCUPTR_READER_SLOTS 16
+
+namespace ZeroTier {
+
+/**
+ * Read-copy-update pointer to an immutable object
+ *
+ * Readers pin the current object with a Reader and never block: entering a
+ * read section is an increment of a reader counter chosen by thread, and
+ * leaving it is a decrement. update() publishes a replacement and then waits
+ * until every reader that could still see the old object has left before it
+ * deletes it.
+ *
+ * Readers register under the current epoch and update() advances the epoch
+ * after publishing, so it only has to wait for readers registered before
+ * the swap. New readers never hold it up.
+ *
+ * Calls to update() must be serialized by the caller, and update() must not
+ * be called by a thread that is inside a read section of the same pointer.
+ *
+ * @tparam T Object type
+ */
+template <typename T> class RCUPtr {
+  public:
+	/**
+	 * Read section pinning the current object
+	 */
+	class Reader {
+	  public:
+		inline Reader(const RCUPtr& r)
+		{
+			const unsigned int s = _slot();
+			for (;;) {
+				const unsigned long e = r._epoch.load();
+				std::atomic<unsigned long>& c = r._readers[e & 1][s].n;
+				c.fetch_add(1);
+				if (r._epoch.load() == e) {
+					_c = &c;
+					break;
+				}
+				c.fetch_sub(1);
+			}
+			_p = r._ptr.load();
+		}
+
+		inline ~Reader()
+		{
+			_c->fetch_sub(1, std::memory_order_release);
+		}
+
+		inline const T* operator->() const
+		{
+			return _p;
+		}
+		inline const T& operator*() const
+		{
+			return *_p;
+		}
+
+	  private:
+		Reader(const Reader&)
+		{
+		}
+		const Reader& operator=(const Reader&)
+		{
+			return *this;
+		}
+
+		std::atomic<unsigned long>* _c;
+		const T* _p;
+	};
+
+	/**
+	 * @param p Initial object (takes ownership)
+	 */
+	RCUPtr(T* p) : _epoch(0), _ptr(p)
+	{
+		for (unsigned int e = 0; e < 2; ++e) {
+			for (unsigned int i = 0; i < ZT_RCUPTR_READER_SLOTS; ++i) {
+				_readers[e][i].n.store(0);
+			}
+		}
+	}
+
+	~RCUPtr()
+	{
+		delete _ptr.load();
+	}
+
+	/**
+	 * Replace the current object and delete the old one once no reader can see it
+	 *
+	 * @param p New object (takes ownership)
+	 */
+	inline void update(T* p)
+	{
+		T* const old = _ptr.exchange(p);
+		const unsigned long e = _epoch.fetch_add(1);
+		for (unsigned int i = 0; i < ZT_RCUPTR_READER_SLOTS; ++i) {
+			while (_readers[e & 1][i].n.load() != 0) {
+				std::this_thread::yield();
+			}
+		}
+		delete old;
+	}
+
+	/**
+	 * @return Current object; only safe for the thread that serializes update()
+	 */
+	inline const T* unsafeGet() const
+	{
+		return _ptr.load(std::memory_order_relaxed);
+	}
+
+  private:
+	RCUPtr(const RCUPtr&)
+	{
+	}
+	const RCUPtr& operator=(const RCUPtr&)
+	{
+		return *this;
+	}
+
+	static inline unsigned int _slot()
+	{
+		static std::atomic<unsigned int> next(0);
+		static thread_local const unsigned int s = next.fetch_add(1, std::memory_order_relaxed) % ZT_RCUPTR_READER_SLOTS;
+		return s;
+	}
+
+	struct alignas(64) _Counter {
+		std::atomic<unsigned long> n;
+	};
+
+	mutable _Counter _readers[2][ZT_RCUPTR_READER_SLOTS];
+	std::atomic<unsigned long> _epoch;
+	std::atomic<T*> _ptr;
+};
+
+}	// namespace ZeroTier
+
+#endif
@@ -31,6 +31,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * Revocation certificate to instantaneously revoke a COM, capability, or tag
@@ -124,9 +125,10 @@ class Revocation : public Credential {
 	 *
 	 * @param RR Runtime environment to provide for peer lookup, etc.
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch If non-NULL, signatures are added to this batch instead of checked and 0 means OK if the batch verifies
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or chain
 	 */
-	int verify(const RuntimeEnvironment* RR, void* tPtr) const;
+	int verify(const RuntimeEnvironment* RR, void* tPtr, SignatureBatch* batch = (SignatureBatch*)0) const;
 
 	template <unsigned int C> inline void serialize(Buffer<C>& b, const bool forSign = false) const
 	{
@@ -27,13 +27,14 @@ class SelfAwareness;
 class Trace;
 class Bond;
 class PacketMultiplexer;
+class CredentialCache;
 
 /**
  * Holds global state for an instance of ZeroTier::Node
  */
 class RuntimeEnvironment {
   public:
-	RuntimeEnvironment(Node* n) : node(n), localNetworkController((NetworkController*)0), rtmem((void*)0), sw((Switch*)0), mc((Multicaster*)0), topology((Topology*)0), sa((SelfAwareness*)0)
+	RuntimeEnvironment(Node* n) : node(n), localNetworkController((NetworkController*)0), rtmem((void*)0), sw((Switch*)0), mc((Multicaster*)0), topology((Topology*)0), sa((SelfAwareness*)0), cc((CredentialCache*)0)
 	{
 		publicIdentityStr[0] = (char)0;
 		secretIdentityStr[0] = (char)0;
@@ -66,6 +67,7 @@ class RuntimeEnvironment {
 	SelfAwareness* sa;
 	Bond* bc;
 	PacketMultiplexer* pm;
+	CredentialCache* cc;
 
 	// This node's identity and string representations thereof
 	Identity identity;
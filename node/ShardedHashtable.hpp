@@ -0,0 +1,276 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#ifndef ZT_SHARDEDHASHTABLE_HPP
+#define ZT_SHARDEDHASHTABLE_HPP
+
+#include "Constants.hpp"
+#include "Hashtable.hpp"
+#include "Mutex.hpp"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * Default number of shards, should be a power of two comfortably above the core count
+ */
+#define ZT_SHARDED_HASHTABLE_DEFAULT_SHARDS 64
+
+namespace ZeroTier {
+
+/**
+ * A Hashtable split into independently locked shards
+ *
+ * Keys are spread over shards by a mix of their hashCode(), so threads that
+ * look up different keys almost never contend for the same lock. Every
+ * method is thread safe. Whole-table operations lock one shard at a time and
+ * so see a consistent view of each shard but not of the whole table.
+ *
+ * Keys must have the same hashCode() and operator==() required by Hashtable.
+ */
+template <typename K, typename V, unsigned int S = ZT_SHARDED_HASHTABLE_DEFAULT_SHARDS> class ShardedHashtable {
+  public:
+	ShardedHashtable()
+	{
+	}
+
+	/**
+	 * @param k Key
+	 * @param v Value to fill with result if found
+	 * @return True if key was found
+	 */
+	inline bool get(const K& k, V& v) const
+	{
+		const _Shard& s = _shard(k);
+		Mutex::Lock _l(s.lock);
+		return s.table.get(k, v);
+	}
+
+	/**
+	 * Get a value, creating it with a factory if it does not exist
+	 *
+	 * The factory is called with the shard locked and must not access this table.
+	 *
+	 * @param k Key
+	 * @param create Function or functor called as create(k) to make a new value
+	 * @return Existing or new value
+	 */
+	template <typename F> inline V getOrAdd(const K& k, F create)
+	{
+		_Shard& s = _shard(k);
+		Mutex::Lock _l(s.lock);
+		V* const v = s.table.get(k);
+		if (v) {
+			return *v;
+		}
+		return s.table.set(k, create(k));
+	}
+
+	/**
+	 * Call a function on the value for a key if it exists
+	 *
+	 * The function is called as f(value) with the shard locked, may modify
+	 * the value in place, and must not access this table.
+	 *
+	 * @param k Key
+	 * @param f Function or functor
+	 * @return True if key was found
+	 */
+	template <typename F> inline bool update(const K& k, F& f)
+	{
+		_Shard& s = _shard(k);
+		Mutex::Lock _l(s.lock);
+		V* const v = s.table.get(k);
+		if (v) {
+			f(*v);
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * @param k Key
+	 * @param v Value
+	 */
+	inline void set(const K& k, const V& v)
+	{
+		_Shard& s = _shard(k);
+		Mutex::Lock _l(s.lock);
+		s.table.set(k, v);
+	}
+
+	/**
+	 * @param k Key
+	 * @return True if value was present
+	 */
+	inline bool erase(const K& k)
+	{
+		_Shard& s = _shard(k);
+		Mutex::Lock _l(s.lock);
+		return s.table.erase(k);
+	}
+
+	/**
+	 * Erase all entries for which a predicate returns true
+	 *
+	 * The predicate is called as f(key,value) with that entry's shard locked.
+	 *
+	 * @param f Predicate
+	 * @return Number of entries erased
+	 */
+	template <typename F> inline unsigned long eraseIf(F f)
+	{
+		unsigned long n = 0;
+		for (unsigned int i = 0; i < S; ++i) {
+			n += shardEraseIf(i, f);
+		}
+		return n;
+	}
+
+	/**
+	 * Erase entries of one shard for which a predicate returns true
+	 *
+	 * This lets callers spread a sweep of the table over time. The predicate
+	 * is called as f(key,value) with the shard locked.
+	 *
+	 * @param i Shard index, less than shards()
+	 * @param f Predicate
+	 * @return Number of entries erased
+	 */
+	template <typename F> inline unsigned long shardEraseIf(const unsigned int i, F& f)
+	{
+		unsigned long n = 0;
+		Mutex::Lock _l(_s[i].lock);
+		typename Hashtable<K, V>::Iterator it(_s[i].table);
+		K* k = (K*)0;
+		V* v = (V*)0;
+		while (it.next(k, v)) {
+			if (f(*k, *v)) {
+				_s[i].table.erase(*k);
+				++n;
+			}
+		}
+		return n;
+	}
+
+	/**
+	 * Call a function for every entry
+	 *
+	 * The function is called as f(key,value) with that entry's shard locked
+	 * and must not access this table.
+	 *
+	 * @param f Function or functor
+	 */
+	template <typename F> inline void each(F& f)
+	{
+		for (unsigned int i = 0; i < S; ++i) {
+			Mutex::Lock _l(_s[i].lock);
+			typename Hashtable<K, V>::Iterator it(_s[i].table);
+			K* k = (K*)0;
+			V* v = (V*)0;
+			while (it.next(k, v)) {
+				f(*k, *v);
+			}
+		}
+	}
+
+	/**
+	 * @return Number of shards
+	 */
+	static inline unsigned int shards()
+	{
+		return S;
+	}
+
+	/**
+	 * Copy the entries of one shard
+	 *
+	 * This holds only that shard's lock and only while copying, so callers
+	 * can walk the table shard by shard and do slow work on each copy without
+	 * blocking lookups.
+	 *
+	 * @param i Shard index, less than shards()
+	 * @param e Vector to fill (replacing any existing contents)
+	 */
+	inline void shardEntries(const unsigned int i, std::vector<std::pair<K, V> >& e) const
+	{
+		Mutex::Lock _l(_s[i].lock);
+		e = _s[i].table.entries();
+	}
+
+	/**
+	 * @return All entries (not an atomic snapshot if the table is being modified concurrently)
+	 */
+	inline std::vector<std::pair<K, V> > entries() const
+	{
+		std::vector<std::pair<K, V> > e, se;
+		for (unsigned int i = 0; i < S; ++i) {
+			shardEntries(i, se);
+			e.insert(e.end(), se.begin(), se.end());
+		}
+		return e;
+	}
+
+	/**
+	 * @return Number of entries (approximate if the table is being modified concurrently)
+	 */
+	inline unsigned long size() const
+	{
+		unsigned long n = 0;
+		for (unsigned int i = 0; i < S; ++i) {
+			Mutex::Lock _l(_s[i].lock);
+			n += _s[i].table.size();
+		}
+		return n;
+	}
+
+  private:
+	// Padded so that locks of adjacent shards do not share a cache line
+	struct _Shard {
+		_Shard() : table(8)
+		{
+		}
+		Mutex lock;
+		Hashtable<K, V> table;
+		uint8_t pad[64];
+	};
+
+	inline _Shard& _shard(const K& k)
+	{
+		return _s[_shardIndex(k)];
+	}
+	inline const _Shard& _shard(const K& k) const
+	{
+		return _s[_shardIndex(k)];
+	}
+
+	static inline unsigned int _shardIndex(const K& k)
+	{
+		// Hashtable uses the low bits of hashCode() for buckets, so mix before picking a shard
+		uint64_t h = (uint64_t)k.hashCode();
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return (unsigned int)(h % S);
+	}
+
+	ShardedHashtable(const ShardedHashtable&)
+	{
+	}
+	const ShardedHashtable& operator=(const ShardedHashtable&)
+	{
+		return *this;
+	}
+
+	_Shard _s[S];
+};
+
+}	// namespace ZeroTier
+
+#endif
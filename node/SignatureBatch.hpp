@@ -0,0 +1,137 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#ifndef ZT_SIGNATUREBATCH_HPP
+#define ZT_SIGNATUREBATCH_HPP
+
+#include "Constants.hpp"
+#include "ECC.hpp"
+#include "Identity.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace ZeroTier {
+
+/**
+ * Signatures collected from several credentials to be verified at once
+ *
+ * Credentials add their signatures here instead of checking them when
+ * verified with a batch. Once verify() has returned true every signature
+ * that was added is known to be good and verified() returns true.
+ *
+ * This class is not thread safe.
+ */
+class SignatureBatch {
+  public:
+	SignatureBatch() : _verified(false)
+	{
+	}
+
+	/**
+	 * Add a signature to be checked by verify()
+	 *
+	 * @param id Identity of signer
+	 * @param data Signed data, which is copied
+	 * @param len Length of data
+	 * @param signature Signature
+	 */
+	inline void add(const Identity& id, const void* data, unsigned int len, const ECC::Signature& signature)
+	{
+		_items.push_back(_Item());
+		_Item& i = _items.back();
+		i.publicKey = id.publicKey();
+		i.signature = signature;
+		i.offset = (unsigned int)_data.size();
+		i.len = len;
+		_data.insert(_data.end(), reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + len);
+		_verified = false;
+	}
+
+	/**
+	 * Verify all signatures added so far
+	 *
+	 * @return True if all signatures are valid
+	 */
+	inline bool verify()
+	{
+		const unsigned int n = (unsigned int)_items.size();
+		std::vector<const ECC::Public*> keys(n);
+		std::vector<const void*> msgs(n);
+		std::vector<unsigned int> lens(n);
+		std::vector<const void*> sigs(n);
+		for (unsigned int i = 0; i < n; ++i) {
+			keys[i] = &(_items[i].publicKey);
+			msgs[i] = _data.data() + _items[i].offset;
+			lens[i] = _items[i].len;
+			sigs[i] = _items[i].signature.data;
+		}
+		// Per-signature results are not needed, so check one internal batch of verifyBatch() at a time
+		bool valid[ZT_ECC_VERIFY_BATCH_SIZE];
+		_verified = true;
+		for (unsigned int i = 0; i < n; i += ZT_ECC_VERIFY_BATCH_SIZE) {
+			const unsigned int c = ((n - i) > ZT_ECC_VERIFY_BATCH_SIZE) ? ZT_ECC_VERIFY_BATCH_SIZE : (n - i);
+			if (! ECC::verifyBatch(c, keys.data() + i, msgs.data() + i, lens.data() + i, sigs.data() + i, valid)) {
+				_verified = false;
+				break;
+			}
+		}
+		return _verified;
+	}
+
+	/**
+	 * @return True if verify() has checked every signature added and all were valid
+	 */
+	inline bool verified() const
+	{
+		return _verified;
+	}
+
+	/**
+	 * @return Number of signatures added
+	 */
+	inline unsigned int size() const
+	{
+		return (unsigned int)_items.size();
+	}
+
+	/**
+	 * @param i Index of signature
+	 * @return Public key the signature is checked against
+	 */
+	inline const ECC::Public& publicKey(const unsigned int i) const
+	{
+		return _items[i].publicKey;
+	}
+
+	/**
+	 * @param i Index of signature
+	 * @return Signature
+	 */
+	inline const ECC::Signature& signature(const unsigned int i) const
+	{
+		return _items[i].signature;
+	}
+
+  private:
+	struct _Item {
+		ECC::Public publicKey;
+		ECC::Signature signature;
+		unsigned int offset;
+		unsigned int len;
+	};
+
+	std::vector<_Item> _items;
+	std::vector<uint8_t> _data;
+	bool _verified;
+};
+
+}	// namespace ZeroTier
+
+#endif
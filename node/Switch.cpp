@@ -26,8 +26,105 @@
 
 namespace ZeroTier {
 
-Switch::Switch(const RuntimeEnvironment* renv) : RR(renv), _lastBeaconResponse(0), _lastCheckedQueues(0), _lastUniteAttempt(8)
+Switch::Switch(const RuntimeEnvironment* renv) : RR(renv), _lastBeaconResponse(0), _lastCheckedQueues(0), _rxQueueSize(ZT_RX_QUEUE_SIZE), _lastUniteAttempt(8)
 {
+	for (unsigned int i = 0; i < ZT_RX_QUEUE_SOURCE_BUCKETS; ++i) {
+		_rxSourceEntries[i].store(0);
+	}
+}
+
+Switch::~Switch()
+{
+	for (unsigned int k = 0; k < ZT_RX_QUEUE_SHARDS; ++k) {
+		Hashtable<uint64_t, RXQueueEntry*>::Iterator i(_rxQueue[k].entries);
+		uint64_t* id = (uint64_t*)0;
+		RXQueueEntry** rq = (RXQueueEntry**)0;
+		while (i.next(id, rq)) {
+			_rxFree(*rq);
+		}
+	}
+	RXQueueEntry* rq;
+	while (_rxEntryPool.pop(rq)) {
+		delete rq;
+	}
+	Packet::Fragment* f;
+	while (_rxFragmentPool.pop(f)) {
+		delete f;
+	}
+
+	for (unsigned int k = 0; k < ZT_AQM_STRIPES; ++k) {
+		Hashtable<uint64_t, AQMScheduler*>::Iterator i(_aqm[k].networks);
+		uint64_t* nwid = (uint64_t*)0;
+		AQMScheduler** sched = (AQMScheduler**)0;
+		while (i.next(nwid, sched)) {
+			_aqmFree((*sched)->clear());
+			delete *sched;
+		}
+	}
+	AQMScheduler::Entry* e;
+	while (_aqmEntryPool.pop(e)) {
+		delete e;
+	}
+}
+
+struct Switch::_TxBatchState {
+	_TxBatchState() : sw((Switch*)0), count(0)
+	{
+	}
+	struct Entry {
+		void* tPtr;
+		SharedPtr<Peer> peer;
+		SharedPtr<Path> viaPath;
+		const AES* aesKeys;
+		unsigned int mtu;
+		int64_t now;
+		int32_t flowId;
+		Packet packet;
+	};
+	Switch* sw;	  // switch of the outermost TxBatch on this thread or NULL if none
+	unsigned int count;
+	Entry entries[ZT_AES_GMACSIV_BATCH_MAX];
+};
+
+struct Switch::_RxBatchState {
+	_RxBatchState() : tPtr((void*)0), count(0)
+	{
+	}
+	void* tPtr;
+	unsigned int count;
+	SharedPtr<Peer> peers[ZT_AES_GMACSIV_BATCH_MAX];
+	SharedPtr<Path> paths[ZT_AES_GMACSIV_BATCH_MAX];
+	IncomingPacket packets[ZT_AES_GMACSIV_BATCH_MAX];
+};
+
+Switch::_TxBatchState& Switch::_txBatchState()
+{
+	static thread_local _TxBatchState b;
+	return b;
+}
+
+Switch::_RxBatchState& Switch::_rxBatchState()
+{
+	static thread_local _RxBatchState b;
+	return b;
+}
+
+Switch::TxBatch::TxBatch(Switch* sw)
+{
+	_TxBatchState& b = _txBatchState();
+	_outer = (! b.sw);
+	if (_outer) {
+		b.sw = sw;
+	}
+}
+
+Switch::TxBatch::~TxBatch()
+{
+	if (_outer) {
+		_TxBatchState& b = _txBatchState();
+		b.sw->_txBatchFlush(b);
+		b.sw = (Switch*)0;
+	}
 }
 
 // Returns true if packet appears valid; pos and proto will be set
@@ -111,40 +208,45 @@ void Switch::onRemotePacket(void* tPtr, const int64_t localSocket, const InetAdd
 						// Total fragments must be more than 1, otherwise why are we
 						// seeing a Packet::Fragment?
 
-						RXQueueEntry* const rq = _findRXQueueEntry(fragmentPacketId);
-						Mutex::Lock rql(rq->lock);
-						if (rq->packetId != fragmentPacketId) {
-							// No packet found, so we received a fragment without its head.
-
-							rq->flowId = flowId;
-							rq->timestamp = now;
-							rq->packetId = fragmentPacketId;
-							rq->frags[fragmentNumber - 1] = fragment;
-							rq->totalFragments = totalFragments;	   // total fragment count is known
-							rq->haveFragments = 1 << fragmentNumber;   // we have only this fragment
-							rq->complete = false;
-						}
-						else if (! (rq->haveFragments & (1 << fragmentNumber))) {
-							// We have other fragments and maybe the head, so add this one and check
-
-							rq->frags[fragmentNumber - 1] = fragment;
-							rq->totalFragments = totalFragments;
+						_RXShard& rs = _rxShard(fragmentPacketId);
+						RXQueueEntry* assembled = (RXQueueEntry*)0;
+						{
+							Mutex::Lock rsl(rs.lock);
+							RXQueueEntry** const e = rs.entries.get(fragmentPacketId);
+							if (! e) {
+								// No packet found, so we received a fragment without its head.
+
+								RXQueueEntry* const rq = _rxNewEntry(path, fragmentPacketId, now, flowId, false);
+								if (! rq) {
+									return;
+								}
+								rq->frags[fragmentNumber - 1] = _rxNewFragment(fragment);
+								rq->totalFragments = totalFragments;	   // total fragment count is known
+								rq->haveFragments = 1 << fragmentNumber;   // we have only this fragment
+								_rxInsert(rs, rq);
+							}
+							else if (! ((*e)->haveFragments & (1 << fragmentNumber))) {
+								// We have other fragments and maybe the head, so add this one and check
 
-							if (Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
-								// We have all fragments -- assemble and process full Packet
+								RXQueueEntry* const rq = *e;
+								rq->frags[fragmentNumber - 1] = _rxNewFragment(fragment);
+								rq->totalFragments = totalFragments;
 
-								for (unsigned int f = 1; f < totalFragments; ++f) {
-									rq->frag0.append(rq->frags[f - 1].payload(), rq->frags[f - 1].payloadLength());
-								}
+								if (Utils::countBits(rq->haveFragments |= (1 << fragmentNumber)) == totalFragments) {
+									// We have all fragments -- assemble, then decode outside the shard lock
 
-								if (rq->frag0.tryDecode(RR, tPtr, flowId)) {
-									rq->timestamp = 0;	 // packet decoded, free entry
-								}
-								else {
-									rq->complete = true;   // set complete flag but leave entry since it probably needs WHOIS or something
+									for (unsigned int f = 1; f < totalFragments; ++f) {
+										rq->frag0.append(rq->frags[f - 1]->payload(), rq->frags[f - 1]->payloadLength());
+									}
+									_rxRemove(rs, rq);
+									assembled = rq;
 								}
-							}
-						}	// else this is a duplicate fragment, ignore
+							}	// else this is a duplicate fragment, ignore
+						}
+						if (assembled) {
+							Metrics::fragment_reassembly_completed++;
+							_rxDecode(tPtr, assembled);
+						}
 					}
 				}
 
@@ -201,57 +303,51 @@ void Switch::onRemotePacket(void* tPtr, const int64_t localSocket, const InetAdd
 						 | (((uint64_t)reinterpret_cast<const uint8_t*>(data)[3]) << 32) | (((uint64_t)reinterpret_cast<const uint8_t*>(data)[4]) << 24) | (((uint64_t)reinterpret_cast<const uint8_t*>(data)[5]) << 16)
 						 | (((uint64_t)reinterpret_cast<const uint8_t*>(data)[6]) << 8) | ((uint64_t)reinterpret_cast<const uint8_t*>(data)[7]));
 
-					RXQueueEntry* const rq = _findRXQueueEntry(packetId);
-					Mutex::Lock rql(rq->lock);
-					if (rq->packetId != packetId) {
-						// If we have no other fragments yet, create an entry and save the head
-
-						rq->flowId = flowId;
-						rq->timestamp = now;
-						rq->packetId = packetId;
-						rq->frag0.init(data, len, path, now);
-						rq->totalFragments = 0;
-						rq->haveFragments = 1;
-						rq->complete = false;
-					}
-					else if (! (rq->haveFragments & 1)) {
-						// If we have other fragments but no head, see if we are complete with the head
-
-						if ((rq->totalFragments > 1) && (Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)) {
-							// We have all fragments -- assemble and process full Packet
+					_RXShard& rs = _rxShard(packetId);
+					RXQueueEntry* assembled = (RXQueueEntry*)0;
+					{
+						Mutex::Lock rsl(rs.lock);
+						RXQueueEntry** const e = rs.entries.get(packetId);
+						if (! e) {
+							// If we have no other fragments yet, create an entry and save the head
+
+							RXQueueEntry* const rq = _rxNewEntry(path, packetId, now, flowId, false);
+							if (! rq) {
+								return;
+							}
+							rq->frag0.init(data, len, path, now);
+							rq->totalFragments = 0;
+							rq->haveFragments = 1;
+							_rxInsert(rs, rq);
+						}
+						else if (! ((*e)->haveFragments & 1)) {
+							// If we have other fragments but no head, see if we are complete with the head
 
+							RXQueueEntry* const rq = *e;
 							rq->frag0.init(data, len, path, now);
-							for (unsigned int f = 1; f < rq->totalFragments; ++f) {
-								rq->frag0.append(rq->frags[f - 1].payload(), rq->frags[f - 1].payloadLength());
-							}
+							if ((rq->totalFragments > 1) && (Utils::countBits(rq->haveFragments |= 1) == rq->totalFragments)) {
+								// We have all fragments -- assemble, then decode outside the shard lock
 
-							if (rq->frag0.tryDecode(RR, tPtr, flowId)) {
-								rq->timestamp = 0;	 // packet decoded, free entry
-							}
-							else {
-								rq->complete = true;   // set complete flag but leave entry since it probably needs WHOIS or something
+								for (unsigned int f = 1; f < rq->totalFragments; ++f) {
+									rq->frag0.append(rq->frags[f - 1]->payload(), rq->frags[f - 1]->payloadLength());
+								}
+								_rxRemove(rs, rq);
+								assembled = rq;
 							}
-						}
-						else {
-							// Still waiting on more fragments, but keep the head
-							rq->frag0.init(data, len, path, now);
-						}
-					}	// else this is a duplicate head, ignore
+							// else still waiting on more fragments, but keep the head
+						}	// else this is a duplicate head, ignore
+					}
+					if (assembled) {
+						Metrics::fragment_reassembly_completed++;
+						_rxDecode(tPtr, assembled);
+					}
 				}
 				else {
 					// RECEIVE: unfragmented packet appears to be ours (this is validated in cryptographic auth after assembly)
 
 					IncomingPacket packet(data, len, path, now);
 					if (! packet.tryDecode(RR, tPtr, flowId)) {
-						RXQueueEntry* const rq = _nextRXQueueEntry();
-						Mutex::Lock rql(rq->lock);
-						rq->flowId = flowId;
-						rq->timestamp = now;
-						rq->packetId = packet.packetId();
-						rq->frag0 = packet;
-						rq->totalFragments = 1;
-						rq->haveFragments = 1;
-						rq->complete = true;
+						_rxWait(packet, path, now, flowId);
 					}
 				}
 
@@ -263,6 +359,108 @@ void Switch::onRemotePacket(void* tPtr, const int64_t localSocket, const InetAdd
 	}	// sanity check, should be caught elsewhere
 }
 
+void Switch::onRemotePackets(void* tPtr, const int64_t localSocket, const InetAddress* const* fromAddrs, const void* const* data, const unsigned int* len, unsigned int count)
+{
+	TxBatch txBatch(this);	 // replies go out armored in batches too
+	_RxBatchState& b = _rxBatchState();
+	b.tPtr = tPtr;
+	for (unsigned int i = 0; i < count; ++i) {
+		if (_rxBatchAdd(b, tPtr, localSocket, *(fromAddrs[i]), data[i], len[i])) {
+			if (b.count == ZT_AES_GMACSIV_BATCH_MAX) {
+				_rxBatchFlush(b);
+			}
+		}
+		else {
+			_rxBatchFlush(b);
+			onRemotePacket(tPtr, localSocket, *(fromAddrs[i]), data[i], len[i]);
+		}
+	}
+	_rxBatchFlush(b);
+}
+
+// Takes a packet into the batch if it is an unfragmented AES-GMAC-SIV packet
+// for us from a peer we know, which is what tryDecode() would dearmor first.
+bool Switch::_rxBatchAdd(_RxBatchState& b, void* tPtr, const int64_t localSocket, const InetAddress& fromAddr, const void* data, unsigned int len)
+{
+	const uint8_t* const d = reinterpret_cast<const uint8_t*>(data);
+	if ((len < ZT_PROTO_MIN_PACKET_LENGTH) || (len > ZT_PROTO_MAX_PACKET_LENGTH) || (d[ZT_PACKET_FRAGMENT_IDX_FRAGMENT_INDICATOR] == ZT_PACKET_FRAGMENT_INDICATOR)) {
+		return false;
+	}
+	if (((d[ZT_PACKET_IDX_FLAGS] & ZT_PROTO_FLAG_FRAGMENTED) != 0) || (((d[ZT_PACKET_IDX_FLAGS] & 0x38) >> 3) != ZT_PROTO_CIPHER_SUITE__AES_GMAC_SIV)) {
+		return false;
+	}
+	const Address source(d + ZT_PACKET_IDX_SOURCE, ZT_ADDRESS_LENGTH);
+	if ((Address(d + ZT_PACKET_IDX_DEST, ZT_ADDRESS_LENGTH) != RR->identity.address()) || (source == RR->identity.address())) {
+		return false;
+	}
+	SharedPtr<Peer> peer(RR->topology->getPeer(tPtr, source));
+	if (! peer) {
+		return false;
+	}
+
+	const int64_t now = RR->node->now();
+	const SharedPtr<Path> path(RR->topology->getPath(localSocket, fromAddr));
+	path->received(now);
+
+	const unsigned int i = b.count++;
+	b.packets[i].init(data, len, path, now);
+	b.peers[i].swap(peer);
+	b.paths[i] = path;
+	return true;
+}
+
+void Switch::_rxBatchFlush(_RxBatchState& b)
+{
+	const unsigned int n = b.count;
+	if (! n) {
+		return;
+	}
+	b.count = 0;
+
+	Packet* packets[ZT_AES_GMACSIV_BATCH_MAX];
+	const AES* aesKeys[ZT_AES_GMACSIV_BATCH_MAX];
+	bool ok[ZT_AES_GMACSIV_BATCH_MAX];
+	for (unsigned int i = 0; i < n; ++i) {
+		packets[i] = &(b.packets[i]);
+		aesKeys[i] = b.peers[i]->aesKeys();
+	}
+	Packet::dearmorBatch(packets, aesKeys, ok, n);
+
+	for (unsigned int i = 0; i < n; ++i) {
+		IncomingPacket& packet = b.packets[i];
+		try {
+			if (ok[i]) {
+				packet.setAuthenticated();
+				if (! packet.tryDecode(RR, b.tPtr, ZT_QOS_NO_FLOW)) {
+					_rxWait(packet, b.paths[i], (int64_t)packet.receiveTime(), ZT_QOS_NO_FLOW);
+				}
+			}
+			else {
+				RR->t->incomingPacketMessageAuthenticationFailure(b.tPtr, b.paths[i], packet.packetId(), packet.source(), packet.hops(), "invalid MAC");
+				b.peers[i]->recordIncomingInvalidPacket(b.paths[i]);
+			}
+		}
+		catch (...) {
+		}	// sanity check, should be caught elsewhere
+		b.peers[i].zero();
+		b.paths[i].zero();
+	}
+}
+
+// Holds a complete packet that could not be decoded yet until its sender is known
+void Switch::_rxWait(const IncomingPacket& packet, const SharedPtr<Path>& path, int64_t now, int32_t flowId)
+{
+	RXQueueEntry* const rq = _rxNewEntry(path, packet.packetId(), now, flowId, true);
+	if (rq) {
+		rq->frag0 = packet;
+		rq->totalFragments = 1;
+		rq->haveFragments = 1;
+		_RXShard& rs = _rxShard(rq->packetId);
+		Mutex::Lock rsl(rs.lock);
+		_rxInsert(rs, rq);
+	}
+}
+
 void Switch::onLocalEthernet(void* tPtr, const SharedPtr<Network>& network, const MAC& from, const MAC& to, unsigned int etherType, unsigned int vlanId, const void* data, unsigned int len)
 {
 	if (! network->hasConfig()) {
@@ -633,260 +831,97 @@ void Switch::aqm_enqueue(void* tPtr, const SharedPtr<Network>& network, Packet&
 		send(tPtr, packet, encrypt, nwid, flowId);
 		return;
 	}
-	NetworkQoSControlBlock* nqcb = _netQueueControlBlock[network->id()];
-	if (! nqcb) {
-		nqcb = new NetworkQoSControlBlock();
-		_netQueueControlBlock[network->id()] = nqcb;
-		// Initialize ZT_QOS_NUM_BUCKETS queues and place them in the INACTIVE list
-		// These queues will be shuffled between the new/old/inactive lists by the enqueue/dequeue algorithm
-		for (int i = 0; i < ZT_AQM_NUM_BUCKETS; i++) {
-			nqcb->inactiveQueues.push_back(new ManagedQueue(i));
-		}
-	}
 	// Don't apply QoS scheduling to ZT protocol traffic
 	if (packet.verb() != Packet::VERB_FRAME && packet.verb() != Packet::VERB_EXT_FRAME) {
 		send(tPtr, packet, encrypt, nwid, flowId);
-	}
-
-	_aqm_m.lock();
-
-	// Enqueue packet and move queue to appropriate list
-
-	const Address dest(packet.destination());
-	TXQueueEntry* txEntry = new TXQueueEntry(dest, nwid, RR->node->now(), packet, encrypt, flowId);
-
-	ManagedQueue* selectedQueue = nullptr;
-	for (size_t i = 0; i < ZT_AQM_NUM_BUCKETS; i++) {
-		if (i < nqcb->oldQueues.size()) {	// search old queues first (I think this is best since old would imply most recent usage of the queue)
-			if (nqcb->oldQueues[i]->id == qosBucket) {
-				selectedQueue = nqcb->oldQueues[i];
-			}
-		}
-		if (i < nqcb->newQueues.size()) {	// search new queues (this would imply not often-used queues)
-			if (nqcb->newQueues[i]->id == qosBucket) {
-				selectedQueue = nqcb->newQueues[i];
-			}
-		}
-		if (i < nqcb->inactiveQueues.size()) {	 // search inactive queues
-			if (nqcb->inactiveQueues[i]->id == qosBucket) {
-				selectedQueue = nqcb->inactiveQueues[i];
-				// move queue to end of NEW queue list
-				selectedQueue->byteCredit = ZT_AQM_QUANTUM;
-				// DEBUG_INFO("moving q=%p from INACTIVE to NEW list", selectedQueue);
-				nqcb->newQueues.push_back(selectedQueue);
-				nqcb->inactiveQueues.erase(nqcb->inactiveQueues.begin() + i);
-			}
-		}
-	}
-	if (! selectedQueue) {
-		_aqm_m.unlock();
 		return;
 	}
 
-	selectedQueue->q.push_back(txEntry);
-	selectedQueue->byteLength += txEntry->packet.payloadLength();
-	nqcb->_currEnqueuedPackets++;
-
-	// DEBUG_INFO("nq=%2lu, oq=%2lu, iq=%2lu, nqcb.size()=%3d, bucket=%2d, q=%p", nqcb->newQueues.size(), nqcb->oldQueues.size(), nqcb->inactiveQueues.size(), nqcb->_currEnqueuedPackets, qosBucket, selectedQueue);
-
-	// Drop a packet if necessary
-	ManagedQueue* selectedQueueToDropFrom = nullptr;
-	if (nqcb->_currEnqueuedPackets > ZT_AQM_MAX_ENQUEUED_PACKETS) {
-		// DEBUG_INFO("too many enqueued packets (%d), finding packet to drop", nqcb->_currEnqueuedPackets);
-		int maxQueueLength = 0;
-		for (size_t i = 0; i < ZT_AQM_NUM_BUCKETS; i++) {
-			if (i < nqcb->oldQueues.size()) {
-				if (nqcb->oldQueues[i]->byteLength > maxQueueLength) {
-					maxQueueLength = nqcb->oldQueues[i]->byteLength;
-					selectedQueueToDropFrom = nqcb->oldQueues[i];
-				}
-			}
-			if (i < nqcb->newQueues.size()) {
-				if (nqcb->newQueues[i]->byteLength > maxQueueLength) {
-					maxQueueLength = nqcb->newQueues[i]->byteLength;
-					selectedQueueToDropFrom = nqcb->newQueues[i];
-				}
-			}
-			if (i < nqcb->inactiveQueues.size()) {
-				if (nqcb->inactiveQueues[i]->byteLength > maxQueueLength) {
-					maxQueueLength = nqcb->inactiveQueues[i]->byteLength;
-					selectedQueueToDropFrom = nqcb->inactiveQueues[i];
-				}
-			}
-		}
-		if (selectedQueueToDropFrom) {
-			// DEBUG_INFO("dropping packet from head of largest queue (%d payload bytes)", maxQueueLength);
-			int sizeOfDroppedPacket = selectedQueueToDropFrom->q.front()->packet.payloadLength();
-			delete selectedQueueToDropFrom->q.front();
-			selectedQueueToDropFrom->q.pop_front();
-			selectedQueueToDropFrom->byteLength -= sizeOfDroppedPacket;
-			nqcb->_currEnqueuedPackets--;
-		}
+	const int64_t now = RR->node->now();
+	AQMScheduler::Entry* e;
+	if (! _aqmEntryPool.pop(e)) {
+		e = new AQMScheduler::Entry();
 	}
-	_aqm_m.unlock();
-	aqm_dequeue(tPtr);
-}
+	e->creationTime = now;
+	e->nwid = nwid;
+	e->flowId = flowId;
+	e->encrypt = encrypt;
+	e->packet.copyFrom(packet.data(), packet.size());
 
-uint64_t Switch::control_law(uint64_t t, int count)
-{
-	return (uint64_t)(t + ZT_AQM_INTERVAL / sqrt(count));
+	AQMScheduler::Entry* done;
+	{
+		_AQMStripe& s = _aqmStripe(network->id());
+		Mutex::Lock _l(s.lock);
+		AQMScheduler** const sp = s.networks.get(network->id());
+		AQMScheduler* const sched = (sp) ? *sp : s.networks.set(network->id(), new AQMScheduler());
+		done = sched->enqueue(e, (unsigned int)qosBucket);
+		_aqmSend(tPtr, sched, now, done);
+	}
+	_aqmFree(done);
 }
 
-Switch::dqr Switch::dodequeue(ManagedQueue* q, uint64_t now)
+void Switch::aqm_dequeue(void* tPtr)
 {
-	dqr r;
-	r.ok_to_drop = false;
-	r.p = q->q.front();
-
-	if (r.p == NULL) {
-		q->first_above_time = 0;
-		return r;
-	}
-	uint64_t sojourn_time = now - r.p->creationTime;
-	if (sojourn_time < ZT_AQM_TARGET || q->byteLength <= ZT_DEFAULT_MTU) {
-		// went below - stay below for at least interval
-		q->first_above_time = 0;
-	}
-	else {
-		if (q->first_above_time == 0) {
-			// just went above from below. if still above at
-			// first_above_time, will say it's ok to drop.
-			q->first_above_time = now + ZT_AQM_INTERVAL;
-		}
-		else if (now >= q->first_above_time) {
-			r.ok_to_drop = true;
+	const int64_t now = RR->node->now();
+	for (unsigned int k = 0; k < ZT_AQM_STRIPES; ++k) {
+		AQMScheduler::Entry* done = (AQMScheduler::Entry*)0;
+		{
+			Mutex::Lock _l(_aqm[k].lock);
+			TxBatch txBatch(this);	 // destroyed first, so held packets still leave under the lock
+			Hashtable<uint64_t, AQMScheduler*>::Iterator i(_aqm[k].networks);
+			uint64_t* nwid = (uint64_t*)0;
+			AQMScheduler** sched = (AQMScheduler**)0;
+			while (i.next(nwid, sched)) {
+				_aqmSend(tPtr, *sched, now, done);
+			}
 		}
+		_aqmFree(done);
 	}
-	return r;
 }
 
-Switch::TXQueueEntry* Switch::CoDelDequeue(ManagedQueue* q, bool isNew, uint64_t now)
+void Switch::removeNetworkQoSControlBlock(uint64_t nwid)
 {
-	dqr r = dodequeue(q, now);
-
-	if (q->dropping) {
-		if (! r.ok_to_drop) {
-			q->dropping = false;
-		}
-		while (now >= q->drop_next && q->dropping) {
-			q->q.pop_front();	// drop
-			r = dodequeue(q, now);
-			if (! r.ok_to_drop) {
-				// leave dropping state
-				q->dropping = false;
-			}
-			else {
-				++(q->count);
-				// schedule the next drop.
-				q->drop_next = control_law(q->drop_next, q->count);
-			}
+	AQMScheduler* sched = (AQMScheduler*)0;
+	{
+		_AQMStripe& s = _aqmStripe(nwid);
+		Mutex::Lock _l(s.lock);
+		AQMScheduler** const sp = s.networks.get(nwid);
+		if (sp) {
+			sched = *sp;
+			s.networks.erase(nwid);
 		}
 	}
-	else if (r.ok_to_drop) {
-		q->q.pop_front();	// drop
-		r = dodequeue(q, now);
-		q->dropping = true;
-		q->count = (q->count > 2 && now - q->drop_next < 8 * ZT_AQM_INTERVAL) ? q->count - 2 : 1;
-		q->drop_next = control_law(now, q->count);
+	if (sched) {
+		_aqmFree(sched->clear());
+		delete sched;
 	}
-	return r.p;
 }
 
-void Switch::aqm_dequeue(void* tPtr)
+// Runs one scheduling round and sends what it emits; sent and dropped entries
+// are added to done. Sending happens with the stripe locked to keep frames in
+// the order the scheduler released them.
+void Switch::_aqmSend(void* tPtr, AQMScheduler* sched, const int64_t now, AQMScheduler::Entry*& done)
 {
-	// Cycle through network-specific QoS control blocks
-	for (std::map<uint64_t, NetworkQoSControlBlock*>::iterator nqcb(_netQueueControlBlock.begin()); nqcb != _netQueueControlBlock.end();) {
-		if (! (*nqcb).second->_currEnqueuedPackets) {
-			return;
-		}
-
-		uint64_t now = RR->node->now();
-		TXQueueEntry* entryToEmit = nullptr;
-		std::vector<ManagedQueue*>* currQueues = &((*nqcb).second->newQueues);
-		std::vector<ManagedQueue*>* oldQueues = &((*nqcb).second->oldQueues);
-		std::vector<ManagedQueue*>* inactiveQueues = &((*nqcb).second->inactiveQueues);
-
-		_aqm_m.lock();
-
-		// Attempt dequeue from queues in NEW list
-		bool examiningNewQueues = true;
-		while (currQueues->size()) {
-			ManagedQueue* queueAtFrontOfList = currQueues->front();
-			if (queueAtFrontOfList->byteCredit < 0) {
-				queueAtFrontOfList->byteCredit += ZT_AQM_QUANTUM;
-				// Move to list of OLD queues
-				// DEBUG_INFO("moving q=%p from NEW to OLD list", queueAtFrontOfList);
-				oldQueues->push_back(queueAtFrontOfList);
-				currQueues->erase(currQueues->begin());
-			}
-			else {
-				entryToEmit = CoDelDequeue(queueAtFrontOfList, examiningNewQueues, now);
-				if (! entryToEmit) {
-					// Move to end of list of OLD queues
-					// DEBUG_INFO("moving q=%p from NEW to OLD list", queueAtFrontOfList);
-					oldQueues->push_back(queueAtFrontOfList);
-					currQueues->erase(currQueues->begin());
-				}
-				else {
-					int len = entryToEmit->packet.payloadLength();
-					queueAtFrontOfList->byteLength -= len;
-					queueAtFrontOfList->byteCredit -= len;
-					// Send the packet!
-					queueAtFrontOfList->q.pop_front();
-					send(tPtr, entryToEmit->packet, entryToEmit->encrypt, entryToEmit->nwid, entryToEmit->flowId);
-					(*nqcb).second->_currEnqueuedPackets--;
-				}
-				if (queueAtFrontOfList) {
-					// DEBUG_INFO("dequeuing from q=%p, len=%lu in NEW list (byteCredit=%d)", queueAtFrontOfList, queueAtFrontOfList->q.size(), queueAtFrontOfList->byteCredit);
-				}
-				break;
-			}
-		}
-
-		// Attempt dequeue from queues in OLD list
-		examiningNewQueues = false;
-		currQueues = &((*nqcb).second->oldQueues);
-		while (currQueues->size()) {
-			ManagedQueue* queueAtFrontOfList = currQueues->front();
-			if (queueAtFrontOfList->byteCredit < 0) {
-				queueAtFrontOfList->byteCredit += ZT_AQM_QUANTUM;
-				oldQueues->push_back(queueAtFrontOfList);
-				currQueues->erase(currQueues->begin());
-			}
-			else {
-				entryToEmit = CoDelDequeue(queueAtFrontOfList, examiningNewQueues, now);
-				if (! entryToEmit) {
-					// DEBUG_INFO("moving q=%p from OLD to INACTIVE list", queueAtFrontOfList);
-					//  Move to inactive list of queues
-					inactiveQueues->push_back(queueAtFrontOfList);
-					currQueues->erase(currQueues->begin());
-				}
-				else {
-					int len = entryToEmit->packet.payloadLength();
-					queueAtFrontOfList->byteLength -= len;
-					queueAtFrontOfList->byteCredit -= len;
-					queueAtFrontOfList->q.pop_front();
-					send(tPtr, entryToEmit->packet, entryToEmit->encrypt, entryToEmit->nwid, entryToEmit->flowId);
-					(*nqcb).second->_currEnqueuedPackets--;
-				}
-				if (queueAtFrontOfList) {
-					// DEBUG_INFO("dequeuing from q=%p, len=%lu in OLD list (byteCredit=%d)", queueAtFrontOfList, queueAtFrontOfList->q.size(), queueAtFrontOfList->byteCredit);
-				}
-				break;
-			}
-		}
-		nqcb++;
-		_aqm_m.unlock();
+	if (! sched->size()) {
+		return;
+	}
+	AQMScheduler::Entry* out[2];
+	const unsigned int n = sched->dequeue(now, out, done);
+	for (unsigned int i = 0; i < n; ++i) {
+		send(tPtr, out[i]->packet, out[i]->encrypt, out[i]->nwid, out[i]->flowId);
+		out[i]->next = done;
+		done = out[i];
 	}
 }
 
-void Switch::removeNetworkQoSControlBlock(uint64_t nwid)
+void Switch::_aqmFree(AQMScheduler::Entry* list)
 {
-	NetworkQoSControlBlock* nq = _netQueueControlBlock[nwid];
-	if (nq) {
-		_netQueueControlBlock.erase(nwid);
-		delete nq;
-		nq = NULL;
+	while (list) {
+		AQMScheduler::Entry* const next = list->next;
+		if (! _aqmEntryPool.push(list)) {
+			delete list;
+		}
+		list = next;
 	}
 }
 
@@ -944,19 +979,11 @@ void Switch::doAnythingWaitingForPeer(void* tPtr, const SharedPtr<Peer>& peer)
 		_lastSentWhoisRequest.erase(peer->address());
 	}
 
-	const int64_t now = RR->node->now();
-	for (unsigned int ptr = 0; ptr < ZT_RX_QUEUE_SIZE; ++ptr) {
-		RXQueueEntry* const rq = &(_rxQueue[ptr]);
-		Mutex::Lock rql(rq->lock);
-		if ((rq->timestamp) && (rq->complete)) {
-			if ((rq->frag0.tryDecode(RR, tPtr, rq->flowId)) || ((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
-				rq->timestamp = 0;
-			}
-		}
-	}
+	_rxRetry(tPtr, RR->node->now(), (std::vector<Address>*)0);
 
 	{
 		Mutex::Lock _l(_txQueue_m);
+		TxBatch txBatch(this);
 		for (std::list<TXQueueEntry>::iterator txi(_txQueue.begin()); txi != _txQueue.end();) {
 			if (txi->dest == peer->address()) {
 				if (_trySend(tPtr, txi->packet, txi->encrypt, txi->nwid, txi->flowId)) {
@@ -982,9 +1009,10 @@ unsigned long Switch::doTimerTasks(void* tPtr, int64_t now)
 	_lastCheckedQueues = now;
 
 	std::vector<Address> needWhois;
+	_rxRetry(tPtr, now, &needWhois);
 	{
 		Mutex::Lock _l(_txQueue_m);
-
+		TxBatch txBatch(this);
 		for (std::list<TXQueueEntry>::iterator txi(_txQueue.begin()); txi != _txQueue.end();) {
 			if (_trySend(tPtr, txi->packet, txi->encrypt, 0, txi->flowId)) {
 				_txQueue.erase(txi++);
@@ -1004,22 +1032,6 @@ unsigned long Switch::doTimerTasks(void* tPtr, int64_t now)
 		requestWhois(tPtr, now, *i);
 	}
 
-	for (unsigned int ptr = 0; ptr < ZT_RX_QUEUE_SIZE; ++ptr) {
-		RXQueueEntry* const rq = &(_rxQueue[ptr]);
-		Mutex::Lock rql(rq->lock);
-		if ((rq->timestamp) && (rq->complete)) {
-			if ((rq->frag0.tryDecode(RR, tPtr, rq->flowId)) || ((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT)) {
-				rq->timestamp = 0;
-			}
-			else {
-				const Address src(rq->frag0.source());
-				if (! RR->topology->getPeer(tPtr, src)) {
-					requestWhois(tPtr, now, src);
-				}
-			}
-		}
-	}
-
 	{
 		Mutex::Lock _l(_lastUniteAttempt_m);
 		Hashtable<_LastUniteKey, uint64_t>::Iterator i(_lastUniteAttempt);
@@ -1047,6 +1059,194 @@ unsigned long Switch::doTimerTasks(void* tPtr, int64_t now)
 	return ZT_WHOIS_RETRY_DELAY;
 }
 
+void Switch::setRxQueueSize(unsigned long n)
+{
+	_rxQueueSize = (n) ? std::min(n, (unsigned long)ZT_RX_QUEUE_MAX_SIZE) : ZT_RX_QUEUE_SIZE;
+}
+
+Switch::RXQueueEntry* Switch::_rxNewEntry(const SharedPtr<Path>& path, const uint64_t packetId, const int64_t now, const int32_t flowId, const bool complete)
+{
+	// Fragments carry no ZeroTier source address, so fairness is by physical source IP
+	const unsigned int b = (unsigned int)(_hash64((uint64_t)path->address().ipOnly().hashCode()) % ZT_RX_QUEUE_SOURCE_BUCKETS);
+	const unsigned long limit = std::max(_rxQueueSize.load() / ZT_RX_QUEUE_MAX_SOURCE_SHARE, 1UL);
+	if (_rxSourceEntries[b].fetch_add(1) >= limit) {
+		_rxSourceEntries[b].fetch_sub(1);
+		if (complete) {
+			Metrics::whois_wait_refused++;
+		}
+		else {
+			Metrics::fragment_reassembly_refused++;
+		}
+		return (RXQueueEntry*)0;
+	}
+
+	RXQueueEntry* rq;
+	if (! _rxEntryPool.pop(rq)) {
+		rq = new RXQueueEntry();
+	}
+	rq->timestamp = now;
+	rq->packetId = packetId;
+	for (unsigned int f = 0; f < (ZT_MAX_PACKET_FRAGMENTS - 1); ++f) {
+		rq->frags[f] = (Packet::Fragment*)0;
+	}
+	rq->totalFragments = 0;
+	rq->haveFragments = 0;
+	rq->complete = complete;
+	rq->flowId = flowId;
+	rq->sourceBucket = b;
+	rq->older = (RXQueueEntry*)0;
+	rq->newer = (RXQueueEntry*)0;
+	return rq;
+}
+
+Packet::Fragment* Switch::_rxNewFragment(const Packet::Fragment& f)
+{
+	Packet::Fragment* pf;
+	if (! _rxFragmentPool.pop(pf)) {
+		pf = new Packet::Fragment();
+	}
+	*pf = f;
+	return pf;
+}
+
+void Switch::_rxFreeFragments(RXQueueEntry* rq)
+{
+	for (unsigned int f = 0; f < (ZT_MAX_PACKET_FRAGMENTS - 1); ++f) {
+		if (rq->frags[f]) {
+			if (! _rxFragmentPool.push(rq->frags[f])) {
+				delete rq->frags[f];
+			}
+			rq->frags[f] = (Packet::Fragment*)0;
+		}
+	}
+}
+
+void Switch::_rxFree(RXQueueEntry* rq)
+{
+	_rxFreeFragments(rq);
+	_rxSourceEntries[rq->sourceBucket].fetch_sub(1);
+	if (! _rxEntryPool.push(rq)) {
+		delete rq;
+	}
+}
+
+void Switch::_rxInsert(_RXShard& s, RXQueueEntry* rq)
+{
+	// assumes s.lock is locked
+	RXQueueEntry** const e = s.entries.get(rq->packetId);
+	if (e) {
+		// A duplicate arrived while this one was out of the table being decoded
+		RXQueueEntry* const dup = *e;
+		_rxRemove(s, dup);
+		_rxFree(dup);
+	}
+
+	const unsigned long capacity = std::max((_rxQueueSize.load() + (ZT_RX_QUEUE_SHARDS - 1)) / ZT_RX_QUEUE_SHARDS, 1UL);
+	while (s.entries.size() >= capacity) {
+		RXQueueEntry* const oldest = s.oldest;
+		_rxRemove(s, oldest);
+		if (oldest->complete) {
+			Metrics::whois_wait_evicted++;
+		}
+		else {
+			Metrics::fragment_reassembly_evicted++;
+		}
+		_rxFree(oldest);
+	}
+
+	s.entries.set(rq->packetId, rq);
+	rq->older = s.newest;
+	rq->newer = (RXQueueEntry*)0;
+	if (s.newest) {
+		s.newest->newer = rq;
+	}
+	else {
+		s.oldest = rq;
+	}
+	s.newest = rq;
+}
+
+void Switch::_rxRemove(_RXShard& s, RXQueueEntry* rq)
+{
+	// assumes s.lock is locked and rq is in s
+	s.entries.erase(rq->packetId);
+	if (rq->older) {
+		rq->older->newer = rq->newer;
+	}
+	else {
+		s.oldest = rq->newer;
+	}
+	if (rq->newer) {
+		rq->newer->older = rq->older;
+	}
+	else {
+		s.newest = rq->older;
+	}
+	rq->older = (RXQueueEntry*)0;
+	rq->newer = (RXQueueEntry*)0;
+}
+
+void Switch::_rxDecode(void* tPtr, RXQueueEntry* rq)
+{
+	// rq must not be in the table, so no lock is held while decoding
+	_rxFreeFragments(rq);
+	if (rq->frag0.tryDecode(RR, tPtr, rq->flowId)) {
+		_rxFree(rq);
+	}
+	else {
+		rq->complete = true;   // set complete flag and keep entry since it probably needs WHOIS or something
+		_RXShard& rs = _rxShard(rq->packetId);
+		Mutex::Lock rsl(rs.lock);
+		_rxInsert(rs, rq);
+	}
+}
+
+void Switch::_rxRetry(void* tPtr, const int64_t now, std::vector<Address>* needWhois)
+{
+	// Take complete packets out of the table and drop expired partial ones
+	std::vector<RXQueueEntry*> waiting;
+	for (unsigned int k = 0; k < ZT_RX_QUEUE_SHARDS; ++k) {
+		_RXShard& rs = _rxQueue[k];
+		Mutex::Lock rsl(rs.lock);
+		RXQueueEntry* rq = rs.oldest;
+		while (rq) {
+			RXQueueEntry* const next = rq->newer;
+			if (rq->complete) {
+				_rxRemove(rs, rq);
+				waiting.push_back(rq);
+			}
+			else if ((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT) {
+				_rxRemove(rs, rq);
+				_rxFree(rq);
+				Metrics::fragment_reassembly_timed_out++;
+			}
+			rq = next;
+		}
+	}
+
+	for (std::vector<RXQueueEntry*>::iterator w(waiting.begin()); w != waiting.end(); ++w) {
+		RXQueueEntry* const rq = *w;
+		if (rq->frag0.tryDecode(RR, tPtr, rq->flowId)) {
+			_rxFree(rq);
+		}
+		else if ((now - rq->timestamp) > ZT_RECEIVE_QUEUE_TIMEOUT) {
+			_rxFree(rq);
+			Metrics::whois_wait_timed_out++;
+		}
+		else {
+			if (needWhois) {
+				const Address src(rq->frag0.source());
+				if (! RR->topology->getPeer(tPtr, src)) {
+					needWhois->push_back(src);
+				}
+			}
+			_RXShard& rs = _rxShard(rq->packetId);
+			Mutex::Lock rsl(rs.lock);
+			_rxInsert(rs, rq);
+		}
+	}
+}
+
 bool Switch::_shouldUnite(const int64_t now, const Address& source, const Address& destination)
 {
 	Mutex::Lock _l(_lastUniteAttempt_m);
@@ -1107,19 +1307,74 @@ void Switch::_sendViaSpecificPath(void* tPtr, SharedPtr<Peer> peer, SharedPtr<Pa
 	if (userSpecifiedMtu > 0) {
 		mtu = userSpecifiedMtu;
 	}
-	unsigned int chunkSize = std::min(packet.size(), mtu);
-	packet.setFragmented(chunkSize < packet.size());
+	packet.setFragmented(packet.size() > mtu);
 
+	_TxBatchState& b = _txBatchState();
 	if (trustedPathId) {
 		packet.setTrusted(trustedPathId);
 	}
 	else {
 		if (! packet.isEncrypted()) {
-			packet.armor(peer->key(), encrypt, false, peer->aesKeysIfSupported(), peer->identity());
+			const AES* const aesKeys = peer->aesKeysIfSupported();
+			if ((encrypt) && (aesKeys) && (b.sw == this)) {
+				_TxBatchState::Entry& e = b.entries[b.count++];
+				e.tPtr = tPtr;
+				e.peer = peer;
+				e.viaPath = viaPath;
+				e.aesKeys = aesKeys;
+				e.mtu = mtu;
+				e.now = now;
+				e.flowId = flowId;
+				e.packet.copyFrom(packet.data(), packet.size());
+				if (b.count == ZT_AES_GMACSIV_BATCH_MAX) {
+					_txBatchFlush(b);
+				}
+				return;
+			}
+			packet.armor(peer->key(), encrypt, false, aesKeys, peer->identity());
 		}
 		RR->node->expectReplyTo(packet.packetId());
 	}
 
+	if (b.sw == this) {
+		_txBatchFlush(b);	// anything held was sent before this
+	}
+	_sendArmored(tPtr, peer, viaPath, mtu, now, packet, flowId);
+}
+
+void Switch::_txBatchFlush(_TxBatchState& b)
+{
+	const unsigned int n = b.count;
+	if (! n) {
+		return;
+	}
+	b.count = 0;
+
+	Packet* packets[ZT_AES_GMACSIV_BATCH_MAX];
+	const AES* aesKeys[ZT_AES_GMACSIV_BATCH_MAX];
+	for (unsigned int i = 0; i < n; ++i) {
+		packets[i] = &(b.entries[i].packet);
+		aesKeys[i] = b.entries[i].aesKeys;
+	}
+	Packet::armorBatch(packets, aesKeys, n);
+
+	for (unsigned int i = 0; i < n; ++i) {
+		_TxBatchState::Entry& e = b.entries[i];
+		try {
+			RR->node->expectReplyTo(e.packet.packetId());
+			_sendArmored(e.tPtr, e.peer, e.viaPath, e.mtu, e.now, e.packet, e.flowId);
+		}
+		catch (...) {
+		}
+		e.peer.zero();
+		e.viaPath.zero();
+	}
+}
+
+void Switch::_sendArmored(void* tPtr, const SharedPtr<Peer>& peer, const SharedPtr<Path>& viaPath, unsigned int mtu, int64_t now, Packet& packet, int32_t flowId)
+{
+	unsigned int chunkSize = std::min(packet.size(), mtu);
+
 	peer->recordOutgoingPacket(viaPath, packet.packetId(), packet.payloadLength(), packet.verb(), flowId, now);
 
 	if (viaPath->send(RR, tPtr, packet.data(), chunkSize, now)) {
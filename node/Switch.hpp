@@ -9,6 +9,8 @@
 #ifndef ZT_N_SWITCH_HPP
 #define ZT_N_SWITCH_HPP
 
+#include "AQMScheduler.hpp"
+#include "BoundedQueue.hpp"
 #include "Constants.hpp"
 #include "Hashtable.hpp"
 #include "IncomingPacket.hpp"
@@ -20,8 +22,8 @@
 #include "SharedPtr.hpp"
 #include "Topology.hpp"
 
+#include <atomic>
 #include <list>
-#include <map>
 #include <vector>
 
 /* Ethernet frame types that might be relevant to us */
@@ -48,18 +50,11 @@ class Peer;
  * wraps/unwraps accordingly. It also handles queues and timeouts and such.
  */
 class Switch {
-	struct ManagedQueue;
-	struct TXQueueEntry;
-
 	friend class SharedPtr<Peer>;
 
-	typedef struct {
-		TXQueueEntry* p;
-		bool ok_to_drop;
-	} dqr;
-
   public:
 	Switch(const RuntimeEnvironment* renv);
+	~Switch();
 
 	/**
 	 * Called when a packet is received from the real network
@@ -72,6 +67,47 @@ class Switch {
 	 */
 	void onRemotePacket(void* tPtr, const int64_t localSocket, const InetAddress& fromAddr, const void* data, unsigned int len);
 
+	/**
+	 * Called with several packets received together from the real network
+	 *
+	 * Unfragmented AES-GMAC-SIV packets from known peers are verified and
+	 * decrypted together with Packet::dearmorBatch(). Everything else goes
+	 * through onRemotePacket(). Packets are handled in order either way.
+	 *
+	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param localSocket Local I/O socket as supplied by external code
+	 * @param fromAddrs Internet IP address of origin of each packet
+	 * @param data Data of each packet
+	 * @param len Length of each packet
+	 * @param count Number of packets
+	 */
+	void onRemotePackets(void* tPtr, const int64_t localSocket, const InetAddress* const* fromAddrs, const void* const* data, const unsigned int* len, unsigned int count);
+
+	/**
+	 * Armors packets sent from the calling thread in batches while it exists
+	 *
+	 * Packets that would be armored with AES-GMAC-SIV are held and armored
+	 * together with Packet::armorBatch() once ZT_AES_GMACSIV_BATCH_MAX of them
+	 * are waiting or the outermost TxBatch on the thread is destroyed. Other
+	 * sends release the held packets first, so packets leave in order.
+	 */
+	class TxBatch {
+	  public:
+		TxBatch(Switch* sw);
+		~TxBatch();
+
+	  private:
+		TxBatch(const TxBatch&)
+		{
+		}
+		const TxBatch& operator=(const TxBatch&)
+		{
+			return *this;
+		}
+
+		bool _outer;
+	};
+
 	/**
 	 * Returns whether our bonding or balancing policy is aware of flows.
 	 */
@@ -91,23 +127,6 @@ class Switch {
 	 */
 	void onLocalEthernet(void* tPtr, const SharedPtr<Network>& network, const MAC& from, const MAC& to, unsigned int etherType, unsigned int vlanId, const void* data, unsigned int len);
 
-	/**
-	 * Determines the next drop schedule for packets in the TX queue
-	 *
-	 * @param t Current time
-	 * @param count Number of packets dropped this round
-	 */
-	uint64_t control_law(uint64_t t, int count);
-
-	/**
-	 * Selects a packet eligible for transmission from a TX queue. According to the control law, multiple packets
-	 * may be intentionally dropped before a packet is returned to the AQM scheduler.
-	 *
-	 * @param q The TX queue that is being dequeued from
-	 * @param now Current time
-	 */
-	dqr dodequeue(ManagedQueue* q, uint64_t now);
-
 	/**
 	 * Presents a packet to the AQM scheduler.
 	 *
@@ -126,15 +145,6 @@ class Switch {
 	 */
 	void aqm_dequeue(void* tPtr);
 
-	/**
-	 * Calls the dequeue mechanism and adjust queue state variables
-	 *
-	 * @param q The TX queue that is being dequeued from
-	 * @param isNew Whether or not this queue is in the NEW list
-	 * @param now Current time
-	 */
-	Switch::TXQueueEntry* CoDelDequeue(ManagedQueue* q, bool isNew, uint64_t now);
-
 	/**
 	 * Removes QoS Queues and flow state variables for a specific network. These queues are created
 	 * automatically upon the transmission of the first packet from this peer to another peer on the
@@ -197,12 +207,33 @@ class Switch {
 	 */
 	unsigned long doTimerTasks(void* tPtr, int64_t now);
 
+	/**
+	 * Set how many packets may be held at once for reassembly or WHOIS
+	 *
+	 * A single physical source may hold at most 1/ZT_RX_QUEUE_MAX_SOURCE_SHARE
+	 * of this. Shrinking takes effect as new packets displace old ones.
+	 *
+	 * @param n Capacity or 0 for ZT_RX_QUEUE_SIZE, capped at ZT_RX_QUEUE_MAX_SIZE
+	 */
+	void setRxQueueSize(unsigned long n);
+
   private:
 	bool _shouldUnite(const int64_t now, const Address& source, const Address& destination);
 	bool _trySend(void* tPtr, Packet& packet, bool encrypt, const uint64_t nwid, const int32_t flowId /* = ZT_QOS_NO_FLOW*/);
 	void _sendViaSpecificPath(void* tPtr, SharedPtr<Peer> peer, SharedPtr<Path> viaPath, uint16_t userSpecifiedMtu, int64_t now, Packet& packet, bool encrypt, int32_t flowId);
+	void _sendArmored(void* tPtr, const SharedPtr<Peer>& peer, const SharedPtr<Path>& viaPath, unsigned int mtu, int64_t now, Packet& packet, int32_t flowId);
 	void _recordOutgoingPacketMetrics(const Packet& p);
 
+	// Per-thread state of TxBatch and onRemotePackets(), see Switch.cpp
+	struct _TxBatchState;
+	struct _RxBatchState;
+	static _TxBatchState& _txBatchState();
+	static _RxBatchState& _rxBatchState();
+	void _txBatchFlush(_TxBatchState& b);
+	bool _rxBatchAdd(_RxBatchState& b, void* tPtr, const int64_t localSocket, const InetAddress& fromAddr, const void* data, unsigned int len);
+	void _rxBatchFlush(_RxBatchState& b);
+	void _rxWait(const IncomingPacket& packet, const SharedPtr<Path>& path, int64_t now, int32_t flowId);
+
 	const RuntimeEnvironment* const RR;
 	int64_t _lastBeaconResponse;
 	volatile int64_t _lastCheckedQueues;
@@ -213,42 +244,61 @@ class Switch {
 
 	// Packets waiting for WHOIS replies or other decode info or missing fragments
 	struct RXQueueEntry {
-		RXQueueEntry() : timestamp(0)
-		{
-		}
-		volatile int64_t timestamp;	  // 0 if entry is not in use
-		volatile uint64_t packetId;
+		int64_t timestamp;
+		uint64_t packetId;
 		IncomingPacket frag0;								   // head of packet
-		Packet::Fragment frags[ZT_MAX_PACKET_FRAGMENTS - 1];   // later fragments (if any)
+		Packet::Fragment* frags[ZT_MAX_PACKET_FRAGMENTS - 1];   // later fragments (pooled, NULL until received)
 		unsigned int totalFragments;						   // 0 if only frag0 received, waiting for frags
 		uint32_t haveFragments;								   // bit mask, LSB to MSB
-		volatile bool complete;								   // if true, packet is complete
-		volatile int32_t flowId;
+		bool complete;										   // if true, packet is complete
+		int32_t flowId;
+		unsigned int sourceBucket;							   // index in _rxSourceEntries of physical source
+		RXQueueEntry* older;								   // neighbors in shard's age list
+		RXQueueEntry* newer;
+	};
+
+	// Entries are indexed by packet ID and spread over shards that each hold
+	// an equal part of the capacity. An entry is only touched with its shard
+	// locked, or by a thread that has taken it out of the table to decode it.
+	// Each shard also links its entries from oldest to newest insertion, so
+	// a full shard evicts its oldest entry without a scan.
+	struct _RXShard {
+		_RXShard() : entries(8), oldest((RXQueueEntry*)0), newest((RXQueueEntry*)0)
+		{
+		}
 		Mutex lock;
+		Hashtable<uint64_t, RXQueueEntry*> entries;
+		RXQueueEntry* oldest;
+		RXQueueEntry* newest;
+		uint8_t pad[64];
 	};
-	RXQueueEntry _rxQueue[ZT_RX_QUEUE_SIZE];
-	AtomicCounter _rxQueuePtr;
+	_RXShard _rxQueue[ZT_RX_QUEUE_SHARDS];
+	std::atomic<unsigned long> _rxQueueSize;
+	std::atomic<unsigned int> _rxSourceEntries[ZT_RX_QUEUE_SOURCE_BUCKETS];	  // entries held per hashed source IP
+	BoundedQueue<RXQueueEntry*, ZT_RX_QUEUE_POOL_SIZE> _rxEntryPool;
+	BoundedQueue<Packet::Fragment*, ZT_RX_FRAGMENT_POOL_SIZE> _rxFragmentPool;
 
-	// Returns matching or next available RX queue entry
-	inline RXQueueEntry* _findRXQueueEntry(uint64_t packetId)
+	static inline uint64_t _hash64(uint64_t h)
 	{
-		const unsigned int current = static_cast<unsigned int>(_rxQueuePtr.load());
-		for (unsigned int k = 1; k <= ZT_RX_QUEUE_SIZE; ++k) {
-			RXQueueEntry* rq = &(_rxQueue[(current - k) % ZT_RX_QUEUE_SIZE]);
-			if ((rq->packetId == packetId) && (rq->timestamp)) {
-				return rq;
-			}
-		}
-		++_rxQueuePtr;
-		return &(_rxQueue[static_cast<unsigned int>(current) % ZT_RX_QUEUE_SIZE]);
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		return h;
 	}
-
-	// Returns current entry in rx queue ring buffer and increments ring pointer
-	inline RXQueueEntry* _nextRXQueueEntry()
+	inline _RXShard& _rxShard(const uint64_t packetId)
 	{
-		return &(_rxQueue[static_cast<unsigned int>((++_rxQueuePtr) - 1) % ZT_RX_QUEUE_SIZE]);
+		return _rxQueue[(unsigned long)(_hash64(packetId) % ZT_RX_QUEUE_SHARDS)];
 	}
 
+	RXQueueEntry* _rxNewEntry(const SharedPtr<Path>& path, uint64_t packetId, int64_t now, int32_t flowId, bool complete);
+	Packet::Fragment* _rxNewFragment(const Packet::Fragment& f);
+	void _rxFreeFragments(RXQueueEntry* rq);
+	void _rxFree(RXQueueEntry* rq);
+	void _rxInsert(_RXShard& s, RXQueueEntry* rq);
+	void _rxRemove(_RXShard& s, RXQueueEntry* rq);
+	void _rxDecode(void* tPtr, RXQueueEntry* rq);
+	void _rxRetry(void* tPtr, int64_t now, std::vector<Address>* needWhois);
+
 	// ZeroTier-layer TX queue entry
 	struct TXQueueEntry {
 		TXQueueEntry()
@@ -267,7 +317,6 @@ class Switch {
 	};
 	std::list<TXQueueEntry> _txQueue;
 	Mutex _txQueue_m;
-	Mutex _aqm_m;
 
 	// Tracks sending of VERB_RENDEZVOUS to relaying peers
 	struct _LastUniteKey {
@@ -298,29 +347,25 @@ class Switch {
 	Hashtable<_LastUniteKey, uint64_t> _lastUniteAttempt;	// key is always sorted in ascending order, for set-like behavior
 	Mutex _lastUniteAttempt_m;
 
-	// Queue with additional flow state variables
-	struct ManagedQueue {
-		ManagedQueue(int id) : id(id), byteCredit(ZT_AQM_QUANTUM), byteLength(0), dropping(false)
+	// Per-network AQM schedulers, striped over locks by network ID. A stripe's
+	// lock guards its table and every scheduler in it.
+	struct _AQMStripe {
+		_AQMStripe() : networks(8)
 		{
 		}
-		int id;
-		int byteCredit;
-		int byteLength;
-		uint64_t first_above_time;
-		uint32_t count;
-		uint64_t drop_next;
-		bool dropping;
-		uint64_t drop_next_time;
-		std::list<TXQueueEntry*> q;
-	};
-	// To implement fq_codel we need to maintain a queue of queues
-	struct NetworkQoSControlBlock {
-		int _currEnqueuedPackets;
-		std::vector<ManagedQueue*> newQueues;
-		std::vector<ManagedQueue*> oldQueues;
-		std::vector<ManagedQueue*> inactiveQueues;
+		Mutex lock;
+		Hashtable<uint64_t, AQMScheduler*> networks;
+		uint8_t pad[64];
 	};
-	std::map<uint64_t, NetworkQoSControlBlock*> _netQueueControlBlock;
+	_AQMStripe _aqm[ZT_AQM_STRIPES];
+	BoundedQueue<AQMScheduler::Entry*, ZT_AQM_POOL_SIZE> _aqmEntryPool;
+
+	inline _AQMStripe& _aqmStripe(const uint64_t nwid)
+	{
+		return _aqm[(unsigned long)(_hash64(nwid) % ZT_AQM_STRIPES)];
+	}
+	void _aqmSend(void* tPtr, AQMScheduler* sched, int64_t now, AQMScheduler::Entry*& done);
+	void _aqmFree(AQMScheduler::Entry* list);
 };
 
 }	// namespace ZeroTier
@@ -24,6 +24,7 @@
 namespace ZeroTier {
 
 class RuntimeEnvironment;
+class SignatureBatch;
 
 /**
  * A tag that can be associated with members and matched in rules
@@ -114,9 +115,10 @@ class Tag : public Credential {
 	 *
 	 * @param RR Runtime environment to allow identity lookup for signedBy
 	 * @param tPtr Thread pointer to be handed through to any callbacks called as a result of this call
+	 * @param batch If non-NULL, signatures are added to this batch instead of checked and 0 means OK if the batch verifies
 	 * @return 0 == OK, 1 == waiting for WHOIS, -1 == BAD signature or tag
 	 */
-	int verify(const RuntimeEnvironment* RR, void* tPtr) const;
+	int verify(const RuntimeEnvironment* RR, void* tPtr, SignatureBatch* batch = (SignatureBatch*)0) const;
 
 	template <unsigned int C> inline void serialize(Buffer<C>& b, const bool forSign = false) const
 	{
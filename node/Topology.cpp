@@ -36,7 +36,7 @@ static const unsigned char ZT_DEFAULT_WORLD[ZT_DEFAULT_WORLD_LENGTH] = {
 	0x39, 0x7c, 0xc8, 0xa5, 0xd9, 0xd1, 0x52, 0x85, 0xa8, 0x7f, 0x00, 0x02, 0x04, 0x54, 0x11, 0x35, 0x9b, 0x27, 0x09, 0x06, 0x2a, 0x02, 0x6e, 0xa0, 0xd4, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x99, 0x93, 0x27, 0x09
 };
 
-Topology::Topology(const RuntimeEnvironment* renv, void* tPtr) : RR(renv), _numConfiguredPhysicalPaths(0), _amUpstream(false)
+Topology::Topology(const RuntimeEnvironment* renv, void* tPtr) : RR(renv), _numConfiguredPhysicalPaths(0), _amUpstream(false), _housekeepingStep(0)
 {
 	uint8_t tmp[ZT_WORLD_MAX_SERIALIZED_LENGTH];
 	uint64_t idtmp[2];
@@ -63,26 +63,15 @@ Topology::Topology(const RuntimeEnvironment* renv, void* tPtr) : RR(renv), _numC
 
 Topology::~Topology()
 {
-	Hashtable<Address, SharedPtr<Peer> >::Iterator i(_peers);
-	Address* a = (Address*)0;
-	SharedPtr<Peer>* p = (SharedPtr<Peer>*)0;
-	while (i.next(a, p)) {
-		_savePeer((void*)0, *p);
+	const std::vector<std::pair<Address, SharedPtr<Peer> > > pl(_peers.entries());
+	for (std::vector<std::pair<Address, SharedPtr<Peer> > >::const_iterator p(pl.begin()); p != pl.end(); ++p) {
+		_savePeer((void*)0, p->second);
 	}
 }
 
 SharedPtr<Peer> Topology::addPeer(void* tPtr, const SharedPtr<Peer>& peer)
 {
-	SharedPtr<Peer> np;
-	{
-		Mutex::Lock _l(_peers_m);
-		SharedPtr<Peer>& hp = _peers[peer->address()];
-		if (! hp) {
-			hp = peer;
-		}
-		np = hp;
-	}
-	return np;
+	return _peers.getOrAdd(peer->address(), _ExistingPeer(peer));
 }
 
 SharedPtr<Peer> Topology::getPeer(void* tPtr, const Address& zta)
@@ -92,10 +81,9 @@ SharedPtr<Peer> Topology::getPeer(void* tPtr, const Address& zta)
 	}
 
 	{
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer>* const ap = _peers.get(zta);
-		if (ap) {
-			return *ap;
+		SharedPtr<Peer> ap;
+		if (_peers.get(zta, ap)) {
+			return ap;
 		}
 	}
 
@@ -107,14 +95,14 @@ SharedPtr<Peer> Topology::getPeer(void* tPtr, const Address& zta)
 		int len = RR->node->stateObjectGet(tPtr, ZT_STATE_OBJECT_PEER, idbuf, buf.unsafeData(), ZT_PEER_MAX_SERIALIZED_STATE_SIZE);
 		if (len > 0) {
 			buf.setSize(len);
-			Mutex::Lock _l(_peers_m);
-			SharedPtr<Peer>& ap = _peers[zta];
-			if (ap) {
+			SharedPtr<Peer> ap;
+			if (_peers.get(zta, ap)) {
 				return ap;
 			}
 			ap = Peer::deserializeFromCache(RR->node->now(), tPtr, buf, RR);
-			if (! ap) {
-				_peers.erase(zta);
+			if (ap) {
+				_rememberIdentity(ap, RR->node->now());
+				_peers.getOrAdd(zta, _ExistingPeer(ap));
 			}
 			return SharedPtr<Peer>();
 		}
@@ -125,16 +113,22 @@ SharedPtr<Peer> Topology::getPeer(void* tPtr, const Address& zta)
 	return SharedPtr<Peer>();
 }
 
+bool Topology::knownIdentityKey(const Identity& id, uint8_t key[ZT_SYMMETRIC_KEY_SIZE], const int64_t now)
+{
+	_KnownIdentityHit hit(id, key, now);
+	_knownIdentities.update(id.address(), hit);
+	return hit.found;
+}
+
 Identity Topology::getIdentity(void* tPtr, const Address& zta)
 {
 	if (zta == RR->identity.address()) {
 		return RR->identity;
 	}
 	else {
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer>* const ap = _peers.get(zta);
-		if (ap) {
-			return (*ap)->identity();
+		SharedPtr<Peer> ap;
+		if (_peers.get(zta, ap)) {
+			return ap->identity();
 		}
 	}
 	return Identity();
@@ -144,7 +138,7 @@ SharedPtr<Peer> Topology::getUpstreamPeer(const uint64_t nwid)
 {
 	const int64_t now = RR->node->now();
 	unsigned int bestq = ~((unsigned int)0);
-	const SharedPtr<Peer>* best = (const SharedPtr<Peer>*)0;
+	SharedPtr<Peer> best;
 
 	/*
 	// If this is related to a network, check for a network specific relay.
@@ -158,12 +152,11 @@ SharedPtr<Peer> Topology::getUpstreamPeer(const uint64_t nwid)
 
 	// If this is unrelated to a network OR there is no network-specific relay, send via a root.
 	{
-		Mutex::Lock _l2(_peers_m);
 		Mutex::Lock _l1(_upstreams_m);
 		for (std::vector<Address>::const_iterator a(_upstreamAddresses.begin()); a != _upstreamAddresses.end(); ++a) {
-			const SharedPtr<Peer>* p = _peers.get(*a);
-			if (p) {
-				const unsigned int q = (*p)->relayQuality(now);
+			SharedPtr<Peer> p;
+			if (_peers.get(*a, p)) {
+				const unsigned int q = p->relayQuality(now);
 				if (q <= bestq) {
 					bestq = q;
 					best = p;
@@ -171,7 +164,7 @@ SharedPtr<Peer> Topology::getUpstreamPeer(const uint64_t nwid)
 			}
 		}
 		if (best) {
-			return *best;
+			return best;
 		}
 	}
 
@@ -289,7 +282,6 @@ bool Topology::addWorld(void* tPtr, const World& newWorld, bool alwaysAcceptNew)
 		return false;
 	}
 
-	Mutex::Lock _l2(_peers_m);
 	Mutex::Lock _l1(_upstreams_m);
 
 	World* existing = (World*)0;
@@ -393,7 +385,6 @@ void Topology::addMoon(void* tPtr, const uint64_t id, const Address& seed)
 
 void Topology::removeMoon(void* tPtr, const uint64_t id)
 {
-	Mutex::Lock _l2(_peers_m);
 	Mutex::Lock _l1(_upstreams_m);
 
 	std::vector<World> nm;
@@ -423,36 +414,48 @@ void Topology::removeMoon(void* tPtr, const uint64_t id)
 
 void Topology::doPeriodicTasks(void* tPtr, int64_t now)
 {
+	// Sweep this step's share of the peer and path table shards, so no single call walks every peer and path
+	const unsigned int step = _housekeepingStep;
+	_housekeepingStep = (step + 1) % ZT_TOPOLOGY_HOUSEKEEPING_STEPS;
+
 	{
-		Mutex::Lock _l1(_peers_m);
-		Mutex::Lock _l2(_upstreams_m);
-		Hashtable<Address, SharedPtr<Peer> >::Iterator i(_peers);
-		Address* a = (Address*)0;
-		SharedPtr<Peer>* p = (SharedPtr<Peer>*)0;
-		while (i.next(a, p)) {
-			if ((! (*p)->isAlive(now)) && (std::find(_upstreamAddresses.begin(), _upstreamAddresses.end(), *a) == _upstreamAddresses.end())) {
-				_savePeer(tPtr, *p);
-				_peers.erase(*a);
+		std::vector<SharedPtr<Peer> > dead;
+		const std::vector<Address> upstreams(upstreamAddresses());
+		_DeadPeer deadPeer(now, upstreams, dead);
+		const unsigned int last = (_peers.shards() * (step + 1)) / ZT_TOPOLOGY_HOUSEKEEPING_STEPS;
+		for (unsigned int s = (_peers.shards() * step) / ZT_TOPOLOGY_HOUSEKEEPING_STEPS; s < last; ++s) {
+			_peers.shardEraseIf(s, deadPeer);
+		}
+		for (std::vector<SharedPtr<Peer> >::const_iterator p(dead.begin()); p != dead.end(); ++p) {
+			_rememberIdentity(*p, now);
+			_savePeer(tPtr, *p);
+		}
+	}
+
+	// Past the limit, forget identities last used before the mean time until back under 3/4 of it
+	if (step == 0) {
+		const unsigned long known = _knownIdentities.size();
+		if (known > ZT_TOPOLOGY_MAX_KNOWN_IDENTITIES) {
+			_KnownIdentityMeanAge age;
+			_knownIdentities.each(age);
+			if (age.count) {
+				_knownIdentities.eraseIf(_StaleKnownIdentity((int64_t)(age.total / (double)age.count), known - ((ZT_TOPOLOGY_MAX_KNOWN_IDENTITIES / 4) * 3)));
 			}
 		}
 	}
 
 	{
-		Mutex::Lock _l(_paths_m);
-		Hashtable<Path::HashKey, SharedPtr<Path> >::Iterator i(_paths);
-		Path::HashKey* k = (Path::HashKey*)0;
-		SharedPtr<Path>* p = (SharedPtr<Path>*)0;
-		while (i.next(k, p)) {
-			if (p->references() <= 1) {
-				_paths.erase(*k);
-			}
+		_PathUnreferenced unreferenced;
+		const unsigned int last = (_paths.shards() * (step + 1)) / ZT_TOPOLOGY_HOUSEKEEPING_STEPS;
+		for (unsigned int s = (_paths.shards() * step) / ZT_TOPOLOGY_HOUSEKEEPING_STEPS; s < last; ++s) {
+			_paths.shardEraseIf(s, unreferenced);
 		}
 	}
 }
 
 void Topology::_memoizeUpstreams(void* tPtr)
 {
-	// assumes _upstreams_m and _peers_m are locked
+	// assumes _upstreams_m is locked
 	_upstreamAddresses.clear();
 	_amUpstream = false;
 
@@ -463,10 +466,7 @@ void Topology::_memoizeUpstreams(void* tPtr)
 		}
 		else if (std::find(_upstreamAddresses.begin(), _upstreamAddresses.end(), id.address()) == _upstreamAddresses.end()) {
 			_upstreamAddresses.push_back(id.address());
-			SharedPtr<Peer>& hp = _peers[id.address()];
-			if (! hp) {
-				hp = new Peer(RR, RR->identity, id);
-			}
+			_peers.getOrAdd(id.address(), _NewUpstreamPeer(RR, RR->identity, id));
 		}
 	}
 
@@ -477,10 +477,7 @@ void Topology::_memoizeUpstreams(void* tPtr)
 			}
 			else if (std::find(_upstreamAddresses.begin(), _upstreamAddresses.end(), i->identity.address()) == _upstreamAddresses.end()) {
 				_upstreamAddresses.push_back(i->identity.address());
-				SharedPtr<Peer>& hp = _peers[i->identity.address()];
-				if (! hp) {
-					hp = new Peer(RR, RR->identity, i->identity);
-				}
+				_peers.getOrAdd(i->identity.address(), _NewUpstreamPeer(RR, RR->identity, i->identity));
 			}
 		}
 	}
@@ -488,6 +485,15 @@ void Topology::_memoizeUpstreams(void* tPtr)
 	std::sort(_upstreamAddresses.begin(), _upstreamAddresses.end());
 }
 
+void Topology::_rememberIdentity(const SharedPtr<Peer>& peer, int64_t now)
+{
+	_KnownIdentity k;
+	k.id = peer->identity();
+	memcpy(k.key, peer->key(), ZT_SYMMETRIC_KEY_SIZE);
+	k.lastUsed = now;
+	_knownIdentities.set(peer->address(), k);
+}
+
 void Topology::_savePeer(void* tPtr, const SharedPtr<Peer>& peer)
 {
 	try {
@@ -17,6 +17,7 @@
 #include "Mutex.hpp"
 #include "Path.hpp"
 #include "Peer.hpp"
+#include "ShardedHashtable.hpp"
 #include "World.hpp"
 
 #include <algorithm>
@@ -64,6 +65,21 @@ class Topology {
 	 */
 	Identity getIdentity(void* tPtr, const Address& zta);
 
+	/**
+	 * Look up the key agreed with an identity that has already been validated
+	 *
+	 * Identities are remembered when their peers leave memory or are loaded
+	 * from the peer cache, so a HELLO from a returning peer can skip both key
+	 * agreement and locallyValidate(). A hit counts as a use, so identities
+	 * that keep coming back are the last to be forgotten.
+	 *
+	 * @param id Identity (must exactly match the remembered identity)
+	 * @param key Buffer to receive agreed key
+	 * @param now Current time
+	 * @return True if identity is known
+	 */
+	bool knownIdentityKey(const Identity& id, uint8_t key[ZT_SYMMETRIC_KEY_SIZE], int64_t now);
+
 	/**
 	 * Get a peer only if it is presently in memory (no disk cache)
 	 *
@@ -76,29 +92,24 @@ class Topology {
 	 */
 	inline SharedPtr<Peer> getPeerNoCache(const Address& zta)
 	{
-		Mutex::Lock _l(_peers_m);
-		const SharedPtr<Peer>* const ap = _peers.get(zta);
-		if (ap) {
-			return *ap;
-		}
-		return SharedPtr<Peer>();
+		SharedPtr<Peer> p;
+		_peers.get(zta, p);
+		return p;
 	}
 
 	/**
 	 * Get a Path object for a given local and remote physical address, creating if needed
 	 *
+	 * This is called for every inbound packet and only locks one shard of
+	 * the path table, so RX threads rarely contend with each other.
+	 *
 	 * @param l Local socket
 	 * @param r Remote address
 	 * @return Pointer to canonicalized Path object
 	 */
 	inline SharedPtr<Path> getPath(const int64_t l, const InetAddress& r)
 	{
-		Mutex::Lock _l(_paths_m);
-		SharedPtr<Path>& p = _paths[Path::HashKey(l, r)];
-		if (! p) {
-			p.set(new Path(l, r));
-		}
-		return p;
+		return _paths.getOrAdd(Path::HashKey(l, r), _PathFactory(l, r));
 	}
 
 	/**
@@ -239,6 +250,10 @@ class Topology {
 
 	/**
 	 * Clean and flush database
+	 *
+	 * Each call sweeps the next 1/ZT_TOPOLOGY_HOUSEKEEPING_STEPS of the peer
+	 * and path tables, so this should be called ZT_TOPOLOGY_HOUSEKEEPING_STEPS
+	 * times per ZT_HOUSEKEEPING_PERIOD.
 	 */
 	void doPeriodicTasks(void* tPtr, int64_t now);
 
@@ -249,14 +264,14 @@ class Topology {
 	inline unsigned long countActive(int64_t now) const
 	{
 		unsigned long cnt = 0;
-		Mutex::Lock _l(_peers_m);
-		Hashtable<Address, SharedPtr<Peer> >::Iterator i(const_cast<Topology*>(this)->_peers);
-		Address* a = (Address*)0;
-		SharedPtr<Peer>* p = (SharedPtr<Peer>*)0;
-		while (i.next(a, p)) {
-			const SharedPtr<Path> pp((*p)->getAppropriatePath(now, false));
-			if (pp) {
-				++cnt;
+		std::vector<std::pair<Address, SharedPtr<Peer> > > sp;
+		for (unsigned int s = 0; s < _peers.shards(); ++s) {
+			_peers.shardEntries(s, sp);
+			for (std::vector<std::pair<Address, SharedPtr<Peer> > >::const_iterator i(sp.begin()); i != sp.end(); ++i) {
+				const SharedPtr<Path> pp(i->second->getAppropriatePath(now, false));
+				if (pp) {
+					++cnt;
+				}
 			}
 		}
 		return cnt;
@@ -265,26 +280,59 @@ class Topology {
 	/**
 	 * Apply a function or function object to all peers
 	 *
+	 * The function is applied to a copy of each shard of the peer table with
+	 * no lock held, so long sweeps never block packet path peer lookups. Peers
+	 * added or removed during the sweep may or may not be visited.
+	 *
 	 * @param f Function to apply
 	 * @tparam F Function or function object type
 	 */
 	template <typename F> inline void eachPeer(F f)
 	{
-		Mutex::Lock _l(_peers_m);
-		Hashtable<Address, SharedPtr<Peer> >::Iterator i(_peers);
-		Address* a = (Address*)0;
-		SharedPtr<Peer>* p = (SharedPtr<Peer>*)0;
-		while (i.next(a, p)) {
-			f(*this, *((const SharedPtr<Peer>*)p));
+		for (unsigned int s = 0; s < _peers.shards(); ++s) {
+			eachPeerInShard<F&>(s, f);
 		}
 	}
 
+	/**
+	 * Apply a function or function object to the peers in one shard of the peer table
+	 *
+	 * This works like eachPeer() and lets callers spread a sweep over time.
+	 *
+	 * @param s Shard index, less than peerShards()
+	 * @param f Function to apply
+	 * @tparam F Function or function object type
+	 */
+	template <typename F> inline void eachPeerInShard(const unsigned int s, F f)
+	{
+		std::vector<std::pair<Address, SharedPtr<Peer> > > sp;
+		_peers.shardEntries(s, sp);
+		for (std::vector<std::pair<Address, SharedPtr<Peer> > >::const_iterator i(sp.begin()); i != sp.end(); ++i) {
+			f(*this, i->second);
+		}
+	}
+
+	/**
+	 * @return Number of shards in the peer table
+	 */
+	static inline unsigned int peerShards()
+	{
+		return ShardedHashtable<Address, SharedPtr<Peer> >::shards();
+	}
+
+	/**
+	 * @return Number of peers in memory (approximate if peers are being added or removed)
+	 */
+	inline unsigned long peerCount() const
+	{
+		return _peers.size();
+	}
+
 	/**
 	 * @return All currently active peers by address (unsorted)
 	 */
 	inline std::vector<std::pair<Address, SharedPtr<Peer> > > allPeers() const
 	{
-		Mutex::Lock _l(_peers_m);
 		return _peers.entries();
 	}
 
@@ -411,17 +459,131 @@ class Topology {
 	Identity _getIdentity(void* tPtr, const Address& zta);
 	void _memoizeUpstreams(void* tPtr);
 	void _savePeer(void* tPtr, const SharedPtr<Peer>& peer);
+	void _rememberIdentity(const SharedPtr<Peer>& peer, int64_t now);
+
+	struct _KnownIdentity {
+		_KnownIdentity() : lastUsed(0)
+		{
+		}
+		~_KnownIdentity()
+		{
+			Utils::burn(key, sizeof(key));
+		}
+		Identity id;
+		uint8_t key[ZT_SYMMETRIC_KEY_SIZE];
+		int64_t lastUsed;
+	};
+	struct _KnownIdentityHit {
+		_KnownIdentityHit(const Identity& id, uint8_t* key, const int64_t now) : id(id), key(key), now(now), found(false)
+		{
+		}
+		inline void operator()(_KnownIdentity& k)
+		{
+			if (k.id == id) {
+				memcpy(key, k.key, ZT_SYMMETRIC_KEY_SIZE);
+				k.lastUsed = now;
+				found = true;
+			}
+		}
+		const Identity& id;
+		uint8_t* const key;
+		const int64_t now;
+		bool found;
+	};
+	struct _KnownIdentityMeanAge {
+		_KnownIdentityMeanAge() : total(0), count(0)
+		{
+		}
+		inline void operator()(const Address&, const _KnownIdentity& k)
+		{
+			total += (double)k.lastUsed;
+			++count;
+		}
+		double total;
+		unsigned long count;
+	};
+	struct _StaleKnownIdentity {
+		_StaleKnownIdentity(const int64_t cutoff, const unsigned long budget) : cutoff(cutoff), budget(budget)
+		{
+		}
+		inline bool operator()(const Address&, const _KnownIdentity& k)
+		{
+			if ((budget) && (k.lastUsed <= cutoff)) {
+				--budget;
+				return true;
+			}
+			return false;
+		}
+		const int64_t cutoff;
+		unsigned long budget;
+	};
+
+	struct _PathFactory {
+		_PathFactory(const int64_t l, const InetAddress& r) : l(l), r(r)
+		{
+		}
+		inline SharedPtr<Path> operator()(const Path::HashKey&) const
+		{
+			return SharedPtr<Path>(new Path(l, r));
+		}
+		const int64_t l;
+		const InetAddress& r;
+	};
+	struct _PathUnreferenced {
+		inline bool operator()(const Path::HashKey&, SharedPtr<Path>& p) const
+		{
+			return (p.references() <= 1);
+		}
+	};
+	struct _ExistingPeer {
+		_ExistingPeer(const SharedPtr<Peer>& p) : p(p)
+		{
+		}
+		inline SharedPtr<Peer> operator()(const Address&) const
+		{
+			return p;
+		}
+		const SharedPtr<Peer>& p;
+	};
+	struct _NewUpstreamPeer {
+		_NewUpstreamPeer(const RuntimeEnvironment* renv, const Identity& myIdentity, const Identity& id) : RR(renv), myIdentity(myIdentity), id(id)
+		{
+		}
+		inline SharedPtr<Peer> operator()(const Address&) const
+		{
+			return SharedPtr<Peer>(new Peer(RR, myIdentity, id));
+		}
+		const RuntimeEnvironment* const RR;
+		const Identity& myIdentity;
+		const Identity& id;
+	};
+	struct _DeadPeer {
+		_DeadPeer(const int64_t now, const std::vector<Address>& upstreams, std::vector<SharedPtr<Peer> >& dead) : now(now), upstreams(upstreams), dead(dead)
+		{
+		}
+		inline bool operator()(const Address& a, SharedPtr<Peer>& p)
+		{
+			if ((! p->isAlive(now)) && (! std::binary_search(upstreams.begin(), upstreams.end(), a))) {
+				dead.push_back(p);
+				return true;
+			}
+			return false;
+		}
+		const int64_t now;
+		const std::vector<Address>& upstreams;
+		std::vector<SharedPtr<Peer> >& dead;
+	};
 
 	const RuntimeEnvironment* const RR;
 
 	std::pair<InetAddress, ZT_PhysicalPathConfiguration> _physicalPathConfig[ZT_MAX_CONFIGURABLE_PATHS];
 	volatile unsigned int _numConfiguredPhysicalPaths;
 
-	Hashtable<Address, SharedPtr<Peer> > _peers;
-	Mutex _peers_m;
+	ShardedHashtable<Address, SharedPtr<Peer> > _peers;
+
+	ShardedHashtable<Path::HashKey, SharedPtr<Path> > _paths;
 
-	Hashtable<Path::HashKey, SharedPtr<Path> > _paths;
-	Mutex _paths_m;
+	ShardedHashtable<Address, _KnownIdentity> _knownIdentities;
 
 	World _planet;
 	std::vector<World> _moons;
@@ -429,6 +591,8 @@ class Topology {
 	std::vector<Address> _upstreamAddresses;
 	bool _amUpstream;
 	Mutex _upstreams_m;	  // locks worlds, upstream info, moon info, etc.
+
+	unsigned int _housekeepingStep;	  // next step of doPeriodicTasks(), only accessed from the background task thread
 };
 
 }	// namespace ZeroTier
@@ -151,7 +151,7 @@ void DB::cleanMember(nlohmann::json& member)
 	member.erase("authenticationClientID");	  // computed
 }
 
-DB::DB()
+DB::DB() : _changeSeq(0)
 {
 }
 DB::~DB()
@@ -293,6 +293,52 @@ void DB::networks(std::set<uint64_t>& networks)
 		networks.insert(n->first);
 }
 
+bool DB::isIpAllocated(const uint64_t networkId, const InetAddress& ip)
+{
+	std::shared_ptr<_Network> nw;
+	{
+		std::shared_lock<std::shared_mutex> l(_networks_l);
+		auto nwi = _networks.find(networkId);
+		if (nwi == _networks.end())
+			return false;
+		nw = nwi->second;
+	}
+	InetAddress ipa(ip);
+	ipa.setPort(0);
+	std::shared_lock<std::shared_mutex> l2(nw->lock);
+	return (nw->allocatedIps.find(ipa) != nw->allocatedIps.end());
+}
+
+bool DB::nextFreeIpv4(const uint64_t networkId, const uint32_t first, const uint32_t last, uint32_t& ip)
+{
+	if (first > last)
+		return false;
+	std::shared_ptr<_Network> nw;
+	{
+		std::shared_lock<std::shared_mutex> l(_networks_l);
+		auto nwi = _networks.find(networkId);
+		if (nwi == _networks.end()) {
+			ip = first;
+			return true;
+		}
+		nw = nwi->second;
+	}
+	std::shared_lock<std::shared_mutex> l2(nw->lock);
+	uint32_t a = first;
+	auto run = nw->allocatedIpv4Ranges.upper_bound(a);
+	if (run != nw->allocatedIpv4Ranges.begin()) {
+		--run;
+		if (run->second >= a) {
+			// Runs are kept merged, so the address after a run is always free
+			if (run->second >= last)
+				return false;
+			a = run->second + 1;
+		}
+	}
+	ip = a;
+	return true;
+}
+
 void DB::_memberChanged(nlohmann::json& old, nlohmann::json& memberConfig, bool notifyListeners)
 {
 	auto provider = opentelemetry::trace::Provider::GetTracerProvider();
@@ -335,7 +381,7 @@ void DB::_memberChanged(nlohmann::json& old, nlohmann::json& memberConfig, bool
 							const std::string ips = ipj;
 							InetAddress ipa(ips.c_str());
 							ipa.setPort(0);
-							nw->allocatedIps.erase(ipa);
+							_releaseIp(*nw, ipa);
 						}
 					}
 				}
@@ -377,7 +423,7 @@ void DB::_memberChanged(nlohmann::json& old, nlohmann::json& memberConfig, bool
 						const std::string ips = ipj;
 						InetAddress ipa(ips.c_str());
 						ipa.setPort(0);
-						nw->allocatedIps.insert(ipa);
+						_allocateIp(*nw, ipa);
 					}
 				}
 			}
@@ -389,6 +435,8 @@ void DB::_memberChanged(nlohmann::json& old, nlohmann::json& memberConfig, bool
 			}
 		}
 
+		_recordChanged(networkId, memberId);
+
 		if (notifyListeners) {
 			std::unique_lock<std::shared_mutex> ll(_changeListeners_l);
 			for (auto i = _changeListeners.begin(); i != _changeListeners.end(); ++i) {
@@ -401,6 +449,7 @@ void DB::_memberChanged(nlohmann::json& old, nlohmann::json& memberConfig, bool
 			std::unique_lock<std::shared_mutex> l(nw->lock);
 			nw->members.erase(memberId);
 		}
+		_forgetChanges(networkId, memberId);
 		if (networkId) {
 			std::unique_lock<std::shared_mutex> l(_networks_l);
 			auto er = _networkByMember.equal_range(memberId);
@@ -481,6 +530,7 @@ void DB::_networkChanged(nlohmann::json& old, nlohmann::json& networkConfig, boo
 				std::unique_lock<std::shared_mutex> l2(nw->lock);
 				nw->config = networkConfig;
 			}
+			_recordChanged(networkId, 0);
 			if (notifyListeners) {
 				std::unique_lock<std::shared_mutex> ll(_changeListeners_l);
 				for (auto i = _changeListeners.begin(); i != _changeListeners.end(); ++i) {
@@ -511,6 +561,8 @@ void DB::_networkChanged(nlohmann::json& old, nlohmann::json& networkConfig, boo
 				std::cerr << "Error deauthorizing members on network delete: " << e.what() << std::endl;
 			}
 
+			_forgetChanges(networkId, 0);
+
 			// delete the network
 			std::unique_lock<std::shared_mutex> l(_networks_l);
 			_networks.erase(networkId);
@@ -518,6 +570,26 @@ void DB::_networkChanged(nlohmann::json& old, nlohmann::json& networkConfig, boo
 	}
 }
 
+void DB::_recordChanged(const uint64_t networkId, const uint64_t memberId)
+{
+	std::lock_guard<std::mutex> l(_changes_l);
+	uint64_t& seq = _changeSeqByRecord[std::pair<uint64_t, uint64_t>(networkId, memberId)];
+	if (seq)
+		_changes.erase(seq);
+	seq = ++_changeSeq;
+	_changes[seq] = std::pair<uint64_t, uint64_t>(networkId, memberId);
+}
+
+void DB::_forgetChanges(const uint64_t networkId, const uint64_t memberId)
+{
+	std::lock_guard<std::mutex> l(_changes_l);
+	auto r = _changeSeqByRecord.lower_bound(std::pair<uint64_t, uint64_t>(networkId, memberId));
+	while ((r != _changeSeqByRecord.end()) && (r->first.first == networkId) && ((! memberId) || (r->first.second == memberId))) {
+		_changes.erase(r->second);
+		r = _changeSeqByRecord.erase(r);
+	}
+}
+
 void DB::_fillSummaryInfo(const std::shared_ptr<_Network>& nw, NetworkSummaryInfo& info)
 {
 	auto provider = opentelemetry::trace::Provider::GetTracerProvider();
@@ -528,12 +600,49 @@ void DB::_fillSummaryInfo(const std::shared_ptr<_Network>& nw, NetworkSummaryInf
 	for (auto ab = nw->activeBridgeMembers.begin(); ab != nw->activeBridgeMembers.end(); ++ab)
 		info.activeBridges.push_back(Address(*ab));
 	std::sort(info.activeBridges.begin(), info.activeBridges.end());
-	for (auto ip = nw->allocatedIps.begin(); ip != nw->allocatedIps.end(); ++ip)
-		info.allocatedIps.push_back(*ip);
-	std::sort(info.allocatedIps.begin(), info.allocatedIps.end());
 	info.authorizedMemberCount = (unsigned long)nw->authorizedMembers.size();
 	info.totalMemberCount = (unsigned long)nw->members.size();
 	info.mostRecentDeauthTime = nw->mostRecentDeauthTime;
 }
 
+void DB::_allocateIp(_Network& nw, const InetAddress& ip)
+{
+	if ((! nw.allocatedIps.insert(ip).second) || (ip.ss_family != AF_INET))
+		return;
+	const uint32_t a = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in*>(&ip)->sin_addr.s_addr));
+	uint32_t first = a, last = a;
+	auto next = nw.allocatedIpv4Ranges.upper_bound(a);
+	if ((next != nw.allocatedIpv4Ranges.end()) && (next->first == (a + 1))) {
+		last = next->second;
+		next = nw.allocatedIpv4Ranges.erase(next);
+	}
+	if (next != nw.allocatedIpv4Ranges.begin()) {
+		auto prev = std::prev(next);
+		if ((prev->second + 1) == a) {
+			first = prev->first;
+			nw.allocatedIpv4Ranges.erase(prev);
+		}
+	}
+	nw.allocatedIpv4Ranges[first] = last;
+}
+
+void DB::_releaseIp(_Network& nw, const InetAddress& ip)
+{
+	if ((! nw.allocatedIps.erase(ip)) || (ip.ss_family != AF_INET))
+		return;
+	const uint32_t a = Utils::ntoh((uint32_t)(reinterpret_cast<const struct sockaddr_in*>(&ip)->sin_addr.s_addr));
+	auto run = nw.allocatedIpv4Ranges.upper_bound(a);
+	if (run == nw.allocatedIpv4Ranges.begin())
+		return;
+	--run;
+	if (run->second < a)
+		return;
+	const uint32_t first = run->first, last = run->second;
+	nw.allocatedIpv4Ranges.erase(run);
+	if (first < a)
+		nw.allocatedIpv4Ranges[first] = a - 1;
+	if (last > a)
+		nw.allocatedIpv4Ranges[a + 1] = last;
+}
+
 }	// namespace ZeroTier
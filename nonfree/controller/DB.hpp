@@ -16,6 +16,7 @@
 #include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <prometheus/simpleapi.h>
 #include <set>
@@ -77,7 +78,6 @@ class DB {
 		{
 		}
 		std::vector<Address> activeBridges;
-		std::vector<InetAddress> allocatedIps;
 		unsigned long authorizedMemberCount;
 		unsigned long totalMemberCount;
 		int64_t mostRecentDeauthTime;
@@ -107,11 +107,44 @@ class DB {
 
 	void networks(std::set<uint64_t>& networks);
 
+	/**
+	 * @param networkId Network ID
+	 * @param ip IP address (port is ignored)
+	 * @return True if ip is assigned to any member of this network
+	 */
+	bool isIpAllocated(const uint64_t networkId, const InetAddress& ip);
+
+	/**
+	 * Find the first IPv4 address in a range that is not assigned to any member
+	 *
+	 * @param networkId Network ID
+	 * @param first First address in range in host byte order
+	 * @param last Last address in range in host byte order
+	 * @param ip Set to free address in host byte order if one is found
+	 * @return True if a free address was found
+	 */
+	bool nextFreeIpv4(const uint64_t networkId, const uint32_t first, const uint32_t last, uint32_t& ip);
+
+	/**
+	 * Call a function for every network and member
+	 *
+	 * This iterates over a snapshot of the network list and holds only a shared
+	 * lock on one network at a time, so reads proceed while it runs. Networks
+	 * and members added or removed during iteration may or may not be seen.
+	 * The function must not save to this DB.
+	 */
 	template <typename F> inline void each(F f)
 	{
 		nlohmann::json nullJson;
-		std::unique_lock<std::shared_mutex> lck(_networks_l);
-		for (auto nw = _networks.begin(); nw != _networks.end(); ++nw) {
+		std::vector<std::pair<uint64_t, std::shared_ptr<_Network> > > nws;
+		{
+			std::shared_lock<std::shared_mutex> lck(_networks_l);
+			nws.reserve(_networks.size());
+			for (auto nw = _networks.begin(); nw != _networks.end(); ++nw)
+				nws.push_back(*nw);
+		}
+		for (auto nw = nws.begin(); nw != nws.end(); ++nw) {
+			std::shared_lock<std::shared_mutex> l2(nw->second->lock);
 			f(nw->first, nw->second->config, 0, nullJson);	 // first provide network with 0 for member ID
 			for (auto m = nw->second->members.begin(); m != nw->second->members.end(); ++m) {
 				f(nw->first, nw->second->config, m->first, m->second);
@@ -119,6 +152,55 @@ class DB {
 		}
 	}
 
+	/**
+	 * Call a function for every network and member changed after a point in this DB's change sequence
+	 *
+	 * Each record is visited once with its current contents, in the order in
+	 * which records were last changed. Networks are passed with 0 for member ID
+	 * and a null member. Records deleted since they changed are skipped.
+	 *
+	 * @param since Change sequence number returned by a previous call, or 0 for all records
+	 * @param f Function called with network ID, network, member ID, and member
+	 * @return Change sequence number of the most recent change visited (or since if none)
+	 */
+	template <typename F> inline uint64_t eachChangedSince(const uint64_t since, F f)
+	{
+		std::vector<std::pair<uint64_t, uint64_t> > changed;
+		uint64_t latest = since;
+		{
+			std::lock_guard<std::mutex> l(_changes_l);
+			for (auto c = _changes.upper_bound(since); c != _changes.end(); ++c) {
+				changed.push_back(c->second);
+				latest = c->first;
+			}
+		}
+		nlohmann::json network, member;
+		for (auto c = changed.begin(); c != changed.end(); ++c) {
+			network.clear();
+			member.clear();
+			std::shared_ptr<_Network> nw;
+			{
+				std::shared_lock<std::shared_mutex> l(_networks_l);
+				auto nwi = _networks.find(c->first);
+				if (nwi == _networks.end())
+					continue;
+				nw = nwi->second;
+			}
+			{
+				std::shared_lock<std::shared_mutex> l2(nw->lock);
+				network = nw->config;
+				if (c->second) {
+					auto m = nw->members.find(c->second);
+					if (m == nw->members.end())
+						continue;
+					member = m->second;
+				}
+			}
+			f(c->first, network, c->second, member);
+		}
+		return latest;
+	}
+
 	virtual bool save(nlohmann::json& record, bool notifyListeners) = 0;
 	virtual void eraseNetwork(const uint64_t networkId) = 0;
 	virtual void eraseMember(const uint64_t networkId, const uint64_t memberId) = 0;
@@ -168,6 +250,7 @@ class DB {
 		std::unordered_set<uint64_t> activeBridgeMembers;
 		std::unordered_set<uint64_t> authorizedMembers;
 		std::unordered_set<InetAddress, InetAddress::Hasher> allocatedIps;
+		std::map<uint32_t, uint32_t> allocatedIpv4Ranges;	 // first -> last of each run of allocated IPv4 addresses in host byte order
 		int64_t mostRecentDeauthTime;
 		std::shared_mutex lock;
 	};
@@ -175,12 +258,23 @@ class DB {
 	virtual void _memberChanged(nlohmann::json& old, nlohmann::json& memberConfig, bool notifyListeners);
 	virtual void _networkChanged(nlohmann::json& old, nlohmann::json& networkConfig, bool notifyListeners);
 	void _fillSummaryInfo(const std::shared_ptr<_Network>& nw, NetworkSummaryInfo& info);
+	void _recordChanged(const uint64_t networkId, const uint64_t memberId);
+	void _forgetChanges(const uint64_t networkId, const uint64_t memberId);
+	static void _allocateIp(_Network& nw, const InetAddress& ip);
+	static void _releaseIp(_Network& nw, const InetAddress& ip);
 
 	std::vector<DB::ChangeListener*> _changeListeners;
 	std::unordered_map<uint64_t, std::shared_ptr<_Network> > _networks;
 	std::unordered_multimap<uint64_t, uint64_t> _networkByMember;
 	mutable std::shared_mutex _changeListeners_l;
 	mutable std::shared_mutex _networks_l;
+
+	// Change log holding only the most recent change of each network (member ID 0) or member,
+	// by change sequence number and by network ID and member ID
+	std::map<uint64_t, std::pair<uint64_t, uint64_t> > _changes;
+	std::map<std::pair<uint64_t, uint64_t>, uint64_t> _changeSeqByRecord;
+	uint64_t _changeSeq;
+	std::mutex _changes_l;
 };
 
 }	// namespace ZeroTier
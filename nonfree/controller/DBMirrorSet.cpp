@@ -11,6 +11,7 @@ namespace ZeroTier {
 DBMirrorSet::DBMirrorSet(DB::ChangeListener* listener) : _listener(listener), _running(true), _syncCheckerThread(), _dbs(), _dbs_l()
 {
 	_syncCheckerThread = std::thread([this]() {
+		std::unordered_map<const DB*, uint64_t> syncedTo;	// change sequence number each DB has been reconciled up to
 		for (;;) {
 			for (int i = 0; i < 120; ++i) {	  // 1 minute delay between checks
 				if (! _running)
@@ -25,14 +26,17 @@ DBMirrorSet::DBMirrorSet(DB::ChangeListener* listener) : _listener(listener), _r
 
 			std::vector<std::shared_ptr<DB> > dbs;
 			{
-				std::unique_lock<std::shared_mutex> l(_dbs_l);
+				std::shared_lock<std::shared_mutex> l(_dbs_l);
 				if (_dbs.size() <= 1)
 					continue;	// no need to do this if there's only one DB, so skip the iteration
 				dbs = _dbs;
 			}
 
+			// Only records changed since the last pass over each DB are reconciled. The
+			// first pass over a DB starts at 0 and so covers everything in it.
 			for (auto db = dbs.begin(); db != dbs.end(); ++db) {
-				(*db)->each([&dbs, &db](uint64_t networkId, const nlohmann::json& network, uint64_t memberId, const nlohmann::json& member) {
+				uint64_t& since = syncedTo[db->get()];
+				since = (*db)->eachChangedSince(since, [&dbs, &db](uint64_t networkId, const nlohmann::json& network, uint64_t memberId, const nlohmann::json& member) {
 					try {
 						if (network.is_object()) {
 							if (memberId == 0) {
@@ -191,6 +195,29 @@ void DBMirrorSet::networks(std::set<uint64_t>& networks)
 	}
 }
 
+bool DBMirrorSet::isIpAllocated(const uint64_t networkId, const InetAddress& ip)
+{
+	std::shared_lock<std::shared_mutex> l(_dbs_l);
+	for (auto d = _dbs.begin(); d != _dbs.end(); ++d) {
+		if ((*d)->hasNetwork(networkId))
+			return (*d)->isIpAllocated(networkId, ip);
+	}
+	return false;
+}
+
+bool DBMirrorSet::nextFreeIpv4(const uint64_t networkId, const uint32_t first, const uint32_t last, uint32_t& ip)
+{
+	std::shared_lock<std::shared_mutex> l(_dbs_l);
+	for (auto d = _dbs.begin(); d != _dbs.end(); ++d) {
+		if ((*d)->hasNetwork(networkId))
+			return (*d)->nextFreeIpv4(networkId, first, last, ip);
+	}
+	if (first > last)
+		return false;
+	ip = first;
+	return true;
+}
+
 bool DBMirrorSet::waitForReady()
 {
 	auto provider = opentelemetry::trace::Provider::GetTracerProvider();
@@ -29,6 +29,9 @@ class DBMirrorSet : public DB::ChangeListener {
 
 	void networks(std::set<uint64_t>& networks);
 
+	bool isIpAllocated(const uint64_t networkId, const InetAddress& ip);
+	bool nextFreeIpv4(const uint64_t networkId, const uint32_t first, const uint32_t last, uint32_t& ip);
+
 	bool waitForReady();
 	bool isReady();
 	bool save(nlohmann::json& record, bool notifyListeners);
@@ -45,6 +45,12 @@ using json = nlohmann::json;
 // Global maximum size of arrays in JSON objects
 #define ZT_CONTROLLER_MAX_ARRAY_SIZE 16384
 
+// Rendered configs are reused for this fraction of their credential time max delta
+#define ZT_CONTROLLER_CONFIG_CACHE_TTL_DIVISOR 8
+
+// Interval between sweeps of expired rendered configs
+#define ZT_CONTROLLER_CONFIG_CACHE_PRUNE_PERIOD 60000
+
 namespace ZeroTier {
 
 namespace {
@@ -1510,6 +1516,16 @@ void EmbeddedNetworkController::onNetworkUpdate(const void* db, uint64_t network
 	auto span = tracer->StartSpan("embedded_controller::onNetworkUpdate");
 	auto scope = tracer->WithActiveSpan(span);
 
+	{
+		std::lock_guard<std::mutex> l(_configCache_l);
+		for (auto i = _configCache.begin(); i != _configCache.end();) {
+			if (i->first.networkId == networkId)
+				i = _configCache.erase(i);
+			else
+				++i;
+		}
+	}
+
 	// Send an update to all members of the network that are online
 	const int64_t now = OSUtils::now();
 	std::lock_guard<std::mutex> l(_memberStatus_l);
@@ -1526,6 +1542,11 @@ void EmbeddedNetworkController::onNetworkMemberUpdate(const void* db, uint64_t n
 	auto span = tracer->StartSpan("embedded_controller::onNetworkMemberUpdate");
 	auto scope = tracer->WithActiveSpan(span);
 
+	{
+		std::lock_guard<std::mutex> l(_configCache_l);
+		_configCache.erase(_MemberStatusKey(networkId, memberId));
+	}
+
 	// Push update to member if online
 	try {
 		std::lock_guard<std::mutex> l(_memberStatus_l);
@@ -1544,6 +1565,11 @@ void EmbeddedNetworkController::onNetworkMemberDeauthorize(const void* db, uint6
 	auto span = tracer->StartSpan("embedded_controller::onNetworkMemberDeauthorize");
 	auto scope = tracer->WithActiveSpan(span);
 
+	{
+		std::lock_guard<std::mutex> l(_configCache_l);
+		_configCache.erase(_MemberStatusKey(networkId, memberId));
+	}
+
 	const int64_t now = OSUtils::now();
 	Revocation rev((uint32_t)_node->prng(), networkId, 0, now, ZT_REVOCATION_FLAG_FAST_PROPAGATE, Address(memberId), Revocation::CREDENTIAL_TYPE_COM);
 	rev.sign(_signingId);
@@ -1818,6 +1844,34 @@ void EmbeddedNetworkController::_request(uint64_t nwid, const InetAddress& fromA
 	// If we made it this far, they are authorized (and authenticated).
 	// -------------------------------------------------------------------------
 
+	// Members whose config depends only on the network and member records, the
+	// request's rules engine and dictionary format, and the network's active
+	// bridges can be sent the config most recently rendered for them. SSO state
+	// and the defaults filled in for new members are not covered by revisions.
+	const uint64_t networkRevision = OSUtils::jsonInt(network["revision"], 0ULL);
+	const uint64_t memberRevision = OSUtils::jsonInt(member["revision"], 0ULL);
+	const bool legacyConfig = (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION, 0) < 6);
+	const bool rulesEngine = (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV, 0) > 0);
+	const bool cacheable = ((! newMember) && (authenticationExpiryTime < 0));
+	if (cacheable) {
+		std::string cachedConfig;
+		{
+			std::lock_guard<std::mutex> l(_configCache_l);
+			auto cc = _configCache.find(msk);
+			if ((cc != _configCache.end()) && (cc->second.expires > now) && (cc->second.networkRevision == networkRevision) && (cc->second.memberRevision == memberRevision) && (cc->second.legacy == legacyConfig)
+				&& (cc->second.rulesEngine == rulesEngine) && (cc->second.activeBridges == ns.activeBridges))
+				cachedConfig = cc->second.dictionary;
+		}
+		if (! cachedConfig.empty()) {
+			Metrics::network_config_cache_hit++;
+			DB::cleanMember(member);
+			_db.save(member, true);
+			_sender->ncSendConfigDictionary(nwid, requestPacketId, identity.address(), cachedConfig.c_str(), (unsigned int)cachedConfig.length());
+			return;
+		}
+		Metrics::network_config_cache_miss++;
+	}
+
 	// Default timeout: 15 minutes. Maximum: two hours. Can be specified by an optional field in the network config
 	// if something longer than 15 minutes is desired. Minimum is 5 minutes since shorter than that would be flaky.
 #ifdef CENTRAL_CONTROLLER_REQUEST_BENCHMARK
@@ -1914,7 +1968,7 @@ void EmbeddedNetworkController::_request(uint64_t nwid, const InetAddress& fromA
 
 	// fprintf(stderr, "IP Assignment Pools for Network %s: %s\n", nwids, OSUtils::jsonDump(ipAssignmentPools, 2).c_str());
 
-	if (metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_RULES_ENGINE_REV, 0) <= 0) {
+	if (! rulesEngine) {
 		// Old versions with no rules engine support get an allow everything rule.
 		// Since rules are enforced bidirectionally, newer versions *will* still
 		// enforce rules on the inbound side.
@@ -1971,9 +2025,11 @@ void EmbeddedNetworkController::_request(uint64_t nwid, const InetAddress& fromA
 								++caprc;
 						}
 					}
-					nc->capabilities[nc->capabilityCount] = Capability((uint32_t)capId, nwid, now, 1, capr, caprc);
-					if (nc->capabilities[nc->capabilityCount].sign(_signingId, identity.address()))
+					Capability c((uint32_t)capId, nwid, now, 1, capr, caprc);
+					if (c.sign(_signingId, identity.address())) {
+						nc->capabilities.push_back(c);
 						++nc->capabilityCount;
+					}
 					if (nc->capabilityCount >= ZT_MAX_NETWORK_CAPABILITIES)
 						break;
 				}
@@ -2141,7 +2197,7 @@ void EmbeddedNetworkController::_request(uint64_t nwid, const InetAddress& fromA
 						}
 
 						// If it's routed, then try to claim and assign it and if successful end loop
-						if ((routedNetmaskBits > 0) && (! std::binary_search(ns.allocatedIps.begin(), ns.allocatedIps.end(), ip6))) {
+						if ((routedNetmaskBits > 0) && (! _db.isIpAllocated(nwid, ip6))) {
 							char tmpip[64];
 							const std::string ipStr(ip6.toIpString(tmpip));
 							if (std::find(ipAssignments.begin(), ipAssignments.end(), ipStr) == ipAssignments.end()) {
@@ -2177,9 +2233,19 @@ void EmbeddedNetworkController::_request(uint64_t nwid, const InetAddress& fromA
 					// Start with the LSB of the member's address
 					uint32_t ipTrialCounter = (uint32_t)(identity.address().toInt() & 0xffffffff);
 
+					const uint32_t ipRangeLast = (ipRangeLen > 0) ? (ipRangeStart + (ipRangeLen - 1)) : ipRangeStart;
 					for (uint32_t k = ipRangeStart, trialCount = 0; ((k <= ipRangeEnd) && (trialCount < 1000)); ++k, ++trialCount) {
 						uint32_t ip = (ipRangeLen > 0) ? (ipRangeStart + (ipTrialCounter % ipRangeLen)) : ipRangeStart;
-						++ipTrialCounter;
+
+						// Skip over addresses other members already hold, wrapping to the start of the pool
+						uint32_t freeIp = ip;
+						if (! _db.nextFreeIpv4(nwid, ip, ipRangeLast, freeIp)) {
+							ipTrialCounter += (ipRangeLast - ip) + 1;
+							continue;
+						}
+						ipTrialCounter += (freeIp - ip) + 1;
+						ip = freeIp;
+
 						if ((ip & 0x000000ff) == 0x000000ff) {
 							continue;	// don't allow addresses that end in .255
 						}
@@ -2199,7 +2265,7 @@ void EmbeddedNetworkController::_request(uint64_t nwid, const InetAddress& fromA
 
 						// If it's routed, then try to claim and assign it and if successful end loop
 						const InetAddress ip4(Utils::hton(ip), 0);
-						if ((routedNetmaskBits > 0) && (! std::binary_search(ns.allocatedIps.begin(), ns.allocatedIps.end(), ip4))) {
+						if (routedNetmaskBits > 0) {
 							char tmpip[64];
 							const std::string ipStr(ip4.toIpString(tmpip));
 							if (std::find(ipAssignments.begin(), ipAssignments.end(), ipStr) == ipAssignments.end()) {
@@ -2284,7 +2350,21 @@ void EmbeddedNetworkController::_request(uint64_t nwid, const InetAddress& fromA
 	c11++;
 	b11.start();
 #endif
-	_sender->ncSendConfig(nwid, requestPacketId, identity.address(), *(nc.get()), metaData.getUI(ZT_NETWORKCONFIG_REQUEST_METADATA_KEY_VERSION, 0) < 6);
+	std::unique_ptr<Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY> > dconf(new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>());
+	if (nc->toDictionary(*dconf, legacyConfig)) {
+		if (cacheable) {
+			std::lock_guard<std::mutex> l(_configCache_l);
+			_ConfigCacheEntry& ce = _configCache[msk];
+			ce.networkRevision = networkRevision;
+			ce.memberRevision = memberRevision;
+			ce.expires = now + (credentialtmd / ZT_CONTROLLER_CONFIG_CACHE_TTL_DIVISOR);
+			ce.legacy = legacyConfig;
+			ce.rulesEngine = rulesEngine;
+			ce.activeBridges = ns.activeBridges;
+			ce.dictionary.assign(dconf->data(), dconf->sizeBytes());
+		}
+		_sender->ncSendConfigDictionary(nwid, requestPacketId, identity.address(), dconf->data(), dconf->sizeBytes());
+	}
 #ifdef CENTRAL_CONTROLLER_REQUEST_BENCHMARK
 	b11.stop();
 #endif
@@ -2335,6 +2415,7 @@ void EmbeddedNetworkController::_startThreads()
 
 void EmbeddedNetworkController::_ssoExpiryThread()
 {
+	int64_t lastConfigCachePrune = OSUtils::now();
 	while (_ssoExpiryRunning) {
 		auto provider = opentelemetry::trace::Provider::GetTracerProvider();
 		auto tracer = provider->GetTracer("embedded_network_controller");
@@ -2371,6 +2452,16 @@ void EmbeddedNetworkController::_ssoExpiryThread()
 			Metrics::sso_member_deauth++;
 			onNetworkMemberDeauthorize(nullptr, e->networkId, e->nodeId);
 		}
+		if ((now - lastConfigCachePrune) >= ZT_CONTROLLER_CONFIG_CACHE_PRUNE_PERIOD) {
+			lastConfigCachePrune = now;
+			std::lock_guard<std::mutex> l(_configCache_l);
+			for (auto i = _configCache.begin(); i != _configCache.end();) {
+				if (i->second.expires <= now)
+					i = _configCache.erase(i);
+				else
+					++i;
+			}
+		}
 		span->End();
 		std::this_thread::sleep_for(std::chrono::milliseconds(500));
 	}
@@ -99,6 +99,18 @@ class EmbeddedNetworkController
 			return ((now - lastRequestTime) < (ZT_NETWORK_AUTOCONF_DELAY * 2));
 		}
 	};
+	struct _ConfigCacheEntry {
+		_ConfigCacheEntry() : networkRevision(0), memberRevision(0), expires(0), legacy(false), rulesEngine(false)
+		{
+		}
+		uint64_t networkRevision;
+		uint64_t memberRevision;
+		int64_t expires;
+		bool legacy;
+		bool rulesEngine;
+		std::vector<Address> activeBridges;
+		std::string dictionary;
+	};
 	struct _MemberStatusHash {
 		inline std::size_t operator()(const _MemberStatusKey& networkIdNodeId) const
 		{
@@ -124,6 +136,10 @@ class EmbeddedNetworkController
 	std::unordered_map<_MemberStatusKey, _MemberStatus, _MemberStatusHash> _memberStatus;
 	std::mutex _memberStatus_l;
 
+	// Signed and serialized configs by member, keyed on network and member revision
+	std::unordered_map<_MemberStatusKey, _ConfigCacheEntry, _MemberStatusHash> _configCache;
+	std::mutex _configCache_l;
+
 	std::set<std::pair<int64_t, _MemberStatusKey> > _expiringSoon;
 	std::mutex _expiringSoon_l;
 
@@ -2,10 +2,13 @@ CORE_OBJS=\
 	node/AES.o \
 	node/AES_aesni.o \
 	node/AES_armcrypto.o \
+	node/AQMScheduler.o \
 	node/ECC.o \
 	node/Capability.o \
 	node/CertificateOfMembership.o \
 	node/CertificateOfOwnership.o \
+	node/CompiledRules.o \
+	node/CredentialCache.o \
 	node/Identity.o \
 	node/IncomingPacket.o \
 	node/InetAddress.o \
@@ -37,4 +40,5 @@ ONE_OBJS=\
 	osdep/EthernetTap.o \
 	osdep/ManagedRoute.o \
 	osdep/Http.o \
+	osdep/PeerCache.o \
 	service/OneService.o
@@ -61,7 +61,7 @@
 // Period between refreshes of bindings
 #define ZT_BINDER_REFRESH_PERIOD 30000
 
-// Max number of bindings
+// Max number of bound addresses, each of which has one binding per Phy<> RX thread
 #define ZT_BINDER_MAX_BINDINGS 256
 
 // Maximum physical interface name length. This number is gigantic because of Windows.
@@ -79,6 +79,12 @@ namespace ZeroTier {
  *
  * On OSes that do not support local port enumeration or where this is not
  * meaningful, this degrades to binding to wildcard.
+ *
+ * If the Phy<> has RX threads running, each address is bound once per RX
+ * thread with SO_REUSEPORT. Bindings for the same address are always kept
+ * next to each other in _bindings, which is how methods below skip the
+ * duplicates. Room for ZT_BINDER_MAX_BINDINGS addresses is allocated at the
+ * first refresh, so RX threads must be started before it.
  */
 class Binder {
   private:
@@ -423,6 +429,12 @@ class Binder {
 			}
 		}
 
+		// Sized once, since isUdpSocketValid() reads bindings without locking
+		const unsigned int rxThreads = phy.rxThreadCount();
+		const unsigned int bindingsPerAddress = (rxThreads > 0) ? rxThreads : 1;
+		if (_bindings.empty())
+			_bindings.resize(ZT_BINDER_MAX_BINDINGS * bindingsPerAddress);
+
 		const unsigned int oldBindingCount = _bindingCount;
 		_bindingCount = 0;
 
@@ -448,8 +460,15 @@ class Binder {
 					break;
 				++bi;
 			}
-			if (bi == _bindingCount) {
-				udps = phy.udpBind(reinterpret_cast<const struct sockaddr*>(&(ii->first)), (void*)0, ZT_UDP_DESIRED_BUF_SIZE);
+			if (bi != _bindingCount)
+				continue;
+			if ((_bindingCount + bindingsPerAddress) > (unsigned int)_bindings.size()) {
+				char buf[64];
+				fprintf(stderr, "WARNING: too many local addresses, not binding to %s" ZT_EOL_S, ii->first.toString(buf));
+				continue;
+			}
+			for (unsigned int t = 0; t < bindingsPerAddress; ++t) {
+				udps = phy.udpBind(reinterpret_cast<const struct sockaddr*>(&(ii->first)), (void*)0, ZT_UDP_DESIRED_BUF_SIZE, (rxThreads > 0) ? (int)t : -1);
 				if (udps) {
 #ifdef __LINUX__
 					// Bind Linux sockets to their device so routes that we manage do not override physical routes (wish all platforms had this!)
@@ -462,13 +481,11 @@ class Binder {
 						}
 					}
 #endif	 // __LINUX__
-					if (_bindingCount < ZT_BINDER_MAX_BINDINGS) {
-						_bindings[_bindingCount].udpSock = udps;
-						_bindings[_bindingCount].address = ii->first;
-						memset(_bindings[_bindingCount].ifname, 0x0, sizeof(_bindings[_bindingCount].ifname));
-						memcpy(_bindings[_bindingCount].ifname, (char*)ii->second.c_str(), (int)ii->second.length());
-						++_bindingCount;
-					}
+					_bindings[_bindingCount].udpSock = udps;
+					_bindings[_bindingCount].address = ii->first;
+					memset(_bindings[_bindingCount].ifname, 0x0, sizeof(_bindings[_bindingCount].ifname));
+					memcpy(_bindings[_bindingCount].ifname, (char*)ii->second.c_str(), (int)ii->second.length());
+					++_bindingCount;
 				}
 				else {
 					phy.close(udps, false);
@@ -484,8 +501,10 @@ class Binder {
 	{
 		std::vector<InetAddress> aa;
 		Mutex::Lock _l(_lock);
-		for (unsigned int b = 0, c = _bindingCount; b < c; ++b)
-			aa.push_back(_bindings[b].address);
+		for (unsigned int b = 0, c = _bindingCount; b < c; ++b) {
+			if (! _isDuplicate(b))
+				aa.push_back(_bindings[b].address);
+		}
 		return aa;
 	}
 
@@ -497,9 +516,11 @@ class Binder {
 		bool r = false;
 		Mutex::Lock _l(_lock);
 		for (unsigned int b = 0, c = _bindingCount; b < c; ++b) {
+			if (_isDuplicate(b))
+				continue;
 			if (ttl)
 				phy.setIp4UdpTtl(_bindings[b].udpSock, ttl);
-			if (phy.udpSend(_bindings[b].udpSock, (const struct sockaddr*)addr, data, len))
+			if (phy.udpSend(_bindings[b].udpSock, (const struct sockaddr*)addr, data, len, (ttl == 0)))
 				r = true;
 			if (ttl)
 				phy.setIp4UdpTtl(_bindings[b].udpSock, 255);
@@ -553,7 +574,13 @@ class Binder {
 	}
 
   private:
-	_Binding _bindings[ZT_BINDER_MAX_BINDINGS];
+	// True if binding b is an additional SO_REUSEPORT socket for the same address as b-1
+	inline bool _isDuplicate(const unsigned int b) const
+	{
+		return ((b > 0) && (_bindings[b - 1].address == _bindings[b].address));
+	}
+
+	std::vector<_Binding> _bindings;
 	std::atomic<unsigned int> _bindingCount;
 	Mutex _lock;
 };
@@ -57,6 +57,7 @@ std::shared_ptr<EthernetTap> EthernetTap::newInstance(
 	const char* tapDeviceType,	 // OS-specific, NULL for default
 	unsigned int concurrency,
 	bool pinning,
+	bool offload,
 	const char* homePath,
 	const MAC& mac,
 	unsigned int mtu,
@@ -95,7 +96,7 @@ std::shared_ptr<EthernetTap> EthernetTap::newInstance(
 #ifdef ZT_EXTOSDEP
 	return std::shared_ptr<EthernetTap>(new ExtOsdepTap(homePath, mac, mtu, metric, nwid, friendlyName, handler, arg));
 #else
-	return std::shared_ptr<EthernetTap>(new LinuxEthernetTap(homePath, concurrency, pinning, mac, mtu, metric, nwid, friendlyName, handler, arg));
+	return std::shared_ptr<EthernetTap>(new LinuxEthernetTap(homePath, concurrency, pinning, offload, mac, mtu, metric, nwid, friendlyName, handler, arg));
 #endif	 // ZT_EXTOSDEP
 #endif	 // __LINUX__
 
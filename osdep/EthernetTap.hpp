@@ -28,6 +28,7 @@ class EthernetTap {
 		const char* tapDeviceType,	 // OS-specific, NULL for default
 		unsigned int concurrency,
 		bool pinning,
+		bool offload,	 // Linux only: accept TSO super-frames and partial checksums from the kernel
 		const char* homePath,
 		const MAC& mac,
 		unsigned int mtu,
@@ -51,6 +51,9 @@ struct HttpPhyHandler {
 	inline void phyOnDatagram(PhySocket* sock, void** uptr, const struct sockaddr* localAddr, const struct sockaddr* from, void* data, unsigned long len)
 	{
 	}
+	inline void phyOnDatagramBatch(PhySocket* sock, void** uptr, const struct sockaddr* localAddr, const struct sockaddr* const* from, void* const* data, const unsigned long* len, unsigned int count)
+	{
+	}
 	inline void phyOnTcpAccept(PhySocket* sockL, PhySocket* sockN, void** uptrL, void** uptrN, const struct sockaddr* from)
 	{
 	}
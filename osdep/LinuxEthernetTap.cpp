@@ -20,6 +20,7 @@
 #include "LinuxEthernetTap.hpp"
 #include "LinuxNetLink.hpp"
 #include "OSUtils.hpp"
+#include "Phy.hpp"
 
 #include <algorithm>
 #include <arpa/inet.h>
@@ -54,6 +55,25 @@
 
 #define ZT_TAP_BUF_SIZE (1024 * 16)
 
+// struct virtio_net_hdr and its constants from linux/virtio_net.h, which uses
+// 'class' as a field name and so can't be included from C++.
+struct _VnetHdr {
+	uint8_t flags;
+	uint8_t gso_type;
+	uint16_t hdr_len;
+	uint16_t gso_size;
+	uint16_t csum_start;
+	uint16_t csum_offset;
+};
+#define ZT_VNET_HDR_F_NEEDS_CSUM  1
+#define ZT_VNET_HDR_GSO_NONE	  0
+#define ZT_VNET_HDR_GSO_TCPV4	  1
+#define ZT_VNET_HDR_GSO_TCPV6	  4
+#define ZT_VNET_HDR_GSO_ECN		  0x80
+
+// Large enough for a virtio_net_hdr plus a 64KB GSO super-frame
+#define ZT_TAP_VNET_BUF_SIZE (sizeof(_VnetHdr) + 65536 + 64)
+
 // ff:ff:ff:ff:ff:ff with no ADI
 static const ZeroTier::MulticastGroup _blindWildcardMulticastGroup(ZeroTier::MAC(0xff), 0);
 
@@ -107,6 +127,7 @@ LinuxEthernetTap::LinuxEthernetTap(
 	const char* homePath,
 	unsigned int concurrency,
 	bool pinning,
+	bool offload,
 	const MAC& mac,
 	unsigned int mtu,
 	unsigned int metric,
@@ -121,6 +142,7 @@ LinuxEthernetTap::LinuxEthernetTap(
 	, _homePath(homePath)
 	, _mtu(mtu)
 	, _fd(0)
+	, _vnetHdr(false)
 	, _enabled(true)
 	, _run(true)
 	, _lastIfAddrsUpdate(0)
@@ -206,15 +228,86 @@ LinuxEthernetTap::LinuxEthernetTap(
 #endif
 	}
 
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
-	if (ioctl(_fd, TUNSETIFF, (void*)&ifr) < 0) {
-		::close(_fd);
-		throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+	// With more than one RX thread try to open the device in multi-queue mode so that
+	// each thread gets its own kernel queue instead of all of them contending for one.
+	// Kernels without IFF_MULTI_QUEUE support reject the flag and we fall back to a
+	// single shared descriptor.
+	//
+	// IFF_VNET_HDR is requested when offloads are wanted so they can be enabled below.
+	// Every queue must be attached with the same feature flags.
+	short tapFlags = IFF_TAP | IFF_NO_PI;
+	if (offload)
+		tapFlags |= IFF_VNET_HDR;
+	bool multiQueue = false;
+	if (concurrency > 1) {
+		ifr.ifr_flags = tapFlags | IFF_MULTI_QUEUE;
+		multiQueue = (ioctl(_fd, TUNSETIFF, (void*)&ifr) == 0);
+	}
+	if (! multiQueue) {
+		ifr.ifr_flags = tapFlags;
+		if (ioctl(_fd, TUNSETIFF, (void*)&ifr) < 0) {
+			tapFlags = IFF_TAP | IFF_NO_PI;
+			ifr.ifr_flags = tapFlags;
+			if (ioctl(_fd, TUNSETIFF, (void*)&ifr) < 0) {
+				::close(_fd);
+				throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+			}
+		}
+	}
+	else {
+		tapFlags |= IFF_MULTI_QUEUE;
+	}
+
+	// Ask the kernel to hand us TSO/GSO super-frames and partially checksummed
+	// packets. We segment and finish checksums ourselves in _vnetRead(), so the
+	// rest of the data path still only ever sees MTU-sized frames, but a bulk
+	// TCP transfer costs one read() per ~64KB instead of one per frame. If the
+	// kernel won't do this we fall back to plain frames with no vnet header.
+	if ((tapFlags & IFF_VNET_HDR) != 0) {
+		int hdrSize = (int)sizeof(_VnetHdr);
+		if ((ioctl(_fd, TUNSETVNETHDRSZ, &hdrSize) == 0) && (ioctl(_fd, TUNSETOFFLOAD, (unsigned long)(TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6)) == 0)) {
+			_vnetHdr = true;
+		}
+		else {
+			fprintf(stderr, "WARNING: tap offloads unavailable on %s, using unsegmented frames" ZT_EOL_S, ifr.ifr_name);
+			::close(_fd);
+			_fd = ::open("/dev/net/tun", O_RDWR);
+			tapFlags &= ~IFF_VNET_HDR;
+			ifr.ifr_flags = tapFlags;
+			if ((_fd <= 0) || (ioctl(_fd, TUNSETIFF, (void*)&ifr) < 0)) {
+				if (_fd > 0)
+					::close(_fd);
+				throw std::runtime_error("unable to configure TUN/TAP device for TAP operation");
+			}
+		}
 	}
 
 	::ioctl(_fd, TUNSETPERSIST, 0);	  // valgrind may generate a false alarm here
 	_dev = ifr.ifr_name;
 	::fcntl(_fd, F_SETFD, fcntl(_fd, F_GETFD) | FD_CLOEXEC);
+	_queueFds.push_back(_fd);
+
+	// Attach one additional queue per extra RX thread. If attaching fails part way we
+	// just run with however many queues we got; threads share them round-robin.
+	if (multiQueue) {
+		for (unsigned int i = 1; i < concurrency; ++i) {
+			int qfd = ::open("/dev/net/tun", O_RDWR);
+			if (qfd <= 0)
+				break;
+			struct ifreq qifr;
+			memset(&qifr, 0, sizeof(qifr));
+			Utils::scopy(qifr.ifr_name, sizeof(qifr.ifr_name), _dev.c_str());
+			qifr.ifr_flags = tapFlags;
+			if (ioctl(qfd, TUNSETIFF, (void*)&qifr) < 0) {
+				fprintf(stderr, "WARNING: unable to attach queue %u to multi-queue tap device %s: %s" ZT_EOL_S, i, _dev.c_str(), strerror(errno));
+				::close(qfd);
+				break;
+			}
+			::fcntl(qfd, F_SETFD, fcntl(qfd, F_GETFD) | FD_CLOEXEC);
+			_queueFds.push_back(qfd);
+		}
+		fprintf(stderr, "Opened tap device %s with %u queues" ZT_EOL_S, _dev.c_str(), (unsigned int)_queueFds.size());
+	}
 
 	(void)::pipe(_shutdownSignalPipe);
 
@@ -235,8 +328,11 @@ LinuxEthernetTap::LinuxEthernetTap(
 			}
 
 			uint8_t b[ZT_TAP_BUF_SIZE];
+			std::vector<uint8_t> vnetBuf(_vnetHdr ? ZT_TAP_VNET_BUF_SIZE : 0);
+			uint8_t* const vb = vnetBuf.data();
 			fd_set readfds, nullfds;
 			int n, nfds, r;
+			const int fd = _queueFds[i % _queueFds.size()];
 			if (i == 0) {
 				struct ifreq ifr;
 				memset(&ifr, 0, sizeof(ifr));
@@ -304,6 +400,9 @@ LinuxEthernetTap::LinuxEthernetTap(
 
 				::close(sock);
 			}
+			else if (fd != _fd) {
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+			}
 
 			if (! _run) {
 				return;
@@ -311,21 +410,32 @@ LinuxEthernetTap::LinuxEthernetTap(
 
 			FD_ZERO(&readfds);
 			FD_ZERO(&nullfds);
-			nfds = (int)std::max(_shutdownSignalPipe[0], _fd) + 1;
+			nfds = (int)std::max(_shutdownSignalPipe[0], fd) + 1;
 
 			r = 0;
 			for (;;) {
 				FD_SET(_shutdownSignalPipe[0], &readfds);
-				FD_SET(_fd, &readfds);
+				FD_SET(fd, &readfds);
 				select(nfds, &readfds, &nullfds, &nullfds, (struct timeval*)0);
 
 				if (FD_ISSET(_shutdownSignalPipe[0], &readfds)) {
 					break;
 				}
-				if (FD_ISSET(_fd, &readfds)) {
+				if (FD_ISSET(fd, &readfds) && (_vnetHdr)) {
+					PhyTxBatch::Scope txBatch;	 // wire packets generated by this burst go out with sendmmsg()
+					for (;;) {
+						n = (int)::read(fd, vb, ZT_TAP_VNET_BUF_SIZE);
+						if (n <= 0)
+							break;
+						if (_enabled)
+							vnetRead(_handler, _arg, _nwid, _mtu, vb, (unsigned int)n);
+					}
+				}
+				else if (FD_ISSET(fd, &readfds)) {
+					PhyTxBatch::Scope txBatch;
 					for (;;) {
 						// read until there are no more packets, then return to outer select() loop
-						n = (int)::read(_fd, b + r, ZT_TAP_BUF_SIZE - r);
+						n = (int)::read(fd, b + r, ZT_TAP_BUF_SIZE - r);
 						if (n > 0) {
 							// Some tap drivers like to send the ethernet frame and the
 							// payload in two chunks, so handle that by accumulating
@@ -359,7 +469,8 @@ LinuxEthernetTap::~LinuxEthernetTap()
 {
 	_run = false;
 	(void)::write(_shutdownSignalPipe[1], "\0", 1);
-	::close(_fd);
+	for (std::vector<int>::iterator qfd(_queueFds.begin()); qfd != _queueFds.end(); ++qfd)
+		::close(*qfd);
 	::close(_shutdownSignalPipe[0]);
 	::close(_shutdownSignalPipe[1]);
 	for (std::thread& t : _rxThreads) {
@@ -500,16 +611,175 @@ std::vector<InetAddress> LinuxEthernetTap::ips() const
 	return r;
 }
 
+// Cheap flow hash used to keep each flow on the same tap queue when writing frames
+// into the kernel. Uses the same symmetric port/protocol mix as IncomingPacket so a
+// flow and its reverse land on the same queue.
+static unsigned int _tapFlowHash(const MAC& from, const MAC& to, unsigned int etherType, const uint8_t* data, unsigned int len)
+{
+	unsigned int proto = 0, pos = 0;
+	uint32_t h = 0;
+	if ((etherType == 0x0800) && (len >= 20)) {	 // IPv4
+		proto = data[9];
+		pos = 4 * (data[0] & 0xf);
+		h = Utils::loadMachineEndian<uint32_t>(data + 12) ^ Utils::loadMachineEndian<uint32_t>(data + 16);
+		if ((Utils::loadBigEndian<uint16_t>(data + 6) & 0x3fff) != 0)	// no ports in fragments
+			proto = 0;
+	}
+	else if ((etherType == 0x86dd) && (len >= 40)) {	 // IPv6
+		proto = data[6];
+		pos = 40;
+		for (unsigned int k = 8; k < 40; k += 4)
+			h ^= Utils::loadMachineEndian<uint32_t>(data + k);
+	}
+	else {
+		const uint64_t m = from.toInt() ^ to.toInt();
+		return (unsigned int)(m ^ (m >> 24));
+	}
+	switch (proto) {
+		case 0x06:	 // TCP
+		case 0x11:	 // UDP
+		case 0x84:	 // SCTP
+		case 0x88:	 // UDPLite
+			if (len >= (pos + 4))
+				h ^= (uint32_t)(Utils::loadBigEndian<uint16_t>(data + pos) ^ Utils::loadBigEndian<uint16_t>(data + pos + 2));
+			break;
+	}
+	h ^= proto;
+	h ^= h >> 16;
+	h ^= h >> 8;
+	return (unsigned int)h;
+}
+
 void LinuxEthernetTap::put(const MAC& from, const MAC& to, unsigned int etherType, const void* data, unsigned int len)
 {
-	char putBuf[ZT_MAX_MTU + 64];
+	char putBuf[ZT_MAX_MTU + 64 + sizeof(_VnetHdr)];
 	if ((_fd > 0) && (len <= _mtu) && (_enabled)) {
-		to.copyTo(putBuf, 6);
-		from.copyTo(putBuf + 6, 6);
-		*((uint16_t*)(putBuf + 12)) = htons((uint16_t)etherType);
-		memcpy(putBuf + 14, data, len);
-		len += 14;
-		(void)::write(_fd, putBuf, len);
+		const int fd = (_queueFds.size() > 1) ? _queueFds[_tapFlowHash(from, to, etherType, reinterpret_cast<const uint8_t*>(data), len) % _queueFds.size()] : _fd;
+		char* p = putBuf;
+		if (_vnetHdr) {
+			memset(p, 0, sizeof(_VnetHdr));   // ZT_VNET_HDR_GSO_NONE, checksums already complete
+			p += sizeof(_VnetHdr);
+		}
+		to.copyTo(p, 6);
+		from.copyTo(p + 6, 6);
+		*((uint16_t*)(p + 12)) = htons((uint16_t)etherType);
+		memcpy(p + 14, data, len);
+		len += 14 + (unsigned int)(p - putBuf);
+		(void)::write(fd, putBuf, len);
+	}
+}
+
+// One's complement sum used for IP and TCP checksums (not folded or inverted)
+static uint32_t _csumAdd(uint32_t sum, const uint8_t* p, unsigned int len)
+{
+	while (len > 1) {
+		sum += ((uint32_t)p[0] << 8) | (uint32_t)p[1];
+		p += 2;
+		len -= 2;
+	}
+	if (len)
+		sum += (uint32_t)p[0] << 8;
+	return sum;
+}
+
+static uint16_t _csumFinish(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+void LinuxEthernetTap::vnetRead(
+	void (*handler)(void*, void*, uint64_t, const MAC&, const MAC&, unsigned int, unsigned int, const void*, unsigned int),
+	void* arg,
+	uint64_t nwid,
+	unsigned int mtu,
+	uint8_t* p,
+	unsigned int n)
+{
+	const unsigned int vhl = (unsigned int)sizeof(_VnetHdr);
+	if (n <= (vhl + 14))
+		return;
+	_VnetHdr vh;
+	memcpy(&vh, p, vhl);
+	uint8_t* const f = p + vhl;
+	const unsigned int flen = n - vhl;
+
+	const MAC to(f, 6), from(f + 6, 6);
+	const unsigned int etherType = Utils::loadBigEndian<uint16_t>(f + 12);
+	const unsigned int gsoType = vh.gso_type & ~ZT_VNET_HDR_GSO_ECN;
+
+	if (gsoType == ZT_VNET_HDR_GSO_NONE) {
+		// Complete a partial checksum: the kernel has left the pseudo-header sum in
+		// the checksum field, so summing from csum_start to the end is sufficient.
+		if ((vh.flags & ZT_VNET_HDR_F_NEEDS_CSUM) != 0) {
+			const unsigned int cs = vh.csum_start, co = vh.csum_offset;
+			if ((cs >= flen) || ((cs + co + 2) > flen))
+				return;
+			const uint16_t c = _csumFinish(_csumAdd(0, f + cs, flen - cs));
+			f[cs + co] = (uint8_t)(c >> 8);
+			f[cs + co + 1] = (uint8_t)c;
+		}
+		if (flen <= (mtu + 14))
+			handler(arg, nullptr, nwid, from, to, etherType, 0, (const void*)(f + 14), flen - 14);
+		return;
+	}
+
+	// TSO super-frame: cut it into gso_size TCP segments, fixing up lengths,
+	// sequence numbers, flags and checksums in each copy of the headers.
+	const bool v4 = (gsoType == ZT_VNET_HDR_GSO_TCPV4);
+	if (((! v4) && (gsoType != ZT_VNET_HDR_GSO_TCPV6)) || (etherType != (v4 ? 0x0800 : 0x86dd)))
+		return;
+	const unsigned int l4 = vh.csum_start;	 // offset of TCP header from start of frame
+	if ((l4 < (14U + (v4 ? 20U : 40U))) || ((l4 + 20) > flen))
+		return;
+	const unsigned int hlen = l4 + (4 * (f[l4 + 12] >> 4));
+	const unsigned int mss = vh.gso_size;
+	if ((hlen > flen) || (mss == 0) || ((hlen - 14 + mss) > mtu))
+		return;
+
+	uint8_t seg[ZT_MAX_MTU + 64];
+	const uint32_t seq = Utils::loadBigEndian<uint32_t>(f + l4 + 4);
+	const uint16_t ipId = v4 ? Utils::loadBigEndian<uint16_t>(f + 18) : 0;
+	const uint8_t tcpFlags = f[l4 + 13];
+	unsigned int off = hlen, i = 0;
+	while (off < flen) {
+		const unsigned int plen = std::min(mss, flen - off);
+		const unsigned int slen = hlen + plen;
+		const bool last = ((off + plen) >= flen);
+		memcpy(seg, f, hlen);
+		memcpy(seg + hlen, f + off, plen);
+
+		if (v4) {
+			Utils::storeBigEndian<uint16_t>(seg + 16, (uint16_t)(slen - 14));
+			Utils::storeBigEndian<uint16_t>(seg + 18, (uint16_t)(ipId + i));
+			seg[24] = 0;
+			seg[25] = 0;
+			Utils::storeBigEndian<uint16_t>(seg + 24, _csumFinish(_csumAdd(0, seg + 14, 4 * (seg[14] & 0xf))));
+		}
+		else {
+			Utils::storeBigEndian<uint16_t>(seg + 18, (uint16_t)(slen - 54));
+		}
+
+		Utils::storeBigEndian<uint32_t>(seg + l4 + 4, seq + (off - hlen));
+		uint8_t fl = tcpFlags;
+		if (! last)
+			fl &= ~0x09;   // FIN and PSH only on the final segment
+		if (i > 0)
+			fl &= ~0x80;   // CWR only on the first
+		seg[l4 + 13] = fl;
+
+		const unsigned int tcpLen = slen - l4;
+		uint32_t sum = v4 ? _csumAdd(0, seg + 26, 8) : _csumAdd(0, seg + 22, 32);
+		sum += 6 + tcpLen;
+		seg[l4 + 16] = 0;
+		seg[l4 + 17] = 0;
+		Utils::storeBigEndian<uint16_t>(seg + l4 + 16, _csumFinish(_csumAdd(sum, seg + l4, tcpLen)));
+
+		handler(arg, nullptr, nwid, from, to, etherType, 0, (const void*)(seg + 14), slen - 14);
+
+		off += plen;
+		++i;
 	}
 }
 
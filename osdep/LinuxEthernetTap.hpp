@@ -31,6 +31,7 @@ class LinuxEthernetTap : public EthernetTap {
 		const char* homePath,
 		unsigned int concurrency,
 		bool pinning,
+		bool offload,
 		const MAC& mac,
 		unsigned int mtu,
 		unsigned int metric,
@@ -57,7 +58,26 @@ class LinuxEthernetTap : public EthernetTap {
 		fprintf(stderr, "WARNING: ignoring call to LinuxEthernetTap::setDns on Linux. This is not implemented yet. See https://github.com/zerotier/ZeroTierOne/issues/2492 for details" ZT_EOL_S);
 	}
 
+	/**
+	 * Hand a frame read from a tap opened with IFF_VNET_HDR to a frame handler
+	 *
+	 * Partial checksums are completed and TSO super-frames are cut into
+	 * TCP segments of the advertised gso_size, so the handler only ever
+	 * sees complete frames no larger than mtu.
+	 *
+	 * @param p virtio_net_hdr followed by an Ethernet frame (modified in place)
+	 * @param n Length of p including the virtio_net_hdr
+	 */
+	static void vnetRead(
+		void (*handler)(void*, void*, uint64_t, const MAC&, const MAC&, unsigned int, unsigned int, const void*, unsigned int),
+		void* arg,
+		uint64_t nwid,
+		unsigned int mtu,
+		uint8_t* p,
+		unsigned int n);
+
   private:
+
 	void (*_handler)(void*, void*, uint64_t, const MAC&, const MAC&, unsigned int, unsigned int, const void*, unsigned int);
 	void* _arg;
 	uint64_t _nwid;
@@ -67,6 +87,8 @@ class LinuxEthernetTap : public EthernetTap {
 	std::vector<MulticastGroup> _multicastGroups;
 	unsigned int _mtu;
 	int _fd;
+	std::vector<int> _queueFds;	  // one per tap queue; _queueFds[0] == _fd
+	bool _vnetHdr;				  // frames carry a virtio_net_hdr and the kernel may send GSO super-frames
 	int _shutdownSignalPipe[2];
 	std::atomic_bool _enabled;
 	std::atomic_bool _run;
@@ -0,0 +1,343 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#include "PeerCache.hpp"
+
+#include "../node/Constants.hpp"
+#include "OSUtils.hpp"
+
+#include <chrono>
+#include <string.h>
+
+// File starts with this, followed by records of: address[8], timestamp[8], length[4], data[length]
+// with integers big-endian. A record with a length of zero deletes the peer.
+#define ZT_PEERCACHE_MAGIC "ZTPEERS1"
+#define ZT_PEERCACHE_MAGIC_LEN 8
+#define ZT_PEERCACHE_RECORD_HEADER_LEN 20
+
+// Larger records are taken to mean the file is corrupt
+#define ZT_PEERCACHE_MAX_RECORD_LEN 65536
+
+namespace ZeroTier {
+
+namespace {
+
+inline void _putU64(uint8_t* p, const uint64_t v)
+{
+	for (int i = 7; i >= 0; --i)
+		*(p++) = (uint8_t)(v >> (i * 8));
+}
+
+inline void _putU32(uint8_t* p, const uint32_t v)
+{
+	for (int i = 3; i >= 0; --i)
+		*(p++) = (uint8_t)(v >> (i * 8));
+}
+
+inline uint64_t _getU64(const uint8_t* p)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < 8; ++i)
+		v = (v << 8) | (uint64_t)p[i];
+	return v;
+}
+
+inline uint32_t _getU32(const uint8_t* p)
+{
+	uint32_t v = 0;
+	for (int i = 0; i < 4; ++i)
+		v = (v << 8) | (uint32_t)p[i];
+	return v;
+}
+
+}	// anonymous namespace
+
+PeerCache::PeerCache(const std::string& path) : _path(path), _f((FILE*)0), _end(0), _liveBytes(0), _failing(false), _opened(false), _run(true)
+{
+	_thread = std::thread([this]() { _threadMain(); });
+}
+
+PeerCache::~PeerCache()
+{
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		_run = false;
+	}
+	_wake.notify_all();
+	_thread.join();
+	flush();
+	if (_f)
+		fclose(_f);
+}
+
+void PeerCache::put(uint64_t address, const void* data, unsigned int len)
+{
+	if ((! len) || (len > ZT_PEERCACHE_MAX_RECORD_LEN))
+		return;
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		_Change& c = _queued[address];
+		c.data.assign(reinterpret_cast<const uint8_t*>(data), reinterpret_cast<const uint8_t*>(data) + len);
+		c.remove = false;
+	}
+	_wake.notify_one();
+}
+
+void PeerCache::remove(uint64_t address)
+{
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		_Change& c = _queued[address];
+		c.data.clear();
+		c.remove = true;
+	}
+	_wake.notify_one();
+}
+
+int PeerCache::get(uint64_t address, void* data, unsigned int maxlen)
+{
+	std::unique_lock<std::mutex> fl(_file_l);
+	_openedCond.wait(fl, [this]() { return _opened; });
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		auto c = _queued.find(address);
+		if (c != _queued.end()) {
+			if ((c->second.remove) || (c->second.data.size() > maxlen))
+				return -1;
+			memcpy(data, c->second.data.data(), c->second.data.size());
+			return (int)c->second.data.size();
+		}
+	}
+	auto e = _index.find(address);
+	if ((! _f) || (e == _index.end()) || (e->second.len > maxlen))
+		return -1;
+	if ((fseek(_f, e->second.offset, SEEK_SET) != 0) || (fread(data, e->second.len, 1, _f) != 1))
+		return -1;
+	return (int)e->second.len;
+}
+
+void PeerCache::flush()
+{
+	std::unique_lock<std::mutex> fl(_file_l);
+	_openedCond.wait(fl, [this]() { return _opened; });
+	std::unordered_map<uint64_t, _Change> changes;
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		changes.swap(_queued);
+	}
+	if ((! changes.empty()) && (! _write(changes, OSUtils::now()))) {
+		// Keep them for the next flush, unless newer changes to the same peers were queued meanwhile
+		std::lock_guard<std::mutex> l(_lock);
+		for (auto c = changes.begin(); c != changes.end(); ++c)
+			_queued.insert(*c);
+	}
+}
+
+unsigned long PeerCache::size()
+{
+	std::unique_lock<std::mutex> fl(_file_l);
+	_openedCond.wait(fl, [this]() { return _opened; });
+	return (unsigned long)_index.size();
+}
+
+void PeerCache::_open()
+{
+	const int64_t now = OSUtils::now();
+	uint8_t hdr[ZT_PEERCACHE_RECORD_HEADER_LEN];
+
+	_index.clear();
+	_end = 0;
+	_liveBytes = 0;
+
+	_f = fopen(_path.c_str(), "r+b");
+	if (_f) {
+		if ((fread(hdr, ZT_PEERCACHE_MAGIC_LEN, 1, _f) != 1) || (memcmp(hdr, ZT_PEERCACHE_MAGIC, ZT_PEERCACHE_MAGIC_LEN) != 0)) {
+			fclose(_f);
+			_f = (FILE*)0;
+		}
+	}
+	if (! _f) {
+		_f = fopen(_path.c_str(), "w+b");
+		if (! _f) {
+			_warn("unable to open");
+			return;
+		}
+		fwrite(ZT_PEERCACHE_MAGIC, ZT_PEERCACHE_MAGIC_LEN, 1, _f);
+		fflush(_f);
+		OSUtils::lockDownFile(_path.c_str(), false);
+		_end = ZT_PEERCACHE_MAGIC_LEN;
+		return;
+	}
+
+	fseek(_f, 0, SEEK_END);
+	const long fileSize = ftell(_f);
+	long pos = ZT_PEERCACHE_MAGIC_LEN;
+	fseek(_f, pos, SEEK_SET);
+	while (fread(hdr, ZT_PEERCACHE_RECORD_HEADER_LEN, 1, _f) == 1) {
+		const uint64_t address = _getU64(hdr);
+		const int64_t timestamp = (int64_t)_getU64(hdr + 8);
+		const uint32_t len = _getU32(hdr + 16);
+		const long dataStart = pos + ZT_PEERCACHE_RECORD_HEADER_LEN;
+		if ((len > ZT_PEERCACHE_MAX_RECORD_LEN) || ((dataStart + (long)len) > fileSize) || (fseek(_f, (long)len, SEEK_CUR) != 0))
+			break;
+
+		auto e = _index.find(address);
+		if (e != _index.end()) {
+			_liveBytes -= ZT_PEERCACHE_RECORD_HEADER_LEN + (long)e->second.len;
+			_index.erase(e);
+		}
+		if ((len) && ((now - timestamp) < ZT_PEERCACHE_MAX_AGE)) {
+			_Entry& ne = _index[address];
+			ne.offset = dataStart;
+			ne.len = len;
+			ne.timestamp = timestamp;
+			_liveBytes += ZT_PEERCACHE_RECORD_HEADER_LEN + (long)len;
+		}
+
+		pos = dataStart + (long)len;
+	}
+	_end = pos;
+
+	// Rewrite the file if it ends in a partial record or is mostly stale
+	if ((_end != fileSize) || ((_end - ZT_PEERCACHE_MAGIC_LEN) > ((_liveBytes * 2) + ZT_PEERCACHE_COMPACT_SLACK)))
+		_compact(now);
+}
+
+bool PeerCache::_write(const std::unordered_map<uint64_t, _Change>& changes, const int64_t now)
+{
+	if (! _f) {
+		_open();
+		if (! _f)
+			return false;
+	}
+
+	std::vector<uint8_t> buf;
+	for (auto c = changes.begin(); c != changes.end(); ++c) {
+		const size_t p = buf.size();
+		buf.resize(p + ZT_PEERCACHE_RECORD_HEADER_LEN);
+		_putU64(buf.data() + p, c->first);
+		_putU64(buf.data() + p + 8, (uint64_t)now);
+		_putU32(buf.data() + p + 16, (c->second.remove) ? 0 : (uint32_t)c->second.data.size());
+		if (! c->second.remove)
+			buf.insert(buf.end(), c->second.data.begin(), c->second.data.end());
+	}
+
+	if ((fseek(_f, _end, SEEK_SET) != 0) || (fwrite(buf.data(), buf.size(), 1, _f) != 1) || (fflush(_f) != 0)) {
+		_warn("I/O error writing");
+		return false;
+	}
+	_failing = false;
+
+	long pos = _end;
+	for (auto c = changes.begin(); c != changes.end(); ++c) {
+		auto e = _index.find(c->first);
+		if (e != _index.end()) {
+			_liveBytes -= ZT_PEERCACHE_RECORD_HEADER_LEN + (long)e->second.len;
+			_index.erase(e);
+		}
+		pos += ZT_PEERCACHE_RECORD_HEADER_LEN;
+		if (! c->second.remove) {
+			_Entry& ne = _index[c->first];
+			ne.offset = pos;
+			ne.len = (unsigned int)c->second.data.size();
+			ne.timestamp = now;
+			_liveBytes += ZT_PEERCACHE_RECORD_HEADER_LEN + (long)ne.len;
+			pos += (long)ne.len;
+		}
+	}
+	_end = pos;
+
+	if ((_end - ZT_PEERCACHE_MAGIC_LEN) > ((_liveBytes * 2) + ZT_PEERCACHE_COMPACT_SLACK))
+		_compact(now);
+	return true;
+}
+
+void PeerCache::_warn(const char* what)
+{
+	if (! _failing) {
+		_failing = true;
+		fprintf(stderr, "WARNING: %s peer cache: %s (will retry)" ZT_EOL_S, what, _path.c_str());
+	}
+}
+
+void PeerCache::_compact(const int64_t now)
+{
+	const std::string tmpPath(_path + ".tmp");
+	FILE* const nf = fopen(tmpPath.c_str(), "wb");
+	if (! nf)
+		return;
+	OSUtils::lockDownFile(tmpPath.c_str(), false);
+
+	std::unordered_map<uint64_t, _Entry> newIndex;
+	long pos = ZT_PEERCACHE_MAGIC_LEN;
+	bool ok = (fwrite(ZT_PEERCACHE_MAGIC, ZT_PEERCACHE_MAGIC_LEN, 1, nf) == 1);
+	std::vector<uint8_t> rec;
+	for (auto e = _index.begin(); (ok) && (e != _index.end()); ++e) {
+		if ((now - e->second.timestamp) >= ZT_PEERCACHE_MAX_AGE)
+			continue;
+		rec.resize(ZT_PEERCACHE_RECORD_HEADER_LEN + e->second.len);
+		_putU64(rec.data(), e->first);
+		_putU64(rec.data() + 8, (uint64_t)e->second.timestamp);
+		_putU32(rec.data() + 16, e->second.len);
+		if ((fseek(_f, e->second.offset, SEEK_SET) != 0) || (fread(rec.data() + ZT_PEERCACHE_RECORD_HEADER_LEN, e->second.len, 1, _f) != 1))
+			continue;
+		ok = (fwrite(rec.data(), rec.size(), 1, nf) == 1);
+		_Entry& ne = newIndex[e->first];
+		ne.offset = pos + ZT_PEERCACHE_RECORD_HEADER_LEN;
+		ne.len = e->second.len;
+		ne.timestamp = e->second.timestamp;
+		pos += (long)rec.size();
+	}
+	if (fclose(nf) != 0)
+		ok = false;
+	if (! ok) {
+		OSUtils::rm(tmpPath);
+		return;
+	}
+
+	fclose(_f);
+	if (OSUtils::rename(tmpPath.c_str(), _path.c_str())) {
+		_index.swap(newIndex);
+		_end = pos;
+		_liveBytes = pos - ZT_PEERCACHE_MAGIC_LEN;
+	}
+	else {
+		OSUtils::rm(tmpPath);
+	}
+
+	// If this fails the next write reopens and rescans the file
+	_f = fopen(_path.c_str(), "r+b");
+	if (! _f)
+		_warn("unable to reopen");
+}
+
+void PeerCache::_threadMain()
+{
+	{
+		std::lock_guard<std::mutex> fl(_file_l);
+		_open();
+		_opened = true;
+	}
+	_openedCond.notify_all();
+
+	std::unique_lock<std::mutex> l(_lock);
+	while (_run) {
+		_wake.wait(l, [this]() { return ((! _run) || (! _queued.empty())); });
+		if (! _run)
+			break;
+
+		// Give a burst of changes a moment to arrive so they are written together
+		_wake.wait_for(l, std::chrono::milliseconds(ZT_PEERCACHE_WRITE_DELAY), [this]() { return (! _run); });
+
+		l.unlock();
+		flush();
+		l.lock();
+	}
+}
+
+}	// namespace ZeroTier
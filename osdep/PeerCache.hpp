@@ -0,0 +1,135 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * (c) ZeroTier, Inc.
+ * https://www.zerotier.com/
+ */
+
+#ifndef ZT_PEERCACHE_HPP
+#define ZT_PEERCACHE_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Entries not written for this long are dropped (30 days)
+#define ZT_PEERCACHE_MAX_AGE 2592000000LL
+
+// Delay before queued writes are appended, so bursts are written together
+#define ZT_PEERCACHE_WRITE_DELAY 1000
+
+// Compact once the file holds more than this many bytes beyond twice what is live
+#define ZT_PEERCACHE_COMPACT_SLACK 262144
+
+namespace ZeroTier {
+
+/**
+ * Single file store for cached peer state with write-behind
+ *
+ * Writes and deletes are queued and return immediately. Queued changes to
+ * the same peer are coalesced, and a background thread appends each batch
+ * to the file with one write. The file is a log of records that is scanned
+ * once when opened to index where the latest state of each peer lies, and
+ * it is rewritten with only live entries once mostly stale. Reads are
+ * answered from queued writes first and then from the file.
+ *
+ * The writer thread performs the initial scan, so creating a cache does not
+ * wait on disk. Reads and flushes wait for the scan to finish. If the file
+ * cannot be opened or written, changes stay queued and the file is reopened
+ * and written on the next flush.
+ *
+ * This class is thread safe.
+ */
+class PeerCache {
+  public:
+	/**
+	 * Start the writer thread, which opens or creates the peer cache file
+	 *
+	 * @param path Path to cache file
+	 */
+	PeerCache(const std::string& path);
+
+	/**
+	 * Write any queued changes and close the file
+	 */
+	~PeerCache();
+
+	/**
+	 * Queue a peer's state to be written
+	 *
+	 * @param address Peer address
+	 * @param data Serialized peer state
+	 * @param len Length of data
+	 */
+	void put(uint64_t address, const void* data, unsigned int len);
+
+	/**
+	 * Queue a peer's state to be deleted
+	 *
+	 * @param address Peer address
+	 */
+	void remove(uint64_t address);
+
+	/**
+	 * @param address Peer address
+	 * @param data Buffer to fill with peer state
+	 * @param maxlen Size of buffer
+	 * @return Length of peer state or -1 if not found or larger than maxlen
+	 */
+	int get(uint64_t address, void* data, unsigned int maxlen);
+
+	/**
+	 * Write queued changes now instead of waiting for the writer thread
+	 */
+	void flush();
+
+	/**
+	 * @return Number of peers with cached state in the file, not counting queued changes
+	 */
+	unsigned long size();
+
+  private:
+	struct _Entry {
+		long offset;   // offset of data in file
+		unsigned int len;
+		int64_t timestamp;
+	};
+
+	struct _Change {
+		std::vector<uint8_t> data;
+		bool remove;
+	};
+
+	void _open();
+	bool _write(const std::unordered_map<uint64_t, _Change>& changes, int64_t now);
+	void _warn(const char* what);
+	void _compact(int64_t now);
+	void _threadMain();
+
+	const std::string _path;
+	FILE* _f;
+	long _end;		  // end of last complete record in file
+	long _liveBytes;  // bytes of records that are the latest state of a peer
+	bool _failing;	  // last open or write failed, so further failures are not logged until one succeeds
+
+	std::unordered_map<uint64_t, _Entry> _index;
+	std::unordered_map<uint64_t, _Change> _queued;
+
+	std::mutex _file_l;	  // guards _f, _end, _liveBytes, _failing, _index and _opened, taken before _lock
+	std::condition_variable _openedCond;
+	bool _opened;
+	std::mutex _lock;	  // guards _queued and _run
+	std::condition_variable _wake;
+	bool _run;
+	std::thread _thread;
+};
+
+}	// namespace ZeroTier
+
+#endif
@@ -9,11 +9,13 @@
 #ifndef ZT_PHY_HPP
 #define ZT_PHY_HPP
 
+#include <algorithm>
 #include <list>
 #include <stdexcept>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 
 #if defined(_WIN32) || defined(_WIN64)
 
@@ -50,13 +52,42 @@
 #ifndef IPV6_DONTFRAG
 #define IPV6_DONTFRAG 62
 #endif
+#if defined(MSG_WAITFORONE)
+#define ZT_PHY_HAVE_SENDMMSG 1
+#define RECVMMSG_WINDOW_SIZE 128
+#define RECVMMSG_BUF_SIZE	 1500
+#include <atomic>
+#include <mutex>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#endif
+// epoll() is used unless ZT_PHY_USE_SELECT is defined at build time
+#ifndef ZT_PHY_USE_SELECT
+#define ZT_PHY_USE_EPOLL 1
+#include <sys/epoll.h>
+#endif
+// UDP sockets can be handed to per-core receive threads, see Phy<>::startRxThreads()
+#if defined(ZT_PHY_USE_EPOLL) && defined(ZT_PHY_HAVE_SENDMMSG) && defined(SO_REUSEPORT)
+#define ZT_PHY_HAVE_RX_THREADS 1
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <unordered_map>
+#endif
 #endif
 
 #define ZT_PHY_SOCKFD_TYPE			 int
 #define ZT_PHY_SOCKFD_NULL			 (-1)
 #define ZT_PHY_SOCKFD_VALID(s)		 ((s) > -1)
 #define ZT_PHY_CLOSE_SOCKET(s)		 ::close(s)
-#define ZT_PHY_MAX_SOCKETS			 (FD_SETSIZE)
+#ifdef ZT_PHY_USE_EPOLL
+#define ZT_PHY_MAX_SOCKETS		 1048576
+#define ZT_PHY_EPOLL_MAX_EVENTS	 256
+#else
+#define ZT_PHY_MAX_SOCKETS (FD_SETSIZE)
+#endif
 #define ZT_PHY_MAX_INTERCEPTS		 ZT_PHY_MAX_SOCKETS
 #define ZT_PHY_SOCKADDR_STORAGE_TYPE struct sockaddr_storage
 
@@ -69,6 +100,317 @@ namespace ZeroTier {
  */
 typedef void PhySocket;
 
+#ifdef ZT_PHY_HAVE_SENDMMSG
+
+#define ZT_PHY_TX_BATCH_SIZE	  64
+#define ZT_PHY_TX_BATCH_SLOT_SIZE 1500
+#define ZT_PHY_TX_BATCH_FAILED_SLOTS 64
+
+/**
+ * Per-thread batch of outgoing UDP datagrams (Linux only)
+ *
+ * While a PhyTxBatch::Scope is alive on a thread, Phy<>::udpSend() calls
+ * made from that thread queue their datagrams here instead of calling
+ * sendto(). The batch is flushed with one sendmmsg() per socket when the
+ * outermost scope ends or the batch fills up. Runs of equal-sized datagrams
+ * to the same destination (typically a packet head and its fragments) are
+ * additionally merged into a single UDP_SEGMENT send if the kernel has UDP
+ * GSO.
+ *
+ * Scopes are placed around processing bursts such as one recvmmsg() window
+ * in Phy<>::poll() or one tap read loop.
+ *
+ * Queued datagrams only reach the kernel when the batch is flushed, so a
+ * queued send cannot report failure to its caller. Instead a destination
+ * whose send failed at flush is remembered, and later sends to it from the
+ * same thread bypass the batch so that they report their own result.
+ * Queued datagrams hold socket descriptors, so Phy<> defers closing a UDP
+ * socket's descriptor until every scope open when it was closed has ended
+ * (see retire()).
+ */
+class PhyTxBatch {
+  public:
+	class Scope {
+	  public:
+		Scope() : _outer(PhyTxBatch::active() != nullptr)
+		{
+			if (! _outer) {
+				PhyTxBatch& b = PhyTxBatch::local();
+				{
+					// Under the lock retire() and retired() take, so a ticket is either issued
+					// before this scope's generation is read or sees that generation already set
+					std::lock_guard<std::mutex> l(_registryLock());
+					b._enteredAt = _generation().load();
+				}
+				PhyTxBatch::active() = &b;
+			}
+		}
+
+		~Scope()
+		{
+			if (! _outer) {
+				PhyTxBatch::active()->flush();
+				PhyTxBatch::active()->_enteredAt = 0;
+				PhyTxBatch::active() = nullptr;
+			}
+		}
+
+	  private:
+		const bool _outer;
+	};
+
+	/**
+	 * @return Batch currently collecting sends on this thread or NULL if none
+	 */
+	static inline PhyTxBatch*& active()
+	{
+		static thread_local PhyTxBatch* a = nullptr;
+		return a;
+	}
+
+	/**
+	 * Start retiring a socket that queued datagrams may still refer to
+	 *
+	 * @return Ticket for retired()
+	 */
+	static inline uint64_t retire()
+	{
+		std::lock_guard<std::mutex> l(_registryLock());
+		return ++_generation();
+	}
+
+	/**
+	 * @param ticket Ticket from retire()
+	 * @return True once every scope that was open when the ticket was issued has ended
+	 */
+	static inline bool retired(const uint64_t ticket)
+	{
+		std::lock_guard<std::mutex> l(_registryLock());
+		for (std::vector<PhyTxBatch*>::const_iterator b(_registry().begin()); b != _registry().end(); ++b) {
+			const uint64_t e = (*b)->_enteredAt;
+			if ((e != 0) && (e < ticket))
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @param fd Socket
+	 * @param addr Destination
+	 * @return True if the last flush failed to send to this destination
+	 */
+	inline bool failed(int fd, const struct sockaddr* addr) const
+	{
+		const uint64_t h = _destinationHash(fd, addr);
+		return (_failed[h % ZT_PHY_TX_BATCH_FAILED_SLOTS] == h);
+	}
+
+	/**
+	 * Forget a failure remembered for a destination after a send to it succeeds
+	 *
+	 * @param fd Socket
+	 * @param addr Destination
+	 */
+	inline void succeeded(int fd, const struct sockaddr* addr)
+	{
+		const uint64_t h = _destinationHash(fd, addr);
+		if (_failed[h % ZT_PHY_TX_BATCH_FAILED_SLOTS] == h)
+			_failed[h % ZT_PHY_TX_BATCH_FAILED_SLOTS] = 0;
+	}
+
+	/**
+	 * Queue a datagram, flushing first if the batch is full
+	 *
+	 * @param fd Socket
+	 * @param addr Destination
+	 * @param data Data (at most ZT_PHY_TX_BATCH_SLOT_SIZE bytes)
+	 * @param len Length of data
+	 * @param gso If true this datagram may be merged into a UDP GSO send
+	 */
+	inline void add(int fd, const struct sockaddr* addr, const void* data, unsigned int len, bool gso)
+	{
+		if (_count >= ZT_PHY_TX_BATCH_SIZE)
+			flush();
+		if (_data.empty())
+			_data.resize(ZT_PHY_TX_BATCH_SIZE * ZT_PHY_TX_BATCH_SLOT_SIZE);
+		_Entry& e = _e[_count];
+		e.fd = fd;
+		e.addrLen = (addr->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+		memcpy(&(e.addr), addr, e.addrLen);
+		e.len = len;
+		e.gso = gso;
+		memcpy(_data.data() + (_count * ZT_PHY_TX_BATCH_SLOT_SIZE), data, len);
+		++_count;
+	}
+
+	/**
+	 * Send everything queued so far
+	 */
+	inline void flush()
+	{
+		struct mmsghdr msgs[ZT_PHY_TX_BATCH_SIZE];
+		struct iovec iovs[ZT_PHY_TX_BATCH_SIZE];
+		char cbufs[ZT_PHY_TX_BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+		unsigned int msgFirst[ZT_PHY_TX_BATCH_SIZE], msgCount[ZT_PHY_TX_BATCH_SIZE];
+		const bool gsoEnabled = _gsoEnabled();
+
+		for (unsigned int k = 0; k < _count; ++k) {
+			iovs[k].iov_base = (void*)(_data.data() + (k * ZT_PHY_TX_BATCH_SLOT_SIZE));
+			iovs[k].iov_len = _e[k].len;
+		}
+
+		unsigned int i = 0;
+		while (i < _count) {
+			const int fd = _e[i].fd;
+			unsigned int m = 0, j = i;
+			while ((j < _count) && (_e[j].fd == fd)) {
+				// A GSO run is a series of same-sized datagrams to one destination
+				// where only the last may be shorter.
+				unsigned int run = 1, total = _e[j].len;
+				if ((gsoEnabled) && (_e[j].gso)) {
+					while ((j + run) < _count) {
+						const _Entry& n = _e[j + run];
+						if ((n.fd != fd) || (! n.gso) || (n.len > _e[j].len) || ((total + n.len) > 65000) || (n.addrLen != _e[j].addrLen) || (memcmp(&(n.addr), &(_e[j].addr), n.addrLen) != 0))
+							break;
+						total += n.len;
+						++run;
+						if (n.len < _e[j].len)
+							break;
+					}
+				}
+
+				memset(&(msgs[m]), 0, sizeof(struct mmsghdr));
+				msgs[m].msg_hdr.msg_name = (void*)&(_e[j].addr);
+				msgs[m].msg_hdr.msg_namelen = _e[j].addrLen;
+				msgs[m].msg_hdr.msg_iov = &(iovs[j]);
+				msgs[m].msg_hdr.msg_iovlen = run;
+				if (run > 1) {
+					memset(cbufs[m], 0, sizeof(cbufs[m]));
+					msgs[m].msg_hdr.msg_control = cbufs[m];
+					msgs[m].msg_hdr.msg_controllen = sizeof(cbufs[m]);
+					struct cmsghdr* cm = CMSG_FIRSTHDR(&(msgs[m].msg_hdr));
+					cm->cmsg_level = IPPROTO_UDP;
+					cm->cmsg_type = UDP_SEGMENT;
+					cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+					const uint16_t segSize = (uint16_t)_e[j].len;
+					memcpy(CMSG_DATA(cm), &segSize, sizeof(segSize));
+				}
+				msgFirst[m] = j;
+				msgCount[m] = run;
+				++m;
+				j += run;
+			}
+
+			unsigned int sent = 0;
+			while (sent < m) {
+				const int r = ::sendmmsg(fd, msgs + sent, m - sent, 0);
+				if (r > 0) {
+					for (unsigned int e = sent + (unsigned int)r; sent < e; ++sent) {
+						for (unsigned int k = msgFirst[sent], ke = msgFirst[sent] + msgCount[sent]; k < ke; ++k)
+							Metrics::udp_send += _e[k].len;
+					}
+					continue;
+				}
+				const unsigned int first = msgFirst[sent];
+				if ((msgCount[sent] > 1) && ((errno == EINVAL) || (errno == EIO) || (errno == ENOPROTOOPT))) {
+					// No UDP GSO in this kernel, so stop trying and send this run one by one.
+					_gsoEnabled() = false;
+					for (unsigned int k = first, e = first + msgCount[sent]; k < e; ++k) {
+						if ((long)::sendto(fd, iovs[k].iov_base, iovs[k].iov_len, 0, (const struct sockaddr*)&(_e[k].addr), _e[k].addrLen) == (long)_e[k].len)
+							Metrics::udp_send += _e[k].len;
+						else
+							_fail(k);
+					}
+				}
+				else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+					_fail(first);
+				}
+				++sent;	  // otherwise drop it, just as a failed sendto() would
+			}
+
+			i = j;
+		}
+
+		_count = 0;
+	}
+
+  private:
+	PhyTxBatch() : _count(0), _enteredAt(0)
+	{
+		memset(_failed, 0, sizeof(_failed));
+		std::lock_guard<std::mutex> l(_registryLock());
+		_registry().push_back(this);
+	}
+
+	~PhyTxBatch()
+	{
+		std::lock_guard<std::mutex> l(_registryLock());
+		_registry().erase(std::find(_registry().begin(), _registry().end(), this));
+	}
+
+	static inline PhyTxBatch& local()
+	{
+		static thread_local PhyTxBatch b;
+		return b;
+	}
+
+	// Incremented by retire() and read when a scope is entered, both under _registryLock()
+	static inline std::atomic<uint64_t>& _generation()
+	{
+		static std::atomic<uint64_t> g(1);
+		return g;
+	}
+
+	// Every thread's batch, so retired() can see which scopes are open
+	static inline std::mutex& _registryLock()
+	{
+		static std::mutex l;
+		return l;
+	}
+	static inline std::vector<PhyTxBatch*>& _registry()
+	{
+		static std::vector<PhyTxBatch*> r;
+		return r;
+	}
+
+	static inline uint64_t _destinationHash(int fd, const struct sockaddr* addr)
+	{
+		const uint8_t* a = reinterpret_cast<const uint8_t*>(addr);
+		uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t)fd;
+		for (unsigned int i = 0, l = (addr->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in); i < l; ++i)
+			h = (h ^ a[i]) * 0x100000001b3ULL;
+		return (h) ? h : 1;
+	}
+
+	inline void _fail(const unsigned int k)
+	{
+		const uint64_t h = _destinationHash(_e[k].fd, (const struct sockaddr*)&(_e[k].addr));
+		_failed[h % ZT_PHY_TX_BATCH_FAILED_SLOTS] = h;
+	}
+
+	static inline std::atomic_bool& _gsoEnabled()
+	{
+		static std::atomic_bool e(true);
+		return e;
+	}
+
+	struct _Entry {
+		int fd;
+		socklen_t addrLen;
+		struct sockaddr_storage addr;
+		unsigned int len;
+		bool gso;
+	};
+
+	_Entry _e[ZT_PHY_TX_BATCH_SIZE];
+	std::vector<uint8_t> _data;
+	unsigned int _count;
+	std::atomic<uint64_t> _enteredAt;	// generation when the outermost scope was entered, 0 if none is open
+	uint64_t _failed[ZT_PHY_TX_BATCH_FAILED_SLOTS];	  // hashes of destinations whose last batched send failed
+};
+
+#endif	 // ZT_PHY_HAVE_SENDMMSG
+
 /**
  * Simple templated non-blocking sockets implementation
  *
@@ -95,6 +437,14 @@ typedef void PhySocket;
  * phyOnUnixData(PhySocket *sock,void **uptr,void *data,unsigned long len)
  * phyOnUnixWritable(PhySocket *sock,void **uptr)
  *
+ * On Linux only:
+ *
+ * phyOnDatagramBatch(PhySocket *sock,void **uptr,const struct sockaddr *localAddr,const struct sockaddr *const *from,void *const *data,const unsigned long *len,unsigned int count)
+ *
+ * UDP sockets on Linux are read with recvmmsg() and everything one call
+ * returns is handed to phyOnDatagramBatch() at once. It must behave like
+ * calling phyOnDatagram() for each datagram in order.
+ *
  * These templates typically refer to function objects. Templates are used to
  * avoid the call overhead of indirection, which is surprisingly high for high
  * bandwidth applications pushing a lot of packets.
@@ -115,6 +465,11 @@ typedef void PhySocket;
  *
  * This isn't thread-safe with the exception of whack(), which is safe to
  * call from another thread to abort poll().
+ *
+ * On Linux UDP sockets may instead be received on RX threads started with
+ * startRxThreads(). phyOnDatagramBatch() is then called concurrently from those
+ * threads and must be thread-safe. All other handlers are still only called
+ * from poll().
  */
 template <typename HANDLER_PTR_TYPE> class Phy {
   private:
@@ -135,13 +490,46 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 	struct PhySocketImpl {
 		PhySocketImpl()
 		{
+#ifdef ZT_PHY_HAVE_SENDMMSG
+			retireTicket = 0;
+#endif
+#ifdef ZT_PHY_HAVE_RX_THREADS
+			rxThread = -1;
+			rxId = 0;
+#endif
 		}
 		PhySocketType type;
 		ZT_PHY_SOCKFD_TYPE sock;
 		void* uptr;	  // user-settable pointer
 		uint16_t localPort;
 		ZT_PHY_SOCKADDR_STORAGE_TYPE saddr;	  // remote for TCP_OUT and TCP_IN, local for TCP_LISTEN, RAW, and UDP
+#ifdef ZT_PHY_USE_EPOLL
+		bool wantRead;
+		bool wantWrite;
+		typename std::list<PhySocketImpl>::iterator self;	// position in _socks, for deferred erase
+#endif
+#ifdef ZT_PHY_HAVE_SENDMMSG
+		uint64_t retireTicket;	 // if non-zero, closed UDP socket whose fd is closed once PhyTxBatch::retired()
+#endif
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		int rxThread;	// RX thread receiving on this UDP socket or -1 if received in poll()
+		uint64_t rxId;	 // key in the RX thread's socks and its epoll data, never reused
+#endif
+	};
+
+#ifdef ZT_PHY_HAVE_RX_THREADS
+	struct _RxThread {
+		int epfd;
+		int wakeReceive;
+		int wakeSend;
+		std::mutex lock;	// guards socks and reads from them against close()
+		std::unordered_map<uint64_t, PhySocketImpl*> socks;
+		std::thread thread;
 	};
+	std::vector<_RxThread*> _rxThreads;
+	std::atomic<uint64_t> _rxNextId;
+	std::atomic<bool> _rxRun;
+#endif
 
 	std::list<PhySocketImpl> _socks;
 	fd_set _readfds;
@@ -150,6 +538,10 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 	fd_set _exceptfds;
 #endif
 	long _nfds;
+#ifdef ZT_PHY_USE_EPOLL
+	int _epfd;
+	std::vector<typename std::list<PhySocketImpl>::iterator> _closedSocks;
+#endif
 
 	ZT_PHY_SOCKFD_TYPE _whackReceiveSocket;
 	ZT_PHY_SOCKFD_TYPE _whackSendSocket;
@@ -207,16 +599,128 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		_whackSendSocket = pipes[1];
 		_noDelay = noDelay;
 		_noCheck = noCheck;
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		_rxNextId = 0;
+		_rxRun = false;
+#endif
+
+#ifdef ZT_PHY_USE_EPOLL
+		_epfd = ::epoll_create1(EPOLL_CLOEXEC);
+		if (_epfd < 0)
+			throw std::runtime_error("unable to create epoll instance");
+		{
+			// The whack pipe stays level-triggered and is identified by a NULL data pointer
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.ptr = (void*)0;
+			::epoll_ctl(_epfd, EPOLL_CTL_ADD, _whackReceiveSocket, &ev);
+		}
+#endif
 	}
 
 	~Phy()
 	{
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		_rxRun = false;
+		for (typename std::vector<_RxThread*>::iterator t(_rxThreads.begin()); t != _rxThreads.end(); ++t) {
+			const char c = 0;
+			(void)::write((*t)->wakeSend, &c, 1);
+			(*t)->thread.join();
+		}
+#endif
 		for (typename std::list<PhySocketImpl>::const_iterator s(_socks.begin()); s != _socks.end(); ++s) {
 			if (s->type != ZT_PHY_SOCKET_CLOSED)
 				this->close((PhySocket*)&(*s), true);
 		}
+#ifdef ZT_PHY_HAVE_SENDMMSG
+		for (typename std::list<PhySocketImpl>::const_iterator s(_socks.begin()); s != _socks.end(); ++s) {
+			if (s->retireTicket)
+				ZT_PHY_CLOSE_SOCKET(s->sock);
+		}
+#endif
 		ZT_PHY_CLOSE_SOCKET(_whackReceiveSocket);
 		ZT_PHY_CLOSE_SOCKET(_whackSendSocket);
+#ifdef ZT_PHY_USE_EPOLL
+		::close(_epfd);
+#endif
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		for (typename std::vector<_RxThread*>::iterator t(_rxThreads.begin()); t != _rxThreads.end(); ++t) {
+			::close((*t)->epfd);
+			::close((*t)->wakeReceive);
+			::close((*t)->wakeSend);
+			delete *t;
+		}
+#endif
+	}
+
+	/**
+	 * Start threads that receive on UDP sockets bound with an RX thread index
+	 *
+	 * Sockets bound with udpBind(...,rxThread) set SO_REUSEPORT, so binding one
+	 * socket per thread to the same address lets the kernel spread incoming
+	 * datagrams over the threads by 4-tuple hash. Each thread drains its own
+	 * sockets with recvmmsg() and calls phyOnDatagram() directly. This must be
+	 * called before such sockets are bound and does nothing if threads are
+	 * already running.
+	 *
+	 * @param count Number of threads
+	 * @param pinning If true, pin thread N to core N
+	 * @return True if threads are running (false if unsupported on this platform)
+	 */
+	inline bool startRxThreads(unsigned int count, bool pinning)
+	{
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		if (! _rxThreads.empty())
+			return true;
+		_rxRun = true;
+		for (unsigned int i = 0; i < count; ++i) {
+			_RxThread* const t = new _RxThread();
+			int pipes[2];
+			t->epfd = ::epoll_create1(EPOLL_CLOEXEC);
+			if ((t->epfd < 0) || (::pipe(pipes))) {
+				if (t->epfd >= 0)
+					::close(t->epfd);
+				delete t;
+				break;
+			}
+			t->wakeReceive = pipes[0];
+			t->wakeSend = pipes[1];
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.u64 = 0;
+			::epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->wakeReceive, &ev);
+			_rxThreads.push_back(t);
+			t->thread = std::thread([this, t, i, count, pinning]() {
+				if (pinning) {
+					cpu_set_t cpuset;
+					CPU_ZERO(&cpuset);
+					CPU_SET(i % count, &cpuset);
+					if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0)
+						fprintf(stderr, "WARNING: failed to pin UDP receive thread %u to core %u\n", i, i % count);
+				}
+				_rxThreadMain(*t);
+			});
+		}
+		return (! _rxThreads.empty());
+#else
+		(void)count;
+		(void)pinning;
+		return false;
+#endif
+	}
+
+	/**
+	 * @return Number of running RX threads (0 if none)
+	 */
+	inline unsigned int rxThreadCount() const
+	{
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		return (unsigned int)_rxThreads.size();
+#else
+		return 0;
+#endif
 	}
 
 	/**
@@ -312,12 +816,13 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 			return (PhySocket*)0;
 		}
 		PhySocketImpl& sws = _socks.back();
-		if ((long)fd > _nfds)
-			_nfds = (long)fd;
-		FD_SET(fd, &_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_IN; /* TODO: Type was changed to allow for CBs with new RPC model */
 		sws.sock = fd;
+#ifdef ZT_PHY_USE_EPOLL
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);   // it is read until EAGAIN on each edge
+#endif
 		sws.uptr = uptr;
+		_watch(sws, true, false);
 		memset(&(sws.saddr), 0, sizeof(struct sockaddr_storage));
 		// no sockaddr for this socket type, leave saddr null
 		return (PhySocket*)&sws;
@@ -329,9 +834,10 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 	 * @param localAddress Local endpoint address and port
 	 * @param uptr Initial value of user pointer associated with this socket (default: NULL)
 	 * @param bufferSize Desired socket receive/send buffer size -- will set as close to this as possible (default: 0, leave alone)
+	 * @param rxThread If non-negative and less than rxThreadCount(), set SO_REUSEPORT and receive on this RX thread instead of in poll() (default: -1)
 	 * @return Socket or NULL on failure to bind
 	 */
-	inline PhySocket* udpBind(const struct sockaddr* localAddress, void* uptr = (void*)0, int bufferSize = 0)
+	inline PhySocket* udpBind(const struct sockaddr* localAddress, void* uptr = (void*)0, int bufferSize = 0, int rxThread = -1)
 	{
 		if (_socks.size() >= ZT_PHY_MAX_SOCKETS)
 			return (PhySocket*)0;
@@ -410,6 +916,18 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		}
 #endif	 // Windows or not
 
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		if ((rxThread < 0) || (rxThread >= (int)_rxThreads.size())) {
+			rxThread = -1;
+		}
+		else {
+			int f = 1;
+			setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (void*)&f, sizeof(f));
+		}
+#else
+		(void)rxThread;
+#endif
+
 		if (::bind(s, localAddress, (localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in))) {
 			ZT_PHY_CLOSE_SOCKET(s);
 			return (PhySocket*)0;
@@ -433,9 +951,6 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		}
 		PhySocketImpl& sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s, &_readfds);
 		sws.type = ZT_PHY_SOCKET_UDP;
 		sws.sock = s;
 		sws.uptr = uptr;
@@ -447,6 +962,24 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		memset(&(sws.saddr), 0, sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr), localAddress, (localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
 
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		if (rxThread >= 0) {
+			_RxThread& t = *(_rxThreads[rxThread]);
+			sws.self = --_socks.end();
+			sws.rxThread = rxThread;
+			sws.rxId = ++_rxNextId;
+			std::lock_guard<std::mutex> l(t.lock);
+			t.socks[sws.rxId] = &sws;
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.u64 = sws.rxId;
+			::epoll_ctl(t.epfd, EPOLL_CTL_ADD, s, &ev);
+		}
+		else
+#endif
+			_watch(sws, true, false);
+
 		return (PhySocket*)&sws;
 	}
 
@@ -475,12 +1008,32 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 	 * @param remoteAddress Destination address (must be correct type for socket)
 	 * @param data Data to send
 	 * @param len Length of packet
-	 * @return True if packet appears to have been sent successfully
+	 * @param batchable If false, send immediately even inside a PhyTxBatch::Scope (default: true)
+	 * @return True if packet appears to have been sent successfully, or was queued in a PhyTxBatch (which cannot report failure)
 	 */
-	inline bool udpSend(PhySocket* sock, const struct sockaddr* remoteAddress, const void* data, unsigned long len)
+	inline bool udpSend(PhySocket* sock, const struct sockaddr* remoteAddress, const void* data, unsigned long len, bool batchable = true)
 	{
 		PhySocketImpl& sws = *(reinterpret_cast<PhySocketImpl*>(sock));
 		bool sent = false;
+#ifdef ZT_PHY_HAVE_SENDMMSG
+		if (batchable && (len <= ZT_PHY_TX_BATCH_SLOT_SIZE)) {
+			PhyTxBatch* const batch = PhyTxBatch::active();
+			if (batch) {
+				// Send directly to a destination that failed at the last flush, so the caller sees the result
+				if (! batch->failed(sws.sock, remoteAddress)) {
+					// UDP GSO is refused by the kernel on sockets with SO_NO_CHECK
+					batch->add(sws.sock, remoteAddress, data, (unsigned int)len, ! ((_noCheck) && (remoteAddress->sa_family == AF_INET)));
+					return true;
+				}
+				sent = ((long)::sendto(sws.sock, data, len, 0, remoteAddress, (remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
+				if (sent) {
+					batch->succeeded(sws.sock, remoteAddress);
+					Metrics::udp_send += len;
+				}
+				return sent;
+			}
+		}
+#endif
 #if defined(_WIN32) || defined(_WIN64)
 		sent = ((long)::sendto(sws.sock, reinterpret_cast<const char*>(data), len, 0, remoteAddress, (remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) == (long)len);
 #else
@@ -539,12 +1092,10 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		}
 		PhySocketImpl& sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s, &_readfds);
 		sws.type = ZT_PHY_SOCKET_UNIX_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
+		_watch(sws, true, false);
 		memset(&(sws.saddr), 0, sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr), &sun, sizeof(struct sockaddr_un));
 
@@ -612,12 +1163,10 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		}
 		PhySocketImpl& sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		FD_SET(s, &_readfds);
 		sws.type = ZT_PHY_SOCKET_TCP_LISTEN;
 		sws.sock = s;
 		sws.uptr = uptr;
+		_watch(sws, true, false);
 		memset(&(sws.saddr), 0, sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr), localAddress, (localAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
 
@@ -708,21 +1257,14 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		}
 		PhySocketImpl& sws = _socks.back();
 
-		if ((long)s > _nfds)
-			_nfds = (long)s;
-		if (connected) {
-			FD_SET(s, &_readfds);
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-		}
-		else {
-			FD_SET(s, &_writefds);
+		sws.type = (connected) ? ZT_PHY_SOCKET_TCP_OUT_CONNECTED : ZT_PHY_SOCKET_TCP_OUT_PENDING;
+		sws.sock = s;
+		sws.uptr = uptr;
+		_watch(sws, connected, ! connected);
 #if defined(_WIN32) || defined(_WIN64)
+		if (! connected)
 			FD_SET(s, &_exceptfds);
 #endif
-			sws.type = ZT_PHY_SOCKET_TCP_OUT_PENDING;
-		}
-		sws.sock = s;
-		sws.uptr = uptr;
 		memset(&(sws.saddr), 0, sizeof(struct sockaddr_storage));
 		memcpy(&(sws.saddr), remoteAddress, (remoteAddress->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
 
@@ -875,12 +1417,17 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 	inline void setNotifyWritable(PhySocket* sock, bool notifyWritable)
 	{
 		PhySocketImpl& sws = *(reinterpret_cast<PhySocketImpl*>(sock));
+#ifdef ZT_PHY_USE_EPOLL
+		if (sws.type != ZT_PHY_SOCKET_CLOSED)
+			_epollSet(sws, sws.wantRead, notifyWritable);
+#else
 		if (notifyWritable) {
 			FD_SET(sws.sock, &_writefds);
 		}
 		else {
 			FD_CLR(sws.sock, &_writefds);
 		}
+#endif
 	}
 
 	/**
@@ -896,12 +1443,17 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 	inline void setNotifyReadable(PhySocket* sock, bool notifyReadable)
 	{
 		PhySocketImpl& sws = *(reinterpret_cast<PhySocketImpl*>(sock));
+#ifdef ZT_PHY_USE_EPOLL
+		if (sws.type != ZT_PHY_SOCKET_CLOSED)
+			_epollSet(sws, notifyReadable, sws.wantWrite);
+#else
 		if (notifyReadable) {
 			FD_SET(sws.sock, &_readfds);
 		}
 		else {
 			FD_CLR(sws.sock, &_readfds);
 		}
+#endif
 	}
 
 	/**
@@ -915,8 +1467,34 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 	 */
 	inline void poll(unsigned long timeout)
 	{
-		char buf[131072];
-		struct sockaddr_storage ss;
+#ifdef ZT_PHY_USE_EPOLL
+		struct epoll_event events[ZT_PHY_EPOLL_MAX_EVENTS];
+		const int n = ::epoll_wait(_epfd, events, ZT_PHY_EPOLL_MAX_EVENTS, (timeout > 0) ? (int)timeout : -1);
+		for (int i = 0; i < n; ++i) {
+			PhySocketImpl* const s = reinterpret_cast<PhySocketImpl*>(events[i].data.ptr);
+			if (! s) {
+				char tmp[16];
+				::read(_whackReceiveSocket, tmp, 16);
+			}
+			else if (s->type != ZT_PHY_SOCKET_CLOSED) {
+				const uint32_t ev = events[i].events;
+				_service(*s, ((ev & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0), ((ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0), false);
+			}
+		}
+
+		// Sockets closed since the last poll() are only unlinked here, so that
+		// events already returned for them above can be safely skipped.
+		for (unsigned long c = 0; c < _closedSocks.size();) {
+			if (_release(*(_closedSocks[c]))) {
+				_socks.erase(_closedSocks[c]);
+				_closedSocks[c] = _closedSocks.back();
+				_closedSocks.pop_back();
+			}
+			else {
+				++c;
+			}
+		}
+#else	// select()
 		struct timeval tv;
 		fd_set rfds, wfds, efds;
 
@@ -943,244 +1521,14 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		}
 
 		for (typename std::list<PhySocketImpl>::iterator s(_socks.begin()); s != _socks.end();) {
-			switch (s->type) {
-				case ZT_PHY_SOCKET_TCP_OUT_PENDING:
-#if defined(_WIN32) || defined(_WIN64)
-					if (FD_ISSET(s->sock, &efds)) {
-						this->close((PhySocket*)&(*s), true);
-					}
-					else   // ... if
-#endif
-						if (FD_ISSET(s->sock, &wfds)) {
-						socklen_t slen = sizeof(ss);
-						if (::getpeername(s->sock, (struct sockaddr*)&ss, &slen) != 0) {
-							this->close((PhySocket*)&(*s), true);
-						}
-						else {
-							s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
-							FD_SET(s->sock, &_readfds);
-							FD_CLR(s->sock, &_writefds);
-#if defined(_WIN32) || defined(_WIN64)
-							FD_CLR(s->sock, &_exceptfds);
-#endif
-							try {
-								_handler->phyOnTcpConnect((PhySocket*)&(*s), &(s->uptr), true);
-							}
-							catch (...) {
-							}
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
-				case ZT_PHY_SOCKET_TCP_IN: {
-					ZT_PHY_SOCKFD_TYPE sock = s->sock;	 // if closed, s->sock becomes invalid as s is no longer dereferencable
-					if (FD_ISSET(sock, &rfds)) {
-						long n = (long)::recv(sock, buf, sizeof(buf), 0);
-						if (n <= 0) {
-							this->close((PhySocket*)&(*s), true);
-						}
-						else {
-							try {
-								_handler->phyOnTcpData((PhySocket*)&(*s), &(s->uptr), (void*)buf, (unsigned long)n);
-							}
-							catch (...) {
-							}
-						}
-					}
-					if ((FD_ISSET(sock, &wfds)) && (FD_ISSET(sock, &_writefds))) {
-						try {
-							_handler->phyOnTcpWritable((PhySocket*)&(*s), &(s->uptr));
-						}
-						catch (...) {
-						}
-					}
-				} break;
-
-				case ZT_PHY_SOCKET_TCP_LISTEN:
-					if (FD_ISSET(s->sock, &rfds)) {
-						memset(&ss, 0, sizeof(ss));
-						socklen_t slen = sizeof(ss);
-						ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock, (struct sockaddr*)&ss, &slen);
-						if (ZT_PHY_SOCKFD_VALID(newSock)) {
-							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
-								ZT_PHY_CLOSE_SOCKET(newSock);
-							}
-							else {
-#if defined(_WIN32) || defined(_WIN64)
-								{
-									BOOL f = (_noDelay ? TRUE : FALSE);
-									setsockopt(newSock, IPPROTO_TCP, TCP_NODELAY, (char*)&f, sizeof(f));
-								}
-								{
-									u_long iMode = 1;
-									ioctlsocket(newSock, FIONBIO, &iMode);
-								}
-#else
-								{
-									int f = (_noDelay ? 1 : 0);
-									setsockopt(newSock, IPPROTO_TCP, TCP_NODELAY, (char*)&f, sizeof(f));
-								}
-								fcntl(newSock, F_SETFL, O_NONBLOCK);
-#endif
-								_socks.push_back(PhySocketImpl());
-								PhySocketImpl& sws = _socks.back();
-								FD_SET(newSock, &_readfds);
-								if ((long)newSock > _nfds)
-									_nfds = (long)newSock;
-								sws.type = ZT_PHY_SOCKET_TCP_IN;
-								sws.sock = newSock;
-								sws.uptr = (void*)0;
-								memcpy(&(sws.saddr), &ss, sizeof(struct sockaddr_storage));
-								try {
-									_handler->phyOnTcpAccept((PhySocket*)&(*s), (PhySocket*)&(_socks.back()), &(s->uptr), &(sws.uptr), (const struct sockaddr*)&(sws.saddr));
-								}
-								catch (...) {
-								}
-							}
-						}
-					}
-					break;
-
-				case ZT_PHY_SOCKET_UDP:
-					if (FD_ISSET(s->sock, &rfds)) {
-#if (defined(__linux__) || defined(linux) || defined(__linux)) && defined(MSG_WAITFORONE)
-#define RECVMMSG_WINDOW_SIZE 128
-#define RECVMMSG_BUF_SIZE	 1500
-						iovec iovs[RECVMMSG_WINDOW_SIZE];
-						uint8_t bufs[RECVMMSG_WINDOW_SIZE][RECVMMSG_BUF_SIZE];
-						sockaddr_storage addrs[RECVMMSG_WINDOW_SIZE];
-						memset(addrs, 0, sizeof(addrs));
-						mmsghdr mm[RECVMMSG_WINDOW_SIZE];
-						memset(mm, 0, sizeof(mm));
-						for (int i = 0; i < RECVMMSG_WINDOW_SIZE; ++i) {
-							iovs[i].iov_base = (void*)bufs[i];
-							iovs[i].iov_len = RECVMMSG_BUF_SIZE;
-							mm[i].msg_hdr.msg_name = (void*)&(addrs[i]);
-							mm[i].msg_hdr.msg_iov = &(iovs[i]);
-							mm[i].msg_hdr.msg_iovlen = 1;
-						}
-						for (int k = 0; k < 1024; ++k) {
-							for (int i = 0; i < RECVMMSG_WINDOW_SIZE; ++i) {
-								mm[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
-								mm[i].msg_len = 0;
-							}
-							int received_count = recvmmsg(s->sock, mm, RECVMMSG_WINDOW_SIZE, MSG_WAITFORONE, nullptr);
-							if (received_count > 0) {
-								for (int i = 0; i < received_count; ++i) {
-									long n = (long)mm[i].msg_len;
-									if (n > 0) {
-										try {
-											_handler->phyOnDatagram((PhySocket*)&(*s), &(s->uptr), (const struct sockaddr*)&(s->saddr), (const struct sockaddr*)&(addrs[i]), bufs[i], (unsigned long)n);
-										}
-										catch (...) {
-										}
-									}
-								}
-							}
-							else {
-								break;
-							}
-						}
-#else
-						for (int k = 0; k < 1024; ++k) {
-							memset(&ss, 0, sizeof(ss));
-							socklen_t slen = sizeof(ss);
-							long n = (long)::recvfrom(s->sock, buf, sizeof(buf), 0, (struct sockaddr*)&ss, &slen);
-							if (n > 0) {
-								try {
-									_handler->phyOnDatagram((PhySocket*)&(*s), &(s->uptr), (const struct sockaddr*)&(s->saddr), (const struct sockaddr*)&ss, (void*)buf, (unsigned long)n);
-								}
-								catch (...) {
-								}
-							}
-							else if (n < 0)
-								break;
-						}
-#endif
-					}
-					break;
-
-				case ZT_PHY_SOCKET_UNIX_IN: {
-#ifdef __UNIX_LIKE__
-					ZT_PHY_SOCKFD_TYPE sock = s->sock;	 // if closed, s->sock becomes invalid as s is no longer dereferencable
-					if ((FD_ISSET(sock, &wfds)) && (FD_ISSET(sock, &_writefds))) {
-						try {
-							_handler->phyOnUnixWritable((PhySocket*)&(*s), &(s->uptr));
-						}
-						catch (...) {
-						}
-					}
-					if (FD_ISSET(sock, &rfds)) {
-						long n = (long)::read(sock, buf, sizeof(buf));
-						if (n <= 0) {
-							this->close((PhySocket*)&(*s), true);
-						}
-						else {
-							try {
-								_handler->phyOnUnixData((PhySocket*)&(*s), &(s->uptr), (void*)buf, (unsigned long)n);
-							}
-							catch (...) {
-							}
-						}
-					}
-#endif	 // __UNIX_LIKE__
-				} break;
-
-				case ZT_PHY_SOCKET_UNIX_LISTEN:
-#ifdef __UNIX_LIKE__
-					if (FD_ISSET(s->sock, &rfds)) {
-						memset(&ss, 0, sizeof(ss));
-						socklen_t slen = sizeof(ss);
-						ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock, (struct sockaddr*)&ss, &slen);
-						if (ZT_PHY_SOCKFD_VALID(newSock)) {
-							if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
-								ZT_PHY_CLOSE_SOCKET(newSock);
-							}
-							else {
-								fcntl(newSock, F_SETFL, O_NONBLOCK);
-								_socks.push_back(PhySocketImpl());
-								PhySocketImpl& sws = _socks.back();
-								FD_SET(newSock, &_readfds);
-								if ((long)newSock > _nfds)
-									_nfds = (long)newSock;
-								sws.type = ZT_PHY_SOCKET_UNIX_IN;
-								sws.sock = newSock;
-								sws.uptr = (void*)0;
-								memcpy(&(sws.saddr), &ss, sizeof(struct sockaddr_storage));
-								try {
-									//_handler->phyOnUnixAccept((PhySocket *)&(*s),(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr));
-								}
-								catch (...) {
-								}
-							}
-						}
-					}
-#endif	 // __UNIX_LIKE__
-					break;
-
-				case ZT_PHY_SOCKET_FD: {
-					ZT_PHY_SOCKFD_TYPE sock = s->sock;
-					const bool readable = ((FD_ISSET(sock, &rfds)) && (FD_ISSET(sock, &_readfds)));
-					const bool writable = ((FD_ISSET(sock, &wfds)) && (FD_ISSET(sock, &_writefds)));
-					if ((readable) || (writable)) {
-						try {
-							//_handler->phyOnFileDescriptorActivity((PhySocket *)&(*s),&(s->uptr),readable,writable);
-						}
-						catch (...) {
-						}
-					}
-				} break;
-
-				default:
-					break;
-			}
-
-			if (s->type == ZT_PHY_SOCKET_CLOSED)
+			if (s->type != ZT_PHY_SOCKET_CLOSED)
+				_service(*s, FD_ISSET(s->sock, &rfds), FD_ISSET(s->sock, &wfds), FD_ISSET(s->sock, &efds));
+			if ((s->type == ZT_PHY_SOCKET_CLOSED) && (_release(*s)))
 				_socks.erase(s++);
 			else
 				++s;
 		}
+#endif	 // ZT_PHY_USE_EPOLL or select()
 	}
 
 	/**
@@ -1195,14 +1543,35 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		if (sws.type == ZT_PHY_SOCKET_CLOSED)
 			return;
 
+#ifdef ZT_PHY_USE_EPOLL
+#ifdef ZT_PHY_HAVE_RX_THREADS
+		if (sws.rxThread >= 0) {
+			// Once it is gone from the RX thread's list under its lock that thread will not read from it again
+			_RxThread& t = *(_rxThreads[sws.rxThread]);
+			std::lock_guard<std::mutex> l(t.lock);
+			::epoll_ctl(t.epfd, EPOLL_CTL_DEL, sws.sock, (struct epoll_event*)0);
+			t.socks.erase(sws.rxId);
+		}
+		else
+#endif
+			::epoll_ctl(_epfd, EPOLL_CTL_DEL, sws.sock, (struct epoll_event*)0);
+#else
 		FD_CLR(sws.sock, &_readfds);
 		FD_CLR(sws.sock, &_writefds);
 #if defined(_WIN32) || defined(_WIN64)
 		FD_CLR(sws.sock, &_exceptfds);
+#endif
 #endif
 
-		if (sws.type != ZT_PHY_SOCKET_FD)
-			ZT_PHY_CLOSE_SOCKET(sws.sock);
+		if (sws.type != ZT_PHY_SOCKET_FD) {
+#ifdef ZT_PHY_HAVE_SENDMMSG
+			// Datagrams queued on any thread may still refer to this fd, so keep it from being reused until they are sent
+			if (sws.type == ZT_PHY_SOCKET_UDP)
+				sws.retireTicket = PhyTxBatch::retire();
+			else
+#endif
+				ZT_PHY_CLOSE_SOCKET(sws.sock);
+		}
 
 #ifdef __UNIX_LIKE__
 		if (sws.type == ZT_PHY_SOCKET_UNIX_LISTEN)
@@ -1243,6 +1612,9 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 		// Causes entry to be deleted from list in poll(), ignored elsewhere
 		sws.type = ZT_PHY_SOCKET_CLOSED;
 
+#ifdef ZT_PHY_USE_EPOLL
+		_closedSocks.push_back(sws.self);
+#else
 		if ((long)sws.sock >= (long)_nfds) {
 			long nfds = (long)_whackSendSocket;
 			if ((long)_whackReceiveSocket > nfds)
@@ -1253,6 +1625,463 @@ template <typename HANDLER_PTR_TYPE> class Phy {
 			}
 			_nfds = nfds;
 		}
+#endif
+	}
+
+  private:
+#ifdef ZT_PHY_HAVE_RX_THREADS
+	inline void _rxThreadMain(_RxThread& t)
+	{
+		struct epoll_event events[ZT_PHY_EPOLL_MAX_EVENTS];
+		std::vector<uint8_t> bufs(RECVMMSG_WINDOW_SIZE * RECVMMSG_BUF_SIZE);
+		iovec iovs[RECVMMSG_WINDOW_SIZE];
+		sockaddr_storage addrs[RECVMMSG_WINDOW_SIZE];
+		mmsghdr mm[RECVMMSG_WINDOW_SIZE];
+		memset(addrs, 0, sizeof(addrs));
+		memset(mm, 0, sizeof(mm));
+		for (int i = 0; i < RECVMMSG_WINDOW_SIZE; ++i) {
+			iovs[i].iov_base = (void*)(bufs.data() + (i * RECVMMSG_BUF_SIZE));
+			iovs[i].iov_len = RECVMMSG_BUF_SIZE;
+			mm[i].msg_hdr.msg_name = (void*)&(addrs[i]);
+			mm[i].msg_hdr.msg_iov = &(iovs[i]);
+			mm[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		while (_rxRun) {
+			const int n = ::epoll_wait(t.epfd, events, ZT_PHY_EPOLL_MAX_EVENTS, -1);
+			for (int e = 0; e < n; ++e) {
+				if (! events[e].data.u64) {
+					char tmp[16];
+					(void)::read(t.wakeReceive, tmp, 16);
+					continue;
+				}
+
+				// Read under the lock so close() cannot close the fd out from under us, then
+				// dispatch without it. The socket is level-triggered so anything left over
+				// after one window brings us back here. Sockets are looked up by an id that
+				// is never reused, and the open scope keeps a socket closed after the lookup
+				// (and its fd) from being released until dispatch is done.
+				PhyTxBatch::Scope txBatch;
+				PhySocketImpl* s;
+				struct sockaddr_storage localAddr;
+				void* uptr;
+				int received;
+				{
+					std::lock_guard<std::mutex> l(t.lock);
+					const typename std::unordered_map<uint64_t, PhySocketImpl*>::const_iterator i(t.socks.find(events[e].data.u64));
+					if (i == t.socks.end())
+						continue;
+					s = i->second;
+					for (int i = 0; i < RECVMMSG_WINDOW_SIZE; ++i) {
+						mm[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+						mm[i].msg_len = 0;
+					}
+					received = recvmmsg(s->sock, mm, RECVMMSG_WINDOW_SIZE, MSG_DONTWAIT, nullptr);
+					memcpy(&localAddr, &(s->saddr), sizeof(localAddr));
+					uptr = s->uptr;
+				}
+
+				if (received > 0) {
+					const struct sockaddr* from[RECVMMSG_WINDOW_SIZE];
+					void* data[RECVMMSG_WINDOW_SIZE];
+					unsigned long len[RECVMMSG_WINDOW_SIZE];
+					unsigned int count = 0;
+					for (int i = 0; i < received; ++i) {
+						if (mm[i].msg_len > 0) {
+							from[count] = (const struct sockaddr*)&(addrs[i]);
+							data[count] = iovs[i].iov_base;
+							len[count++] = (unsigned long)mm[i].msg_len;
+						}
+					}
+					if (count) {
+						try {
+							_handler->phyOnDatagramBatch((PhySocket*)s, &uptr, (const struct sockaddr*)&localAddr, from, data, len, count);
+						}
+						catch (...) {
+						}
+					}
+				}
+			}
+		}
+	}
+#endif
+
+	/**
+	 * Check whether a closed socket can be erased, closing its fd first if that was deferred
+	 */
+	inline bool _release(PhySocketImpl& sws)
+	{
+#ifdef ZT_PHY_HAVE_SENDMMSG
+		if (sws.retireTicket) {
+			if (! PhyTxBatch::retired(sws.retireTicket))
+				return false;
+			ZT_PHY_CLOSE_SOCKET(sws.sock);
+			sws.retireTicket = 0;
+		}
+#endif
+		return true;
+	}
+
+	/**
+	 * Start watching a socket that was just added to the end of _socks
+	 */
+	inline void _watch(PhySocketImpl& sws, bool readable, bool writable)
+	{
+#ifdef ZT_PHY_USE_EPOLL
+		sws.self = --_socks.end();
+		_epollSet(sws, readable, writable, EPOLL_CTL_ADD);
+#else
+		if ((long)sws.sock > _nfds)
+			_nfds = (long)sws.sock;
+		if (readable)
+			FD_SET(sws.sock, &_readfds);
+		if (writable)
+			FD_SET(sws.sock, &_writefds);
+#endif
+	}
+
+	inline bool _wantsReadable(const PhySocketImpl& sws) const
+	{
+#ifdef ZT_PHY_USE_EPOLL
+		return sws.wantRead;
+#else
+		return FD_ISSET(sws.sock, &_readfds);
+#endif
+	}
+
+	inline bool _wantsWritable(const PhySocketImpl& sws) const
+	{
+#ifdef ZT_PHY_USE_EPOLL
+		return sws.wantWrite;
+#else
+		return FD_ISSET(sws.sock, &_writefds);
+#endif
+	}
+
+#ifdef ZT_PHY_USE_EPOLL
+	/**
+	 * Set (or re-arm) a socket's edge-triggered interest set
+	 *
+	 * EPOLL_CTL_MOD makes the kernel re-check readiness, so calling this with
+	 * unchanged interests delivers a new event if the socket is still ready.
+	 */
+	inline void _epollSet(PhySocketImpl& sws, bool readable, bool writable, int op = EPOLL_CTL_MOD)
+	{
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLET | (readable ? EPOLLIN : 0) | (writable ? EPOLLOUT : 0);
+		ev.data.ptr = (void*)&sws;
+		sws.wantRead = readable;
+		sws.wantWrite = writable;
+		::epoll_ctl(_epfd, op, sws.sock, &ev);
+	}
+#endif
+
+	/**
+	 * Handle readiness on one socket
+	 *
+	 * With epoll this is called on edges, so reads and accepts loop until the
+	 * socket would block, and sockets that still want writability after their
+	 * writable handler are re-armed to keep select()'s level semantics.
+	 */
+	inline void _service(PhySocketImpl& sws, const bool readable, const bool writable, const bool except)
+	{
+		char buf[131072];
+		struct sockaddr_storage ss;
+		PhySocketImpl* const s = &sws;
+
+		switch (s->type) {
+			case ZT_PHY_SOCKET_TCP_OUT_PENDING:
+#if defined(_WIN32) || defined(_WIN64)
+				if (except) {
+					this->close((PhySocket*)s, true);
+				}
+				else   // ... if
+#endif
+					if (writable) {
+					socklen_t slen = sizeof(ss);
+					if (::getpeername(s->sock, (struct sockaddr*)&ss, &slen) != 0) {
+						this->close((PhySocket*)s, true);
+					}
+					else {
+						s->type = ZT_PHY_SOCKET_TCP_OUT_CONNECTED;
+#ifdef ZT_PHY_USE_EPOLL
+						_epollSet(*s, true, false);
+#else
+						FD_SET(s->sock, &_readfds);
+						FD_CLR(s->sock, &_writefds);
+#if defined(_WIN32) || defined(_WIN64)
+						FD_CLR(s->sock, &_exceptfds);
+#endif
+#endif
+						try {
+							_handler->phyOnTcpConnect((PhySocket*)s, &(s->uptr), true);
+						}
+						catch (...) {
+						}
+					}
+				}
+				break;
+
+			case ZT_PHY_SOCKET_TCP_OUT_CONNECTED:
+			case ZT_PHY_SOCKET_TCP_IN: {
+				ZT_PHY_SOCKFD_TYPE sock = s->sock;	 // if closed, s->sock becomes invalid as s is no longer dereferencable
+				if (readable) {
+					for (;;) {
+						long n = (long)::recv(sock, buf, sizeof(buf), 0);
+						if (n <= 0) {
+#ifdef ZT_PHY_USE_EPOLL
+							if (n < 0) {
+								if (errno == EINTR)
+									continue;
+								if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+									break;
+							}
+#endif
+							this->close((PhySocket*)s, true);
+							break;
+						}
+						try {
+							_handler->phyOnTcpData((PhySocket*)s, &(s->uptr), (void*)buf, (unsigned long)n);
+						}
+						catch (...) {
+						}
+#ifdef ZT_PHY_USE_EPOLL
+						if (s->type != ZT_PHY_SOCKET_CLOSED)
+							continue;	// edge-triggered: read to EAGAIN or EOF, or a FIN that came with the data is missed
+#endif
+						break;
+					}
+				}
+				if ((writable) && (s->type != ZT_PHY_SOCKET_CLOSED) && (_wantsWritable(*s))) {
+					try {
+						_handler->phyOnTcpWritable((PhySocket*)s, &(s->uptr));
+					}
+					catch (...) {
+					}
+#ifdef ZT_PHY_USE_EPOLL
+					if ((s->type != ZT_PHY_SOCKET_CLOSED) && (s->wantWrite))
+						_epollSet(*s, s->wantRead, true);
+#endif
+				}
+			} break;
+
+			case ZT_PHY_SOCKET_TCP_LISTEN:
+				while (readable) {
+					memset(&ss, 0, sizeof(ss));
+					socklen_t slen = sizeof(ss);
+					ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock, (struct sockaddr*)&ss, &slen);
+					if (! ZT_PHY_SOCKFD_VALID(newSock))
+						break;
+					if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+						ZT_PHY_CLOSE_SOCKET(newSock);
+					}
+					else {
+#if defined(_WIN32) || defined(_WIN64)
+						{
+							BOOL f = (_noDelay ? TRUE : FALSE);
+							setsockopt(newSock, IPPROTO_TCP, TCP_NODELAY, (char*)&f, sizeof(f));
+						}
+						{
+							u_long iMode = 1;
+							ioctlsocket(newSock, FIONBIO, &iMode);
+						}
+#else
+						{
+							int f = (_noDelay ? 1 : 0);
+							setsockopt(newSock, IPPROTO_TCP, TCP_NODELAY, (char*)&f, sizeof(f));
+						}
+						fcntl(newSock, F_SETFL, O_NONBLOCK);
+#endif
+						_socks.push_back(PhySocketImpl());
+						PhySocketImpl& sws = _socks.back();
+						sws.type = ZT_PHY_SOCKET_TCP_IN;
+						sws.sock = newSock;
+						sws.uptr = (void*)0;
+						memcpy(&(sws.saddr), &ss, sizeof(struct sockaddr_storage));
+						_watch(sws, true, false);
+						try {
+							_handler->phyOnTcpAccept((PhySocket*)s, (PhySocket*)&(_socks.back()), &(s->uptr), &(sws.uptr), (const struct sockaddr*)&(sws.saddr));
+						}
+						catch (...) {
+						}
+					}
+#ifndef ZT_PHY_USE_EPOLL
+					break;
+#endif
+				}
+				break;
+
+			case ZT_PHY_SOCKET_UDP:
+				if (readable) {
+					bool drained = false;
+#if (defined(__linux__) || defined(linux) || defined(__linux)) && defined(MSG_WAITFORONE)
+					iovec iovs[RECVMMSG_WINDOW_SIZE];
+					uint8_t bufs[RECVMMSG_WINDOW_SIZE][RECVMMSG_BUF_SIZE];
+					sockaddr_storage addrs[RECVMMSG_WINDOW_SIZE];
+					memset(addrs, 0, sizeof(addrs));
+					mmsghdr mm[RECVMMSG_WINDOW_SIZE];
+					memset(mm, 0, sizeof(mm));
+					for (int i = 0; i < RECVMMSG_WINDOW_SIZE; ++i) {
+						iovs[i].iov_base = (void*)bufs[i];
+						iovs[i].iov_len = RECVMMSG_BUF_SIZE;
+						mm[i].msg_hdr.msg_name = (void*)&(addrs[i]);
+						mm[i].msg_hdr.msg_iov = &(iovs[i]);
+						mm[i].msg_hdr.msg_iovlen = 1;
+					}
+					for (int k = 0; k < 1024; ++k) {
+						for (int i = 0; i < RECVMMSG_WINDOW_SIZE; ++i) {
+							mm[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+							mm[i].msg_len = 0;
+						}
+						int received_count = recvmmsg(s->sock, mm, RECVMMSG_WINDOW_SIZE, MSG_WAITFORONE, nullptr);
+						if (received_count > 0) {
+							PhyTxBatch::Scope txBatch;	 // replies and relayed packets go out with sendmmsg()
+							const struct sockaddr* from[RECVMMSG_WINDOW_SIZE];
+							void* data[RECVMMSG_WINDOW_SIZE];
+							unsigned long len[RECVMMSG_WINDOW_SIZE];
+							unsigned int count = 0;
+							for (int i = 0; i < received_count; ++i) {
+								if (mm[i].msg_len > 0) {
+									from[count] = (const struct sockaddr*)&(addrs[i]);
+									data[count] = bufs[i];
+									len[count++] = (unsigned long)mm[i].msg_len;
+								}
+							}
+							if (count) {
+								try {
+									_handler->phyOnDatagramBatch((PhySocket*)s, &(s->uptr), (const struct sockaddr*)&(s->saddr), from, data, len, count);
+								}
+								catch (...) {
+								}
+							}
+						}
+						else {
+							drained = true;
+							break;
+						}
+					}
+#else
+					for (int k = 0; k < 1024; ++k) {
+						memset(&ss, 0, sizeof(ss));
+						socklen_t slen = sizeof(ss);
+						long n = (long)::recvfrom(s->sock, buf, sizeof(buf), 0, (struct sockaddr*)&ss, &slen);
+						if (n > 0) {
+							try {
+								_handler->phyOnDatagram((PhySocket*)s, &(s->uptr), (const struct sockaddr*)&(s->saddr), (const struct sockaddr*)&ss, (void*)buf, (unsigned long)n);
+							}
+							catch (...) {
+							}
+						}
+						else if (n < 0) {
+							drained = true;
+							break;
+						}
+					}
+#endif
+#ifdef ZT_PHY_USE_EPOLL
+					// Stopped for fairness with datagrams still queued, so ask for another edge
+					if ((! drained) && (s->type != ZT_PHY_SOCKET_CLOSED))
+						_epollSet(*s, s->wantRead, s->wantWrite);
+#else
+					(void)drained;
+#endif
+				}
+				break;
+
+			case ZT_PHY_SOCKET_UNIX_IN: {
+#ifdef __UNIX_LIKE__
+				ZT_PHY_SOCKFD_TYPE sock = s->sock;	 // if closed, s->sock becomes invalid as s is no longer dereferencable
+				if ((writable) && (_wantsWritable(*s))) {
+					try {
+						_handler->phyOnUnixWritable((PhySocket*)s, &(s->uptr));
+					}
+					catch (...) {
+					}
+#ifdef ZT_PHY_USE_EPOLL
+					if ((s->type != ZT_PHY_SOCKET_CLOSED) && (s->wantWrite))
+						_epollSet(*s, s->wantRead, true);
+#endif
+				}
+				if ((readable) && (s->type != ZT_PHY_SOCKET_CLOSED)) {
+					for (;;) {
+						long n = (long)::read(sock, buf, sizeof(buf));
+						if (n <= 0) {
+#ifdef ZT_PHY_USE_EPOLL
+							if (n < 0) {
+								if (errno == EINTR)
+									continue;
+								if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+									break;
+							}
+#endif
+							this->close((PhySocket*)s, true);
+							break;
+						}
+						try {
+							_handler->phyOnUnixData((PhySocket*)s, &(s->uptr), (void*)buf, (unsigned long)n);
+						}
+						catch (...) {
+						}
+#ifdef ZT_PHY_USE_EPOLL
+						if (s->type != ZT_PHY_SOCKET_CLOSED)
+							continue;	// edge-triggered: read to EAGAIN or EOF, or a FIN that came with the data is missed
+#endif
+						break;
+					}
+				}
+#endif	 // __UNIX_LIKE__
+			} break;
+
+			case ZT_PHY_SOCKET_UNIX_LISTEN:
+#ifdef __UNIX_LIKE__
+				while (readable) {
+					memset(&ss, 0, sizeof(ss));
+					socklen_t slen = sizeof(ss);
+					ZT_PHY_SOCKFD_TYPE newSock = ::accept(s->sock, (struct sockaddr*)&ss, &slen);
+					if (! ZT_PHY_SOCKFD_VALID(newSock))
+						break;
+					if (_socks.size() >= ZT_PHY_MAX_SOCKETS) {
+						ZT_PHY_CLOSE_SOCKET(newSock);
+					}
+					else {
+						fcntl(newSock, F_SETFL, O_NONBLOCK);
+						_socks.push_back(PhySocketImpl());
+						PhySocketImpl& sws = _socks.back();
+						sws.type = ZT_PHY_SOCKET_UNIX_IN;
+						sws.sock = newSock;
+						sws.uptr = (void*)0;
+						memcpy(&(sws.saddr), &ss, sizeof(struct sockaddr_storage));
+						_watch(sws, true, false);
+						try {
+							//_handler->phyOnUnixAccept((PhySocket *)s,(PhySocket *)&(_socks.back()),&(s->uptr),&(sws.uptr));
+						}
+						catch (...) {
+						}
+					}
+#ifndef ZT_PHY_USE_EPOLL
+					break;
+#endif
+				}
+#endif	 // __UNIX_LIKE__
+				break;
+
+			case ZT_PHY_SOCKET_FD: {
+				const bool r = ((readable) && (_wantsReadable(*s)));
+				const bool w = ((writable) && (_wantsWritable(*s)));
+				if ((r) || (w)) {
+					try {
+						//_handler->phyOnFileDescriptorActivity((PhySocket *)s,&(s->uptr),r,w);
+					}
+					catch (...) {
+					}
+				}
+			} break;
+
+			default:
+				break;
+		}
+		(void)except;
 	}
 };
 
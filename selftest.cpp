@@ -6,9 +6,13 @@
  * https://www.zerotier.com/
  */
 
+#include "node/AQMScheduler.hpp"
+#include "node/BoundedQueue.hpp"
 #include "node/Buffer.hpp"
 #include "node/CertificateOfMembership.hpp"
+#include "node/CompiledRules.hpp"
 #include "node/Constants.hpp"
+#include "node/CredentialCache.hpp"
 #include "node/Dictionary.hpp"
 #include "node/ECC.hpp"
 #include "node/Hashtable.hpp"
@@ -16,21 +20,36 @@
 #include "node/IncomingPacket.hpp"
 #include "node/InetAddress.hpp"
 #include "node/MAC.hpp"
+#include "node/Membership.hpp"
+#include "node/Metrics.hpp"
+#include "node/Mutex.hpp"
+#include "node/Network.hpp"
 #include "node/NetworkConfig.hpp"
 #include "node/Node.hpp"
 #include "node/Packet.hpp"
 #include "node/Peer.hpp"
 #include "node/Poly1305.hpp"
+#include "node/RCUPtr.hpp"
 #include "node/RuntimeEnvironment.hpp"
 #include "node/SHA512.hpp"
 #include "node/Salsa20.hpp"
+#include "node/ShardedHashtable.hpp"
+#include "node/SignatureBatch.hpp"
+#include "node/Switch.hpp"
+#include "node/Topology.hpp"
 #include "node/Utils.hpp"
 #include "osdep/OSUtils.hpp"
+#ifdef __LINUX__
+#include "osdep/LinuxEthernetTap.hpp"
+#endif
+#include "osdep/PeerCache.hpp"
 #include "osdep/Phy.hpp"
 #include "osdep/PortMapper.hpp"
 #include "osdep/Thread.hpp"
 
+#include <atomic>
 #include <iostream>
+#include <map>
 #include <stdexcept>
 #include <stdio.h>
 #include <stdlib.h>
@@ -774,6 +793,58 @@ static int testCrypto()
 	}
 	*/
 
+	std::cout << "[crypto] Testing AES-GMAC-SIV batches... ";
+	std::cout.flush();
+	{
+		AES keys[6];
+		for (unsigned int i = 0; i < 6; ++i) {
+			Utils::getSecureRandom(buf1, 32);
+			keys[i].init(buf1);
+		}
+		uint8_t pt[19][200], ct[19][200], aad[11];
+		AES::GMACSIVBatch::Message msgs[19];
+		Utils::getSecureRandom(aad, sizeof(aad));
+		for (unsigned int i = 0; i < 19; ++i) {
+			Utils::getSecureRandom(pt[i], sizeof(pt[i]));
+			msgs[i].k0 = &keys[(i % 3) * 2];
+			msgs[i].k1 = &keys[((i % 3) * 2) + 1];
+			msgs[i].aad = aad;
+			msgs[i].aadLen = (i & 1) ? sizeof(aad) : 0;
+			msgs[i].in = pt[i];
+			msgs[i].out = ct[i];
+			msgs[i].len = (i * 11) % 200;
+			msgs[i].tag[0] = i;
+		}
+		AES::GMACSIVBatch::encrypt(msgs, 19);
+		for (unsigned int i = 0; i < 19; ++i) {
+			uint8_t ref[200];
+			AES::GMACSIVEncryptor enc(*msgs[i].k0, *msgs[i].k1);
+			enc.init(i, ref);
+			enc.aad(aad, msgs[i].aadLen);
+			enc.update1(pt[i], msgs[i].len);
+			enc.finish1();
+			enc.update2(pt[i], msgs[i].len);
+			const uint64_t* const tag = enc.finish2();
+			if ((memcmp(tag, msgs[i].tag, 16) != 0) || (memcmp(ref, ct[i], msgs[i].len) != 0)) {
+				std::cout << "FAIL (encrypt, message " << i << ")" << std::endl;
+				return -1;
+			}
+			msgs[i].in = ct[i];
+		}
+		ct[5][0] ^= 1;
+		if ((AES::GMACSIVBatch::decrypt(msgs, 19) != 18) || (msgs[5].ok)) {
+			std::cout << "FAIL (decrypt accepted modified message)" << std::endl;
+			return -1;
+		}
+		for (unsigned int i = 0; i < 19; ++i) {
+			if ((i != 5) && ((! msgs[i].ok) || (memcmp(pt[i], ct[i], msgs[i].len) != 0))) {
+				std::cout << "FAIL (decrypt, message " << i << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
 	std::cout << "[crypto] Benchmarking AES-GMAC-SIV... ";
 	std::cout.flush();
 	{
@@ -968,6 +1039,183 @@ static int testCrypto()
 	et = OSUtils::now();
 	std::cout << ((double)(et - st) / 50.0) << "ms per signature." << std::endl;
 
+	std::cout << "[crypto] Testing Ed25519 batch verification... ";
+	std::cout.flush();
+	{
+		ECC::Pair bkp[40];
+		ECC::Signature bsig[40];
+		uint8_t bmsg[40][64];
+		const ECC::Public* bkeys[40];
+		const void* bmsgs[40];
+		unsigned int blens[40];
+		const void* bsigs[40];
+		bool bvalid[40];
+		for (unsigned int i = 0; i < 40; ++i) {
+			bkp[i] = ECC::generate();
+			Utils::getSecureRandom(bmsg[i], sizeof(bmsg[i]));
+			bsig[i] = ECC::sign(bkp[i], bmsg[i], sizeof(bmsg[i]));
+			bkeys[i] = &(bkp[i].pub);
+			bmsgs[i] = bmsg[i];
+			blens[i] = sizeof(bmsg[i]);
+			bsigs[i] = bsig[i].data;
+		}
+		if (! ECC::verifyBatch(40, bkeys, bmsgs, blens, bsigs, bvalid)) {
+			std::cout << "FAILED (valid batch rejected)" << std::endl;
+			return -1;
+		}
+		for (unsigned int i = 0; i < 40; ++i) {
+			if (! bvalid[i]) {
+				std::cout << "FAILED (valid signature " << i << " marked bad)" << std::endl;
+				return -1;
+			}
+		}
+
+		for (int k = 0; k < 32; ++k) {
+			ECC::Signature bad[40];
+			const unsigned int bi = (unsigned int)(rand() % 40);
+			memcpy(bad, bsig, sizeof(bad));
+			switch (k & 3) {
+				case 0:
+					bad[bi].data[rand() % 64] ^= (unsigned char)(1 << (rand() & 7));
+					break;
+				case 1:
+					bkeys[bi] = &(bkp[(bi + 1) % 40].pub);
+					break;
+				case 2:
+					bmsg[bi][rand() % 64] ^= 1;
+					break;
+				case 3:
+					memcpy(bad[bi].data, bsig[(bi + 1) % 40].data, ZT_ECC_SIGNATURE_LEN);
+					break;
+			}
+			for (unsigned int i = 0; i < 40; ++i) {
+				bsigs[i] = bad[i].data;
+			}
+			const bool all = ECC::verifyBatch(40, bkeys, bmsgs, blens, bsigs, bvalid);
+			for (unsigned int i = 0; i < 40; ++i) {
+				if (bvalid[i] != ECC::verify(*bkeys[i], bmsgs[i], blens[i], bsigs[i])) {
+					std::cout << "FAILED (batch and single verification disagree on " << i << ")" << std::endl;
+					return -1;
+				}
+			}
+			if ((all) || (bvalid[bi])) {
+				std::cout << "FAILED (bad signature " << bi << " accepted)" << std::endl;
+				return -1;
+			}
+			bkeys[bi] = &(bkp[bi].pub);
+			if ((k & 3) == 2) {
+				Utils::getSecureRandom(bmsg[bi], sizeof(bmsg[bi]));
+				bsig[bi] = ECC::sign(bkp[bi], bmsg[bi], sizeof(bmsg[bi]));
+			}
+		}
+		// A small order R is checked singly, since the cofactored batch equation ignores it
+		{
+			ECC::Signature smallR(bsig[7]);
+			memset(smallR.data, 0, 32);
+			smallR.data[0] = 1;
+			for (unsigned int i = 0; i < 40; ++i) {
+				bsigs[i] = (i == 7) ? smallR.data : bsig[i].data;
+			}
+			if ((ECC::verifyBatch(40, bkeys, bmsgs, blens, bsigs, bvalid)) || (bvalid[7]) || (! bvalid[8])) {
+				std::cout << "FAILED (signature with small order R accepted)" << std::endl;
+				return -1;
+			}
+		}
+		for (unsigned int i = 0; i < 40; ++i) {
+			bsigs[i] = bsig[i].data;
+		}
+		// SignatureBatch checks more signatures than fit in one internal batch, a batch at a time
+		{
+			SignatureBatch good, bad;
+			for (unsigned int i = 0; i < 40; ++i) {
+				char pub[(ZT_ECC_PUBLIC_KEY_SET_LEN * 2) + 1], ids[256];
+				OSUtils::ztsnprintf(ids, sizeof(ids), "%.10llx:0:%s", 0x4400000000ULL + i, Utils::hex(bkp[i].pub.data, ZT_ECC_PUBLIC_KEY_SET_LEN, pub));
+				Identity id;
+				id.fromString(ids);
+				good.add(id, bmsg[i], sizeof(bmsg[i]), bsig[i]);
+				bad.add(id, bmsg[i], sizeof(bmsg[i]), bsig[(i == 37) ? 36 : i]);
+			}
+			if ((! good.verify()) || (! good.verified()) || (bad.verify()) || (bad.verified())) {
+				std::cout << "FAILED (SignatureBatch of 40)" << std::endl;
+				return -1;
+			}
+		}
+		std::cout << "PASS" << std::endl;
+
+		std::cout << "[crypto] Benchmarking Ed25519 batch verification... ";
+		std::cout.flush();
+		st = OSUtils::now();
+		for (int k = 0; k < 10; ++k) {
+			for (unsigned int i = 0; i < 32; ++i) {
+				ECC::verify(*bkeys[i], bmsgs[i], blens[i], bsigs[i]);
+			}
+		}
+		et = OSUtils::now();
+		const double single = (double)(et - st) / 320.0;
+		st = OSUtils::now();
+		for (int k = 0; k < 10; ++k) {
+			ECC::verifyBatch(32, bkeys, bmsgs, blens, bsigs, bvalid);
+		}
+		et = OSUtils::now();
+		std::cout << single << "ms per signature singly, " << ((double)(et - st) / 320.0) << "ms per signature in batches of 32." << std::endl;
+	}
+
+	std::cout << "[crypto] Testing credential signature cache... ";
+	std::cout.flush();
+	{
+		CredentialCache* const cc = new CredentialCache();
+		Identity signer;
+		signer.generate();
+		uint8_t cmsg[256];
+		Utils::getSecureRandom(cmsg, sizeof(cmsg));
+		const ECC::Signature csig(signer.sign(cmsg, sizeof(cmsg)));
+		ECC::Signature cbad(csig);
+		cbad.data[3] ^= 0x10;
+
+		const uint64_t hits = Metrics::credential_cache_hit.value();
+		const uint64_t misses = Metrics::credential_cache_miss.value();
+		if ((! cc->verify(signer, cmsg, sizeof(cmsg), csig, (SignatureBatch*)0)) || (! cc->verify(signer, cmsg, sizeof(cmsg), csig, (SignatureBatch*)0))) {
+			std::cout << "FAILED (valid signature rejected)" << std::endl;
+			return -1;
+		}
+		if ((cc->verify(signer, cmsg, sizeof(cmsg), cbad, (SignatureBatch*)0)) || (cc->verify(signer, cmsg, sizeof(cmsg), cbad, (SignatureBatch*)0))) {
+			std::cout << "FAILED (bad signature accepted)" << std::endl;
+			return -1;
+		}
+		cmsg[100] ^= 1;
+		if (cc->verify(signer, cmsg, sizeof(cmsg), csig, (SignatureBatch*)0)) {
+			std::cout << "FAILED (cached signature accepted for different data)" << std::endl;
+			return -1;
+		}
+		cmsg[100] ^= 1;
+		if (((Metrics::credential_cache_hit.value() - hits) != 2) || ((Metrics::credential_cache_miss.value() - misses) != 2)) {
+			std::cout << "FAILED (wrong hit/miss counts)" << std::endl;
+			return -1;
+		}
+
+		// Batched signatures are cached once the batch verifies
+		Utils::getSecureRandom(cmsg, sizeof(cmsg));
+		const ECC::Signature csig2(signer.sign(cmsg, sizeof(cmsg)));
+		SignatureBatch batch;
+		if ((! cc->verify(signer, cmsg, sizeof(cmsg), csig2, &batch)) || (batch.size() != 1) || (! cc->verify(batch)) || (! batch.verified())) {
+			std::cout << "FAILED (batch)" << std::endl;
+			return -1;
+		}
+		SignatureBatch batch2;
+		if ((! cc->verify(signer, cmsg, sizeof(cmsg), csig2, &batch2)) || (batch2.size() != 0)) {
+			std::cout << "FAILED (verified batch not cached)" << std::endl;
+			return -1;
+		}
+
+		const int64_t cst = OSUtils::now();
+		for (int k = 0; k < 100000; ++k) {
+			cc->verify(signer, cmsg, sizeof(cmsg), csig2, (SignatureBatch*)0);
+		}
+		const int64_t cet = OSUtils::now();
+		std::cout << "PASS (" << ((double)(cet - cst) * 10.0) << "ns per cached check)" << std::endl;
+		delete cc;
+	}
+
 	return 0;
 }
 
@@ -1189,9 +1437,568 @@ static int testPacket()
 	*/
 
 	std::cout << "PASS" << std::endl;
+
+	std::cout << "[packet] Testing batched AES-GMAC-SIV armor against armor()... ";
+	{
+		AES keys[6];
+		for (unsigned int i = 0; i < 6; ++i) {
+			uint8_t k[32];
+			Utils::getSecureRandom(k, 32);
+			keys[i].init(k);
+		}
+		const Identity noIdentity;
+		std::vector<Packet> plain(19), batch(19), single(19);
+		Packet* batchPtrs[19];
+		const AES* batchKeys[19];
+		for (unsigned int i = 0; i < 19; ++i) {
+			plain[i].reset(Address(0x1000000000ULL + i), Address(0x2000000000ULL + i), Packet::VERB_FRAME);
+			uint8_t payload[1500];
+			Utils::getSecureRandom(payload, sizeof(payload));
+			plain[i].append(payload, (i * 97) % sizeof(payload));
+			batch[i] = plain[i];
+			single[i] = plain[i];
+			batchPtrs[i] = &(batch[i]);
+			batchKeys[i] = &(keys[(i % 3) * 2]);
+			single[i].armor(salsaKey, true, false, batchKeys[i], noIdentity);
+		}
+		Packet::armorBatch(batchPtrs, batchKeys, 19);
+		for (unsigned int i = 0; i < 19; ++i) {
+			if (batch[i] != single[i]) {
+				std::cout << "FAIL (armor, packet " << i << ")" << std::endl;
+				return -1;
+			}
+		}
+
+		batch[4].incrementHops();	// hops are not authenticated
+		batch[11][ZT_PACKET_IDX_PAYLOAD] ^= 1;
+		bool ok[19];
+		Packet::dearmorBatch(batchPtrs, batchKeys, ok, 19);
+		for (unsigned int i = 0; i < 19; ++i) {
+			if (i == 11) {
+				if (ok[i]) {
+					std::cout << "FAIL (dearmor accepted modified packet)" << std::endl;
+					return -1;
+				}
+			}
+			else if ((! ok[i]) || (memcmp(batch[i].field(ZT_PACKET_IDX_VERB, 1), plain[i].field(ZT_PACKET_IDX_VERB, 1), plain[i].size() - ZT_PACKET_IDX_VERB) != 0)) {
+				std::cout << "FAIL (dearmor, packet " << i << ")" << std::endl;
+				return -1;
+			}
+		}
+	}
+	std::cout << "PASS" << std::endl;
+
 	return 0;
 }
 
+// Runs 'threads' threads each calling f(threadIndex,iterations) and returns total calls per second
+template <typename F> static double benchmarkThreads(unsigned int threads, unsigned long iterations, F f)
+{
+	std::vector<std::thread> t;
+	const int64_t start = OSUtils::now();
+	for (unsigned int i = 0; i < threads; ++i)
+		t.push_back(std::thread(f, i, iterations));
+	for (unsigned int i = 0; i < threads; ++i)
+		t[i].join();
+	const int64_t end = OSUtils::now();
+	return ((double)threads * (double)iterations) / ((double)std::max((int64_t)1, end - start) / 1000.0);
+}
+
+static int testTopology()
+{
+	std::vector<InetAddress> addrs;
+	for (unsigned int i = 0; i < 4096; ++i) {
+		uint8_t ip[4];
+		Utils::getSecureRandom(ip, 4);
+		addrs.push_back(InetAddress(ip, 4, 1024 + (i & 0x7fff)));
+	}
+
+	std::cout << "[topology] Testing sharded path table... ";
+	std::cout.flush();
+	{
+		ShardedHashtable<Path::HashKey, SharedPtr<Path> > paths;
+		std::vector<SharedPtr<Path> > firsts;
+		for (unsigned int i = 0; i < addrs.size(); ++i)
+			firsts.push_back(paths.getOrAdd(Path::HashKey(i & 3, addrs[i]), [&](const Path::HashKey&) { return SharedPtr<Path>(new Path(i & 3, addrs[i])); }));
+		std::atomic<unsigned long> mismatches(0);
+		benchmarkThreads(4, addrs.size(), [&](unsigned int, unsigned long n) {
+			for (unsigned long i = 0; i < n; ++i) {
+				SharedPtr<Path> p(paths.getOrAdd(Path::HashKey(i & 3, addrs[i]), [&](const Path::HashKey&) { return SharedPtr<Path>(new Path(i & 3, addrs[i])); }));
+				if (p != firsts[i])
+					++mismatches;
+			}
+		});
+		if ((mismatches != 0) || (paths.size() != addrs.size())) {
+			std::cout << "FAILED! (lookup mismatch)" << std::endl;
+			return -1;
+		}
+		for (unsigned int i = 0; i < addrs.size(); i += 2)
+			firsts[i].zero();
+		// Sweep half the shards one at a time, as incremental housekeeping does, and the rest at once
+		auto unreferenced = [](const Path::HashKey&, SharedPtr<Path>& p) { return (p.references() <= 1); };
+		unsigned long erased = 0;
+		for (unsigned int s = 0; s < (paths.shards() / 2); ++s)
+			erased += paths.shardEraseIf(s, unreferenced);
+		if ((erased == 0) || (erased >= (addrs.size() / 2))) {
+			std::cout << "FAILED! (shardEraseIf)" << std::endl;
+			return -1;
+		}
+		erased += paths.eraseIf(unreferenced);
+		if ((erased != (addrs.size() / 2)) || (paths.size() != (addrs.size() / 2)) || (paths.entries().size() != (addrs.size() / 2))) {
+			std::cout << "FAILED! (eraseIf)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[topology] Benchmarking path lookup throughput vs. threads (single lock / sharded):" << std::endl;
+	{
+		Hashtable<Path::HashKey, SharedPtr<Path> > single;
+		Mutex singleLock;
+		ShardedHashtable<Path::HashKey, SharedPtr<Path> > sharded;
+		for (unsigned int i = 0; i < addrs.size(); ++i) {
+			SharedPtr<Path> p(new Path(0, addrs[i]));
+			single.set(Path::HashKey(0, addrs[i]), p);
+			sharded.set(Path::HashKey(0, addrs[i]), p);
+		}
+		for (unsigned int threads = 1; threads <= 8; threads <<= 1) {
+			const double s = benchmarkThreads(threads, 1000000, [&](unsigned int t, unsigned long n) {
+				for (unsigned long i = 0; i < n; ++i) {
+					const InetAddress& a = addrs[(i * 7 + t) & 4095];
+					SharedPtr<Path> r;
+					{
+						Mutex::Lock _l(singleLock);
+						SharedPtr<Path>& p = single[Path::HashKey(0, a)];
+						if (! p)
+							p.set(new Path(0, a));
+						r = p;
+					}
+				}
+			});
+			const double m = benchmarkThreads(threads, 1000000, [&](unsigned int t, unsigned long n) {
+				for (unsigned long i = 0; i < n; ++i) {
+					const InetAddress& a = addrs[(i * 7 + t) & 4095];
+					sharded.getOrAdd(Path::HashKey(0, a), [&](const Path::HashKey&) { return SharedPtr<Path>(new Path(0, a)); });
+				}
+			});
+			std::cout << "[topology]   " << threads << " thread(s): " << (s / 1000000.0) << " / " << (m / 1000000.0) << " million lookups/second" << std::endl;
+		}
+	}
+
+	return 0;
+}
+
+static void randomRule(ZT_VirtualNetworkRule& r, const uint64_t* zts, const uint64_t* macs, const uint32_t* ip4s, const uint8_t (*ip6s)[16], const bool action)
+{
+	static const uint16_t etherTypes[4] = { ZT_ETHERTYPE_IPV4, ZT_ETHERTYPE_IPV6, ZT_ETHERTYPE_ARP, 0x8100 };
+	static const uint8_t protocols[6] = { 0x01, 0x06, 0x11, 0x3a, 0x84, 0x88 };
+	memset(&r, 0, sizeof(r));
+	if (action) {
+		r.t = (uint8_t)(((rand() & 7) == 0) ? (rand() & 15) : (rand() % 7));
+		r.v.fwd.address = zts[rand() & 3];
+		r.v.fwd.length = (uint16_t)(((rand() & 1) == 0) ? 0 : (rand() % 256));
+		if (r.t == ZT_NETWORK_RULE_ACTION_PRIORITY)
+			r.v.qosBucket = (uint8_t)(rand() % 10);
+		return;
+	}
+	unsigned int t;
+	do {
+		t = ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS + (rand() % (ZT_NETWORK_RULE_MATCH__MAX_ID + 1 - ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS));
+	} while (t == ZT_NETWORK_RULE_MATCH_RANDOM);   // needs a Node
+	r.t = (uint8_t)(t | (((rand() & 3) == 0) ? 0x80 : 0) | (((rand() & 7) == 0) ? 0x40 : 0));
+	switch (t) {
+		case ZT_NETWORK_RULE_MATCH_SOURCE_ZEROTIER_ADDRESS:
+		case ZT_NETWORK_RULE_MATCH_DEST_ZEROTIER_ADDRESS:
+			r.v.zt = zts[rand() & 3];
+			break;
+		case ZT_NETWORK_RULE_MATCH_VLAN_ID:
+			r.v.vlanId = (uint16_t)(rand() & 3);
+			break;
+		case ZT_NETWORK_RULE_MATCH_VLAN_PCP:
+		case ZT_NETWORK_RULE_MATCH_VLAN_DEI:
+			r.v.vlanPcp = (uint8_t)(rand() & 1);
+			break;
+		case ZT_NETWORK_RULE_MATCH_MAC_SOURCE:
+		case ZT_NETWORK_RULE_MATCH_MAC_DEST:
+			MAC(macs[rand() & 3]).copyTo(r.v.mac, 6);
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV4_SOURCE:
+		case ZT_NETWORK_RULE_MATCH_IPV4_DEST:
+			r.v.ipv4.ip = Utils::hton(ip4s[rand() & 3]);
+			r.v.ipv4.mask = (uint8_t)(rand() % 33);
+			break;
+		case ZT_NETWORK_RULE_MATCH_IPV6_SOURCE:
+		case ZT_NETWORK_RULE_MATCH_IPV6_DEST:
+			memcpy(r.v.ipv6.ip, ip6s[rand() & 3], 16);
+			r.v.ipv6.mask = (uint8_t)(rand() % 129);
+			if ((rand() & 1) == 0) {	// exercise both masked and unmasked rule addresses
+				const InetAddress n(InetAddress(r.v.ipv6.ip, 16, r.v.ipv6.mask).network());
+				memcpy(r.v.ipv6.ip, n.rawIpData(), 16);
+			}
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_TOS:
+			r.v.ipTos.mask = (uint8_t)rand();
+			r.v.ipTos.value[0] = (uint8_t)(rand() & 0x7f);
+			r.v.ipTos.value[1] = (uint8_t)(r.v.ipTos.value[0] + (rand() & 0x7f));
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_PROTOCOL:
+			r.v.ipProtocol = protocols[rand() % 6];
+			break;
+		case ZT_NETWORK_RULE_MATCH_ETHERTYPE:
+			r.v.etherType = etherTypes[rand() & 3];
+			break;
+		case ZT_NETWORK_RULE_MATCH_ICMP:
+			r.v.icmp.type = (uint8_t)(rand() & 3);
+			r.v.icmp.code = (uint8_t)(rand() & 3);
+			r.v.icmp.flags = (uint8_t)(rand() & 1);
+			break;
+		case ZT_NETWORK_RULE_MATCH_IP_SOURCE_PORT_RANGE:
+		case ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE:
+			r.v.port[0] = (uint16_t)(rand() % 8);
+			r.v.port[1] = (uint16_t)(r.v.port[0] + (rand() % 8));
+			break;
+		case ZT_NETWORK_RULE_MATCH_CHARACTERISTICS:
+			r.v.characteristics = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+			break;
+		case ZT_NETWORK_RULE_MATCH_FRAME_SIZE_RANGE:
+			r.v.frameSize[0] = (uint16_t)(rand() % 128);
+			r.v.frameSize[1] = (uint16_t)(r.v.frameSize[0] + (rand() % 128));
+			break;
+		case ZT_NETWORK_RULE_MATCH_TAGS_DIFFERENCE:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_AND:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_OR:
+		case ZT_NETWORK_RULE_MATCH_TAGS_BITWISE_XOR:
+		case ZT_NETWORK_RULE_MATCH_TAGS_EQUAL:
+		case ZT_NETWORK_RULE_MATCH_TAG_SENDER:
+		case ZT_NETWORK_RULE_MATCH_TAG_RECEIVER:
+			r.v.tag.id = (uint32_t)(rand() % 6);
+			r.v.tag.value = (uint32_t)(rand() & 7);
+			break;
+		case ZT_NETWORK_RULE_MATCH_INTEGER_RANGE:
+			r.v.intRange.start = (uint64_t)(rand() & 0xff);
+			r.v.intRange.end = (uint32_t)(rand() & 0xff);
+			r.v.intRange.idx = (uint16_t)(rand() % 160);
+			r.v.intRange.format = (uint8_t)(rand() & 0xbf);
+			break;
+		default:
+			break;
+	}
+}
+
+static unsigned int randomFrame(uint8_t* f, unsigned int& etherType, const uint32_t* ip4s, const uint8_t (*ip6s)[16])
+{
+	static const uint8_t protocols[8] = { 0x01, 0x06, 0x11, 0x3a, 0x84, 0x88, 0x00, 0x2b };
+	for (unsigned int i = 0; i < 2048; ++i)
+		f[i] = (uint8_t)rand();
+	unsigned int len = (unsigned int)(rand() % 160);
+	switch (rand() & 3) {
+		case 0: {
+			etherType = ZT_ETHERTYPE_IPV4;
+			f[0] = (uint8_t)(0x40 | (((rand() & 7) == 0) ? (rand() & 0xf) : (5 + (rand() & 1))));
+			f[9] = protocols[rand() & 7];
+			const uint32_t s = Utils::hton(ip4s[rand() & 3]), d = Utils::hton(ip4s[rand() & 3]);
+			memcpy(f + 12, &s, 4);
+			memcpy(f + 16, &d, 4);
+			const unsigned int hl = (f[0] & 0xf) * 4;
+			f[hl] = (uint8_t)((f[9] == 0x01) ? (rand() & 3) : 0);
+			f[hl + 1] = (uint8_t)(rand() & 7);
+			f[hl + 2] = 0;
+			f[hl + 3] = (uint8_t)(rand() & 15);
+		} break;
+		case 1: {
+			etherType = ZT_ETHERTYPE_IPV6;
+			f[6] = protocols[rand() & 7];
+			memcpy(f + 8, ip6s[rand() & 3], 16);
+			memcpy(f + 24, ip6s[rand() & 3], 16);
+			unsigned int pos = 40;
+			if ((f[6] == 0x00) || (f[6] == 0x2b)) {
+				f[pos] = protocols[rand() & 3];
+				f[pos + 1] = (uint8_t)(rand() & 1);
+				pos += (f[pos + 1] * 8) + 8;
+			}
+			f[pos] = (uint8_t)(((rand() & 1) == 0) ? (0x85 + (rand() & 3)) : (rand() & 3));
+			f[pos + 1] = (uint8_t)(rand() & 7);
+			f[pos + 2] = 0;
+			f[pos + 3] = (uint8_t)(rand() & 15);
+			if ((rand() & 3) == 0) {
+				f[6] = 0x3a;
+				f[40] = (uint8_t)(0x87 + (rand() & 1));
+			}
+		} break;
+		case 2:
+			etherType = ZT_ETHERTYPE_ARP;
+			break;
+		default:
+			etherType = (unsigned int)(rand() & 0xffff);
+			break;
+	}
+	return len;
+}
+
+static int testRules()
+{
+	std::cout << "[rules] Testing compiled rules against the interpreter... ";
+	std::cout.flush();
+	{
+		RuntimeEnvironment RR((Node*)0);
+		if (! RR.identity.fromString(KNOWN_GOOD_IDENTITY)) {
+			std::cout << "FAILED! (identity)" << std::endl;
+			return -1;
+		}
+
+		const uint64_t zts[4] = { 0x1111111111ULL, 0x2222222222ULL, RR.identity.address().toInt(), 0x4444444444ULL };
+		const uint64_t macs[4] = { 0x0211111111ULL, 0x0222222222ULL, 0xffffffffffffULL, 0x01005e000001ULL };
+		const uint32_t ip4s[4] = { 0x0a000001, 0x0a000102, 0xc0a80101, 0xe0000001 };
+		uint8_t ip6s[4][16];
+		for (unsigned int i = 0; i < 4; ++i) {
+			memset(ip6s[i], 0, 16);
+			ip6s[i][0] = 0xfd;
+			ip6s[i][1] = (uint8_t)(i >> 1);
+			ip6s[i][15] = (uint8_t)i;
+		}
+
+		NetworkConfig* const nconf = new NetworkConfig();
+		for (unsigned int i = 0; i < 4; ++i)
+			nconf->tags[i] = Tag(1, 0, Address(zts[2]), i + 1, i * 3);
+		nconf->tagCount = 4;
+
+		ZT_VirtualNetworkRule rules[64];
+		uint8_t* const frame = new uint8_t[2048];
+		unsigned long mismatches = 0;
+		for (unsigned int k = 0; k < 4000; ++k) {
+			// Half the tables are mostly ethertype gated sets so dispatch is exercised
+			const bool gated = ((k & 1) == 0);
+			unsigned int ruleCount = 0;
+			const unsigned int target = 1 + (rand() % 60);
+			while (ruleCount < target) {
+				const unsigned int matches = rand() % 4;
+				if ((gated) && ((rand() & 7) != 0)) {
+					randomRule(rules[ruleCount], zts, macs, ip4s, ip6s, false);
+					rules[ruleCount].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+					rules[ruleCount].v.etherType = (uint16_t)(((rand() & 3) == 0) ? ZT_ETHERTYPE_ARP : (((rand() & 1) == 0) ? ZT_ETHERTYPE_IPV4 : ZT_ETHERTYPE_IPV6));
+					++ruleCount;
+				}
+				for (unsigned int m = 0; (m < matches) && (ruleCount < (target - 1)); ++m) {
+					randomRule(rules[ruleCount], zts, macs, ip4s, ip6s, false);
+					if (gated)
+						rules[ruleCount].t &= 0xbf;
+					++ruleCount;
+				}
+				randomRule(rules[ruleCount++], zts, macs, ip4s, ip6s, true);
+				if ((gated) && ((rand() & 7) != 0)) {
+					static const uint8_t plainActions[5] = { ZT_NETWORK_RULE_ACTION_DROP, ZT_NETWORK_RULE_ACTION_ACCEPT, ZT_NETWORK_RULE_ACTION_BREAK, ZT_NETWORK_RULE_ACTION_PRIORITY, 9 };
+					rules[ruleCount - 1].t = plainActions[rand() % 5];
+				}
+			}
+			if ((rand() & 3) == 0)
+				--ruleCount;   // trailing matches with no action
+
+			nconf->flags = ((rand() & 1) == 0) ? ZT_NETWORKCONFIG_FLAG_RULES_RESULT_OF_UNSUPPORTED_MATCH : 0;
+			CompiledRules cr;
+			cr.compile(rules, ruleCount, *nconf);
+
+			for (unsigned int j = 0; j < 16; ++j) {
+				unsigned int etherType = 0;
+				const unsigned int len = randomFrame(frame, etherType, ip4s, ip6s);
+				const MAC macSource(macs[rand() & 3]), macDest(macs[rand() & 3]);
+				const unsigned int vlanId = rand() & 3;
+				const Address ztSource(zts[rand() & 3]), ztDest0(zts[rand() & 3]);
+				for (unsigned int mode = 0; mode < 4; ++mode) {
+					const bool inbound = ((mode & 1) != 0);
+					const bool trace = ((mode & 2) != 0);
+					const CompiledRules::Frame fr(macSource, macDest, frame, len, etherType, vlanId);
+
+					Trace::RuleResultLog rrl1, rrl2;
+					Address ztDest1(ztDest0), ztDest2(ztDest0), cc1, cc2;
+					unsigned int ccLength1 = 0, ccLength2 = 0;
+					bool ccWatch1 = false, ccWatch2 = false;
+					uint8_t qos1 = 255, qos2 = 255;
+					const CompiledRules::Result r1 = CompiledRules::interpret(&RR, rrl1, *nconf, (Membership*)0, inbound, ztSource, ztDest1, macSource, macDest, frame, len, etherType, vlanId, rules, ruleCount, cc1, ccLength1, ccWatch1, qos1);
+					const CompiledRules::Result r2 = cr.filter(&RR, (trace) ? &rrl2 : (Trace::RuleResultLog*)0, *nconf, (Membership*)0, inbound, ztSource, ztDest2, fr, cc2, ccLength2, ccWatch2, qos2);
+					if ((r1 != r2) || (ztDest1 != ztDest2) || (cc1 != cc2) || (ccLength1 != ccLength2) || (ccWatch1 != ccWatch2) || (qos1 != qos2) || ((trace) && (memcmp(rrl1.data(), rrl2.data(), rrl1.sizeBytes()) != 0)))
+						++mismatches;
+				}
+			}
+		}
+
+		delete[] frame;
+		delete nconf;
+		if (mismatches) {
+			std::cout << "FAILED! (" << mismatches << " mismatches)" << std::endl;
+			return -1;
+		}
+		std::cout << "PASS" << std::endl;
+	}
+
+	std::cout << "[rules] Benchmarking 64 ethertype gated rule sets (interpreted / compiled)... ";
+	std::cout.flush();
+	{
+		RuntimeEnvironment RR((Node*)0);
+		RR.identity.fromString(KNOWN_GOOD_IDENTITY);
+		NetworkConfig* const nconf = new NetworkConfig();
+		ZT_VirtualNetworkRule rules[193];
+		for (unsigned int i = 0; i < 64; ++i) {
+			memset(&(rules[i * 3]), 0, sizeof(ZT_VirtualNetworkRule) * 3);
+			rules[i * 3].t = ZT_NETWORK_RULE_MATCH_ETHERTYPE;
+			rules[i * 3].v.etherType = (uint16_t)(0x8800 + i);
+			rules[(i * 3) + 1].t = ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
+			rules[(i * 3) + 1].v.port[0] = rules[(i * 3) + 1].v.port[1] = (uint16_t)(1000 + i);
+			rules[(i * 3) + 2].t = ZT_NETWORK_RULE_ACTION_DROP;
+		}
+		memset(&(rules[192]), 0, sizeof(ZT_VirtualNetworkRule));
+		rules[192].t = ZT_NETWORK_RULE_ACTION_ACCEPT;
+		CompiledRules cr;
+		cr.compile(rules, 193, *nconf);
+
+		uint8_t frame[128];
+		memset(frame, 0, sizeof(frame));
+		frame[0] = 0x45;
+		frame[9] = 0x11;
+		const MAC macSource(0x0211111111ULL), macDest(0x0222222222ULL);
+		const Address ztSource(0x1111111111ULL);
+		unsigned long accepted = 0;
+		double rates[2];
+		for (unsigned int compiled = 0; compiled < 2; ++compiled) {
+			const int64_t start = OSUtils::now();
+			for (unsigned int i = 0; i < 1000000; ++i) {
+				Trace::RuleResultLog rrl;
+				Address ztDest(0x2222222222ULL), cc;
+				unsigned int ccLength = 0;
+				bool ccWatch = false;
+				uint8_t qosBucket = 255;
+				if (compiled) {
+					const CompiledRules::Frame fr(macSource, macDest, frame, sizeof(frame), ZT_ETHERTYPE_IPV4, 0);
+					accepted += (cr.filter(&RR, (Trace::RuleResultLog*)0, *nconf, (Membership*)0, false, ztSource, ztDest, fr, cc, ccLength, ccWatch, qosBucket) == CompiledRules::FILTER_ACCEPT);
+				}
+				else {
+					accepted += (CompiledRules::interpret(&RR, rrl, *nconf, (Membership*)0, false, ztSource, ztDest, macSource, macDest, frame, sizeof(frame), ZT_ETHERTYPE_IPV4, 0, rules, 193, cc, ccLength, ccWatch, qosBucket) == CompiledRules::FILTER_ACCEPT);
+				}
+			}
+			rates[compiled] = 1000000.0 / ((double)(OSUtils::now() - start) / 1000.0);
+		}
+		delete nconf;
+		std::cout << (rates[0] / 1000000.0) << " / " << (rates[1] / 1000000.0) << " million frames/second" << ((accepted == 2000000) ? "" : " (WRONG RESULT)") << std::endl;
+	}
+
+	return 0;
+}
+
+// In-memory state store for tests that run a whole Node
+struct TestStateStore {
+	Mutex lock;
+	std::map<std::pair<int, uint64_t>, std::string> objects;
+	static inline std::pair<int, uint64_t> key(enum ZT_StateObjectType type, const uint64_t id[2])
+	{
+		// Identities are looked up before the node knows its address, so they are not keyed by ID
+		return std::pair<int, uint64_t>((int)type, ((type == ZT_STATE_OBJECT_IDENTITY_PUBLIC) || (type == ZT_STATE_OBJECT_IDENTITY_SECRET)) ? 0 : id[0]);
+	}
+};
+static void testStatePut(ZT_Node* n, void* uptr, void* tptr, enum ZT_StateObjectType type, const uint64_t id[2], const void* data, int len)
+{
+	TestStateStore* const ss = reinterpret_cast<TestStateStore*>(uptr);
+	Mutex::Lock _l(ss->lock);
+	if (len < 0)
+		ss->objects.erase(TestStateStore::key(type, id));
+	else
+		ss->objects[TestStateStore::key(type, id)].assign(reinterpret_cast<const char*>(data), (size_t)len);
+}
+static int testStateGet(ZT_Node* n, void* uptr, void* tptr, enum ZT_StateObjectType type, const uint64_t id[2], void* data, unsigned int maxlen)
+{
+	TestStateStore* const ss = reinterpret_cast<TestStateStore*>(uptr);
+	Mutex::Lock _l(ss->lock);
+	std::map<std::pair<int, uint64_t>, std::string>::const_iterator o(ss->objects.find(TestStateStore::key(type, id)));
+	if ((o == ss->objects.end()) || (o->second.length() > maxlen))
+		return -1;
+	memcpy(data, o->second.data(), o->second.length());
+	return (int)o->second.length();
+}
+static int testWirePacketSend(ZT_Node* n, void* uptr, void* tptr, int64_t localSocket, const struct sockaddr_storage* addr, const void* data, unsigned int len, unsigned int ttl)
+{
+	return 0;
+}
+static void testVirtualNetworkFrame(ZT_Node* n, void* uptr, void* tptr, uint64_t nwid, void** nuptr, uint64_t sourceMac, uint64_t destMac, unsigned int etherType, unsigned int vlanId, const void* data, unsigned int len)
+{
+}
+static int testVirtualNetworkConfig(ZT_Node* n, void* uptr, void* tptr, uint64_t nwid, void** nuptr, enum ZT_VirtualNetworkConfigOperation op, const ZT_VirtualNetworkConfig* nc)
+{
+	return 0;
+}
+static void testEvent(ZT_Node* n, void* uptr, void* tptr, enum ZT_Event event, const void* metaData)
+{
+}
+
+#ifdef __LINUX__
+// Frames handed up by LinuxEthernetTap::vnetRead(), without their Ethernet header
+static void testTapFrame(void* arg, void* tptr, uint64_t nwid, const MAC& from, const MAC& to, unsigned int etherType, unsigned int vlanId, const void* data, unsigned int len)
+{
+	reinterpret_cast<std::vector<std::string>*>(arg)->push_back(std::string(reinterpret_cast<const char*>(data), len));
+}
+// Folded one's complement sum; a correct IP or TCP/UDP checksum sums to 0xffff
+static uint16_t testInetSum(uint32_t sum, const uint8_t* p, unsigned int len)
+{
+	for (unsigned int i = 0; (i + 1) < len; i += 2)
+		sum += ((uint32_t)p[i] << 8) | (uint32_t)p[i + 1];
+	if (len & 1)
+		sum += (uint32_t)p[len - 1] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)sum;
+}
+// Build a virtio_net_hdr (host byte order) and an Ethernet header with the given IP header and L4 header + payload behind it
+static unsigned int testVnetFrame(uint8_t* f, uint8_t flags, uint8_t gsoType, uint16_t gsoSize, uint16_t csumStart, uint16_t csumOffset, bool v6, uint8_t proto, const uint8_t* l4, unsigned int l4len)
+{
+	const uint16_t iphl = v6 ? 40 : 20;
+	const uint16_t hdrLen = (uint16_t)(14 + iphl + ((proto == 6) ? 20 : 8));
+	f[0] = flags;
+	f[1] = gsoType;
+	memcpy(f + 2, &hdrLen, 2);
+	memcpy(f + 4, &gsoSize, 2);
+	memcpy(f + 6, &csumStart, 2);
+	memcpy(f + 8, &csumOffset, 2);
+	uint8_t* e = f + 10;
+	memset(e, 0, 14 + iphl);
+	MAC(0x32aabbccdd01ULL).copyTo(e, 6);
+	MAC(0x32aabbccdd02ULL).copyTo(e + 6, 6);
+	Utils::storeBigEndian<uint16_t>(e + 12, v6 ? 0x86dd : 0x0800);
+	uint8_t* ip = e + 14;
+	if (v6) {
+		ip[0] = 0x60;
+		Utils::storeBigEndian<uint16_t>(ip + 4, (uint16_t)l4len);
+		ip[6] = proto;
+		ip[7] = 64;
+		ip[8] = 0xfd;
+		ip[23] = 1;
+		ip[24] = 0xfd;
+		ip[39] = 2;
+	}
+	else {
+		ip[0] = 0x45;
+		Utils::storeBigEndian<uint16_t>(ip + 2, (uint16_t)(20 + l4len));
+		Utils::storeBigEndian<uint16_t>(ip + 4, 0x1234);
+		ip[6] = 0x40;
+		ip[8] = 64;
+		ip[9] = proto;
+		Utils::storeBigEndian<uint32_t>(ip + 12, 0x0a000001);
+		Utils::storeBigEndian<uint32_t>(ip + 16, 0x0a000002);
+		Utils::storeBigEndian<uint16_t>(ip + 10, (uint16_t)~testInetSum(0, ip, 20));
+	}
+	memcpy(ip + iphl, l4, l4len);
+	// As the kernel does for a partial checksum, leave the uncomplemented pseudo-header sum in place
+	const uint32_t pseudo = (uint32_t)testInetSum(0, v6 ? ip + 8 : ip + 12, v6 ? 32 : 8) + proto + l4len;
+	Utils::storeBigEndian<uint16_t>(ip + iphl + ((proto == 6) ? 16 : 6), testInetSum(pseudo, (const uint8_t*)0, 0));
+	return 10 + 14 + iphl + l4len;
+}
+// Check the L4 checksum of a frame handed up by vnetRead()
+static bool testVnetL4Ok(const std::string& fr, bool v6)
+{
+	const uint8_t* const ip = reinterpret_cast<const uint8_t*>(fr.data());
+	const unsigned int iphl = v6 ? 40 : 20;
+	const unsigned int l4len = (unsigned int)fr.length() - iphl;
+	const uint32_t pseudo = (uint32_t)testInetSum(0, v6 ? ip + 8 : ip + 12, v6 ? 32 : 8) + ip[v6 ? 6 : 9] + l4len;
+	return (testInetSum(pseudo, ip + iphl, l4len) == 0xffff);
+}
+#endif	 // __LINUX__
+
 static int testOther()
 {
 	char buf[1024];
@@ -1390,6 +2197,220 @@ static int testOther()
 	std::cout << "PASS" << std::endl;
 #endif
 
+	std::cout << "[other] Testing BoundedQueue with concurrent producers... ";
+	std::cout.flush();
+	{
+		BoundedQueue<uint64_t, 256>* q = new BoundedQueue<uint64_t, 256>();
+		std::vector<std::thread> producers;
+		for (uint64_t t = 0; t < 4; ++t) {
+			producers.push_back(std::thread([q, t]() {
+				for (uint64_t i = 0; i < 100000; ++i) {
+					while (! q->push((t << 32) | i))
+						std::this_thread::yield();
+				}
+			}));
+		}
+		uint64_t next[4] = { 0, 0, 0, 0 };
+		bool ordered = true;
+		for (unsigned long n = 0; n < 400000;) {
+			uint64_t v;
+			if (q->pop(v)) {
+				if ((v & 0xffffffffULL) != next[v >> 32]++)
+					ordered = false;
+				++n;
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+		for (unsigned int t = 0; t < 4; ++t)
+			producers[t].join();
+		uint64_t v;
+		if ((! ordered) || (q->pop(v))) {
+			std::cout << "FAILED! (order or count)" << std::endl;
+			return -1;
+		}
+		delete q;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Testing RCUPtr with concurrent readers and updates... ";
+	std::cout.flush();
+	{
+		struct _RCUTest {
+			uint64_t a, b;
+			_RCUTest* self;
+			~_RCUTest()
+			{
+				self = (_RCUTest*)0;
+			}
+		};
+		_RCUTest* first = new _RCUTest();
+		first->a = first->b = 0;
+		first->self = first;
+		RCUPtr<_RCUTest>* p = new RCUPtr<_RCUTest>(first);
+		std::atomic<bool> done(false), torn(false);
+		std::vector<std::thread> readers;
+		for (unsigned int t = 0; t < 4; ++t) {
+			readers.push_back(std::thread([p, &done, &torn]() {
+				uint64_t last = 0;
+				while (! done.load()) {
+					RCUPtr<_RCUTest>::Reader rd(*p);
+					if ((rd->self != &(*rd)) || (rd->a != rd->b) || (rd->a < last))
+						torn = true;
+					last = rd->a;
+				}
+			}));
+		}
+		for (uint64_t i = 1; i <= 20000; ++i) {
+			_RCUTest* n = new _RCUTest();
+			n->a = n->b = i;
+			n->self = n;
+			p->update(n);
+		}
+		done = true;
+		for (unsigned int t = 0; t < 4; ++t)
+			readers[t].join();
+		if ((torn.load()) || (p->unsafeGet()->a != 20000)) {
+			std::cout << "FAILED! (reader saw a retired or torn object)" << std::endl;
+			return -1;
+		}
+		delete p;
+	}
+	std::cout << "PASS" << std::endl;
+
+	std::cout << "[other] Benchmarking AQM scheduler under 2x overload... ";
+	std::cout.flush();
+	{
+		// Frames arrive twice as fast as one scheduling round per millisecond can send them
+		AQMScheduler* aqm = new AQMScheduler();
+		std::vector<AQMScheduler::Entry*> pool;
+		for (unsigned int i = 0; i < (ZT_AQM_MAX_ENQUEUED_PACKETS + 8); ++i) {
+			AQMScheduler::Entry* e = new AQMScheduler::Entry();
+			e->packet = Packet(Address(0x0102030405ULL), Address(0x0504030201ULL), Packet::VERB_FRAME);
+			e->packet.setSize(ZT_PROTO_MIN_PACKET_LENGTH + 1400);
+			pool.push_back(e);
+		}
+		unsigned long in = 0, sent = 0, dropped = 0;
+		double sojourn = 0.0;
+		int64_t now = 1;
+		const int64_t start = OSUtils::now();
+		for (unsigned long round = 0; round < 2000000; ++round) {
+			for (unsigned int k = 0; k < 4; ++k) {
+				AQMScheduler::Entry* e = pool.back();
+				pool.pop_back();
+				e->creationTime = now;
+				++in;
+				AQMScheduler::Entry* d = aqm->enqueue(e, (unsigned int)((in * 7) % ZT_AQM_NUM_BUCKETS));
+				if (d) {
+					pool.push_back(d);
+					++dropped;
+				}
+			}
+			AQMScheduler::Entry* out[2];
+			AQMScheduler::Entry* d = (AQMScheduler::Entry*)0;
+			const unsigned int n = aqm->dequeue(now, out, d);
+			for (unsigned int i = 0; i < n; ++i) {
+				sojourn += (double)(now - out[i]->creationTime);
+				pool.push_back(out[i]);
+				++sent;
+			}
+			while (d) {
+				pool.push_back(d);
+				d = d->next;
+				++dropped;
+			}
+			if ((round & 1) == 1) {
+				++now;
+			}
+		}
+		const int64_t end = OSUtils::now();
+		const unsigned long queued = aqm->size();
+		for (AQMScheduler::Entry* e = aqm->clear(); e; e = e->next) {
+			pool.push_back(e);
+		}
+		if (((sent + dropped + queued) != in) || (pool.size() != (ZT_AQM_MAX_ENQUEUED_PACKETS + 8))) {
+			std::cout << "FAILED! (lost frames: in " << in << " sent " << sent << " dropped " << dropped << " queued " << queued << ")" << std::endl;
+			return -1;
+		}
+		std::cout << ((double)(end - start) * 1000000.0 / (double)in) << " ns/frame, mean sojourn " << (sojourn / (double)sent) << " ms, " << queued << " left queued" << std::endl;
+		for (std::vector<AQMScheduler::Entry*>::iterator e(pool.begin()); e != pool.end(); ++e) {
+			delete *e;
+		}
+		delete aqm;
+	}
+
+	std::cout << "[other] Benchmarking certificate of ownership lookup... ";
+	std::cout.flush();
+	{
+		NetworkConfig* nconf = new NetworkConfig();
+		nconf->timestamp = 1000000;
+		nconf->credentialTimeMaxDelta = ZT_NETWORKCONFIG_DEFAULT_CREDENTIAL_TIME_MAX_MAX_DELTA;
+		SignatureBatch verified;
+		verified.verify();
+		static const unsigned int cooCounts[3] = { 1, 16, 128 };
+		for (unsigned int c = 0; c < 3; ++c) {
+			// Each COO claims 8 IPv4 and 8 IPv6 addresses, as for a member routing many subnets
+			Membership* m = new Membership();
+			std::vector<CertificateOfOwnership> coos;
+			std::vector<InetAddress> owned;
+			for (unsigned int i = 0; i < cooCounts[c]; ++i) {
+				CertificateOfOwnership coo(0x8056c2e21c000001ULL, nconf->timestamp, Address(0x0102030405ULL), i + 1);
+				for (unsigned int t = 0; t < 8; ++t) {
+					const uint32_t ip4 = Utils::hton((uint32_t)(0x0a000000 | (i << 8) | t));
+					owned.push_back(InetAddress(&ip4, 4, 0));
+					coo.addThing(owned.back());
+					uint8_t ip6[16];
+					memset(ip6, 0, sizeof(ip6));
+					ip6[0] = 0xfd;
+					ip6[14] = (uint8_t)i;
+					ip6[15] = (uint8_t)t;
+					owned.push_back(InetAddress(ip6, 16, 0));
+					coo.addThing(owned.back());
+				}
+				coos.push_back(coo);
+				if (m->addCredential((const RuntimeEnvironment*)0, (void*)0, *nconf, coo, &verified) != Membership::ADD_ACCEPTED_NEW) {
+					std::cout << "FAILED! (COO not accepted)" << std::endl;
+					return -1;
+				}
+			}
+			const uint32_t notOwned4 = Utils::hton((uint32_t)0x0b000001);
+			if ((m->hasCertificateOfOwnershipFor(*nconf, InetAddress(&notOwned4, 4, 0))) || (m->hasCertificateOfOwnershipFor(*nconf, MAC(0x0102030405ULL)))) {
+				std::cout << "FAILED! (unowned address matched)" << std::endl;
+				return -1;
+			}
+
+			unsigned long found = 0;
+			int64_t start = OSUtils::now();
+			for (unsigned int k = 0; k < 1000000; ++k) {
+				found += m->hasCertificateOfOwnershipFor(*nconf, owned[k % owned.size()]) ? 1 : 0;
+			}
+			int64_t end = OSUtils::now();
+			if (found != 1000000) {
+				std::cout << "FAILED! (owned address not matched)" << std::endl;
+				return -1;
+			}
+			const double indexed = (double)(end - start);
+
+			found = 0;
+			start = OSUtils::now();
+			for (unsigned int k = 0; k < 1000000; ++k) {
+				const InetAddress& ip = owned[k % owned.size()];
+				for (std::vector<CertificateOfOwnership>::const_iterator coo(coos.begin()); coo != coos.end(); ++coo) {
+					if (coo->owns(ip)) {
+						++found;
+						break;
+					}
+				}
+			}
+			end = OSUtils::now();
+			std::cout << cooCounts[c] << " COOs: " << indexed << " ns/lookup (linear scan " << ((double)(end - start)) << " ns)" << ((c == 2) ? "" : ", ");
+			delete m;
+		}
+		std::cout << std::endl;
+		delete nconf;
+	}
+
 	std::cout << "[other] Testing/fuzzing Dictionary... ";
 	std::cout.flush();
 	for (int k = 0; k < 1000; ++k) {
@@ -1406,9 +2427,10 @@ static int testOther()
 			value[q][r] = (char)0;
 			test->add(key[q], value[q], r);
 		}
+		const Dictionary<8194>::Index idx(*test);
 		for (unsigned int q = 0; q < 1024; ++q) {
 			int r = rand() % 32;
-			char tmp[128];
+			char tmp[128], tmp2[128];
 			if (test->get(key[r], tmp, sizeof(tmp)) >= 0) {
 				if (strcmp(value[r], tmp)) {
 					std::cout << "FAILED (invalid value '" << value[r] << "' != '" << tmp << "')!" << std::endl;
@@ -1419,6 +2441,10 @@ static int testOther()
 				std::cout << "FAILED (can't find key '" << key[r] << "')!" << std::endl;
 				return -1;
 			}
+			if ((idx.get(key[r], tmp2, sizeof(tmp2)) < 0) || (strcmp(tmp, tmp2))) {
+				std::cout << "FAILED (index value for '" << key[r] << "' differs)!" << std::endl;
+				return -1;
+			}
 		}
 		delete test;
 	}
@@ -1431,19 +2457,482 @@ static int testOther()
 			tmp[q] = (unsigned char)((rand() % 254) + 1);	   // don't put nulls since those will always just terminate scan
 		tmp[r] = (r % 32) ? (char)(rand() & 0xff) : (char)0;   // every 32nd iteration don't terminate the string maybe...
 		Dictionary<8194>* test = new Dictionary<8194>((const char*)tmp);
+		const Dictionary<8194>::Index idx(*test);
 		for (unsigned int q = 0; q < 100; ++q) {
 			char tmp[128];
 			for (unsigned int x = 0; x < 128; ++x)
 				tmp[x] = (char)(rand() & 0xff);
 			tmp[127] = (char)0;
-			char value[8194];
-			*bar += test->get(tmp, value, sizeof(value));
+			if ((q & 1) == 1) {
+				// Also look up keys that are actually present in the junk
+				const char* const line = test->data() + (rand() % 8194);
+				unsigned int x = 0;
+				while ((x < 127) && ((line + x) < (test->data() + 8194)) && (line[x]) && (line[x] != '=') && (line[x] != 10) && (line[x] != 13)) {
+					tmp[x] = line[x];
+					++x;
+				}
+				tmp[x] = (char)0;
+			}
+			char value[8194], value2[8194];
+			const int r = test->get(tmp, value, sizeof(value));
+			if ((idx.get(tmp, value2, sizeof(value2)) != r) || ((r > 0) && (memcmp(value, value2, r)))) {
+				std::cout << "FAILED (index result for junk key differs)!" << std::endl;
+				return -1;
+			}
+			*bar += r;
 		}
 		delete test;
 		delete[] tmp;
 	}
 	std::cout << "PASS (junk value to prevent optimization-out of test: " << foo << ")" << std::endl;
 
+	std::cout << "[other] Benchmarking Dictionary index on a large network config... ";
+	std::cout.flush();
+	{
+		NetworkConfig* nc = new NetworkConfig();
+		nc->networkId = 0x8056c2e21c000001ULL;
+		nc->timestamp = 1000000;
+		nc->issuedTo = Address(0x0102030405ULL);
+		for (unsigned int i = 0; i < ZT_MAX_CERTIFICATES_OF_OWNERSHIP; ++i) {
+			CertificateOfOwnership& coo = nc->certificatesOfOwnership[nc->certificateOfOwnershipCount++];
+			coo = CertificateOfOwnership(nc->networkId, nc->timestamp, nc->issuedTo, i);
+			for (unsigned int t = 0; t < ZT_CERTIFICATEOFOWNERSHIP_MAX_THINGS; ++t) {
+				const uint32_t ip4 = Utils::hton((uint32_t)(0x0a000000 | (i << 8) | t));
+				coo.addThing(InetAddress(&ip4, 4, 0));
+			}
+		}
+		for (unsigned int i = 0; i < ZT_MAX_NETWORK_RULES; ++i)
+			nc->rules[nc->ruleCount++].t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>* d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		NetworkConfig* nc2 = new NetworkConfig();
+		if ((! nc->toDictionary(*d, false)) || (! nc2->fromDictionary(*d)) || (nc2->certificateOfOwnershipCount != nc->certificateOfOwnershipCount) || (nc2->ruleCount != nc->ruleCount)) {
+			std::cout << "FAILED (network config did not survive a round trip)" << std::endl;
+			return -1;
+		}
+		int64_t start = OSUtils::now();
+		for (unsigned int k = 0; k < 200; ++k)
+			nc2->fromDictionary(*d);
+		int64_t end = OSUtils::now();
+		std::cout << d->sizeBytes() << " bytes, fromDictionary() " << ((double)(end - start) * 1000.0 / 200.0) << " us, ";
+		start = OSUtils::now();
+		for (unsigned int k = 0; k < 200; ++k)
+			nc->toDictionary(*d, false);
+		end = OSUtils::now();
+		std::cout << "toDictionary() " << ((double)(end - start) * 1000.0 / 200.0) << " us" << std::endl;
+		delete nc2;
+		delete d;
+		delete nc;
+	}
+
+	std::cout << "[other] Measuring network config memory per joined network... ";
+	std::cout.flush();
+	{
+		NetworkConfig* nc = new NetworkConfig();
+		nc->networkId = 0x8056c2e21c000001ULL;
+		nc->timestamp = 1000000;
+		nc->issuedTo = Address(0x0102030405ULL);
+		ZT_VirtualNetworkRule capRules[4];
+		memset(capRules, 0, sizeof(capRules));
+		for (unsigned int i = 0; i < 4; ++i)
+			capRules[i].t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+		for (unsigned int i = 0; i < 4; ++i) {
+			nc->capabilities.push_back(Capability(4 - i, nc->networkId, nc->timestamp, 1, capRules, i + 1));
+			++nc->capabilityCount;
+		}
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>* d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		NetworkConfig* nc2 = new NetworkConfig();
+		if ((! nc->toDictionary(*d, false)) || (! nc2->fromDictionary(Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>::Index(d->data(), d->sizeBytes() + 1))) || (nc2->capabilityCount != 4) || (nc2->capabilities.size() != 4)
+			|| (nc2->capabilities[0].id() != 1) || (nc2->capabilities[3].ruleCount() != 1) || (! nc2->capability(3))) {
+			std::cout << "FAILED (capabilities did not survive a round trip)" << std::endl;
+			return -1;
+		}
+		NetworkConfig* nc3 = new NetworkConfig(*nc2);
+		if (! (*nc3 == *nc2)) {
+			std::cout << "FAILED (copy of network config does not compare equal)" << std::endl;
+			return -1;
+		}
+		nc3->capabilities.pop_back();
+		if (*nc3 == *nc2) {
+			std::cout << "FAILED (differing capabilities compare equal)" << std::endl;
+			return -1;
+		}
+		// A joined network holds its config twice: once under its lock and once in the frame path snapshot
+		const unsigned long perConfig = (unsigned long)(sizeof(NetworkConfig) + (sizeof(Capability) * nc2->capabilities.size()));
+		std::cout << "NetworkConfig " << sizeof(NetworkConfig) << " bytes + " << (sizeof(Capability) * nc2->capabilities.size()) << " for " << nc2->capabilityCount << " capabilities, Network " << sizeof(Network) << " bytes, about " << ((sizeof(Network) + perConfig + (sizeof(Capability) * nc2->capabilities.size())) / 1024) << "KB per joined network" << std::endl;
+		delete nc3;
+		delete nc2;
+		delete d;
+		delete nc;
+	}
+
+	std::cout << "[other] Testing peer cache store... ";
+	std::cout.flush();
+	{
+		const std::string cachePath("zerotier-selftest-peers.cache");
+		OSUtils::rm(cachePath);
+		std::vector<std::vector<uint8_t> > expected(2000);
+		uint8_t buf[1024];
+		PeerCache* pc = new PeerCache(cachePath);
+		uint64_t start = OSUtils::now();
+		for (unsigned int i = 0; i < 2000; ++i) {
+			unsigned int rl = 0;
+			Utils::getSecureRandom(&rl, sizeof(rl));
+			expected[i].resize(100 + (rl % 400));
+			Utils::getSecureRandom(expected[i].data(), (unsigned int)expected[i].size());
+			pc->put(0x1000000000ULL + i, expected[i].data(), (unsigned int)expected[i].size());
+		}
+		uint64_t end = OSUtils::now();
+		std::cout << (double)((end - start) * 1000) / 2000.0 << "us per queued put, ";
+		for (unsigned int i = 0; i < 2000; i += 7)
+			pc->remove(0x1000000000ULL + i);
+		for (unsigned int i = 0; i < 2000; i += 7)
+			expected[i].clear();
+
+		for (int pass = 0; pass < 3; ++pass) {
+			for (unsigned int i = 0; i < 2000; ++i) {
+				const int n = pc->get(0x1000000000ULL + i, buf, sizeof(buf));
+				if (expected[i].empty() ? (n != -1) : ((n != (int)expected[i].size()) || (memcmp(buf, expected[i].data(), n) != 0))) {
+					std::cout << "FAILED (entry " << i << " wrong on pass " << pass << ")" << std::endl;
+					return -1;
+				}
+			}
+			if (pass == 0) {
+				pc->flush();
+			}
+			else if (pass == 1) {
+				delete pc;
+				start = OSUtils::now();
+				pc = new PeerCache(cachePath);
+				end = OSUtils::now();
+				std::cout << (end - start) << "ms to reopen " << pc->size() << " peers, ";
+			}
+		}
+
+		// Rewriting the same peers over and over must not grow the file without bound
+		for (unsigned int r = 0; r < 50; ++r) {
+			for (unsigned int i = 1; i < 2000; i += 7) {
+				expected[i][0] = (uint8_t)r;
+				pc->put(0x1000000000ULL + i, expected[i].data(), (unsigned int)expected[i].size());
+			}
+			pc->flush();
+		}
+		delete pc;
+		pc = new PeerCache(cachePath);
+		if ((pc->get(0x1000000001ULL, buf, sizeof(buf)) != (int)expected[1].size()) || (memcmp(buf, expected[1].data(), expected[1].size()) != 0)) {
+			std::cout << "FAILED (entry rewritten many times is wrong)" << std::endl;
+			return -1;
+		}
+		delete pc;
+		const long fileSize = (long)OSUtils::getFileSize(cachePath.c_str());
+		if (fileSize > ((2000 * 520 * 2) + ZT_PEERCACHE_COMPACT_SLACK)) {
+			std::cout << "FAILED (file not compacted, " << fileSize << " bytes)" << std::endl;
+			return -1;
+		}
+		std::cout << fileSize << " bytes on disk after rewrites" << std::endl;
+		OSUtils::rm(cachePath);
+	}
+
+	std::cout << "[other] Benchmarking rejoin of 256 networks at startup... ";
+	std::cout.flush();
+	{
+		TestStateStore ss;
+		struct ZT_Node_Callbacks cb;
+		memset(&cb, 0, sizeof(cb));
+		cb.statePutFunction = testStatePut;
+		cb.stateGetFunction = testStateGet;
+		cb.wirePacketSendFunction = testWirePacketSend;
+		cb.virtualNetworkFrameFunction = testVirtualNetworkFrame;
+		cb.virtualNetworkConfigFunction = testVirtualNetworkConfig;
+		cb.eventCallback = testEvent;
+		struct ZT_Node_Config config;
+		memset(&config, 0, sizeof(config));
+
+		// Cache a config with a realistic number of routes and rules for each network
+		Node* node = new Node(&ss, (void*)0, &config, &cb, OSUtils::now());
+		const Address nodeAddress(node->address());
+		delete node;
+		std::vector<uint64_t> nwids;
+		NetworkConfig* nc = new NetworkConfig();
+		Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>* d = new Dictionary<ZT_NETWORKCONFIG_DICT_CAPACITY>();
+		for (unsigned int i = 0; i < 256; ++i) {
+			nwids.push_back(0x8056c2e21c000000ULL + i);
+			nc->networkId = nwids.back();
+			nc->timestamp = 1000000;
+			nc->revision = 1;
+			nc->issuedTo = nodeAddress;
+			nc->mtu = ZT_DEFAULT_MTU;
+			nc->multicastLimit = 32;
+			OSUtils::ztsnprintf(nc->name, sizeof(nc->name), "network%u", i);
+			nc->routeCount = 32;
+			for (unsigned int r = 0; r < nc->routeCount; ++r) {
+				*reinterpret_cast<InetAddress*>(&(nc->routes[r].target)) = InetAddress(Utils::hton((uint32_t)(0x0a000000 | (r << 16))), 16);
+				nc->routes[r].flags = 0;
+				nc->routes[r].metric = 0;
+			}
+			nc->staticIpCount = 1;
+			nc->staticIps[0] = InetAddress(Utils::hton((uint32_t)(0x0a000001 + i)), 8);
+			nc->ruleCount = 0;
+			for (unsigned int r = 0; r < 128; ++r) {
+				nc->rules[nc->ruleCount].t = (uint8_t)ZT_NETWORK_RULE_MATCH_IPV4_DEST;
+				nc->rules[nc->ruleCount].v.ipv4.ip = Utils::hton((uint32_t)(0x0a000000 | (r << 8)));
+				nc->rules[nc->ruleCount++].v.ipv4.mask = 24;
+				nc->rules[nc->ruleCount].t = (uint8_t)ZT_NETWORK_RULE_MATCH_IP_DEST_PORT_RANGE;
+				nc->rules[nc->ruleCount].v.port[0] = (uint16_t)(1000 + r);
+				nc->rules[nc->ruleCount++].v.port[1] = (uint16_t)(2000 + r);
+				nc->rules[nc->ruleCount++].t = (uint8_t)ZT_NETWORK_RULE_ACTION_ACCEPT;
+			}
+			nc->rules[nc->ruleCount++].t = (uint8_t)ZT_NETWORK_RULE_ACTION_DROP;
+			d->clear();
+			if (! nc->toDictionary(*d, false)) {
+				std::cout << "FAILED (could not serialize network config)" << std::endl;
+				return -1;
+			}
+			uint64_t id[2];
+			id[0] = nwids.back();
+			id[1] = 0;
+			testStatePut((ZT_Node*)0, &ss, (void*)0, ZT_STATE_OBJECT_NETWORK_CONFIG, id, d->data(), (int)d->sizeBytes());
+		}
+		delete d;
+		delete nc;
+
+		// Join one network at a time as before, then all at once
+		int64_t elapsed[2];
+		for (int parallel = 0; parallel < 2; ++parallel) {
+			node = new Node(&ss, (void*)0, &config, &cb, OSUtils::now());
+			const int64_t start = OSUtils::now();
+			if (parallel) {
+				node->join(nwids, (void*)0);
+			}
+			else {
+				for (std::vector<uint64_t>::const_iterator nwid(nwids.begin()); nwid != nwids.end(); ++nwid)
+					node->join(*nwid, (void*)0, (void*)0);
+			}
+			elapsed[parallel] = OSUtils::now() - start;
+			for (unsigned int i = 0; i < nwids.size(); i += 17) {
+				ZT_VirtualNetworkConfig* const vc = node->networkConfig(nwids[i]);
+				char name[ZT_MAX_NETWORK_SHORT_NAME_LENGTH + 1];
+				OSUtils::ztsnprintf(name, sizeof(name), "network%u", i);
+				const bool ok = ((vc) && (strcmp(vc->name, name) == 0) && (vc->routeCount == 32) && (vc->assignedAddressCount == 1));
+				if (vc)
+					node->freeQueryResult(vc);
+				if (! ok) {
+					std::cout << "FAILED (network " << i << " not configured from cache)" << std::endl;
+					return -1;
+				}
+			}
+			delete node;
+		}
+		std::cout << elapsed[0] << "ms one at a time, " << elapsed[1] << "ms in parallel" << std::endl;
+	}
+
+	std::cout << "[other] Testing sharded RX queue eviction and retry... ";
+	std::cout.flush();
+	{
+		TestStateStore ss;
+		struct ZT_Node_Callbacks cb;
+		memset(&cb, 0, sizeof(cb));
+		cb.statePutFunction = testStatePut;
+		cb.stateGetFunction = testStateGet;
+		cb.wirePacketSendFunction = testWirePacketSend;
+		cb.virtualNetworkFrameFunction = testVirtualNetworkFrame;
+		cb.virtualNetworkConfigFunction = testVirtualNetworkConfig;
+		cb.eventCallback = testEvent;
+		struct ZT_Node_Config config;
+		memset(&config, 0, sizeof(config));
+		const int64_t now = OSUtils::now();
+		Node* const node = new Node(&ss, (void*)0, &config, &cb, now);
+		node->setRxQueueSize(ZT_RX_QUEUE_SHARDS * 2);	// two entries per shard
+
+		const uint64_t fragCompleted = Metrics::fragment_reassembly_completed.value();
+		const uint64_t fragEvicted = Metrics::fragment_reassembly_evicted.value();
+		const uint64_t fragTimedOut = Metrics::fragment_reassembly_timed_out.value();
+		const uint64_t whoisEvicted = Metrics::whois_wait_evicted.value();
+		const uint64_t whoisTimedOut = Metrics::whois_wait_timed_out.value();
+		const uint64_t whoisRefused = Metrics::whois_wait_refused.value();
+
+		// Heads of two-fragment packets from unknown peers, each from its own IP so none is refused
+		const unsigned int count = 400;
+		std::vector<Packet> packets;
+		for (unsigned int i = 0; i < count; ++i) {
+			packets.push_back(Packet(node->address(), Address(0x1100000000ULL + i), Packet::VERB_NOP));
+			for (unsigned int b = 0; b < 200; ++b)
+				packets.back().append((uint8_t)b);
+			packets.back().setFragmented(true);
+		}
+		int64_t t = now;
+		volatile int64_t deadline = 0;
+		for (unsigned int i = 0; i < count; ++i) {
+			const InetAddress from(Utils::hton((uint32_t)(0x0a000000 | (i << 8) | 1)), 9993);
+			node->processWirePacket((void*)0, ++t, 1, reinterpret_cast<const struct sockaddr_storage*>(&from), packets[i].data(), 100, &deadline);
+		}
+		if ((Metrics::fragment_reassembly_evicted.value() - fragEvicted) != (count - (ZT_RX_QUEUE_SHARDS * 2))) {
+			std::cout << "FAILED (evicted " << (Metrics::fragment_reassembly_evicted.value() - fragEvicted) << " of " << count << " partial packets)" << std::endl;
+			return -1;
+		}
+
+		// The newest packets are still held, the oldest was evicted first
+		const unsigned int probe[3] = { count - 1, count - 2, 0 };
+		for (unsigned int p = 0; p < 3; ++p) {
+			const Packet::Fragment f(packets[probe[p]], 100, packets[probe[p]].size() - 100, 1, 2);
+			const InetAddress from(Utils::hton((uint32_t)(0x0a000000 | (probe[p] << 8) | 1)), 9993);
+			node->processWirePacket((void*)0, ++t, 1, reinterpret_cast<const struct sockaddr_storage*>(&from), f.data(), f.size(), &deadline);
+		}
+		if ((Metrics::fragment_reassembly_completed.value() - fragCompleted) != 2) {
+			std::cout << "FAILED (reassembled " << (Metrics::fragment_reassembly_completed.value() - fragCompleted) << " packets, expected the newest 2)" << std::endl;
+			return -1;
+		}
+
+		// Unfragmented packets waiting for WHOIS are limited per source and counted as such. The
+		// queue is grown so that no shard fills up and evicts, which leaves only the source limit.
+		node->setRxQueueSize(ZT_RX_QUEUE_SHARDS * 64);
+		const unsigned int busyLimit = (ZT_RX_QUEUE_SHARDS * 64) / ZT_RX_QUEUE_MAX_SOURCE_SHARE;
+		const unsigned int busyCount = busyLimit + 20;
+		const InetAddress busy(Utils::hton((uint32_t)0xc0a80001), 9993);
+		for (unsigned int i = 0; i < busyCount; ++i) {
+			Packet p(node->address(), Address(0x2200000000ULL + i), Packet::VERB_NOP);
+			p.append((uint32_t)i);
+			node->processWirePacket((void*)0, ++t, 1, reinterpret_cast<const struct sockaddr_storage*>(&busy), p.data(), p.size(), &deadline);
+		}
+		const uint64_t refused = Metrics::whois_wait_refused.value() - whoisRefused;
+		if (refused != (busyCount - busyLimit)) {
+			std::cout << "FAILED (refused " << refused << " of " << busyCount << " packets from one source)" << std::endl;
+			return -1;
+		}
+
+		// Retrying after the timeout drops everything still held, each under its own outcome
+		node->processBackgroundTasks((void*)0, t + ZT_RECEIVE_QUEUE_TIMEOUT + 1000, &deadline);
+		const uint64_t partial = (Metrics::fragment_reassembly_completed.value() - fragCompleted) + (Metrics::fragment_reassembly_evicted.value() - fragEvicted) + (Metrics::fragment_reassembly_timed_out.value() - fragTimedOut);
+		const uint64_t waiting = (Metrics::whois_wait_evicted.value() - whoisEvicted) + (Metrics::whois_wait_timed_out.value() - whoisTimedOut);
+		if ((partial != (count + 1)) || (waiting != (2 + (busyCount - refused))) || (Metrics::whois_wait_timed_out.value() == whoisTimedOut)) {
+			std::cout << "FAILED (" << partial << " partial and " << waiting << " waiting packets accounted for)" << std::endl;
+			return -1;
+		}
+		delete node;
+		std::cout << "OK" << std::endl;
+	}
+
+	std::cout << "[other] Testing that known identities in use survive eviction... ";
+	std::cout.flush();
+	{
+		TestStateStore ss;
+		struct ZT_Node_Callbacks cb;
+		memset(&cb, 0, sizeof(cb));
+		cb.statePutFunction = testStatePut;
+		cb.stateGetFunction = testStateGet;
+		cb.wirePacketSendFunction = testWirePacketSend;
+		cb.virtualNetworkFrameFunction = testVirtualNetworkFrame;
+		cb.virtualNetworkConfigFunction = testVirtualNetworkConfig;
+		cb.eventCallback = testEvent;
+		struct ZT_Node_Config config;
+		memset(&config, 0, sizeof(config));
+		int64_t t = OSUtils::now();
+		Node* const node = new Node(&ss, (void*)0, &config, &cb, t);
+		RuntimeEnvironment rr(node);
+		rr.identity.fromString(KNOWN_GOOD_IDENTITY);
+		Topology* const topo = new Topology(&rr, (void*)0);
+
+		// Identities are remembered as their peers leave memory: an older quarter past the limit, then the rest
+		const char* const publicKey = strchr(strchr(KNOWN_GOOD_IDENTITY, ':') + 1, ':') + 1;
+		const unsigned int older = (ZT_TOPOLOGY_MAX_KNOWN_IDENTITIES / 4) + 1, total = ZT_TOPOLOGY_MAX_KNOWN_IDENTITIES + 1;
+		std::vector<Identity> ids(total);
+		uint8_t key[ZT_SYMMETRIC_KEY_SIZE];
+		memset(key, 0, sizeof(key));
+		for (unsigned int i = 0; i < total; ++i) {
+			OSUtils::ztsnprintf(buf, sizeof(buf), "%.10llx:0:%.128s", 0x3300000000ULL + i, publicKey);
+			ids[i].fromString(buf);
+			Utils::storeBigEndian<uint32_t>(key, i);
+			topo->addPeer((void*)0, SharedPtr<Peer>(new Peer(&rr, rr.identity, ids[i], key)));
+			if (((i + 1) == older) || ((i + 1) == total)) {
+				t += ZT_PEER_ACTIVITY_TIMEOUT;
+				for (unsigned int s = 0; s < ZT_TOPOLOGY_HOUSEKEEPING_STEPS; ++s)
+					topo->doPeriodicTasks((void*)0, t);
+			}
+		}
+
+		// One of the older identities keeps coming back, so it must outlive the rest of them
+		uint8_t got[ZT_SYMMETRIC_KEY_SIZE];
+		if ((! topo->knownIdentityKey(ids[0], got, t + 1000)) || (Utils::loadBigEndian<uint32_t>(got) != 0)) {
+			std::cout << "FAILED (identity not remembered)" << std::endl;
+			return -1;
+		}
+		t += 2000;
+		topo->doPeriodicTasks((void*)0, t);
+		unsigned int olderKept = 0, newerKept = 0;
+		for (unsigned int i = 1; i < total; ++i) {
+			if (topo->knownIdentityKey(ids[i], got, t))
+				++((i < older) ? olderKept : newerKept);
+		}
+		if ((! topo->knownIdentityKey(ids[0], got, t)) || (olderKept != 0) || (newerKept != (total - older))) {
+			std::cout << "FAILED (identity in use was evicted, or " << olderKept << " older and " << newerKept << " newer kept)" << std::endl;
+			return -1;
+		}
+		delete topo;
+		delete node;
+		std::cout << "OK" << std::endl;
+	}
+
+#ifdef __LINUX__
+	{
+		std::cout << "[other] Testing tap offload segmentation and checksum completion... ";
+		std::vector<uint8_t> fb(10 + 14 + 40 + 20 + 4000), l4(20 + 4000);
+		std::vector<std::string> frames;
+		for (unsigned int i = 0; i < 4000; ++i)
+			l4[20 + i] = (uint8_t)(i * 7);
+
+		// 2500 bytes of TCP payload with FIN|PSH|ACK, cut into 1000 byte segments
+		const uint32_t seq = 0xfffff000;   // wraps during the transfer
+		for (int v6 = 0; v6 < 2; ++v6) {
+			memset(l4.data(), 0, 20);
+			Utils::storeBigEndian<uint16_t>(l4.data(), 40000);
+			Utils::storeBigEndian<uint16_t>(l4.data() + 2, 80);
+			Utils::storeBigEndian<uint32_t>(l4.data() + 4, seq);
+			l4[12] = 0x50;
+			l4[13] = 0x19;
+			Utils::storeBigEndian<uint16_t>(l4.data() + 14, 65535);
+			const unsigned int iphl = v6 ? 40 : 20;
+			const unsigned int n = testVnetFrame(fb.data(), 1, v6 ? 4 : 1, 1000, (uint16_t)(14 + iphl), 16, v6 != 0, 6, l4.data(), 20 + 2500);
+			frames.clear();
+			LinuxEthernetTap::vnetRead(testTapFrame, &frames, 0, ZT_DEFAULT_MTU, fb.data(), n);
+			if (frames.size() != 3) {
+				std::cout << "FAILED (TCPv" << (v6 ? 6 : 4) << " super-frame became " << frames.size() << " segments)" << std::endl;
+				return -1;
+			}
+			for (unsigned int i = 0; i < 3; ++i) {
+				const uint8_t* const ip = reinterpret_cast<const uint8_t*>(frames[i].data());
+				const uint8_t* const tcp = ip + iphl;
+				const unsigned int plen = (i < 2) ? 1000 : 500;
+				bool ok = (frames[i].length() == (iphl + 20 + plen)) && (memcmp(tcp + 20, l4.data() + 20 + (i * 1000), plen) == 0);
+				if (v6)
+					ok &= (Utils::loadBigEndian<uint16_t>(ip + 4) == (20 + plen));
+				else
+					ok &= (Utils::loadBigEndian<uint16_t>(ip + 2) == (40 + plen)) && (Utils::loadBigEndian<uint16_t>(ip + 4) == (0x1234 + i)) && (testInetSum(0, ip, 20) == 0xffff);
+				ok &= (Utils::loadBigEndian<uint32_t>(tcp + 4) == (uint32_t)(seq + (i * 1000))) && (tcp[13] == ((i < 2) ? 0x10 : 0x19)) && testVnetL4Ok(frames[i], v6 != 0);
+				if (! ok) {
+					std::cout << "FAILED (TCPv" << (v6 ? 6 : 4) << " segment " << i << " is wrong)" << std::endl;
+					return -1;
+				}
+			}
+		}
+
+		// Partially checksummed TCPv4 and UDPv6 frames are completed and passed through whole
+		memset(l4.data(), 0, 20);
+		l4[12] = 0x50;
+		l4[13] = 0x10;
+		unsigned int n = testVnetFrame(fb.data(), 1, 0, 0, 34, 16, false, 6, l4.data(), 20 + 333);
+		frames.clear();
+		LinuxEthernetTap::vnetRead(testTapFrame, &frames, 0, ZT_DEFAULT_MTU, fb.data(), n);
+		memset(l4.data(), 0, 8);
+		Utils::storeBigEndian<uint16_t>(l4.data() + 4, 8 + 777);
+		n = testVnetFrame(fb.data(), 1, 0, 0, 54, 6, true, 17, l4.data(), 8 + 777);
+		LinuxEthernetTap::vnetRead(testTapFrame, &frames, 0, ZT_DEFAULT_MTU, fb.data(), n);
+		if ((frames.size() != 2) || (frames[0].length() != (20 + 20 + 333)) || (frames[1].length() != (40 + 8 + 777)) || (! testVnetL4Ok(frames[0], false)) || (! testVnetL4Ok(frames[1], true))) {
+			std::cout << "FAILED (partial checksums not completed)" << std::endl;
+			return -1;
+		}
+		std::cout << "OK" << std::endl;
+	}
+#endif	 // __LINUX__
+
 	return 0;
 }
 
@@ -1453,11 +2942,13 @@ static int testOther()
 #define ZT_TEST_PHY_NUM_INVALID_TCP_CONNECTS 2
 #define ZT_TEST_PHY_TCP_MESSAGE_SIZE		 1000000
 #define ZT_TEST_PHY_TIMEOUT_MS				 20000
-static unsigned long phyTestUdpPacketCount = 0;
+static std::atomic<unsigned long> phyTestUdpPacketCount(0);
 static unsigned long phyTestTcpByteCount = 0;
 static unsigned long phyTestTcpConnectSuccessCount = 0;
 static unsigned long phyTestTcpConnectFailCount = 0;
 static unsigned long phyTestTcpAcceptCount = 0;
+static unsigned long phyTestUnixByteCount = 0;
+static unsigned long phyTestUnixCloseCount = 0;
 struct TestPhyHandlers;
 static Phy<TestPhyHandlers*>* testPhyInstance = (Phy<TestPhyHandlers*>*)0;
 struct TestPhyHandlers {
@@ -1466,6 +2957,11 @@ struct TestPhyHandlers {
 		++phyTestUdpPacketCount;
 	}
 
+	inline void phyOnDatagramBatch(PhySocket* sock, void** uptr, const struct sockaddr* localAddr, const struct sockaddr* const* from, void* const* data, const unsigned long* len, unsigned int count)
+	{
+		phyTestUdpPacketCount += count;
+	}
+
 	inline void phyOnTcpConnect(PhySocket* sock, void** uptr, bool success)
 	{
 		if (success) {
@@ -1512,9 +3008,11 @@ struct TestPhyHandlers {
 	}
 	inline void phyOnUnixClose(PhySocket* sock, void** uptr)
 	{
+		++phyTestUnixCloseCount;
 	}
 	inline void phyOnUnixData(PhySocket* sock, void** uptr, void* data, unsigned long len)
 	{
+		phyTestUnixByteCount += len;
 	}
 	inline void phyOnUnixWritable(PhySocket* sock, void** uptr)
 	{
@@ -1581,6 +3079,117 @@ static int testPhy()
 	}
 	std::cout << "got " << phyTestUdpPacketCount << " packets, OK" << std::endl;
 
+#ifdef ZT_PHY_HAVE_SENDMMSG
+	std::cout << "[phy] Testing batched UDP send (sendmmsg/UDP GSO)... ";
+	std::cout.flush();
+	{
+		// Checksums on so that UDP GSO can be used for runs of equal-sized datagrams
+		Phy<TestPhyHandlers*> batchPhy(&testPhyHandlers, false, false);
+		struct sockaddr_in batchaddr;
+		memcpy(&batchaddr, &bindaddr, sizeof(batchaddr));
+		batchaddr.sin_port = Utils::hton((uint16_t)60006);
+		PhySocket* batchSock = batchPhy.udpBind((const struct sockaddr*)&batchaddr);
+		if (! batchSock) {
+			std::cout << "FAILED (bind)." << std::endl;
+			return -1;
+		}
+		const unsigned long before = phyTestUdpPacketCount;
+		unsigned long batchSent = 0;
+		for (unsigned int b = 0; b < 20; ++b) {
+			{
+				PhyTxBatch::Scope txBatch;
+				for (unsigned int i = 0; i < 25; ++i) {
+					// 24 full-sized datagrams and one short one per scope
+					batchPhy.udpSend(batchSock, (const struct sockaddr*)&batchaddr, udpTestPayload, (i == 24) ? 100 : 1000);
+					++batchSent;
+				}
+			}
+			batchPhy.poll(10);
+		}
+		timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+		while ((OSUtils::now() < timeoutAt) && ((phyTestUdpPacketCount - before) < batchSent))
+			batchPhy.poll(100);
+		if ((phyTestUdpPacketCount - before) != batchSent) {
+			std::cout << "FAILED (got " << (phyTestUdpPacketCount - before) << " of " << batchSent << ")." << std::endl;
+			return -1;
+		}
+		std::cout << "got " << (phyTestUdpPacketCount - before) << " packets, OK" << std::endl;
+	}
+#endif
+
+#ifdef ZT_PHY_HAVE_RX_THREADS
+	std::cout << "[phy] Testing UDP receive on SO_REUSEPORT RX threads... ";
+	std::cout.flush();
+	{
+		Phy<TestPhyHandlers*> rxPhy(&testPhyHandlers, false, true);
+		if ((! rxPhy.startRxThreads(2, false)) || (rxPhy.rxThreadCount() != 2)) {
+			std::cout << "FAILED (start)." << std::endl;
+			return -1;
+		}
+		struct sockaddr_in rxaddr;
+		memcpy(&rxaddr, &bindaddr, sizeof(rxaddr));
+		rxaddr.sin_port = Utils::hton((uint16_t)60008);
+		if ((! rxPhy.udpBind((const struct sockaddr*)&rxaddr, (void*)0, 0, 0)) || (! rxPhy.udpBind((const struct sockaddr*)&rxaddr, (void*)0, 0, 1))) {
+			std::cout << "FAILED (bind)." << std::endl;
+			return -1;
+		}
+		std::vector<PhySocket*> senders;
+		for (unsigned int i = 0; i < 8; ++i) {
+			struct sockaddr_in saddr;
+			memcpy(&saddr, &bindaddr, sizeof(saddr));
+			saddr.sin_port = Utils::hton((uint16_t)(60010 + i));
+			PhySocket* const ss = rxPhy.udpBind((const struct sockaddr*)&saddr);
+			if (ss)
+				senders.push_back(ss);
+		}
+		const unsigned long before = phyTestUdpPacketCount;
+		unsigned long rxSent = 0;
+		for (unsigned int i = 0; i < 1000; ++i) {
+			if (rxPhy.udpSend(senders[i % senders.size()], (const struct sockaddr*)&rxaddr, udpTestPayload, sizeof(udpTestPayload), false))
+				++rxSent;
+			if ((i % 100) == 99)
+				Thread::sleep(10);	 // stay within default socket receive buffers
+		}
+		timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+		while ((OSUtils::now() < timeoutAt) && ((phyTestUdpPacketCount - before) < rxSent))
+			Thread::sleep(10);
+		if ((senders.empty()) || ((phyTestUdpPacketCount - before) != rxSent)) {
+			std::cout << "FAILED (got " << (phyTestUdpPacketCount - before) << " of " << rxSent << ")." << std::endl;
+			return -1;
+		}
+		std::cout << "got " << (phyTestUdpPacketCount - before) << " packets, OK" << std::endl;
+	}
+#endif
+
+#ifdef __UNIX_LIKE__
+	std::cout << "[phy] Testing data followed by shutdown() on a stream socket... ";
+	std::cout.flush();
+	{
+		// The data and the FIN arrive before the socket is polled, so both come in on one edge
+		int sv[2];
+		if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+			std::cout << "FAILED (socketpair)." << std::endl;
+			return -1;
+		}
+		Phy<TestPhyHandlers*> streamPhy(&testPhyHandlers, false, true);
+		streamPhy.wrapSocket(sv[0]);
+		const char msg[] = "some data and then a FIN";
+		if ((::write(sv[1], msg, sizeof(msg)) != (ssize_t)sizeof(msg)) || (::shutdown(sv[1], SHUT_WR) != 0)) {
+			std::cout << "FAILED (write)." << std::endl;
+			return -1;
+		}
+		timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
+		while ((OSUtils::now() < timeoutAt) && (! phyTestUnixCloseCount))
+			streamPhy.poll(100);
+		::close(sv[1]);
+		if ((phyTestUnixByteCount != sizeof(msg)) || (phyTestUnixCloseCount != 1)) {
+			std::cout << "FAILED (read " << phyTestUnixByteCount << " bytes, " << phyTestUnixCloseCount << " closes)." << std::endl;
+			return -1;
+		}
+		std::cout << "OK" << std::endl;
+	}
+#endif
+
 	std::cout << "[phy] Testing TCP... ";
 	std::cout.flush();
 	timeoutAt = OSUtils::now() + ZT_TEST_PHY_TIMEOUT_MS;
@@ -1673,6 +3282,8 @@ int main(int argc, char** argv)
 	r |= testPacket();
 	r |= testIdentity();
 	r |= testCertificate();
+	r |= testTopology();
+	r |= testRules();
 	r |= testPhy();
 	//*/
 
@@ -37,6 +37,7 @@
 #include "../osdep/BlockingQueue.hpp"
 #include "../osdep/ManagedRoute.hpp"
 #include "../osdep/OSUtils.hpp"
+#include "../osdep/PeerCache.hpp"
 #include "../osdep/Phy.hpp"
 #include "../osdep/PortMapper.hpp"
 #include "../version.h"
@@ -827,6 +828,7 @@ class OneServiceImpl : public OneService {
 	EmbeddedNetworkController* _controller;
 	Phy<OneServiceImpl*> _phy;
 	Node* _node;
+	PeerCache* _peerCache;
 	bool _updateAutoApply;
 
 	httplib::Server _controlPlane;
@@ -842,6 +844,8 @@ class OneServiceImpl : public OneService {
 	Mutex _rxPacketVector_m, _rxPacketThreads_m;
 	bool _multicoreEnabled;
 	bool _cpuPinningEnabled;
+	bool _multicoreUdpReceive;
+	bool _tapOffloadEnabled;
 	unsigned int _concurrency;
 
 	bool _allowTcpFallbackRelay;
@@ -946,6 +950,7 @@ class OneServiceImpl : public OneService {
 		, _controller((EmbeddedNetworkController*)0)
 		, _phy(this, false, true)
 		, _node((Node*)0)
+		, _peerCache((PeerCache*)0)
 		, _updateAutoApply(false)
 		, _controlPlane()
 		, _controlPlaneV6()
@@ -1035,6 +1040,7 @@ class OneServiceImpl : public OneService {
 #endif
 		delete _controller;
 		delete _rc;
+		delete _peerCache;
 	}
 
 	void setUpMultithreading()
@@ -1163,6 +1169,8 @@ class OneServiceImpl : public OneService {
 				struct ZT_Node_Config config;
 				config.enableEncryptedHello = 0;
 				config.lowBandwidthMode = 0;
+				_peerCache = new PeerCache(_homePath + ZT_PATH_SEPARATOR_S "peers.cache");
+				_migratePeersDir();
 				_node = new Node(this, (void*)0, &config, &cb, OSUtils::now());
 			}
 
@@ -1170,6 +1178,12 @@ class OneServiceImpl : public OneService {
 			readLocalSettings();
 			applyLocalConfig();
 
+			// Only honored at startup: this must happen before the first binder refresh, which
+			// sizes its socket table for one SO_REUSEPORT socket per address per thread.
+			if ((_multicoreUdpReceive) && (_phy.startRxThreads(_concurrency, _cpuPinningEnabled))) {
+				fprintf(stderr, "Receiving UDP on %u threads" ZT_EOL_S, _phy.rxThreadCount());
+			}
+
 #ifdef ZT_OPENTELEMETRY_ENABLED
 			fprintf(stderr, "OneServiceImpl::run: initializing OpenTelemetry...\n");
 			initTracing();
@@ -1269,14 +1283,16 @@ class OneServiceImpl : public OneService {
 
 			startHTTPControlPlane();
 
-			// Join existing networks in networks.d
+			// Join existing networks in networks.d, loading their configs in parallel
 			{
 				std::vector<std::string> networksDotD(OSUtils::listDirectory((_homePath + ZT_PATH_SEPARATOR_S "networks.d").c_str()));
+				std::vector<uint64_t> nwids;
 				for (std::vector<std::string>::iterator f(networksDotD.begin()); f != networksDotD.end(); ++f) {
 					std::size_t dot = f->find_last_of('.');
 					if ((dot == 16) && (f->substr(16) == ".conf"))
-						_node->join(Utils::hexStrToU64(f->substr(0, dot).c_str()), (void*)0, (void*)0);
+						nwids.push_back(Utils::hexStrToU64(f->substr(0, dot).c_str()));
 				}
+				_node->join(nwids, (void*)0);
 			}
 
 			// Orbit existing moons in moons.d
@@ -1295,7 +1311,6 @@ class OneServiceImpl : public OneService {
 			_lastRestart = clockShouldBe;
 			int64_t lastTapMulticastGroupCheck = 0;
 			int64_t lastBindRefresh = 0;
-			int64_t lastCleanedPeersDb = 0;
 			int64_t lastLocalConfFileCheck = OSUtils::now();
 			int64_t lastOnline = lastLocalConfFileCheck;
 
@@ -1423,12 +1438,6 @@ class OneServiceImpl : public OneService {
 					}
 				}
 
-				// Clean peers.d periodically
-				if ((now - lastCleanedPeersDb) >= 3600000) {
-					lastCleanedPeersDb = now;
-					OSUtils::cleanDirectory((_homePath + ZT_PATH_SEPARATOR_S "peers.d").c_str(), now - 2592000000LL);	// delete older than 30 days
-				}
-
 				const unsigned long delay = (dl > now) ? (unsigned long)(dl - now) : 500;
 				clockShouldBe = now + (int64_t)delay;
 				_phy.poll(delay);
@@ -2890,6 +2899,9 @@ class OneServiceImpl : public OneService {
 		_portMappingEnabled = OSUtils::jsonBool(settings["portMappingEnabled"], true);
 		_node->setEncryptedHelloEnabled(OSUtils::jsonBool(settings["encryptedHelloEnabled"], false));
 		_node->setLowBandwidthMode(OSUtils::jsonBool(settings["lowBandwidthMode"], false));
+		// Negative values wrap around, so treat those as unset and cap the rest
+		const int64_t rxQueueSize = (int64_t)OSUtils::jsonInt(settings["rxQueueSize"], 0);
+		_node->setRxQueueSize((rxQueueSize > 0) ? (unsigned long)std::min(rxQueueSize, (int64_t)ZT_RX_QUEUE_MAX_SIZE) : 0UL);
 #if defined(__LINUX__) || defined(__FreeBSD__)
 		_multicoreEnabled = OSUtils::jsonBool(settings["multicoreEnabled"], false);
 		_concurrency = OSUtils::jsonInt(settings["concurrency"], 1);
@@ -2902,17 +2914,22 @@ class OneServiceImpl : public OneService {
 				_concurrency = conservativeDefault;
 			}
 			setUpMultithreading();
+			_multicoreUdpReceive = OSUtils::jsonBool(settings["multicoreUdpReceive"], false);
 		}
 		else {
 			// Force values in case the user accidentally defined them with multicore disabled
 			_concurrency = 1;
 			_cpuPinningEnabled = false;
+			_multicoreUdpReceive = false;
 		}
 #else
 		_multicoreEnabled = false;
 		_concurrency = 1;
 		_cpuPinningEnabled = false;
+		_multicoreUdpReceive = false;
 #endif
+		// Only taps created after this point pick up a change
+		_tapOffloadEnabled = OSUtils::jsonBool(settings["tapOffloadEnabled"], false);
 
 		json& ignoreIfs = settings["interfacePrefixBlacklist"];
 		if (ignoreIfs.is_array()) {
@@ -3229,6 +3246,39 @@ class OneServiceImpl : public OneService {
 		}
 	}
 
+	inline void phyOnDatagramBatch(PhySocket* sock, void** uptr, const struct sockaddr* localAddr, const struct sockaddr* const* from, void* const* data, const unsigned long* len, unsigned int count)
+	{
+		if (_forceTcpRelay) {
+			return;
+		}
+		const uint64_t now = OSUtils::now();
+		unsigned int lens[RECVMMSG_WINDOW_SIZE];
+		while (count) {
+			const unsigned int n = (count < RECVMMSG_WINDOW_SIZE) ? count : RECVMMSG_WINDOW_SIZE;
+			for (unsigned int i = 0; i < n; ++i) {
+				Metrics::udp_recv += len[i];
+				lens[i] = (unsigned int)len[i];
+				if ((len[i] >= 16) && (reinterpret_cast<const InetAddress*>(from[i])->ipScope() == InetAddress::IP_SCOPE_GLOBAL)) {
+					_lastDirectReceiveFromGlobal = now;
+				}
+			}
+			const ZT_ResultCode rc = _node->processWirePackets(nullptr, now, reinterpret_cast<int64_t>(sock), reinterpret_cast<const struct sockaddr_storage* const*>(from), data, lens, n, &_nextBackgroundTaskDeadline);
+			if (ZT_ResultCode_isFatal(rc)) {
+				char tmp[256];
+				OSUtils::ztsnprintf(tmp, sizeof(tmp), "fatal error code from processWirePackets: %d", (int)rc);
+				Mutex::Lock _l(_termReason_m);
+				_termReason = ONE_UNRECOVERABLE_ERROR;
+				_fatalErrorMessage = tmp;
+				this->terminate();
+				return;
+			}
+			from += n;
+			data += n;
+			len += n;
+			count -= n;
+		}
+	}
+
 	inline void phyOnTcpConnect(PhySocket* sock, void** uptr, bool success)
 	{
 		if (! success) {
@@ -3522,7 +3572,7 @@ class OneServiceImpl : public OneService {
 						char friendlyName[128];
 						OSUtils::ztsnprintf(friendlyName, sizeof(friendlyName), "ZeroTier One [%.16llx]", nwid);
 
-						n.setTap(EthernetTap::newInstance(nullptr, _concurrency, _cpuPinningEnabled, _homePath.c_str(), MAC(nwc->mac), nwc->mtu, (unsigned int)ZT_IF_METRIC, nwid, friendlyName, StapFrameHandler, (void*)this));
+						n.setTap(EthernetTap::newInstance(nullptr, _concurrency, _cpuPinningEnabled, _tapOffloadEnabled, _homePath.c_str(), MAC(nwc->mac), nwc->mtu, (unsigned int)ZT_IF_METRIC, nwid, friendlyName, StapFrameHandler, (void*)this));
 						*nuptr = (void*)&n;
 
 						char nlcpath[256];
@@ -3735,6 +3785,26 @@ class OneServiceImpl : public OneService {
 	}
 #endif
 
+	// Move peer state files left in peers.d by older versions into the peer cache
+	void _migratePeersDir()
+	{
+		const std::string peersDir(_homePath + ZT_PATH_SEPARATOR_S "peers.d");
+		OSUtils::cleanDirectory(peersDir.c_str(), OSUtils::now() - ZT_PEERCACHE_MAX_AGE);
+		const std::vector<std::string> files(OSUtils::listDirectory(peersDir.c_str()));
+		if (files.empty())
+			return;
+		for (std::vector<std::string>::const_iterator f(files.begin()); f != files.end(); ++f) {
+			if ((f->length() == 15) && (f->substr(10) == ".peer")) {
+				std::string buf;
+				if ((OSUtils::readFile((peersDir + ZT_PATH_SEPARATOR_S + *f).c_str(), buf)) && (! buf.empty()))
+					_peerCache->put(Utils::hexStrToU64(f->substr(0, 10).c_str()), buf.data(), (unsigned int)buf.length());
+			}
+		}
+		_peerCache->flush();
+		for (std::vector<std::string>::const_iterator f(files.begin()); f != files.end(); ++f)
+			OSUtils::rm(peersDir + ZT_PATH_SEPARATOR_S + *f);
+	}
+
 	inline void nodeStatePutFunction(enum ZT_StateObjectType type, const uint64_t id[2], const void* data, int len)
 	{
 #if ZT_VAULT_SUPPORT
@@ -3772,8 +3842,17 @@ class OneServiceImpl : public OneService {
 				OSUtils::ztsnprintf(p, sizeof(p), "%s" ZT_PATH_SEPARATOR_S "%.16llx.conf", dirname, (unsigned long long)id[0]);
 				break;
 			case ZT_STATE_OBJECT_PEER:
+				// Peers go to the write-behind peer cache so the core never waits on disk for them
+				if (_peerCache) {
+					if ((len >= 0) && (data))
+						_peerCache->put(id[0], data, (unsigned int)len);
+					else
+						_peerCache->remove(id[0]);
+					return;
+				}
 				OSUtils::ztsnprintf(dirname, sizeof(dirname), "%s" ZT_PATH_SEPARATOR_S "peers.d", _homePath.c_str());
 				OSUtils::ztsnprintf(p, sizeof(p), "%s" ZT_PATH_SEPARATOR_S "%.10llx.peer", dirname, (unsigned long long)id[0]);
+				secure = true;	 // contains the key agreed with this peer
 				break;
 			default:
 				return;
@@ -3923,6 +4002,8 @@ class OneServiceImpl : public OneService {
 				OSUtils::ztsnprintf(p, sizeof(p), "%s" ZT_PATH_SEPARATOR_S "networks.d" ZT_PATH_SEPARATOR_S "%.16llx.conf", _homePath.c_str(), (unsigned long long)id[0]);
 				break;
 			case ZT_STATE_OBJECT_PEER:
+				if (_peerCache)
+					return _peerCache->get(id[0], data, maxlen);
 				OSUtils::ztsnprintf(p, sizeof(p), "%s" ZT_PATH_SEPARATOR_S "peers.d" ZT_PATH_SEPARATOR_S "%.10llx.peer", _homePath.c_str(), (unsigned long long)id[0]);
 				break;
 			default:
@@ -4021,7 +4102,7 @@ class OneServiceImpl : public OneService {
 			if ((ttl) && (addr->ss_family == AF_INET)) {
 				_phy.setIp4UdpTtl((PhySocket*)((uintptr_t)localSocket), ttl);
 			}
-			const bool r = _phy.udpSend((PhySocket*)((uintptr_t)localSocket), (const struct sockaddr*)addr, data, len);
+			const bool r = _phy.udpSend((PhySocket*)((uintptr_t)localSocket), (const struct sockaddr*)addr, data, len, (ttl == 0));
 			if ((ttl) && (addr->ss_family == AF_INET)) {
 				_phy.setIp4UdpTtl((PhySocket*)((uintptr_t)localSocket), 255);
 			}
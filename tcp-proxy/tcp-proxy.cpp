@@ -6,16 +6,9 @@
  * https://www.zerotier.com/
  */
 
-// HACK! Will eventually use epoll() or something in Phy<> instead of select().
-// Also be sure to change ulimit -n and fs.file-max in /etc/sysctl.conf on relays.
-#if defined(__linux__) || defined(__LINUX__) || defined(__LINUX) || defined(LINUX)
-#include <bits/types.h>
-#include <linux/posix_types.h>
-#undef __FD_SETSIZE
-#define __FD_SETSIZE 1048576
-#undef FD_SETSIZE
-#define FD_SETSIZE 1048576
-#endif
+// Phy<> uses epoll() on Linux, so the number of connections is limited only by
+// the process fd limit. Be sure to change ulimit -n and fs.file-max in
+// /etc/sysctl.conf on relays.
 
 #include "../node/Metrics.hpp"
 #include "../osdep/Phy.hpp"
@@ -147,6 +140,12 @@ struct TcpProxyService {
 		}
 	}
 
+	void phyOnDatagramBatch(PhySocket* sock, void** uptr, const struct sockaddr* localAddr, const struct sockaddr* const* from, void* const* data, const unsigned long* len, unsigned int count)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+			phyOnDatagram(sock, uptr, localAddr, from[i], data[i], len[i]);
+	}
+
 	void phyOnTcpConnect(PhySocket* sock, void** uptr, bool success)
 	{
 		// unused, we don't initiate outbound connections